@@ -0,0 +1,563 @@
+/**
+ * Copyright (c) 2020, Timothy Stack
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Timothy Stack nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file json_scan.cc
+ */
+
+#include "config.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "json_scan.hh"
+
+#if defined(HAVE_X86INTRIN_H) && \
+    (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define USE_X86_SIMD 1
+#include <x86intrin.h>
+
+#define SSE2_TARGET __attribute__((target("sse2")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+/**
+ * A string kernel returns the offset of the first quote, backslash or
+ * control character at or after the given offset, or the length of the
+ * buffer if there is none.  That is all the work needed for the plain
+ * runs of text that make up most of a string.
+ */
+typedef size_t (*json_string_func_t)(const char *str, size_t off, size_t len);
+
+static inline bool is_string_special(unsigned char ch)
+{
+    return ch == '"' || ch == '\\' || ch < 0x20;
+}
+
+static size_t skip_string_scalar(const char *str, size_t off, size_t len)
+{
+    while (off < len && !is_string_special(str[off])) {
+        off += 1;
+    }
+
+    return off;
+}
+
+#ifdef USE_X86_SIMD
+
+SSE2_TARGET
+static size_t skip_string_sse2(const char *str, size_t off, size_t len)
+{
+    const __m128i quotes = _mm_set1_epi8('"');
+    const __m128i slashes = _mm_set1_epi8('\\');
+    const __m128i ctrl_max = _mm_set1_epi8(0x1f);
+
+    while (len - off >= 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *) &str[off]);
+        // max(byte, 0x1f) == 0x1f only holds for the control characters.
+        __m128i special = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(bytes, quotes),
+                         _mm_cmpeq_epi8(bytes, slashes)),
+            _mm_cmpeq_epi8(_mm_max_epu8(bytes, ctrl_max), ctrl_max));
+        unsigned int mask = _mm_movemask_epi8(special);
+
+        if (mask) {
+            return off + __builtin_ctz(mask);
+        }
+        off += 16;
+    }
+
+    return skip_string_scalar(str, off, len);
+}
+
+AVX2_TARGET
+static size_t skip_string_avx2(const char *str, size_t off, size_t len)
+{
+    const __m256i quotes = _mm256_set1_epi8('"');
+    const __m256i slashes = _mm256_set1_epi8('\\');
+    const __m256i ctrl_max = _mm256_set1_epi8(0x1f);
+    unsigned int mask = 0;
+
+    while (len - off >= 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i *) &str[off]);
+        __m256i special = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(bytes, quotes),
+                            _mm256_cmpeq_epi8(bytes, slashes)),
+            _mm256_cmpeq_epi8(_mm256_max_epu8(bytes, ctrl_max), ctrl_max));
+
+        mask = _mm256_movemask_epi8(special);
+        if (mask) {
+            break;
+        }
+        off += 32;
+    }
+
+    // The compiler does not always do this for us and leaving the upper
+    // halves dirty slows down any SSE code that runs afterward.
+    _mm256_zeroupper();
+
+    if (mask) {
+        return off + __builtin_ctz(mask);
+    }
+
+    return skip_string_scalar(str, off, len);
+}
+
+#endif
+
+static const json_string_func_t STRING_FUNCS[] = {
+    skip_string_scalar,
+#ifdef USE_X86_SIMD
+    skip_string_sse2,
+    skip_string_avx2,
+#else
+    nullptr,
+    nullptr,
+#endif
+};
+
+static const char *SCAN_NAMES[] = {
+    "scalar",
+    "sse2",
+    "avx2",
+};
+
+namespace {
+
+struct json_scanner {
+    json_scanner(json_string_func_t func, const char *str, size_t len)
+        : js_skip_string(func), js_str(str), js_len(len) {
+    };
+
+    void skip_ws() {
+        while (this->js_pos < this->js_len) {
+            switch (this->js_str[this->js_pos]) {
+                case ' ':
+                case '\t':
+                case '\n':
+                case '\v':
+                case '\f':
+                case '\r':
+                    this->js_pos += 1;
+                    break;
+                default:
+                    return;
+            }
+        }
+    };
+
+    bool at(char ch) const {
+        return this->js_pos < this->js_len && this->js_str[this->js_pos] == ch;
+    };
+
+    bool is_hex(size_t off) const {
+        return off < this->js_len && isxdigit(this->js_str[off]);
+    };
+
+    /**
+     * Scan a string, the position should be on the opening quote.  The
+     * optional field is updated with the details of the string.
+     */
+    bool scan_string(const char *&start_out,
+                     size_t &len_out,
+                     bool &escaped_out,
+                     json_scan_field *field) {
+        this->js_pos += 1;
+        start_out = &this->js_str[this->js_pos];
+        escaped_out = false;
+        while (true) {
+            this->js_pos = this->js_skip_string(
+                this->js_str, this->js_pos, this->js_len);
+            if (this->js_pos >= this->js_len) {
+                return false;
+            }
+
+            switch (this->js_str[this->js_pos]) {
+                case '"':
+                    len_out = &this->js_str[this->js_pos] - start_out;
+                    this->js_pos += 1;
+                    return true;
+                case '\\':
+                    escaped_out = true;
+                    this->js_pos += 1;
+                    if (this->js_pos >= this->js_len) {
+                        return false;
+                    }
+                    switch (this->js_str[this->js_pos]) {
+                        case 'n':
+                            if (field != nullptr) {
+                                field->jsf_newlines += 1;
+                            }
+                            // fallthrough
+                        case '"':
+                        case '\\':
+                        case '/':
+                        case 'b':
+                        case 'f':
+                        case 'r':
+                        case 't':
+                            this->js_pos += 1;
+                            break;
+                        case 'u': {
+                            for (size_t lpc = 1; lpc <= 4; lpc++) {
+                                if (!this->is_hex(this->js_pos + lpc)) {
+                                    return false;
+                                }
+                            }
+                            if (field != nullptr) {
+                                field->jsf_unicode_escaped = true;
+                                if (strncasecmp(
+                                    &this->js_str[this->js_pos + 1],
+                                    "000a", 4) == 0) {
+                                    field->jsf_newlines += 1;
+                                }
+                            }
+                            this->js_pos += 5;
+                            break;
+                        }
+                        default:
+                            return false;
+                    }
+                    break;
+                default:
+                    // A raw control character.
+                    return false;
+            }
+        }
+    };
+
+    size_t scan_digits() {
+        size_t start = this->js_pos;
+
+        while (this->js_pos < this->js_len &&
+               isdigit(this->js_str[this->js_pos])) {
+            this->js_pos += 1;
+        }
+
+        return this->js_pos - start;
+    };
+
+    bool scan_number(json_scan_field *field) {
+        size_t start = this->js_pos;
+        bool is_double = false;
+
+        if (this->at('-')) {
+            this->js_pos += 1;
+        }
+        if (this->at('0')) {
+            this->js_pos += 1;
+        }
+        else if (this->scan_digits() == 0) {
+            return false;
+        }
+        if (this->at('.')) {
+            this->js_pos += 1;
+            if (this->scan_digits() == 0) {
+                return false;
+            }
+            is_double = true;
+        }
+        if (this->at('e') || this->at('E')) {
+            this->js_pos += 1;
+            if (this->at('+') || this->at('-')) {
+                this->js_pos += 1;
+            }
+            if (this->scan_digits() == 0) {
+                return false;
+            }
+            is_double = true;
+        }
+
+        size_t num_len = this->js_pos - start;
+        const char *num = &this->js_str[start];
+
+        if (!is_double) {
+            size_t digits = num_len - (num[0] == '-' ? 1 : 0);
+            int64_t val = 0;
+
+            // Anything longer might not fit, let the full parser decide.
+            if (digits > 18) {
+                return false;
+            }
+            if (field != nullptr) {
+                for (size_t lpc = num_len - digits; lpc < num_len; lpc++) {
+                    val = val * 10 + (num[lpc] - '0');
+                }
+                field->jsf_type = JST_INTEGER;
+                field->jsf_integer = num[0] == '-' ? -val : val;
+            }
+            return true;
+        }
+
+        char buffer[64];
+        double val;
+
+        if (num_len >= sizeof(buffer)) {
+            return false;
+        }
+        memcpy(buffer, num, num_len);
+        buffer[num_len] = '\0';
+        errno = 0;
+        val = strtod(buffer, nullptr);
+        if ((val == HUGE_VAL || val == -HUGE_VAL) && errno == ERANGE) {
+            return false;
+        }
+        if (field != nullptr) {
+            field->jsf_type = JST_DOUBLE;
+            field->jsf_double = val;
+        }
+
+        return true;
+    };
+
+    bool scan_literal(const char *lit, size_t lit_len) {
+        if (this->js_len - this->js_pos < lit_len ||
+            strncmp(&this->js_str[this->js_pos], lit, lit_len) != 0) {
+            return false;
+        }
+        this->js_pos += lit_len;
+        return true;
+    };
+
+    /** Scan a scalar value, the field is only set at the top level. */
+    bool scan_scalar(json_scan_field *field) {
+        if (this->js_pos >= this->js_len) {
+            return false;
+        }
+
+        switch (this->js_str[this->js_pos]) {
+            case '"': {
+                const char *start;
+                size_t len;
+                bool escaped;
+
+                if (!this->scan_string(start, len, escaped, field)) {
+                    return false;
+                }
+                if (field != nullptr) {
+                    field->jsf_type = JST_STRING;
+                    field->jsf_value = start;
+                    field->jsf_value_len = len;
+                    field->jsf_escaped = escaped;
+                }
+                return true;
+            }
+            case 't':
+                if (field != nullptr) {
+                    field->jsf_type = JST_TRUE;
+                }
+                return this->scan_literal("true", 4);
+            case 'f':
+                if (field != nullptr) {
+                    field->jsf_type = JST_FALSE;
+                }
+                return this->scan_literal("false", 5);
+            case 'n':
+                if (field != nullptr) {
+                    field->jsf_type = JST_NULL;
+                }
+                return this->scan_literal("null", 4);
+            default:
+                return this->scan_number(field);
+        }
+    };
+
+    void end_container(json_scan_field &field) const {
+        field.jsf_value_len = &this->js_str[this->js_pos] - field.jsf_value;
+    };
+
+    bool scan_object(std::vector<json_scan_field> &fields_out) {
+        char stack[JSON_SCAN_MAX_DEPTH];
+        size_t depth = 0;
+        bool first = true;
+
+        fields_out.clear();
+        this->skip_ws();
+        if (!this->at('{')) {
+            return false;
+        }
+        stack[depth++] = '}';
+        this->js_pos += 1;
+
+        // The containers are tracked with an explicit stack of the closing
+        // brackets instead of recursing.
+        while (depth > 0) {
+            char closer = stack[depth - 1];
+            json_scan_field *field = nullptr;
+            bool opened = false;
+
+            this->skip_ws();
+            if (first && this->at(closer)) {
+                this->js_pos += 1;
+                depth -= 1;
+                if (depth == 1) {
+                    this->end_container(fields_out.back());
+                }
+            }
+            else {
+                if (closer == '}') {
+                    const char *key;
+                    size_t key_len;
+                    bool key_escaped;
+
+                    if (!this->at('"')) {
+                        return false;
+                    }
+                    if (depth == 1) {
+                        fields_out.emplace_back();
+                        field = &fields_out.back();
+                        memset(field, 0, sizeof(*field));
+                    }
+                    if (!this->scan_string(key, key_len, key_escaped,
+                                           nullptr)) {
+                        return false;
+                    }
+                    if (field != nullptr) {
+                        field->jsf_key = key;
+                        field->jsf_key_len = key_len;
+                        field->jsf_key_escaped = key_escaped;
+                    }
+                    this->skip_ws();
+                    if (!this->at(':')) {
+                        return false;
+                    }
+                    this->js_pos += 1;
+                    this->skip_ws();
+                }
+
+                if (this->at('{') || this->at('[')) {
+                    if (depth == JSON_SCAN_MAX_DEPTH) {
+                        return false;
+                    }
+                    if (field != nullptr) {
+                        field->jsf_type = this->at('{') ?
+                                          JST_OBJECT : JST_ARRAY;
+                        field->jsf_value = &this->js_str[this->js_pos];
+                    }
+                    stack[depth++] = this->at('{') ? '}' : ']';
+                    this->js_pos += 1;
+                    opened = true;
+                }
+                else if (!this->scan_scalar(field)) {
+                    return false;
+                }
+            }
+
+            if (opened) {
+                first = true;
+                continue;
+            }
+
+            // Consume the separators and closing brackets after the value.
+            while (depth > 0) {
+                this->skip_ws();
+                if (this->at(',')) {
+                    this->js_pos += 1;
+                    first = false;
+                    break;
+                }
+                if (!this->at(stack[depth - 1])) {
+                    return false;
+                }
+                this->js_pos += 1;
+                depth -= 1;
+                if (depth == 1) {
+                    this->end_container(fields_out.back());
+                }
+            }
+        }
+
+        this->skip_ws();
+
+        return this->js_pos == this->js_len;
+    };
+
+    json_string_func_t js_skip_string;
+    const char *js_str;
+    size_t js_len;
+    size_t js_pos{0};
+};
+
+}
+
+bool json_scan_supported(json_scan_impl_t impl)
+{
+    switch (impl) {
+        case JSI_SCALAR:
+            return true;
+#ifdef USE_X86_SIMD
+        case JSI_SSE2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse2");
+        case JSI_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+const char *json_scan_impl_name(json_scan_impl_t impl)
+{
+    return SCAN_NAMES[impl];
+}
+
+static json_string_func_t find_best_string_func()
+{
+    for (int impl = JSI__MAX - 1; impl > JSI_SCALAR; impl--) {
+        if (json_scan_supported((json_scan_impl_t) impl)) {
+            return STRING_FUNCS[impl];
+        }
+    }
+
+    return STRING_FUNCS[JSI_SCALAR];
+}
+
+bool json_scan_object(const char *str,
+                      size_t len,
+                      std::vector<json_scan_field> &fields_out)
+{
+    static const json_string_func_t best_func = find_best_string_func();
+    json_scanner scanner(best_func, str, len);
+
+    return scanner.scan_object(fields_out);
+}
+
+bool json_scan_object(json_scan_impl_t impl,
+                      const char *str,
+                      size_t len,
+                      std::vector<json_scan_field> &fields_out)
+{
+    json_scanner scanner(STRING_FUNCS[impl], str, len);
+
+    return scanner.scan_object(fields_out);
+}
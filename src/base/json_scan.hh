@@ -0,0 +1,120 @@
+/**
+ * Copyright (c) 2020, Timothy Stack
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Timothy Stack nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * @file json_scan.hh
+ */
+
+#ifndef lnav_json_scan_hh
+#define lnav_json_scan_hh
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <vector>
+
+/** The implementations of the string scanner used by the JSON scanner. */
+enum json_scan_impl_t {
+    JSI_SCALAR,
+    JSI_SSE2,
+    JSI_AVX2,
+
+    JSI__MAX
+};
+
+enum json_scan_type_t {
+    JST_NULL,
+    JST_TRUE,
+    JST_FALSE,
+    JST_INTEGER,
+    JST_DOUBLE,
+    JST_STRING,
+    JST_ARRAY,
+    JST_OBJECT,
+};
+
+/** A member of the top-level object. */
+struct json_scan_field {
+    /** The raw key, without the quotes. */
+    const char *jsf_key;
+    size_t jsf_key_len;
+    /** True if the key contains escape sequences. */
+    bool jsf_key_escaped;
+
+    json_scan_type_t jsf_type;
+    /**
+     * The raw value.  For strings, this is the text between the quotes.
+     * For containers, this is the whole container including the brackets.
+     */
+    const char *jsf_value;
+    size_t jsf_value_len;
+    /** True if the string value contains escape sequences. */
+    bool jsf_escaped;
+    /** True if the string value contains a '\u' escape sequence. */
+    bool jsf_unicode_escaped;
+    /** The number of newlines in the string value once it is decoded. */
+    int jsf_newlines;
+    int64_t jsf_integer;
+    double jsf_double;
+};
+
+/**
+ * Validate a buffer that should contain a single JSON object and collect
+ * the members of the top-level object.  Nested containers are checked,
+ * but their contents are not returned.
+ *
+ * The scanner is stricter than yajl in a few cases, integers with more
+ * than 18 digits and nesting deeper than JSON_SCAN_MAX_DEPTH are rejected,
+ * so callers should fall back to a full parser when this returns false.
+ *
+ * @param str The buffer to scan.
+ * @param len The length of the buffer.
+ * @param fields_out The members of the top-level object, in order.
+ * @return True if the buffer is a valid JSON object.
+ */
+bool json_scan_object(const char *str,
+                      size_t len,
+                      std::vector<json_scan_field> &fields_out);
+
+/**
+ * Scan an object using a specific implementation, which must be supported
+ * by the CPU.  This is meant for testing and benchmarking.
+ */
+bool json_scan_object(json_scan_impl_t impl,
+                      const char *str,
+                      size_t len,
+                      std::vector<json_scan_field> &fields_out);
+
+/** @return True if the given implementation can be used on this machine. */
+bool json_scan_supported(json_scan_impl_t impl);
+
+const char *json_scan_impl_name(json_scan_impl_t impl);
+
+#define JSON_SCAN_MAX_DEPTH 256
+
+#endif
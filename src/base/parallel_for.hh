@@ -0,0 +1,119 @@
+/**
+ * Copyright (c) 2020, Timothy Stack
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Timothy Stack nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file parallel_for.hh
+ */
+
+#ifndef lnav_parallel_for_hh
+#define lnav_parallel_for_hh
+
+#include <atomic>
+#include <future>
+#include <thread>
+#include <vector>
+#include <exception>
+#include <algorithm>
+
+/**
+ * @return The number of worker threads to use for CPU-bound work.
+ */
+inline size_t parallel_worker_count()
+{
+    size_t retval = std::thread::hardware_concurrency();
+
+    return std::max(retval, (size_t) 1);
+}
+
+/**
+ * Call 'func' with each index in the range [0, count) using a pool of up to
+ * 'max_workers' threads.  The calling thread takes part in the work and this
+ * function does not return until every index has been processed.  If any of
+ * the calls throw, the first exception is rethrown once all of the workers
+ * have finished.
+ *
+ * @param count The number of work items.
+ * @param func The function to call with the index of each work item.
+ * @param max_workers The maximum number of threads to use, including the
+ *   calling thread.  A value of zero means to use parallel_worker_count().
+ */
+template<typename F>
+void parallel_for(size_t count, F func, size_t max_workers = 0)
+{
+    if (max_workers == 0) {
+        max_workers = parallel_worker_count();
+    }
+
+    size_t worker_count = std::min(count, max_workers);
+
+    if (worker_count <= 1) {
+        for (size_t lpc = 0; lpc < count; lpc++) {
+            func(lpc);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next_index{0};
+    auto worker = [&]() {
+        size_t index;
+
+        while ((index = next_index.fetch_add(1)) < count) {
+            func(index);
+        }
+    };
+    std::vector<std::future<void>> helpers;
+    std::exception_ptr first_error;
+
+    helpers.reserve(worker_count - 1);
+    for (size_t lpc = 1; lpc < worker_count; lpc++) {
+        helpers.emplace_back(std::async(std::launch::async, worker));
+    }
+
+    try {
+        worker();
+    } catch (...) {
+        first_error = std::current_exception();
+        next_index = count;
+    }
+
+    for (auto &helper : helpers) {
+        try {
+            helper.get();
+        } catch (...) {
+            if (!first_error) {
+                first_error = std::current_exception();
+            }
+            next_index = count;
+        }
+    }
+
+    if (first_error) {
+        std::rethrow_exception(first_error);
+    }
+}
+
+#endif
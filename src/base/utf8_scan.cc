@@ -0,0 +1,552 @@
+/**
+ * Copyright (c) 2020, Timothy Stack
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Timothy Stack nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * The SIMD validation is based on the algorithm from:
+ *
+ *   https://github.com/lemire/fastvalidate-utf-8
+ *
+ * @file utf8_scan.cc
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "is_utf8.hh"
+#include "utf8_scan.hh"
+
+#if defined(HAVE_X86INTRIN_H) && \
+    (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define USE_X86_SIMD 1
+#include <x86intrin.h>
+
+/*
+ * The kernels are compiled for the newer instruction sets using function
+ * attributes so the rest of the code does not depend on them.  The right
+ * one is picked at runtime.
+ */
+#define SSE4_TARGET __attribute__((target("sse4.1")))
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+typedef utf8_scan_result (*utf8_scan_func_t)(const char *str, size_t len);
+
+static utf8_scan_result scan_utf8_line_scalar(const char *str, size_t len)
+{
+    utf8_scan_result retval;
+    const char *msg;
+    int faulty_bytes;
+
+    retval.usr_end = is_utf8((unsigned char *) str, len, &msg, &faulty_bytes);
+    if (msg != nullptr) {
+        // The scan stopped at the bad data, so keep looking for the newline.
+        auto lf = (const char *) memchr(&str[retval.usr_end],
+                                        '\n',
+                                        len - retval.usr_end);
+
+        retval.usr_valid = false;
+        retval.usr_end = lf == nullptr ? -1 : lf - str;
+    }
+
+    return retval;
+}
+
+#ifdef USE_X86_SIMD
+
+/*
+ * legal utf-8 byte sequence
+ * http://www.unicode.org/versions/Unicode6.0.0/ch03.pdf - page 94
+ *
+ *  Code Points        1st       2s       3s       4s
+ * U+0000..U+007F     00..7F
+ * U+0080..U+07FF     C2..DF   80..BF
+ * U+0800..U+0FFF     E0       A0..BF   80..BF
+ * U+1000..U+CFFF     E1..EC   80..BF   80..BF
+ * U+D000..U+D7FF     ED       80..9F   80..BF
+ * U+E000..U+FFFF     EE..EF   80..BF   80..BF
+ * U+10000..U+3FFFF   F0       90..BF   80..BF   80..BF
+ * U+40000..U+FFFFF   F1..F3   80..BF   80..BF   80..BF
+ * U+100000..U+10FFFF F4       80..8F   80..BF   80..BF
+ *
+ * Each block of input is classified by the high nibble of each byte to find
+ * the number of bytes that should be in each sequence.  Those lengths are
+ * carried forward to check that the continuation bytes are where they
+ * should be.  The extra limits on the first continuation byte after E0, ED,
+ * F0, and F4 are then checked separately.
+ *
+ * The newline search is folded into the same pass: when a block contains a
+ * newline, the bytes after it are cleared so that they are not validated.
+ * Since the newline is ASCII, a sequence that is cut off by the newline is
+ * still caught as an error.
+ */
+
+struct sse_utf_bytes {
+    __m128i rawbytes;
+    __m128i high_nibbles;
+    __m128i carried_continuations;
+};
+
+SSE4_TARGET
+static inline __m128i sse_continuation_lengths(__m128i high_nibbles)
+{
+    return _mm_shuffle_epi8(
+        _mm_setr_epi8(1, 1, 1, 1, 1, 1, 1, 1, // 0xxx (ASCII)
+                      0, 0, 0, 0,             // 10xx (continuation)
+                      2, 2,                   // 110x
+                      3,                      // 1110
+                      4), // 1111, next should be 0 (not checked here)
+        high_nibbles);
+}
+
+SSE4_TARGET
+static inline __m128i sse_carry_continuations(__m128i initial_lengths,
+                                              __m128i previous_carries)
+{
+    __m128i right1 = _mm_subs_epu8(
+        _mm_alignr_epi8(initial_lengths, previous_carries, 16 - 1),
+        _mm_set1_epi8(1));
+    __m128i sum = _mm_add_epi8(initial_lengths, right1);
+    __m128i right2 = _mm_subs_epu8(
+        _mm_alignr_epi8(sum, previous_carries, 16 - 2),
+        _mm_set1_epi8(2));
+
+    return _mm_add_epi8(sum, right2);
+}
+
+SSE4_TARGET
+static inline sse_utf_bytes sse_check_bytes(__m128i current_bytes,
+                                            const sse_utf_bytes &previous,
+                                            __m128i &has_error)
+{
+    sse_utf_bytes pb;
+
+    pb.rawbytes = current_bytes;
+    pb.high_nibbles = _mm_and_si128(_mm_srli_epi16(current_bytes, 4),
+                                    _mm_set1_epi8(0x0F));
+
+    // all byte values must be no larger than 0xF4
+    has_error = _mm_or_si128(has_error,
+                             _mm_subs_epu8(current_bytes,
+                                           _mm_set1_epi8(0xF4)));
+
+    __m128i initial_lengths = sse_continuation_lengths(pb.high_nibbles);
+
+    pb.carried_continuations = sse_carry_continuations(
+        initial_lengths, previous.carried_continuations);
+
+    // (carries > length) == (lengths > 0) means an overlap or underlap
+    has_error = _mm_or_si128(has_error, _mm_cmpeq_epi8(
+        _mm_cmpgt_epi8(pb.carried_continuations, initial_lengths),
+        _mm_cmpgt_epi8(initial_lengths, _mm_setzero_si128())));
+
+    __m128i off1_current_bytes =
+        _mm_alignr_epi8(pb.rawbytes, previous.rawbytes, 16 - 1);
+
+    // when 0xED is found, next byte must be no larger than 0x9F
+    // when 0xF4 is found, next byte must be no larger than 0x8F
+    __m128i maskED = _mm_cmpeq_epi8(off1_current_bytes, _mm_set1_epi8(0xED));
+    __m128i maskF4 = _mm_cmpeq_epi8(off1_current_bytes, _mm_set1_epi8(0xF4));
+    __m128i badfollowED = _mm_and_si128(
+        _mm_cmpgt_epi8(current_bytes, _mm_set1_epi8(0x9F)), maskED);
+    __m128i badfollowF4 = _mm_and_si128(
+        _mm_cmpgt_epi8(current_bytes, _mm_set1_epi8(0x8F)), maskF4);
+
+    has_error = _mm_or_si128(has_error,
+                             _mm_or_si128(badfollowED, badfollowF4));
+
+    // overlong encodings
+    __m128i off1_hibits = _mm_alignr_epi8(pb.high_nibbles,
+                                          previous.high_nibbles,
+                                          16 - 1);
+    __m128i initial_mins = _mm_shuffle_epi8(
+        _mm_setr_epi8(-128, -128, -128, -128, -128, -128, -128, -128,
+                      -128, -128, -128, -128,  // 10xx => false
+                      0xC2, -128, // 110x
+                      0xE1, // 1110
+                      0xF1),
+        off1_hibits);
+    __m128i initial_under = _mm_cmpgt_epi8(initial_mins, off1_current_bytes);
+    __m128i second_mins = _mm_shuffle_epi8(
+        _mm_setr_epi8(-128, -128, -128, -128, -128, -128, -128, -128,
+                      -128, -128, -128, -128,  // 10xx => false
+                      127, 127, // 110x => true
+                      0xA0, // 1110
+                      0x90),
+        off1_hibits);
+    __m128i second_under = _mm_cmpgt_epi8(second_mins, current_bytes);
+
+    has_error = _mm_or_si128(has_error,
+                             _mm_and_si128(initial_under, second_under));
+
+    return pb;
+}
+
+SSE4_TARGET
+static utf8_scan_result scan_utf8_line_sse4(const char *str, size_t len)
+{
+    utf8_scan_result retval;
+    const __m128i lfchars = _mm_set1_epi8('\n');
+    const __m128i indexes = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                                          8, 9, 10, 11, 12, 13, 14, 15);
+    // The carries are only checked for the last byte of a block.
+    const __m128i max_carries = _mm_setr_epi8(9, 9, 9, 9, 9, 9, 9, 9,
+                                              9, 9, 9, 9, 9, 9, 9, 1);
+    __m128i has_error = _mm_setzero_si128();
+    sse_utf_bytes previous = {
+        _mm_setzero_si128(), _mm_setzero_si128(), _mm_setzero_si128()
+    };
+
+    for (size_t lpc = 0; lpc < len; lpc += 16) {
+        __m128i current_bytes;
+
+        if (len - lpc >= 16) {
+            current_bytes = _mm_loadu_si128((const __m128i *) &str[lpc]);
+        }
+        else {
+            // The padding is ASCII, so a truncated sequence is an error.
+            char buffer[16];
+
+            memset(buffer, 0, sizeof(buffer));
+            memcpy(buffer, &str[lpc], len - lpc);
+            current_bytes = _mm_loadu_si128((const __m128i *) buffer);
+        }
+
+        int lf_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(current_bytes,
+                                                       lfchars));
+
+        if (lf_mask) {
+            int lf_index = __builtin_ctz(lf_mask);
+
+            current_bytes = _mm_and_si128(
+                current_bytes,
+                _mm_cmpgt_epi8(_mm_set1_epi8(lf_index + 1), indexes));
+            retval.usr_end = lpc + lf_index;
+        }
+
+        if (_mm_movemask_epi8(current_bytes) == 0) {
+            // All ASCII, just make sure the previous block was complete.
+            has_error = _mm_or_si128(
+                has_error,
+                _mm_cmpgt_epi8(previous.carried_continuations, max_carries));
+            previous.rawbytes = current_bytes;
+            previous.high_nibbles = _mm_setzero_si128();
+            previous.carried_continuations = _mm_set1_epi8(1);
+        }
+        else {
+            previous = sse_check_bytes(current_bytes, previous, has_error);
+        }
+
+        if (retval.usr_end != -1) {
+            break;
+        }
+    }
+
+    has_error = _mm_or_si128(
+        has_error,
+        _mm_cmpgt_epi8(previous.carried_continuations, max_carries));
+    retval.usr_valid = _mm_testz_si128(has_error, has_error);
+
+    return retval;
+}
+
+struct avx_utf_bytes {
+    __m256i rawbytes;
+    __m256i high_nibbles;
+    __m256i carried_continuations;
+};
+
+/**
+ * The AVX2 alignr instruction works on each 128-bit lane separately, so the
+ * bytes that cross the middle of the register have to be moved over first.
+ */
+AVX2_TARGET
+static inline __m256i avx_push_last_byte_of_a_to_b(__m256i a, __m256i b)
+{
+    return _mm256_alignr_epi8(b, _mm256_permute2x128_si256(a, b, 0x21), 15);
+}
+
+AVX2_TARGET
+static inline __m256i avx_push_last_2bytes_of_a_to_b(__m256i a, __m256i b)
+{
+    return _mm256_alignr_epi8(b, _mm256_permute2x128_si256(a, b, 0x21), 14);
+}
+
+AVX2_TARGET
+static inline __m256i avx_continuation_lengths(__m256i high_nibbles)
+{
+    return _mm256_shuffle_epi8(
+        _mm256_setr_epi8(1, 1, 1, 1, 1, 1, 1, 1, // 0xxx (ASCII)
+                         0, 0, 0, 0,             // 10xx (continuation)
+                         2, 2,                   // 110x
+                         3,                      // 1110
+                         4, // 1111, next should be 0 (not checked here)
+                         1, 1, 1, 1, 1, 1, 1, 1,
+                         0, 0, 0, 0,
+                         2, 2,
+                         3,
+                         4),
+        high_nibbles);
+}
+
+AVX2_TARGET
+static inline __m256i avx_carry_continuations(__m256i initial_lengths,
+                                              __m256i previous_carries)
+{
+    __m256i right1 = _mm256_subs_epu8(
+        avx_push_last_byte_of_a_to_b(previous_carries, initial_lengths),
+        _mm256_set1_epi8(1));
+    __m256i sum = _mm256_add_epi8(initial_lengths, right1);
+    __m256i right2 = _mm256_subs_epu8(
+        avx_push_last_2bytes_of_a_to_b(previous_carries, sum),
+        _mm256_set1_epi8(2));
+
+    return _mm256_add_epi8(sum, right2);
+}
+
+AVX2_TARGET
+static inline avx_utf_bytes avx_check_bytes(__m256i current_bytes,
+                                            const avx_utf_bytes &previous,
+                                            __m256i &has_error)
+{
+    avx_utf_bytes pb;
+
+    pb.rawbytes = current_bytes;
+    pb.high_nibbles = _mm256_and_si256(_mm256_srli_epi16(current_bytes, 4),
+                                       _mm256_set1_epi8(0x0F));
+
+    // all byte values must be no larger than 0xF4
+    has_error = _mm256_or_si256(has_error,
+                                _mm256_subs_epu8(current_bytes,
+                                                 _mm256_set1_epi8(0xF4)));
+
+    __m256i initial_lengths = avx_continuation_lengths(pb.high_nibbles);
+
+    pb.carried_continuations = avx_carry_continuations(
+        initial_lengths, previous.carried_continuations);
+
+    // (carries > length) == (lengths > 0) means an overlap or underlap
+    has_error = _mm256_or_si256(has_error, _mm256_cmpeq_epi8(
+        _mm256_cmpgt_epi8(pb.carried_continuations, initial_lengths),
+        _mm256_cmpgt_epi8(initial_lengths, _mm256_setzero_si256())));
+
+    __m256i off1_current_bytes =
+        avx_push_last_byte_of_a_to_b(previous.rawbytes, pb.rawbytes);
+
+    // when 0xED is found, next byte must be no larger than 0x9F
+    // when 0xF4 is found, next byte must be no larger than 0x8F
+    __m256i maskED = _mm256_cmpeq_epi8(off1_current_bytes,
+                                       _mm256_set1_epi8(0xED));
+    __m256i maskF4 = _mm256_cmpeq_epi8(off1_current_bytes,
+                                       _mm256_set1_epi8(0xF4));
+    __m256i badfollowED = _mm256_and_si256(
+        _mm256_cmpgt_epi8(current_bytes, _mm256_set1_epi8(0x9F)), maskED);
+    __m256i badfollowF4 = _mm256_and_si256(
+        _mm256_cmpgt_epi8(current_bytes, _mm256_set1_epi8(0x8F)), maskF4);
+
+    has_error = _mm256_or_si256(has_error,
+                                _mm256_or_si256(badfollowED, badfollowF4));
+
+    // overlong encodings
+    __m256i off1_hibits = avx_push_last_byte_of_a_to_b(previous.high_nibbles,
+                                                       pb.high_nibbles);
+    __m256i initial_mins = _mm256_shuffle_epi8(
+        _mm256_setr_epi8(-128, -128, -128, -128, -128, -128, -128, -128,
+                         -128, -128, -128, -128,  // 10xx => false
+                         0xC2, -128, // 110x
+                         0xE1, // 1110
+                         0xF1,
+                         -128, -128, -128, -128, -128, -128, -128, -128,
+                         -128, -128, -128, -128,
+                         0xC2, -128,
+                         0xE1,
+                         0xF1),
+        off1_hibits);
+    __m256i initial_under = _mm256_cmpgt_epi8(initial_mins,
+                                              off1_current_bytes);
+    __m256i second_mins = _mm256_shuffle_epi8(
+        _mm256_setr_epi8(-128, -128, -128, -128, -128, -128, -128, -128,
+                         -128, -128, -128, -128,  // 10xx => false
+                         127, 127, // 110x => true
+                         0xA0, // 1110
+                         0x90,
+                         -128, -128, -128, -128, -128, -128, -128, -128,
+                         -128, -128, -128, -128,
+                         127, 127,
+                         0xA0,
+                         0x90),
+        off1_hibits);
+    __m256i second_under = _mm256_cmpgt_epi8(second_mins, current_bytes);
+
+    has_error = _mm256_or_si256(has_error,
+                                _mm256_and_si256(initial_under, second_under));
+
+    return pb;
+}
+
+AVX2_TARGET
+static utf8_scan_result scan_utf8_line_avx2(const char *str, size_t len)
+{
+    utf8_scan_result retval;
+    const __m256i lfchars = _mm256_set1_epi8('\n');
+    const __m256i indexes = _mm256_setr_epi8(
+        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+        16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31);
+    // The carries are only checked for the last byte of a block.
+    const __m256i max_carries = _mm256_setr_epi8(
+        9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9,
+        9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 9, 1);
+    __m256i has_error = _mm256_setzero_si256();
+    avx_utf_bytes previous = {
+        _mm256_setzero_si256(), _mm256_setzero_si256(), _mm256_setzero_si256()
+    };
+
+    for (size_t lpc = 0; lpc < len; lpc += 32) {
+        __m256i current_bytes;
+
+        if (len - lpc >= 32) {
+            current_bytes = _mm256_loadu_si256((const __m256i *) &str[lpc]);
+        }
+        else {
+            // The padding is ASCII, so a truncated sequence is an error.
+            char buffer[32];
+
+            memset(buffer, 0, sizeof(buffer));
+            memcpy(buffer, &str[lpc], len - lpc);
+            current_bytes = _mm256_loadu_si256((const __m256i *) buffer);
+        }
+
+        unsigned int lf_mask = _mm256_movemask_epi8(
+            _mm256_cmpeq_epi8(current_bytes, lfchars));
+
+        if (lf_mask) {
+            int lf_index = __builtin_ctz(lf_mask);
+
+            current_bytes = _mm256_and_si256(
+                current_bytes,
+                _mm256_cmpgt_epi8(_mm256_set1_epi8(lf_index + 1), indexes));
+            retval.usr_end = lpc + lf_index;
+        }
+
+        if (_mm256_movemask_epi8(current_bytes) == 0) {
+            // All ASCII, just make sure the previous block was complete.
+            has_error = _mm256_or_si256(
+                has_error,
+                _mm256_cmpgt_epi8(previous.carried_continuations,
+                                  max_carries));
+            previous.rawbytes = current_bytes;
+            previous.high_nibbles = _mm256_setzero_si256();
+            previous.carried_continuations = _mm256_set1_epi8(1);
+        }
+        else {
+            previous = avx_check_bytes(current_bytes, previous, has_error);
+        }
+
+        if (retval.usr_end != -1) {
+            break;
+        }
+    }
+
+    has_error = _mm256_or_si256(
+        has_error,
+        _mm256_cmpgt_epi8(previous.carried_continuations, max_carries));
+    retval.usr_valid = _mm256_testz_si256(has_error, has_error);
+
+    // The compiler does not always do this for us and leaving the upper
+    // halves dirty slows down any SSE code that runs afterward.
+    _mm256_zeroupper();
+
+    return retval;
+}
+
+#endif
+
+static const utf8_scan_func_t SCAN_FUNCS[] = {
+    scan_utf8_line_scalar,
+#ifdef USE_X86_SIMD
+    scan_utf8_line_sse4,
+    scan_utf8_line_avx2,
+#else
+    nullptr,
+    nullptr,
+#endif
+};
+
+static const char *SCAN_NAMES[] = {
+    "scalar",
+    "sse4",
+    "avx2",
+};
+
+bool utf8_scan_supported(utf8_scan_impl_t impl)
+{
+    switch (impl) {
+        case USI_SCALAR:
+            return true;
+#ifdef USE_X86_SIMD
+        case USI_SSE4:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("sse4.1");
+        case USI_AVX2:
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#endif
+        default:
+            return false;
+    }
+}
+
+const char *utf8_scan_impl_name(utf8_scan_impl_t impl)
+{
+    return SCAN_NAMES[impl];
+}
+
+static utf8_scan_func_t find_best_scan_func()
+{
+    for (int impl = USI__MAX - 1; impl > USI_SCALAR; impl--) {
+        if (utf8_scan_supported((utf8_scan_impl_t) impl)) {
+            return SCAN_FUNCS[impl];
+        }
+    }
+
+    return SCAN_FUNCS[USI_SCALAR];
+}
+
+utf8_scan_result scan_utf8_line(const char *str, size_t len)
+{
+    static const utf8_scan_func_t best_func = find_best_scan_func();
+
+    return best_func(str, len);
+}
+
+utf8_scan_result scan_utf8_line(utf8_scan_impl_t impl,
+                                const char *str,
+                                size_t len)
+{
+    return SCAN_FUNCS[impl](str, len);
+}
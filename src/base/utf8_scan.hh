@@ -0,0 +1,77 @@
+/**
+ * Copyright (c) 2020, Timothy Stack
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Timothy Stack nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ *
+ * @file utf8_scan.hh
+ */
+
+#ifndef lnav_utf8_scan_hh
+#define lnav_utf8_scan_hh
+
+#include <sys/types.h>
+
+/** The implementations of the line scanner. */
+enum utf8_scan_impl_t {
+    USI_SCALAR,
+    USI_SSE4,
+    USI_AVX2,
+
+    USI__MAX
+};
+
+struct utf8_scan_result {
+    /** The offset of the newline or -1 if there was no newline. */
+    ssize_t usr_end{-1};
+    /** True if the data before the newline is valid UTF-8. */
+    bool usr_valid{true};
+};
+
+/**
+ * Find the next newline in a buffer and check that the data before it is
+ * valid UTF-8 in a single pass.  If there is no newline, the whole buffer
+ * is checked and a multi-byte sequence that is cut off at the end of the
+ * buffer is treated as invalid.
+ *
+ * The fastest implementation supported by the CPU is used.
+ */
+utf8_scan_result scan_utf8_line(const char *str, size_t len);
+
+/**
+ * Scan a line using a specific implementation, which must be supported by
+ * the CPU.  This is meant for testing and benchmarking.
+ */
+utf8_scan_result scan_utf8_line(utf8_scan_impl_t impl,
+                                const char *str,
+                                size_t len);
+
+/** @return True if the given implementation can be used on this machine. */
+bool utf8_scan_supported(utf8_scan_impl_t impl);
+
+const char *utf8_scan_impl_name(utf8_scan_impl_t impl);
+
+#endif
@@ -74,6 +74,12 @@ struct big_array {
         this->ba_size = 0;
     };
 
+    void truncate(size_t size) {
+        require(size <= this->ba_size);
+
+        this->ba_size = size;
+    };
+
     size_t size() const {
         return this->ba_size;
     };
@@ -87,6 +87,9 @@ string execute_command(exec_context &ec, const string &cmdline)
 
     log_info("Executing: %s", cmdline.c_str());
 
+    // Commands expect the filtered lines to be up-to-date.
+    check_background_filters(true);
+
     split_ws(cmdline, args);
 
     if (args.size() > 0) {
@@ -104,6 +107,140 @@ string execute_command(exec_context &ec, const string &cmdline)
     return msg;
 }
 
+/**
+ * Append a bound value to the key used to remember the result of a
+ * statement.  The length prefix keeps the values from running together.
+ */
+static void append_bind_key(string *key_out,
+                            char type,
+                            const char *value,
+                            size_t len)
+{
+    if (key_out == nullptr) {
+        return;
+    }
+
+    key_out->push_back(type);
+    key_out->append(to_string(len));
+    key_out->push_back(':');
+    key_out->append(value, len);
+}
+
+/**
+ * Bind the parameters in a statement to the overrides, variables, and log
+ * line values in the context.
+ *
+ * @param ec The context to get the values from.
+ * @param stmt The statement to bind.
+ * @param key_out If not null, a description of every value that was bound
+ *   is appended to this string.
+ */
+void bind_sql_parameters(exec_context &ec, sqlite3_stmt *stmt, string *key_out)
+{
+    int param_count;
+
+    param_count = sqlite3_bind_parameter_count(stmt);
+    for (int lpc = 0; lpc < param_count; lpc++) {
+        map<string, string>::iterator ov_iter;
+        const char *name;
+
+        name = sqlite3_bind_parameter_name(stmt, lpc + 1);
+        if (name == nullptr) {
+            // An anonymous '?' parameter, there is nothing to bind it to.
+            append_bind_key(key_out, 'u', "", 0);
+            continue;
+        }
+        ov_iter = ec.ec_override.find(name);
+        if (ov_iter != ec.ec_override.end()) {
+            sqlite3_bind_text(stmt,
+                              lpc,
+                              ov_iter->second.c_str(),
+                              ov_iter->second.length(),
+                              SQLITE_TRANSIENT);
+            append_bind_key(key_out, 'o',
+                            ov_iter->second.c_str(),
+                            ov_iter->second.length());
+        }
+        else if (name[0] == '$') {
+            map<string, string> &lvars = ec.ec_local_vars.top();
+            map<string, string> &gvars = ec.ec_global_vars;
+            map<string, string>::iterator local_var, global_var;
+            const char *env_value;
+
+            if ((local_var = lvars.find(&name[1])) != lvars.end()) {
+                sqlite3_bind_text(stmt, lpc + 1,
+                                  local_var->second.c_str(), -1,
+                                  SQLITE_TRANSIENT);
+                append_bind_key(key_out, 't',
+                                local_var->second.c_str(),
+                                strlen(local_var->second.c_str()));
+            }
+            else if ((global_var = gvars.find(&name[1])) != gvars.end()) {
+                sqlite3_bind_text(stmt, lpc + 1,
+                                  global_var->second.c_str(), -1,
+                                  SQLITE_TRANSIENT);
+                append_bind_key(key_out, 't',
+                                global_var->second.c_str(),
+                                strlen(global_var->second.c_str()));
+            }
+            else if ((env_value = getenv(&name[1])) != NULL) {
+                sqlite3_bind_text(stmt, lpc + 1, env_value, -1, SQLITE_STATIC);
+                append_bind_key(key_out, 't', env_value, strlen(env_value));
+            }
+            else {
+                append_bind_key(key_out, 'u', "", 0);
+            }
+        }
+        else if (name[0] == ':' && ec.ec_line_values != NULL) {
+            vector<logline_value> &lvalues = *ec.ec_line_values;
+            vector<logline_value>::iterator iter;
+
+            append_bind_key(key_out, 'u', "", 0);
+            for (iter = lvalues.begin(); iter != lvalues.end(); ++iter) {
+                if (strcmp(&name[1], iter->lv_name.get()) != 0) {
+                    continue;
+                }
+                switch (iter->lv_kind) {
+                    case logline_value::VALUE_BOOLEAN:
+                    case logline_value::VALUE_INTEGER: {
+                        string int_str = to_string(iter->lv_value.i);
+
+                        sqlite3_bind_int64(stmt, lpc + 1, iter->lv_value.i);
+                        append_bind_key(key_out, 'i',
+                                        int_str.c_str(), int_str.size());
+                        break;
+                    }
+                    case logline_value::VALUE_FLOAT:
+                        sqlite3_bind_double(stmt, lpc + 1, iter->lv_value.d);
+                        append_bind_key(key_out, 'f',
+                                        (const char *) &iter->lv_value.d,
+                                        sizeof(iter->lv_value.d));
+                        break;
+                    case logline_value::VALUE_NULL:
+                        sqlite3_bind_null(stmt, lpc + 1);
+                        append_bind_key(key_out, 'n', "", 0);
+                        break;
+                    default:
+                        sqlite3_bind_text(stmt,
+                                          lpc + 1,
+                                          iter->text_value(),
+                                          iter->text_length(),
+                                          SQLITE_TRANSIENT);
+                        append_bind_key(key_out, 't',
+                                        iter->text_value(),
+                                        iter->text_length());
+                        break;
+                }
+            }
+        }
+        else {
+            sqlite3_bind_null(stmt, lpc + 1);
+            log_warning("Could not bind variable: %s", name);
+            append_bind_key(key_out, 'n', "", 0);
+        }
+    }
+}
+
 string execute_sql(exec_context &ec, const string &sql, string &alt_msg)
 {
     db_label_source &dls = lnav_data.ld_db_row_source;
@@ -115,6 +252,8 @@ string execute_sql(exec_context &ec, const string &sql, string &alt_msg)
 
     log_info("Executing SQL: %s", sql.c_str());
 
+    check_background_filters(true);
+
     lnav_data.ld_bottom_source.grep_error("");
 
     if (stmt_str == ".schema") {
@@ -153,78 +292,8 @@ string execute_sql(exec_context &ec, const string &sql, string &alt_msg)
     }
     else {
         bool done = false;
-        int param_count;
-
-        param_count = sqlite3_bind_parameter_count(stmt.in());
-        for (int lpc = 0; lpc < param_count; lpc++) {
-            map<string, string>::iterator ov_iter;
-            const char *name;
-
-            name = sqlite3_bind_parameter_name(stmt.in(), lpc + 1);
-            ov_iter = ec.ec_override.find(name);
-            if (ov_iter != ec.ec_override.end()) {
-                sqlite3_bind_text(stmt.in(),
-                                  lpc,
-                                  ov_iter->second.c_str(),
-                                  ov_iter->second.length(),
-                                  SQLITE_TRANSIENT);
-            }
-            else if (name[0] == '$') {
-                map<string, string> &lvars = ec.ec_local_vars.top();
-                map<string, string> &gvars = ec.ec_global_vars;
-                map<string, string>::iterator local_var, global_var;
-                const char *env_value;
-
-                if ((local_var = lvars.find(&name[1])) != lvars.end()) {
-                    sqlite3_bind_text(stmt.in(), lpc + 1,
-                                      local_var->second.c_str(), -1,
-                                      SQLITE_TRANSIENT);
-                }
-                else if ((global_var = gvars.find(&name[1])) != gvars.end()) {
-                    sqlite3_bind_text(stmt.in(), lpc + 1,
-                                      global_var->second.c_str(), -1,
-                                      SQLITE_TRANSIENT);
-                }
-                else if ((env_value = getenv(&name[1])) != NULL) {
-                    sqlite3_bind_text(stmt.in(), lpc + 1, env_value, -1, SQLITE_STATIC);
-                }
-            }
-            else if (name[0] == ':' && ec.ec_line_values != NULL) {
-                vector<logline_value> &lvalues = *ec.ec_line_values;
-                vector<logline_value>::iterator iter;
 
-                for (iter = lvalues.begin(); iter != lvalues.end(); ++iter) {
-                    if (strcmp(&name[1], iter->lv_name.get()) != 0) {
-                        continue;
-                    }
-                    switch (iter->lv_kind) {
-                        case logline_value::VALUE_BOOLEAN:
-                            sqlite3_bind_int64(stmt.in(), lpc + 1, iter->lv_value.i);
-                            break;
-                        case logline_value::VALUE_FLOAT:
-                            sqlite3_bind_double(stmt.in(), lpc + 1, iter->lv_value.d);
-                            break;
-                        case logline_value::VALUE_INTEGER:
-                            sqlite3_bind_int64(stmt.in(), lpc + 1, iter->lv_value.i);
-                            break;
-                        case logline_value::VALUE_NULL:
-                            sqlite3_bind_null(stmt.in(), lpc + 1);
-                            break;
-                        default:
-                            sqlite3_bind_text(stmt.in(),
-                                              lpc + 1,
-                                              iter->text_value(),
-                                              iter->text_length(),
-                                              SQLITE_TRANSIENT);
-                            break;
-                    }
-                }
-            }
-            else {
-                sqlite3_bind_null(stmt.in(), lpc + 1);
-                log_warning("Could not bind variable: %s", name);
-            }
-        }
+        bind_sql_parameters(ec, stmt.in());
 
         if (lnav_data.ld_rl_view != NULL) {
             lnav_data.ld_rl_view->set_value("Executing query: " + sql + " ...");
@@ -602,6 +671,199 @@ string execute_any(exec_context &ec, const string &cmdline_with_mode)
     return retval;
 }
 
+/**
+ * The builtin SQL functions whose result only depends on their arguments.
+ */
+static const char *PURE_SQL_FUNCTIONS[] = {
+    "abs",
+    "char",
+    "coalesce",
+    "glob",
+    "hex",
+    "ifnull",
+    "iif",
+    "instr",
+    "length",
+    "like",
+    "lower",
+    "ltrim",
+    "max",
+    "min",
+    "nullif",
+    "printf",
+    "quote",
+    "replace",
+    "round",
+    "rtrim",
+    "substr",
+    "trim",
+    "typeof",
+    "unicode",
+    "upper",
+};
+
+struct rewriter_auth_state {
+    bool ras_reads_tables{false};
+    bool ras_impure{false};
+};
+
+static int rewriter_authorizer(void *pUserData, int action_code,
+                               const char *detail1, const char *detail2,
+                               const char *detail3, const char *detail4)
+{
+    auto *state = (rewriter_auth_state *) pUserData;
+
+    switch (action_code) {
+        case SQLITE_READ:
+            state->ras_reads_tables = true;
+            break;
+        case SQLITE_SELECT:
+            break;
+        case SQLITE_FUNCTION: {
+            bool found = false;
+
+            for (const char *func : PURE_SQL_FUNCTIONS) {
+                if (strcasecmp(func, detail2) == 0) {
+                    found = true;
+                    break;
+                }
+            }
+            if (!found) {
+                state->ras_impure = true;
+            }
+            break;
+        }
+        default:
+            state->ras_impure = true;
+            break;
+    }
+
+    if (lnav_data.ld_flags & LNF_SECURE_MODE) {
+        return sqlite_authorizer(nullptr, action_code,
+                                 detail1, detail2, detail3, detail4);
+    }
+
+    return SQLITE_OK;
+}
+
+field_rewriter::field_rewriter(string cmdline)
+    : fr_cmdline(std::move(cmdline)), fr_stmt(sqlite3_finalize)
+{
+    if (!this->fr_cmdline.empty() && this->fr_cmdline[0] == ';') {
+        this->prepare();
+    }
+}
+
+void field_rewriter::prepare()
+{
+    string stmt_str = trim(this->fr_cmdline.substr(1));
+    rewriter_auth_state state;
+    int retcode;
+
+    if (lnav_data.ld_db.in() == nullptr) {
+        return;
+    }
+
+    sqlite3_set_authorizer(lnav_data.ld_db.in(), rewriter_authorizer, &state);
+    retcode = sqlite3_prepare_v2(lnav_data.ld_db.in(),
+                                 stmt_str.c_str(),
+                                 -1,
+                                 this->fr_stmt.out(),
+                                 nullptr);
+    if (lnav_data.ld_flags & LNF_SECURE_MODE) {
+        sqlite3_set_authorizer(lnav_data.ld_db.in(), sqlite_authorizer, nullptr);
+    }
+    else {
+        sqlite3_set_authorizer(lnav_data.ld_db.in(), nullptr, nullptr);
+    }
+
+    if (retcode != SQLITE_OK || state.ras_reads_tables) {
+        // The statement might depend on the log tables, which are set up
+        // for each execution, so leave it to execute_any().
+        log_debug("not preparing rewriter -- %s", this->fr_cmdline.c_str());
+        this->fr_stmt.reset();
+        return;
+    }
+
+    this->fr_memoize = (this->fr_stmt.in() != nullptr && !state.ras_impure);
+#ifdef HAVE_SQLITE3_STMT_READONLY
+    this->fr_memoize = (this->fr_memoize &&
+                        sqlite3_stmt_readonly(this->fr_stmt.in()));
+#endif
+    log_debug("prepared rewriter (memoize=%d) -- %s",
+              this->fr_memoize, this->fr_cmdline.c_str());
+}
+
+string field_rewriter::execute(exec_context &ec)
+{
+    if (!this->is_prepared()) {
+        return execute_any(ec, this->fr_cmdline);
+    }
+
+    sqlite3_stmt *stmt = this->fr_stmt.in();
+    string key, retval;
+    bool done = false;
+
+    sqlite3_clear_bindings(stmt);
+    bind_sql_parameters(ec, stmt, this->fr_memoize ? &key : nullptr);
+    if (this->fr_memoize) {
+        auto iter = this->fr_results.find(key);
+
+        if (iter != this->fr_results.end()) {
+            return iter->second;
+        }
+    }
+
+    ec.ec_accumulator.clear();
+    ec.ec_sql_callback(ec, stmt);
+    while (!done) {
+        int retcode = sqlite3_step(stmt);
+
+        switch (retcode) {
+            case SQLITE_OK:
+            case SQLITE_DONE:
+                done = true;
+                retval = ec.ec_accumulator.get_string();
+                break;
+
+            case SQLITE_ROW:
+                ec.ec_sql_callback(ec, stmt);
+                break;
+
+            default: {
+                const char *errmsg;
+
+                log_error("sqlite3_step error code: %d", retcode);
+                errmsg = sqlite3_errmsg(lnav_data.ld_db);
+                retval = ec.get_error_prefix() + string(errmsg);
+                sqlite3_reset(stmt);
+                return retval;
+            }
+        }
+    }
+    sqlite3_reset(stmt);
+
+    if (this->fr_memoize) {
+        if (this->fr_results.size() >= MAX_RESULTS) {
+            this->fr_results.clear();
+        }
+        this->fr_results[key] = retval;
+    }
+
+    return retval;
+}
+
+string execute_rewriter(exec_context &ec,
+                        shared_ptr<field_rewriter> &fr,
+                        const string &cmdline)
+{
+    if (!fr) {
+        fr = make_shared<field_rewriter>(cmdline);
+    }
+
+    return fr->execute(ec);
+}
+
 void execute_init_commands(exec_context &ec, vector<pair<string, string> > &msgs)
 {
     if (lnav_data.ld_cmd_init_done) {
@@ -33,10 +33,13 @@
 #include <sqlite3.h>
 
 #include <future>
+#include <memory>
 #include <string>
+#include <unordered_map>
 
 #include "optional.hpp"
 #include "auto_fd.hh"
+#include "auto_mem.hh"
 #include "attr_line.hh"
 #include "textview_curses.hh"
 
@@ -101,11 +104,49 @@ struct exec_context {
     pipe_callback_t ec_pipe_callback;
 };
 
+/**
+ * A rewriter for a log field.  Rewriters run for every value that is shown
+ * in the pretty-print view, so SQL rewriters are prepared once and, if the
+ * result of the statement only depends on the values bound to it, the
+ * results are remembered.  Other rewriters go through execute_any().
+ */
+class field_rewriter {
+public:
+    explicit field_rewriter(std::string cmdline);
+
+    std::string execute(exec_context &ec);
+
+    bool is_prepared() const {
+        return this->fr_stmt.in() != nullptr;
+    };
+
+    bool is_memoized() const {
+        return this->fr_memoize;
+    };
+
+private:
+    /** The number of results to remember before starting over. */
+    static const size_t MAX_RESULTS = 1024;
+
+    void prepare();
+
+    std::string fr_cmdline;
+    auto_mem<sqlite3_stmt> fr_stmt;
+    bool fr_memoize{false};
+    std::unordered_map<std::string, std::string> fr_results;
+};
+
 std::string execute_command(exec_context &ec, const std::string &cmdline);
 
 std::string execute_sql(exec_context &ec, const std::string &sql, std::string &alt_msg);
+void bind_sql_parameters(exec_context &ec,
+                         sqlite3_stmt *stmt,
+                         std::string *key_out = nullptr);
 std::string execute_file(exec_context &ec, const std::string &path_and_args, bool multiline = true);
 std::string execute_any(exec_context &ec, const std::string &cmdline);
+std::string execute_rewriter(exec_context &ec,
+                             std::shared_ptr<field_rewriter> &fr,
+                             const std::string &cmdline);
 void execute_init_commands(exec_context &ec, std::vector<std::pair<std::string, std::string> > &msgs);
 
 int sql_callback(exec_context &ec, sqlite3_stmt *stmt);
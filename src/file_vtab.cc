@@ -53,7 +53,9 @@ CREATE TABLE lnav_file (
     filepath text,        -- The path to the file.
     format text,          -- The log file format for the file.
     lines integer,        -- The number of lines in the file.
-    time_offset integer   -- The millisecond offset for timestamps.
+    time_offset integer,  -- The millisecond offset for timestamps.
+    render_cache_hits integer,   -- Lines found in the rendered message cache.
+    render_cache_misses integer  -- Lines that had to be rendered again.
 );
 )";
 
@@ -104,6 +106,16 @@ CREATE TABLE lnav_file (
                 to_sqlite(ctx, ms);
                 break;
             }
+            case 6:
+            case 7: {
+                log_format::subline_cache_stats stats;
+
+                if (format != nullptr) {
+                    stats = format->get_subline_cache_stats();
+                }
+                to_sqlite(ctx, col == 6 ? stats.scs_hits : stats.scs_misses);
+                break;
+            }
             default:
                 ensure(0);
                 break;
@@ -131,7 +143,9 @@ CREATE TABLE lnav_file (
                    const char *path,
                    const char *format,
                    int64_t lines,
-                   int64_t time_offset) {
+                   int64_t time_offset,
+                   int64_t render_cache_hits,
+                   int64_t render_cache_misses) {
         auto lf = lnav_data.ld_files[rowid];
         struct timeval tv = {
             (int) (time_offset / 1000LL),
@@ -29,6 +29,7 @@
 
 #include "config.h"
 
+#include "base/parallel_for.hh"
 #include "filter_observer.hh"
 
 void line_filter_observer::logline_new_line(const logfile &lf,
@@ -57,6 +58,69 @@ void line_filter_observer::logline_new_line(const logfile &lf,
     }
 }
 
+void line_filter_observer::logline_new_lines(
+    const logfile &lf,
+    logfile::const_iterator ll,
+    shared_buffer_ref &window,
+    const std::vector<file_range> &line_ranges)
+{
+    size_t offset = std::distance(lf.begin(), ll);
+
+    require(&lf == this->lfo_filter_state.tfs_logfile.get());
+
+    this->lfo_filter_state.resize(lf.size());
+    if (this->lfo_filter_stack.empty()) {
+        return;
+    }
+
+    if (lf.get_format() != nullptr && lf.get_format()->has_sublines()) {
+        logline_observer::logline_new_lines(lf, ll, window, line_ranges);
+        return;
+    }
+
+    size_t line_count = line_ranges.size();
+
+    for (auto &filter : this->lfo_filter_stack) {
+        if (filter->lf_deleted) {
+            continue;
+        }
+
+        size_t count =
+            this->lfo_filter_state.tfs_filter_count[filter->get_index()];
+        size_t start = count > offset ?
+                       std::min(count - offset, line_count) : 0;
+
+        if (start == line_count) {
+            continue;
+        }
+
+        size_t shard_count = 1;
+
+        if (filter->is_batch_reentrant()) {
+            shard_count = std::min(
+                this->lfo_max_workers,
+                std::max((line_count - start) / MIN_SHARD_LINES, (size_t) 1));
+        }
+
+        size_t shard_size = (line_count - start + shard_count - 1) /
+                            shard_count;
+
+        this->lfo_matched.assign(line_count, 0);
+        parallel_for(shard_count, [&](size_t index) {
+            size_t shard_start = std::min(start + index * shard_size,
+                                          line_count);
+            size_t shard_end = std::min(shard_start + shard_size,
+                                        line_count);
+
+            filter->matches_batch(lf, ll, window, line_ranges,
+                                  shard_start, shard_end,
+                                  this->lfo_matched);
+        }, shard_count);
+        filter->add_lines(this->lfo_filter_state, ll, this->lfo_matched,
+                          start);
+    }
+}
+
 void line_filter_observer::logline_eof(const logfile &lf)
 {
     for (auto &iter : this->lfo_filter_stack) {
@@ -66,3 +130,146 @@ void line_filter_observer::logline_eof(const logfile &lf)
         iter->end_of_message(this->lfo_filter_state);
     }
 }
+
+bool background_filter::start(filter_stack &fs,
+                              const std::vector<line_filter_observer *> &observers)
+{
+    require(!this->is_running());
+
+    if (!this->bf_enabled) {
+        return false;
+    }
+
+    this->bf_filters.clear_filters();
+    for (auto &filter : fs) {
+        if (!filter->lf_deleted) {
+            this->bf_filters.add_filter(filter);
+        }
+    }
+
+    this->bf_passes.clear();
+    this->bf_lines_total = 0;
+    for (auto lfo : observers) {
+        auto lf = lfo->lfo_filter_state.tfs_logfile;
+        size_t start = lfo->get_min_count(lf->size());
+
+        if (start == lf->size()) {
+            continue;
+        }
+        if (!lf->can_observe_in_background()) {
+            this->bf_passes.clear();
+            return false;
+        }
+
+        auto_fd fd(dup(lf->get_fd()));
+
+        if (fd == -1) {
+            this->bf_passes.clear();
+            return false;
+        }
+
+        file_pass fp;
+
+        fp.fp_target = lfo;
+        fp.fp_observer = std::make_unique<line_filter_observer>(
+            this->bf_filters, lf);
+        fp.fp_observer->lfo_filter_state = lfo->lfo_filter_state;
+        fp.fp_start = start;
+        fp.fp_fd = fd.release();
+        this->bf_lines_total += lf->size() - start;
+        this->bf_passes.emplace_back(std::move(fp));
+    }
+
+    if (this->bf_passes.empty()) {
+        return false;
+    }
+
+    log_debug("applying filters to %d file(s) in the background",
+              this->bf_passes.size());
+    this->bf_stop = false;
+    this->bf_done = false;
+    this->bf_lines_done = 0;
+    this->bf_thread = std::thread([this]() {
+        this->run();
+    });
+
+    return true;
+}
+
+void background_filter::run()
+{
+    size_t worker_count = parallel_worker_count();
+    size_t file_workers = std::max(
+        worker_count / this->bf_passes.size(), (size_t) 1);
+
+    parallel_for(this->bf_passes.size(), [this, file_workers](size_t index) {
+        file_pass &fp = this->bf_passes[index];
+        auto lf = fp.fp_observer->lfo_filter_state.tfs_logfile;
+        auto last = lf->begin() + fp.fp_start;
+        line_buffer lb;
+
+        lb.set_fd(fp.fp_fd);
+        fp.fp_observer->lfo_max_workers = file_workers;
+        fp.fp_complete = lf->observe_lines(
+            lb, *fp.fp_observer, last,
+            [this, &last](logfile::iterator curr) {
+                this->bf_lines_done += std::distance(last, curr);
+                last = curr;
+                return !this->bf_stop;
+            });
+        if (fp.fp_complete) {
+            this->bf_lines_done += std::distance(last, lf->end());
+            fp.fp_observer->logline_eof(*lf);
+        }
+        fp.fp_observer->lfo_max_workers = 1;
+    }, worker_count);
+
+    this->bf_done = true;
+}
+
+void background_filter::cancel()
+{
+    if (!this->is_running()) {
+        return;
+    }
+
+    this->bf_stop = true;
+    this->wait();
+    this->bf_passes.clear();
+    this->bf_filters.clear_filters();
+}
+
+void background_filter::wait()
+{
+    if (this->bf_thread.joinable()) {
+        this->bf_thread.join();
+    }
+}
+
+bool background_filter::finish()
+{
+    if (!this->is_running()) {
+        return false;
+    }
+
+    this->wait();
+    for (auto &fp : this->bf_passes) {
+        auto lf = fp.fp_observer->lfo_filter_state.tfs_logfile;
+
+        // The file should not have changed, but make sure the result still
+        // belongs to the observer before handing it over.
+        if (!fp.fp_complete ||
+            lf->get_logline_observer() != fp.fp_target ||
+            fp.fp_target->lfo_filter_state.tfs_logfile != lf) {
+            log_warning("%s: dropping background filter result",
+                        lf->get_filename().c_str());
+            continue;
+        }
+        fp.fp_target->lfo_filter_state =
+            std::move(fp.fp_observer->lfo_filter_state);
+    }
+    this->bf_passes.clear();
+    this->bf_filters.clear_filters();
+
+    return true;
+}
@@ -32,6 +32,11 @@
 
 #include <sys/types.h>
 
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
 #include "logfile.hh"
 #include "textview_curses.hh"
 
@@ -50,6 +55,11 @@ public:
 
     void logline_new_line(const logfile &lf, logfile::const_iterator ll, shared_buffer_ref &sbr);
 
+    void logline_new_lines(const logfile &lf,
+                           logfile::const_iterator ll,
+                           shared_buffer_ref &window,
+                           const std::vector<file_range> &line_ranges) override;
+
     void logline_eof(const logfile &lf);;
 
     bool excluded(uint32_t filter_in_mask, uint32_t filter_out_mask,
@@ -87,8 +97,117 @@ public:
         this->lfo_filter_state.clear_deleted_filter_state(used_mask);
     };
 
+    /**
+     * The minimum number of lines in a window before matching is split up
+     * between worker threads.
+     */
+    static const size_t MIN_SHARD_LINES = 512;
+
     filter_stack &lfo_filter_stack;
     logfile_filter_state lfo_filter_state;
+    /** The number of threads that can be used to match a window. */
+    size_t lfo_max_workers{1};
+    std::vector<uint8_t> lfo_matched;
+};
+
+/**
+ * Re-applies the filters to a set of files on a separate thread so that
+ * the view can keep showing the old filtered lines while the new state is
+ * computed.  The thread works on copies of the files' filter states and
+ * reads the files through its own line buffers.  The results are swapped
+ * into the files' observers by finish(), which must be called from the
+ * same thread as start().  The files must not be re-indexed, their lines
+ * must not be modified, and their observers must not be changed while the
+ * filters are being applied.  Use wait() to stop the thread before changing
+ * the lines.
+ */
+class background_filter {
+public:
+    ~background_filter() {
+        this->cancel();
+    };
+
+    /**
+     * @param enabled True if start() should apply the filters in the
+     *   background, otherwise the caller has to apply them itself.
+     */
+    void set_enabled(bool enabled) {
+        this->bf_enabled = enabled;
+    };
+
+    /**
+     * Start re-applying the filters to the files of the given observers.
+     *
+     * @param fs The filters to apply.
+     * @param observers The observers that will receive the new filter state.
+     * @return True if the filters are being applied in the background.  If
+     *   false, nothing was started because background filtering is disabled,
+     *   the files are already up-to-date, or one of the files cannot be read
+     *   from another thread.
+     */
+    bool start(filter_stack &fs,
+               const std::vector<line_filter_observer *> &observers);
+
+    /** Stop applying the filters and throw away the results. */
+    void cancel();
+
+    /**
+     * Wait for the filters to be applied without swapping in the result,
+     * so that the lines can be modified.  The result is still swapped in
+     * by a later call to finish().
+     */
+    void wait();
+
+    /**
+     * Wait for the filters to be applied and swap the new state into the
+     * observers.
+     *
+     * @return True if there was a result to swap in.
+     */
+    bool finish();
+
+    /** @return True if the filters are being applied or are waiting to be finished. */
+    bool is_running() const {
+        return this->bf_thread.joinable() || !this->bf_passes.empty();
+    };
+
+    /** @return True if the thread is done and finish() will not block. */
+    bool is_done() const {
+        return this->bf_done;
+    };
+
+    size_t get_lines_done() const {
+        return this->bf_lines_done;
+    };
+
+    size_t get_lines_total() const {
+        return this->bf_lines_total;
+    };
+
+private:
+    struct file_pass {
+        /** The observer that receives the result. */
+        line_filter_observer *fp_target;
+        /** The observer that computes the result on the thread. */
+        std::unique_ptr<line_filter_observer> fp_observer;
+        /** The first line that needs to be observed. */
+        size_t fp_start;
+        auto_fd fp_fd;
+        /** Set by the thread if all of the lines were observed. */
+        bool fp_complete{false};
+    };
+
+    void run();
+
+    bool bf_enabled{false};
+    /** A copy of the filters, so changes to the stack do not affect the thread. */
+    filter_stack bf_filters;
+    std::vector<file_pass> bf_passes;
+    std::thread bf_thread;
+    std::atomic<bool> bf_stop{false};
+    std::atomic<bool> bf_done{false};
+    std::atomic<size_t> bf_lines_done{0};
+    size_t bf_lines_total{0};
 };
 
 #endif
@@ -37,11 +37,13 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <signal.h>
 #include <sys/types.h>
-#include <sys/wait.h>
+
+#include <algorithm>
+#include <future>
 
 #include "base/lnav_log.hh"
+#include "base/parallel_for.hh"
 #include "base/string_util.hh"
 #include "lnav_util.hh"
 #include "grep_proc.hh"
@@ -62,36 +64,20 @@ grep_proc<LineType>::grep_proc(pcre *code, grep_proc_source<LineType> &gps)
 }
 
 template<typename LineType>
-grep_proc<LineType>::~grep_proc()
+grep_proc<LineType>::grep_proc(const pcrepp &pattern,
+                               grep_proc_source<LineType> &gps)
+    : gp_pcre(pattern),
+      gp_source(gps)
 {
-    this->invalidate();
+    require(this->invariant());
+
+    gps.register_proc(this);
 }
 
 template<typename LineType>
-void grep_proc<LineType>::handle_match(int line,
-                                       string &line_value,
-                                       int off,
-                                       int *matches,
-                                       int count)
+grep_proc<LineType>::~grep_proc()
 {
-    int lpc;
-
-    if (off == 0) {
-        fprintf(stdout, "%d\n", line);
-    }
-    fprintf(stdout, "[%d:%d]\n", matches[0], matches[1]);
-    for (lpc = 1; lpc < count; lpc++) {
-        fprintf(stdout,
-                "(%d:%d)",
-                matches[lpc * 2],
-                matches[lpc * 2 + 1]);
-        fwrite(&(line_value.c_str()[matches[lpc * 2]]),
-               1,
-               matches[lpc * 2 + 1] -
-               matches[lpc * 2],
-               stdout);
-        fputc('\n', stdout);
-    }
+    this->invalidate();
 }
 
 template<typename LineType>
@@ -99,219 +85,203 @@ void grep_proc<LineType>::start()
 {
     require(this->invariant());
 
-    if (this->gp_child_started || this->gp_queue.empty()) {
+    if (this->gp_started || this->gp_queue.empty()) {
         return;
     }
 
-    auto_pipe in_pipe(STDIN_FILENO);
-    auto_pipe out_pipe(STDOUT_FILENO);
-    auto_pipe err_pipe(STDERR_FILENO);
-
-    /* Get ahold of some pipes for stdout and stderr. */
-    if (out_pipe.open() < 0) {
-        throw error(errno);
-    }
-
-    if (err_pipe.open() < 0) {
-        throw error(errno);
-    }
+    if (this->gp_ready_pipe.read_end() == -1) {
+        static const char READY = 'r';
 
-    if ((this->gp_child = fork()) < 0) {
-        throw error(errno);
+        if (this->gp_ready_pipe.open() < 0) {
+            throw error(errno);
+        }
+        log_perror(fcntl(this->gp_ready_pipe.read_end(), F_SETFD, 1));
+        log_perror(fcntl(this->gp_ready_pipe.write_end(), F_SETFD, 1));
+        /* The byte is never read, so the pipe is always readable. */
+        log_perror(write(this->gp_ready_pipe.write_end(), &READY, 1));
     }
 
-    in_pipe.after_fork(this->gp_child);
-    out_pipe.after_fork(this->gp_child);
-    err_pipe.after_fork(this->gp_child);
-
-    if (this->gp_child != 0) {
-        log_perror(fcntl(out_pipe.read_end(), F_SETFL, O_NONBLOCK));
-        log_perror(fcntl(out_pipe.read_end(), F_SETFD, 1));
-        this->gp_line_buffer.set_fd(out_pipe.read_end());
+    this->gp_started = true;
 
-        log_perror(fcntl(err_pipe.read_end(), F_SETFL, O_NONBLOCK));
-        log_perror(fcntl(err_pipe.read_end(), F_SETFD, 1));
-        require(this->gp_err_pipe.get() == -1);
-        this->gp_err_pipe      = err_pipe.read_end();
-        this->gp_child_started = true;
-        this->gp_child_queue_size = this->gp_queue.size();
+    ensure(this->invariant());
+}
 
-        this->gp_queue.clear();
-        return;
+template<typename LineType>
+void grep_proc<LineType>::search_shard(size_t begin,
+                                       size_t end,
+                                       shard_result &result_out)
+{
+    result_out.sr_matches.clear();
+    result_out.sr_captures.clear();
+    for (size_t lpc = begin; lpc < end; lpc++) {
+        pcre_context_static<128> pc;
+        pcre_input pi(this->gp_batch_values[lpc]);
+
+        while (this->gp_pcre.match(pc, pi)) {
+            pcre_context::capture_t *m = pc.all();
+            shard_match sm;
+
+            sm.sm_line_index = lpc;
+            sm.sm_start = m->c_begin;
+            sm.sm_end = m->c_end;
+            sm.sm_capture_start = result_out.sr_captures.size();
+            for (auto pc_iter = pc.begin(); pc_iter != pc.end(); pc_iter++) {
+                if (!pc_iter->is_valid()) {
+                    continue;
+                }
+                result_out.sr_captures.emplace_back(pc_iter->c_begin,
+                                                    pc_iter->c_end);
+            }
+            sm.sm_capture_end = result_out.sr_captures.size();
+            result_out.sr_matches.push_back(sm);
+        }
     }
+}
 
-    /* In the child... */
-
-    /*
-     * Restore the default signal handlers so we don't hang around
-     * forever if there is a problem.
-     */
-    signal(SIGINT, SIG_DFL);
-    signal(SIGTERM, SIG_DFL);
-
-    this->child_init();
-
-    this->child_loop();
-
-    _exit(0);
+template<typename LineType>
+void grep_proc<LineType>::dispatch_match(const shard_result &result,
+                                         const shard_match &sm)
+{
+    uint32_t generation = this->gp_generation;
+    LineType line = this->gp_batch_lines[sm.sm_line_index];
+    const string &value = this->gp_batch_values[sm.sm_line_index];
+
+    this->gp_sink->grep_match(*this, line, sm.sm_start, sm.sm_end);
+    for (size_t lpc = sm.sm_capture_start;
+         lpc < sm.sm_capture_end && generation == this->gp_generation;
+         lpc++) {
+        const auto &cap = result.sr_captures[lpc];
+        string capture = value.substr(cap.first, cap.second - cap.first);
+
+        this->gp_sink->grep_capture(*this,
+                                    line,
+                                    cap.first,
+                                    cap.second,
+                                    &capture[0]);
+    }
+    if (generation == this->gp_generation) {
+        this->gp_sink->grep_match_end(*this, line);
+    }
 }
 
 template<typename LineType>
-void grep_proc<LineType>::child_loop()
+void grep_proc<LineType>::search_batch()
 {
-    char   outbuf[BUFSIZ * 2];
-    string line_value;
+    require(this->invariant());
 
-    /* Make sure buffering is on, not sure of the state in the parent. */
-    if (setvbuf(stdout, outbuf, _IOFBF, BUFSIZ * 2) < 0) {
-        perror("setvbuf");
+    size_t finished_count = 0;
+    size_t shard_size = std::max(BATCH_LINES / parallel_worker_count(),
+                                 MIN_SHARD_LINES);
+    size_t shard_count = 0;
+    size_t dispatched = 0;
+    vector<future<void>> shards;
+
+    this->gp_batch_lines.clear();
+    // The workers hold references into the values while the rest of the
+    // batch is read, so they cannot be reallocated.
+    if (this->gp_batch_values.size() < BATCH_LINES) {
+        this->gp_batch_values.resize(BATCH_LINES);
+    }
+    if (this->gp_shard_results.size() < BATCH_LINES / shard_size + 1) {
+        this->gp_shard_results.resize(BATCH_LINES / shard_size + 1);
     }
-    lnav_log_file = fopen("/tmp/lnav.grep.err", "a");
-    line_value.reserve(BUFSIZ * 2);
-    while (!this->gp_queue.empty()) {
+
+    while (!this->gp_queue.empty() &&
+           this->gp_batch_lines.size() < BATCH_LINES) {
         LineType start_line = this->gp_queue.front().first;
         LineType stop_line  = this->gp_queue.front().second;
-        bool        done       = false;
-        LineType line;
+        bool done = false;
 
-        this->gp_queue.pop_front();
-        for (line = this->gp_source.grep_initial_line(start_line, this->gp_highest_line);
-             line != -1 && (stop_line == -1 || line < stop_line) && !done;
+        if (!this->gp_request_active) {
+            this->gp_next_line = this->gp_source.grep_initial_line(
+                start_line, this->gp_highest_line);
+            this->gp_request_active = true;
+        }
+
+        LineType &line = this->gp_next_line;
+
+        for (;
+             line != -1 && (stop_line == -1 || line < stop_line) && !done &&
+             this->gp_batch_lines.size() < BATCH_LINES;
              this->gp_source.grep_next_line(line)) {
+            size_t index = this->gp_batch_lines.size();
+            string &line_value = this->gp_batch_values[index];
+
             line_value.clear();
             done = !this->gp_source.grep_value_for_line(line, line_value);
-            if (!done) {
-                pcre_context_static<128> pc;
-                pcre_input pi(line_value);
-
-                while (this->gp_pcre.match(pc, pi)) {
-                    pcre_context::iterator   pc_iter;
-                    pcre_context::capture_t *m;
-
-                    if (pi.pi_offset == 0) {
-                        fprintf(stdout, "%d\n", (int) line);
-                    }
-                    m = pc.all();
-                    fprintf(stdout, "[%d:%d]\n", m->c_begin, m->c_end);
-                    for (pc_iter = pc.begin(); pc_iter != pc.end();
-                         pc_iter++) {
-                        if (!pc_iter->is_valid()) {
-                            continue;
-                        }
-                        fprintf(stdout,
-                                "(%d:%d)",
-                                pc_iter->c_begin,
-                                pc_iter->c_end);
-
-                        /* If the capture was conditional, pcre will return a -1
-                         * here.
-                         */
-                        if (pc_iter->c_begin >= 0) {
-                            fwrite(pi.get_substr_start(pc_iter),
-                                   1,
-                                   pc_iter->length(),
-                                   stdout);
-                        }
-                        fputc('\n', stdout);
-                    }
-                    fprintf(stdout, "/\n");
-                }
+            if (done) {
+                continue;
             }
-
-            if (((line + 1) % 10000) == 0) {
-                /* Periodically flush the buffer so the parent sees progress */
-                this->child_batch();
+            this->gp_batch_lines.push_back(line);
+
+            size_t line_count = this->gp_batch_lines.size();
+
+            // The last shard in the batch is searched on this thread.
+            if (line_count - dispatched >= shard_size &&
+                line_count < BATCH_LINES) {
+                shards.emplace_back(std::async(
+                    std::launch::async,
+                    &grep_proc::search_shard,
+                    this,
+                    dispatched,
+                    line_count,
+                    std::ref(this->gp_shard_results[shard_count])));
+                dispatched = line_count;
+                shard_count += 1;
             }
         }
 
-        if (stop_line == -1) {
-            // When scanning to the end of the source, we need to return the
-            // highest line that was seen so that the next request that
-            // continues from the end works properly.
-            fprintf(stdout, "h%d\n", line - 1);
-        }
-        this->child_term();
-    }
-}
-
-template<typename LineType>
-void grep_proc<LineType>::cleanup()
-{
-    if (this->gp_child != -1 && this->gp_child != 0) {
-        int status = 0;
-
-        kill(this->gp_child, SIGTERM);
-        while (waitpid(this->gp_child, &status, 0) < 0 && (errno == EINTR)) {
-            ;
+        if (!done && line != -1 && (stop_line == -1 || line < stop_line)) {
+            /* Out of room in this batch, pick up here on the next one. */
+            break;
         }
-        require(!WIFSIGNALED(status) || WTERMSIG(status) != SIGABRT);
-        this->gp_child         = -1;
-        this->gp_child_started = false;
 
-        if (this->gp_sink) {
-            for (int lpc = 0; lpc < this->gp_child_queue_size; lpc++) {
-                this->gp_sink->grep_end(*this);
-            }
+        if (stop_line == -1) {
+            // When scanning to the end of the source, we need to remember
+            // the highest line that was seen so that the next request that
+            // continues from the end works properly.
+            this->gp_highest_line = line - LineType(1);
         }
+        finished_count += 1;
+        this->gp_request_active = false;
+        this->gp_queue.pop_front();
     }
 
-    if (this->gp_err_pipe != -1) {
-        this->gp_err_pipe.reset();
+    this->search_shard(dispatched,
+                       this->gp_batch_lines.size(),
+                       this->gp_shard_results[shard_count]);
+    shard_count += 1;
+    for (auto &shard : shards) {
+        shard.get();
     }
 
-    this->gp_pipe_range.clear();
-    this->gp_line_buffer.reset();
-
-    ensure(this->invariant());
-
-    if (!this->gp_queue.empty()) {
-        this->start();
+    if (this->gp_queue.empty()) {
+        this->gp_started = false;
     }
-}
 
-template<typename LineType>
-void grep_proc<LineType>::dispatch_line(char *line)
-{
-    int start, end, capture_start;
+    if (this->gp_sink != nullptr) {
+        uint32_t generation = this->gp_generation;
 
-    require(line != nullptr);
-
-    if (sscanf(line, "h%d", this->gp_highest_line.out()) == 1) {
-    } else if (sscanf(line, "%d", this->gp_last_line.out()) == 1) {
-        /* Starting a new line with matches. */
-        ensure(this->gp_last_line >= 0);
-    }
-    else if (sscanf(line, "[%d:%d]", &start, &end) == 2) {
-        require(start >= 0);
-        require(end >= 0);
+        for (size_t lpc = 0;
+             lpc < shard_count && generation == this->gp_generation;
+             lpc++) {
+            const auto &result = this->gp_shard_results[lpc];
 
-        /* Pass the match offsets to the sink delegate. */
-        if (this->gp_sink != nullptr) {
-            this->gp_sink->grep_match(*this, this->gp_last_line, start, end);
+            for (const auto &sm : result.sr_matches) {
+                this->dispatch_match(result, sm);
+                if (generation != this->gp_generation) {
+                    break;
+                }
+            }
         }
-    }
-    else if (sscanf(line, "(%d:%d)%n", &start, &end, &capture_start) == 2) {
-        require(start == -1 || start >= 0);
-        require(end >= 0);
-
-        /* Pass the captured strings to the sink delegate. */
-        if (this->gp_sink != nullptr) {
-            this->gp_sink->grep_capture(*this,
-                                        this->gp_last_line,
-                                        start,
-                                        end,
-                                        start < 0 ?
-                                        nullptr : &line[capture_start]);
+
+        if (generation == this->gp_generation) {
+            this->gp_sink->grep_end_batch(*this);
         }
-    }
-    else if (line[0] == '/') {
-        if (this->gp_sink != nullptr) {
-            this->gp_sink->grep_match_end(*this, this->gp_last_line);
+        for (size_t lpc = 0; lpc < finished_count; lpc++) {
+            this->gp_sink->grep_end(*this);
         }
     }
-    else {
-        log_error("bad line from child -- %s", line);
-    }
 }
 
 template<typename LineType>
@@ -319,79 +289,27 @@ void grep_proc<LineType>::check_poll_set(const std::vector<struct pollfd> &pollf
 {
     require(this->invariant());
 
-    if (this->gp_err_pipe != -1 && pollfd_ready(pollfds, this->gp_err_pipe)) {
-        char buffer[1024 + 1];
-        ssize_t rc;
-
-        rc = read(this->gp_err_pipe, buffer, sizeof(buffer) - 1);
-        if (rc > 0) {
-            static const char *PREFIX = ": ";
-
-            buffer[rc] = '\0';
-            if (strncmp(buffer, PREFIX, strlen(PREFIX)) == 0) {
-                char *lf;
-
-                if ((lf = strchr(buffer, '\n')) != nullptr) {
-                    *lf = '\0';
-                }
-                if (this->gp_control != nullptr) {
-                    this->gp_control->grep_error(&buffer[strlen(PREFIX)]);
-                }
-            }
-        }
-        else if (rc == 0) {
-            this->gp_err_pipe.reset();
-        }
+    if (this->gp_started &&
+        pollfd_ready(pollfds, this->gp_ready_pipe.read_end())) {
+        this->search_batch();
     }
 
-    if (this->gp_line_buffer.get_fd() != -1 &&
-        pollfd_ready(pollfds, this->gp_line_buffer.get_fd())) {
-        try {
-            static const int MAX_LOOPS = 100;
-
-            int loop_count = 0;
-            bool drained = false;
-
-            while (loop_count < MAX_LOOPS) {
-                auto load_result = this->gp_line_buffer
-                    .load_next_line(this->gp_pipe_range);
-
-                if (load_result.isErr()) {
-                    break;
-                }
-
-                auto li = load_result.unwrap();
-
-                if (li.li_file_range.empty()) {
-                    drained = true;
-                    break;
-                }
-
-                this->gp_pipe_range = li.li_file_range;
-                this->gp_line_buffer.read_range(li.li_file_range).then([this](auto sbr) {
-                    char buf[1024];
-
-                    sbr.rtrim(is_line_ending);
-                    memcpy(buf, sbr.get_data(), sbr.length());
-                    buf[sbr.length()] = '\0';
-                    this->dispatch_line(buf);
-                });
-
-                loop_count += 1;
-            }
+    ensure(this->invariant());
+}
 
-            if (this->gp_sink != nullptr) {
-                this->gp_sink->grep_end_batch(*this);
-            }
+template<typename LineType>
+void grep_proc<LineType>::cleanup()
+{
+    this->gp_generation += 1;
+    this->gp_started = false;
+    this->gp_request_active = false;
 
-            if (drained && this->gp_line_buffer.is_pipe_closed()) {
-                this->cleanup();
-            }
-        }
-        catch (line_buffer::error & e) {
-            this->cleanup();
+    if (this->gp_sink) {
+        for (size_t lpc = 0; lpc < this->gp_queue.size(); lpc++) {
+            this->gp_sink->grep_end(*this);
         }
     }
+    this->gp_queue.clear();
 
     ensure(this->invariant());
 }
@@ -399,12 +317,6 @@ void grep_proc<LineType>::check_poll_set(const std::vector<struct pollfd> &pollf
 template<typename LineType>
 grep_proc<LineType> &grep_proc<LineType>::invalidate()
 {
-    if (this->gp_sink) {
-        for (int lpc = 0; lpc < this->gp_queue.size(); lpc++) {
-            this->gp_sink->grep_end(*this);
-        }
-    }
-    this->gp_queue.clear();
     this->cleanup();
     return *this;
 }
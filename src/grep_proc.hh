@@ -46,6 +46,7 @@
 #endif
 
 #include <deque>
+#include <memory>
 #include <string>
 #include <vector>
 #include <exception>
@@ -55,7 +56,6 @@
 #include "auto_mem.hh"
 #include "base/lnav_log.hh"
 #include "strong_int.hh"
-#include "line_buffer.hh"
 
 template<typename LineType>
 class grep_proc;
@@ -117,10 +117,13 @@ public:
     /** Called at the start of a new grep run. */
     virtual void grep_begin(grep_proc<LineType> &gp, LineType start, LineType stop) { };
 
-    /** Called periodically between grep_begin and grep_end. */
+    /**
+     * Called after each batch of matches has been delivered, between
+     * grep_begin and grep_end.
+     */
     virtual void grep_end_batch(grep_proc<LineType> &gp) { };
 
-    /** Called at the end of a grep run. */
+    /** Called at the end of each request queued with queue_request(). */
     virtual void grep_end(grep_proc<LineType> &gp) { };
 
     /**
@@ -155,11 +158,18 @@ public:
 };
 
 /**
- * "Grep" that runs in a separate process so it doesn't stall user-interaction.
- * This class manages the child process and any interactions between the parent
- * and child.  The source data to be matched comes from the grep_proc_source
- * delegate and the results are sent to the grep_proc_sink delegate in the
- * parent process.
+ * "Grep" that runs in-process without stalling user-interaction.  The lines
+ * to be searched are pulled from the grep_proc_source delegate in batches.
+ * Each batch is split into shards that are handed to worker threads as soon
+ * as their lines have been read, so the matching overlaps with reading the
+ * rest of the batch.  The workers share the compiled pattern and each match
+ * with its own context.  The matches are then passed to the grep_proc_sink
+ * delegate in line order.
+ *
+ * The search is driven by the main loop through update_poll_set() and
+ * check_poll_set().  While there is work to do, a descriptor that is always
+ * readable is added to the poll set so that a batch is processed on each
+ * pass through the loop.
  *
  * Note: The "grep" executable is not actually used, instead we use the pcre(3)
  * library directly.
@@ -178,13 +188,22 @@ public:
 
     /**
      * Construct a grep_proc object.  You must call the start() method
-     * to fork off the child process and begin processing.
+     * to begin processing.
      *
      * @param code The pcre code to run over the lines of input.
      * @param gps The source of the data to match.
      */
     grep_proc(pcre *code, grep_proc_source<LineType> &gps);
 
+    /**
+     * Construct a grep_proc object from a pattern that may have been able
+     * to find a required literal to screen lines with.
+     *
+     * @param pattern The pattern to run over the lines of input.
+     * @param gps The source of the data to match.
+     */
+    grep_proc(const pcrepp &pattern, grep_proc_source<LineType> &gps);
+
     virtual ~grep_proc();
 
     /** @param gpd The sink to send resuls to. */
@@ -232,16 +251,9 @@ public:
 
     void update_poll_set(std::vector<struct pollfd> &pollfds)
     {
-        if (this->gp_line_buffer.get_fd() != -1) {
+        if (this->gp_started) {
             pollfds.push_back((struct pollfd) {
-                    this->gp_line_buffer.get_fd(),
-                    POLLIN,
-                    0
-            });
-        }
-        if (this->gp_err_pipe != -1) {
-            pollfds.push_back((struct pollfd) {
-                    this->gp_err_pipe,
+                    this->gp_ready_pipe.read_end(),
                     POLLIN,
                     0
             });
@@ -258,70 +270,87 @@ public:
     /** Check the invariants for this object. */
     bool invariant()
     {
-        if (this->gp_child_started) {
-            require(this->gp_child > 0);
-            require(this->gp_line_buffer.get_fd() != -1);
-        }
-        else {
-            /* require(this->gp_child == -1); XXX doesnt work with static destr */
-            require(this->gp_line_buffer.get_fd() == -1);
+        if (this->gp_started) {
+            require(this->gp_ready_pipe.read_end() != -1);
+            require(!this->gp_queue.empty());
         }
 
         return true;
     };
 
 protected:
+    /** The maximum number of lines to search in one pass of the main loop. */
+    static const size_t BATCH_LINES = 16 * 1024;
+
+    /** The minimum number of lines worth handing to a worker thread. */
+    static const size_t MIN_SHARD_LINES = 1024;
+
+    /** A match found in a line by one of the workers. */
+    struct shard_match {
+        size_t sm_line_index;
+        int sm_start;
+        int sm_end;
+        size_t sm_capture_start;
+        size_t sm_capture_end;
+    };
+
+    /** The matches found by a worker in its share of a batch. */
+    struct shard_result {
+        std::vector<shard_match> sr_matches;
+        std::vector<std::pair<int, int>> sr_captures;
+    };
 
     /**
-     * Dispatch a line received from the child.
+     * Pull the next batch of lines from the source, search them, and send
+     * the results to the sink.
      */
-    void dispatch_line(char *line);
+    void search_batch();
 
     /**
-     * Free any resources used by the object and make sure the child has been
-     * terminated.
+     * Search the lines in the range [begin, end) of the current batch.
      */
-    void cleanup();
-
-    void child_loop();
-
-    virtual void child_init() { };
-
-    virtual void child_batch() { fflush(stdout); };
+    void search_shard(size_t begin, size_t end, shard_result &result_out);
 
-    virtual void child_term() { fflush(stdout); };
+    /** Send a match and its captures to the sink. */
+    void dispatch_match(const shard_result &result, const shard_match &sm);
 
-    virtual void handle_match(int line,
-                              std::string &line_value,
-                              int off,
-                              int *matches,
-                              int count);
+    /**
+     * Stop searching and tell the sink that any outstanding requests are
+     * finished.
+     */
+    void cleanup();
 
     pcrepp             gp_pcre;
     grep_proc_source<LineType> &gp_source;        /*< The data source delegate. */
 
-    auto_fd     gp_err_pipe;             /*< Standard error from the child. */
-    line_buffer gp_line_buffer;          /*< Standard out from the child. */
-    file_range  gp_pipe_range;
-
-    pid_t gp_child{-1};                     /*<
-                                         * The child's pid or zero in the
-                                         * child.
-                                         */
-    bool     gp_child_started{false};          /*< True if the child was start()'d. */
-    size_t gp_child_queue_size{0};
+    auto_pipe gp_ready_pipe;             /*<
+                                          * Always readable, used to keep the
+                                          * main loop running while there is
+                                          * work to be done.
+                                          */
+    bool     gp_started{false};          /*< True if the search was start()'d. */
+    bool     gp_request_active{false};   /*<
+                                          * True if the request at the front
+                                          * of the queue has been started.
+                                          */
+    LineType gp_next_line{0};            /*< The next line to search. */
+    uint32_t gp_generation{0};           /*<
+                                          * Incremented when the search is
+                                          * invalidated so that dispatching
+                                          * can stop.
+                                          */
+
+    /** The line numbers and values in the current batch. */
+    std::vector<LineType> gp_batch_lines;
+    std::vector<std::string> gp_batch_values;
+    std::vector<shard_result> gp_shard_results;
 
     /** The queue of search requests. */
     std::deque<std::pair<LineType, LineType> > gp_queue;
-    LineType gp_last_line{0};           /*<
-                                         * The last line number received from
-                                         * the child.  For multiple matches,
-                                         * the line number is only sent once.
-                                         */
     LineType gp_highest_line;        /*< The highest numbered line processed
-                                         * by the grep child process.  This
-                                         * value is used when the start line
-                                         * for a queued request is -1.
+                                         * by the search.  This value is used
+                                         * when the start line for a queued
+                                         * request is -1.
                                          */
     grep_proc_sink<LineType> *gp_sink{nullptr};         /*< The sink delegate. */
     grep_proc_control *gp_control{nullptr};      /*< The control delegate. */
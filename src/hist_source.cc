@@ -29,6 +29,8 @@
 
 #include "config.h"
 
+#include <algorithm>
+
 #include "lnav_util.hh"
 #include "hist_source.hh"
 
@@ -38,30 +40,136 @@ const char *hist_source2::LINE_FORMAT = " %8d normal  %8d errors  %8d warnings
 
 int hist_source2::row_for_time(struct timeval tv_bucket)
 {
-    std::map<int64_t, struct bucket_block>::iterator iter;
-    int retval = 0;
+    const auto &buckets = this->current_level().hl_buckets;
     time_t time_bucket = rounddown(tv_bucket.tv_sec, this->hs_time_slice);
+    auto iter = lower_bound(buckets.begin(), buckets.end(), time_bucket,
+                            [](const bucket_t &lhs, time_t rhs) {
+                                return lhs.b_time < rhs;
+                            });
+
+    return distance(buckets.begin(), iter);
+}
+
+void hist_source2::add_late_value(time_t row, hist_type_t htype, double value)
+{
+    auto &late = this->hs_late_values;
 
-    for (iter = this->hs_blocks.begin();
-         iter != this->hs_blocks.end();
-         ++iter) {
-        struct bucket_block &bb = iter->second;
+    if (late.empty() || late.back().b_time != row) {
+        late.emplace_back();
+        late.back().b_time = row;
+    }
+    late.back().b_values[htype].hv_value += value;
+}
 
-        if (time_bucket < bb.bb_buckets[0].b_time) {
-            break;
+void hist_source2::merge_late_values()
+{
+    auto &late = this->hs_late_values;
+
+    if (late.empty()) {
+        return;
+    }
+
+    stable_sort(late.begin(), late.end(),
+                [](const bucket_t &lhs, const bucket_t &rhs) {
+                    return lhs.b_time < rhs.b_time;
+                });
+
+    vector<bucket_t> merged;
+    auto base_iter = this->hs_base.cbegin();
+    auto late_iter = late.cbegin();
+
+    merged.reserve(this->hs_base.size() + late.size());
+    while (base_iter != this->hs_base.cend() || late_iter != late.cend()) {
+        const bucket_t *next;
+
+        if (late_iter == late.cend() ||
+            (base_iter != this->hs_base.cend() &&
+             base_iter->b_time <= late_iter->b_time)) {
+            next = &(*base_iter++);
+        }
+        else {
+            next = &(*late_iter++);
         }
-        if (time_bucket > bb.bb_buckets[bb.bb_used].b_time) {
-            retval += bb.bb_used + 1;
+
+        if (merged.empty() || merged.back().b_time != next->b_time) {
+            merged.push_back(*next);
             continue;
         }
+        for (int lpc = 0; lpc < HT__MAX; lpc++) {
+            merged.back().b_values[lpc].hv_value +=
+                next->b_values[lpc].hv_value;
+        }
+    }
+    this->hs_base.swap(merged);
+    late.clear();
+
+    // The levels only merge the tail of the base buckets when updating, so
+    // they need to be merged from the start again.
+    this->hs_levels.clear();
+    this->hs_chart_slice = -1;
+    this->hs_base_updates += 1;
+}
+
+hist_source2::hist_level &hist_source2::current_level()
+{
+    require(this->hs_time_slice % BASE_TIME_SLICE == 0);
+
+    this->merge_late_values();
+
+    hist_level &hl = this->hs_levels[this->hs_time_slice];
+
+    if (hl.hl_updates != this->hs_base_updates) {
+        auto &buckets = hl.hl_buckets;
+        size_t base_index = 0;
+
+        // The last bucket might still have been filling up, so merge it
+        // again along with any new base buckets.
+        if (!buckets.empty()) {
+            buckets.pop_back();
+            base_index = hl.hl_last_start;
+        }
+
+        size_t first_new = buckets.size();
+
+        for (; base_index < this->hs_base.size(); base_index++) {
+            const bucket_t &base_bucket = this->hs_base[base_index];
+            time_t row = rounddown(base_bucket.b_time, this->hs_time_slice);
 
-        for (unsigned int lpc = 0; lpc <= bb.bb_used; lpc++, retval++) {
-            if (time_bucket <= bb.bb_buckets[lpc].b_time) {
-                return retval;
+            if (buckets.empty() || buckets.back().b_time != row) {
+                buckets.emplace_back();
+                buckets.back().b_time = row;
+                hl.hl_last_start = base_index;
+            }
+            for (int lpc = 0; lpc < HT__MAX; lpc++) {
+                buckets.back().b_values[lpc].hv_value +=
+                    base_bucket.b_values[lpc].hv_value;
+            }
+        }
+        hl.hl_updates = this->hs_base_updates;
+
+        if (this->hs_chart_slice == this->hs_time_slice) {
+            for (size_t index = first_new; index < buckets.size(); index++) {
+                for (int lpc = 0; lpc < HT__MAX; lpc++) {
+                    this->hs_chart.add_value(
+                        (const hist_type_t) lpc,
+                        buckets[index].b_values[lpc].hv_value);
+                }
             }
         }
     }
-    return retval;
+
+    if (this->hs_chart_slice != this->hs_time_slice) {
+        this->hs_chart.clear_stats();
+        for (const auto &bucket : hl.hl_buckets) {
+            for (int lpc = 0; lpc < HT__MAX; lpc++) {
+                this->hs_chart.add_value((const hist_type_t) lpc,
+                                         bucket.b_values[lpc].hv_value);
+            }
+        }
+        this->hs_chart_slice = this->hs_time_slice;
+    }
+
+    return hl;
 }
 
 void hist_source2::text_value_for_line(textview_curses &tc, int row,
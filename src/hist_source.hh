@@ -242,6 +242,13 @@ public:
         this->sbc_show_state = show_all();
     };
 
+    /** Reset the statistics for the idents, but keep their attributes. */
+    void clear_stats() {
+        for (auto &ci : this->sbc_idents) {
+            ci.ci_stats = bucket_stats_t();
+        }
+    };
+
     void add_value(const T &ident, double amount = 1.0) {
         struct chart_ident &ci = this->find_ident(ident);
         ci.ci_stats.update(amount);
@@ -330,6 +337,13 @@ public:
         this->clear();
     };
 
+    /**
+     * The counts are kept in buckets of this many seconds as they are
+     * added.  The buckets for the time slice being displayed are merged
+     * from these, so the slice needs to be a multiple of this value.
+     */
+    static const int64_t BASE_TIME_SLICE = 1;
+
     void init() {
         view_colors &vc = view_colors::singleton();
 
@@ -353,7 +367,7 @@ public:
     };
 
     size_t text_line_count() {
-        return this->hs_line_count;
+        return this->current_level().hl_buckets.size();
     };
 
     size_t text_line_width(textview_curses &curses) {
@@ -361,40 +375,31 @@ public:
     };
 
     void clear() {
-        this->hs_line_count = 0;
-        this->hs_last_bucket = -1;
         this->hs_last_row = -1;
-        this->hs_blocks.clear();
+        this->hs_base_updates = 0;
+        this->hs_base.clear();
+        this->hs_late_values.clear();
+        this->hs_levels.clear();
+        this->hs_chart_slice = -1;
         this->hs_chart.clear();
         this->init();
     };
 
     void add_value(time_t row, hist_type_t htype, double value = 1.0) {
-        require(row >= this->hs_last_row);
+        row = rounddown(row, BASE_TIME_SLICE);
+        if (row < this->hs_last_row) {
+            this->add_late_value(row, htype, value);
+            return;
+        }
 
-        row = rounddown(row, this->hs_time_slice);
         if (row != this->hs_last_row) {
-            this->end_of_row();
-
-            this->hs_last_bucket += 1;
+            this->hs_base.emplace_back();
+            this->hs_base.back().b_time = row;
             this->hs_last_row = row;
         }
 
-        bucket_t &bucket = this->find_bucket(this->hs_last_bucket);
-        bucket.b_time = row;
-        bucket.b_values[htype].hv_value += value;
-    };
-
-    void end_of_row() {
-        if (this->hs_last_bucket >= 0) {
-            bucket_t &last_bucket = this->find_bucket(this->hs_last_bucket);
-
-            for (int lpc = 0; lpc < HT__MAX; lpc++) {
-                this->hs_chart.add_value(
-                        (const hist_type_t) lpc,
-                        last_bucket.b_values[lpc].hv_value);
-            }
-        }
+        this->hs_base.back().b_values[htype].hv_value += value;
+        this->hs_base_updates += 1;
     };
 
     void text_value_for_line(textview_curses &tc,
@@ -412,7 +417,7 @@ public:
 
     struct timeval time_for_row(int row) {
         require(row >= 0);
-        require(row < this->hs_line_count);
+        require(row < (int) this->text_line_count());
 
         bucket_t &bucket = this->find_bucket(row);
 
@@ -433,30 +438,43 @@ private:
         hist_value b_values[HT__MAX];
     };
 
-    static const int64_t BLOCK_SIZE = 100;
+    /** The buckets for a time slice, merged from the base buckets. */
+    struct hist_level {
+        std::vector<bucket_t> hl_buckets;
+        /** The index of the first base bucket in the last bucket. */
+        size_t hl_last_start{0};
+        /** The value of hs_base_updates when the level was last merged. */
+        uint64_t hl_updates{0};
+    };
 
-    struct bucket_block {
-        bucket_block() : bb_used(0) {
-            memset(this->bb_buckets, 0, sizeof(this->bb_buckets));
-        };
+    /**
+     * Add a value that is older than the last one, which happens when late
+     * lines are merged into the log index.  The value is held until the
+     * buckets are needed so that a batch of late values only has to be
+     * merged into the base buckets once.
+     */
+    void add_late_value(time_t row, hist_type_t htype, double value);
 
-        unsigned int bb_used;
-        bucket_t bb_buckets[BLOCK_SIZE];
-    };
+    /** Merge any pending late values into the base buckets. */
+    void merge_late_values();
+
+    hist_level &current_level();
 
     bucket_t &find_bucket(int64_t index) {
-        struct bucket_block &bb = this->hs_blocks[index / BLOCK_SIZE];
-        unsigned int intra_block_index = index % BLOCK_SIZE;
-        bb.bb_used = std::max(intra_block_index, bb.bb_used);
-        this->hs_line_count = std::max(this->hs_line_count, index + 1);
-        return bb.bb_buckets[intra_block_index];
+        return this->current_level().hl_buckets[index];
     };
 
     int64_t hs_time_slice;
-    int64_t hs_line_count;
-    int64_t hs_last_bucket;
     time_t hs_last_row;
-    std::map<int64_t, struct bucket_block> hs_blocks;
+    /** Incremented for every value that is added to the base buckets. */
+    uint64_t hs_base_updates;
+    /** The buckets of BASE_TIME_SLICE seconds that the values are added to. */
+    std::vector<bucket_t> hs_base;
+    /** The values added by add_late_value() that have not been merged. */
+    std::vector<bucket_t> hs_late_values;
+    std::map<int64_t, hist_level> hs_levels;
+    /** The time slice of the level whose values are in the chart stats. */
+    int64_t hs_chart_slice;
     stacked_bar_chart<hist_type_t> hs_chart;
 };
 
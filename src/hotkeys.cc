@@ -631,7 +631,7 @@ void handle_paging_key(int ch)
                     alerter::singleton().chime();
                     lnav_data.ld_rl_view->set_value("Log message does not contain an opid");
                 } else {
-                    unsigned int opid_hash = start_line.get_opid();
+                    uint32_t opid_hash = start_line.get_opid();
                     logline_helper next_helper(*lss);
                     bool found = false;
 
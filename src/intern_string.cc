@@ -31,12 +31,53 @@
 
 #include "config.h"
 
+#include <stdlib.h>
 #include <string.h>
 
+#include <atomic>
+#include <new>
+#include <vector>
+
+#include "base/pthreadpp.hh"
 #include "intern_string.hh"
 
-const static int TABLE_SIZE = 4095;
-static intern_string *TABLE[TABLE_SIZE];
+/**
+ * The interned strings are kept in an open-addressed table with linear
+ * probing.  Lookups of strings that are already in the table do not take
+ * the lock: they probe whichever table is current and only fall back to
+ * the locked path on a miss.  Entries are never removed, so a slot only
+ * goes from empty to full, and a table that has been replaced by a larger
+ * one is never modified again.  The replaced tables are kept around since
+ * another thread might still be probing them, they add up to less than
+ * the size of the current table.
+ */
+struct intern_table {
+    explicit intern_table(size_t capacity)
+        : it_mask(capacity - 1),
+          it_slots(new std::atomic<const intern_string *>[capacity]()) {
+    };
+
+    size_t capacity() const {
+        return this->it_mask + 1;
+    };
+
+    const size_t it_mask;
+    size_t it_count{0};
+    size_t it_max_probe{0};
+    std::atomic<const intern_string *> *it_slots;
+};
+
+static const size_t INITIAL_CAPACITY = 4096;
+static const size_t ARENA_CHUNK_SIZE = 64 * 1024;
+
+static std::atomic<intern_table *> CURRENT_TABLE{nullptr};
+static pthread_mutex_t TABLE_MUTEX = PTHREAD_MUTEX_INITIALIZER;
+
+static char *ARENA_NEXT = nullptr;
+static size_t ARENA_LEFT = 0;
+static size_t ARENA_BYTES = 0;
+static size_t ARENA_USED = 0;
+static std::vector<intern_table *> *RETIRED_TABLES = nullptr;
 
 unsigned long
 hash_str(const char *str, size_t len)
@@ -51,32 +92,201 @@ hash_str(const char *str, size_t len)
     return retval;
 }
 
+static inline uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+/**
+ * A hash for the table that consumes eight bytes at a time.  The strings
+ * are mostly short field names, so there is no attempt at being clever
+ * with longer inputs.
+ */
+static uint64_t hash_intern(const char *str, size_t len)
+{
+    const uint64_t MULT = 0x9e3779b97f4a7c15ULL;
+    uint64_t h = len * MULT;
+
+    while (len >= 8) {
+        uint64_t word;
+
+        memcpy(&word, str, sizeof(word));
+        h = (h ^ mix64(word)) * MULT;
+        str += 8;
+        len -= 8;
+    }
+    if (len > 0) {
+        uint64_t word = 0;
+
+        memcpy(&word, str, len);
+        h = (h ^ mix64(word)) * MULT;
+    }
+
+    return mix64(h);
+}
+
+/**
+ * Carve out memory for a string from the arena.  Must be called with the
+ * table lock held.
+ */
+static void *arena_alloc(size_t size)
+{
+    const size_t align = alignof(intern_string);
+
+    size = (size + align - 1) & ~(align - 1);
+
+    ARENA_USED += size;
+    if (size > ARENA_CHUNK_SIZE / 4) {
+        ARENA_BYTES += size;
+        return malloc(size);
+    }
+
+    if (size > ARENA_LEFT) {
+        ARENA_NEXT = (char *) malloc(ARENA_CHUNK_SIZE);
+        ARENA_LEFT = ARENA_CHUNK_SIZE;
+        ARENA_BYTES += ARENA_CHUNK_SIZE;
+    }
+
+    void *retval = ARENA_NEXT;
+
+    ARENA_NEXT += size;
+    ARENA_LEFT -= size;
+
+    return retval;
+}
+
+static void table_insert(intern_table *table, const intern_string *is)
+{
+    size_t index = is->hash() & table->it_mask;
+    size_t probe = 0;
+
+    while (table->it_slots[index].load(std::memory_order_relaxed) != nullptr) {
+        index = (index + 1) & table->it_mask;
+        probe += 1;
+    }
+    table->it_slots[index].store(is, std::memory_order_release);
+    table->it_count += 1;
+    if (probe > table->it_max_probe) {
+        table->it_max_probe = probe;
+    }
+}
+
+/**
+ * Double the size of the table when it is more than 70% full.  Must be
+ * called with the table lock held.
+ */
+static intern_table *table_ensure_space(intern_table *table)
+{
+    if (table == nullptr) {
+        table = new intern_table(INITIAL_CAPACITY);
+        CURRENT_TABLE.store(table, std::memory_order_release);
+        return table;
+    }
+
+    if ((table->it_count + 1) * 10 <= table->capacity() * 7) {
+        return table;
+    }
+
+    auto *bigger = new intern_table(table->capacity() * 2);
+
+    for (size_t lpc = 0; lpc < table->capacity(); lpc++) {
+        const intern_string *is =
+            table->it_slots[lpc].load(std::memory_order_relaxed);
+
+        if (is != nullptr) {
+            table_insert(bigger, is);
+        }
+    }
+    CURRENT_TABLE.store(bigger, std::memory_order_release);
+    if (RETIRED_TABLES == nullptr) {
+        RETIRED_TABLES = new std::vector<intern_table *>();
+    }
+    RETIRED_TABLES->push_back(table);
+
+    return bigger;
+}
+
+static const intern_string *table_find(const intern_table *table,
+                                       uint64_t h,
+                                       const char *str,
+                                       size_t len)
+{
+    size_t index = h & table->it_mask;
+
+    while (true) {
+        const intern_string *curr =
+            table->it_slots[index].load(std::memory_order_acquire);
+
+        if (curr == nullptr) {
+            return nullptr;
+        }
+        if (curr->hash() == h && curr->size() == len &&
+            memcmp(curr->get(), str, len) == 0) {
+            return curr;
+        }
+        index = (index + 1) & table->it_mask;
+    }
+}
+
 const intern_string *intern_string::lookup(const char *str, ssize_t len)
 {
-    unsigned long h;
-    intern_string *curr;
+    const intern_string *retval;
+    intern_table *table;
+    uint64_t h;
 
     if (len == -1) {
         len = strlen(str);
     }
-    h = hash_str(str, len) % TABLE_SIZE;
+    h = hash_intern(str, len);
 
-    curr = TABLE[h];
-    while (curr != NULL) {
-        if (curr->is_len == len && strncmp(curr->is_str, str, len) == 0) {
-            return curr;
-        }
-        curr = curr->is_next;
+    table = CURRENT_TABLE.load(std::memory_order_acquire);
+    if (table != nullptr &&
+        (retval = table_find(table, h, str, len)) != nullptr) {
+        return retval;
+    }
+
+    mutex_guard mg(TABLE_MUTEX);
+
+    table = CURRENT_TABLE.load(std::memory_order_relaxed);
+    if (table != nullptr &&
+        (retval = table_find(table, h, str, len)) != nullptr) {
+        return retval;
     }
 
-    char *strcp = new char[len + 1];
+    table = table_ensure_space(table);
+
+    char *mem = (char *) arena_alloc(sizeof(intern_string) + len + 1);
+    char *strcp = mem + sizeof(intern_string);
+
     memcpy(strcp, str, len);
     strcp[len] = '\0';
-    curr = new intern_string(strcp, len);
-    curr->is_next = TABLE[h];
-    TABLE[h] = curr;
+    retval = new (mem) intern_string(strcp, len, h);
+    table_insert(table, retval);
+
+    return retval;
+}
 
-    return curr;
+intern_string::table_stats intern_string::get_table_stats()
+{
+    mutex_guard mg(TABLE_MUTEX);
+    intern_table *table = CURRENT_TABLE.load(std::memory_order_relaxed);
+    table_stats retval;
+
+    if (table != nullptr) {
+        retval.ts_count = table->it_count;
+        retval.ts_capacity = table->capacity();
+        retval.ts_max_probe = table->it_max_probe;
+    }
+    retval.ts_arena_bytes = ARENA_BYTES;
+    retval.ts_arena_used = ARENA_USED;
+
+    return retval;
 }
 
 const intern_string *intern_string::lookup(const string_fragment &sf)
@@ -32,6 +32,7 @@
 #ifndef __intern_string_hh
 #define __intern_string_hh
 
+#include <stdint.h>
 #include <string.h>
 #include <sys/types.h>
 
@@ -151,6 +152,22 @@ inline bool operator<(const string_fragment &left, const char *right) {
 class intern_string {
 
 public:
+    /**
+     * Statistics about the table of interned strings.
+     */
+    struct table_stats {
+        /** The number of strings in the table. */
+        size_t ts_count{0};
+        /** The number of slots in the table. */
+        size_t ts_capacity{0};
+        /** The longest distance from a string's home slot. */
+        size_t ts_max_probe{0};
+        /** The bytes allocated for holding the strings. */
+        size_t ts_arena_bytes{0};
+        /** The bytes that have been handed out of the allocation. */
+        size_t ts_arena_used{0};
+    };
+
     static const intern_string *lookup(const char *str, ssize_t len);
 
     static const intern_string *lookup(const string_fragment &sf);
@@ -180,13 +197,19 @@ public:
         return *prefix == '\0';
     }
 
+    uint64_t hash() const {
+        return this->is_hash;
+    }
+
+    static table_stats get_table_stats();
+
 private:
-    intern_string(const char *str, ssize_t len)
-            : is_next(nullptr), is_str(str), is_len(len) {
+    intern_string(const char *str, ssize_t len, uint64_t hash)
+            : is_hash(hash), is_str(str), is_len(len) {
 
     }
 
-    intern_string *is_next;
+    uint64_t is_hash;
     const char *is_str;
     ssize_t is_len;
 };
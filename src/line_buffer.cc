@@ -35,90 +35,1469 @@
 #include <errno.h>
 #include <string.h>
 #include <fcntl.h>
+#include <signal.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #ifdef HAVE_BZLIB_H
 #include <bzlib.h>
 #endif
 
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_LZMA_H
+#include <lzma.h>
+#endif
+
 #include <set>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+
+#include "base/parallel_for.hh"
+#include "base/utf8_scan.hh"
+#include "lnav_util.hh"
+#include "line_buffer.hh"
+#include "fmtlib/fmt/format.h"
+
+using namespace std;
+
+static const ssize_t DEFAULT_INCREMENT          = 128 * 1024;
+static const ssize_t MAX_COMPRESSED_BUFFER_SIZE = 32 * 1024 * 1024;
+
+/** The minimum amount of address space to reserve when mapping a file. */
+static const size_t MIN_MAP_SIZE = 16 * 1024 * 1024;
+/** The maximum number of file mappings that can be live at once. */
+static const size_t MAX_MAPPINGS = 512;
+
+/** The minimum amount of data to decompress when filling the buffer. */
+static const ssize_t COMPRESSED_FILL_SIZE = 1024 * 1024;
+/** The amount of compressed data to read from a gzip file at a time. */
+static const size_t GZ_INPUT_SIZE = 64 * 1024;
+/** Inflate a raw deflate stream, which is used when resuming at a checkpoint. */
+static const int GZ_RAW_WINDOW_BITS = -15;
+/** Inflate a gzip stream, including the header. */
+static const int GZ_HEADER_WINDOW_BITS = 15 + 16;
+/** The size of the gzip trailer that follows a deflate stream. */
+static const off_t GZ_TRAILER_SIZE = 8;
+/** The largest block that is decoded into memory instead of streamed. */
+static const off_t MAX_DECODED_BLOCK_SIZE = 32 * 1024 * 1024;
+/** The amount of decoded block data to keep around. */
+static const size_t MAX_BLOCK_CACHE_SIZE = 128 * 1024 * 1024;
+/** The amount of compressed data to feed a block decoder at a time. */
+static const size_t BLOCK_INPUT_SIZE = 64 * 1024;
+/** The amount of a bzip2 file to read at a time when looking for blocks. */
+static const size_t BZ_SCAN_SIZE = 1024 * 1024;
+/** The bit pattern at the start of a bzip2 block (BCD pi). */
+static const uint64_t BZ_BLOCK_MAGIC = 0x314159265359ULL;
+/** The bit pattern at the end of a bzip2 stream (BCD sqrt(pi)). */
+static const uint64_t BZ_EOS_MAGIC = 0x177245385090ULL;
+static const uint64_t BZ_MAGIC_MASK = (1ULL << 48) - 1;
+static const int BZ_MAGIC_BITS = 48;
+/** The magic number at the end of a zstd seekable format seek table. */
+static const uint32_t ZSTD_SEEKABLE_MAGIC = 0x8F92EAB1;
+/** The number of frames, descriptor, and magic at the end of a seek table. */
+static const off_t ZSTD_SEEK_TABLE_FOOTER_SIZE = 9;
+static const off_t ZSTD_SKIPPABLE_HEADER_SIZE = 8;
+static const off_t ZSTD_BLOCK_HEADER_SIZE = 3;
+static const off_t ZSTD_CHECKSUM_SIZE = 4;
+
+
+line_buffer::gz_indexed::gz_indexed(int fd)
+    : gi_fd(fd),
+      gi_raw(false),
+      gi_inbuf(new unsigned char[GZ_INPUT_SIZE])
+{
+    memset(&this->gi_stream, 0, sizeof(this->gi_stream));
+    this->init_stream(GZ_HEADER_WINDOW_BITS);
+}
+
+line_buffer::gz_indexed::~gz_indexed()
+{
+    inflateEnd(&this->gi_stream);
+}
+
+void line_buffer::gz_indexed::init_stream(int window_bits)
+{
+    inflateEnd(&this->gi_stream);
+    memset(&this->gi_stream, 0, sizeof(this->gi_stream));
+    switch (inflateInit2(&this->gi_stream, window_bits)) {
+        case Z_OK:
+            break;
+        case Z_MEM_ERROR:
+            throw bad_alloc();
+        default:
+            throw error(EINVAL);
+    }
+    this->gi_raw = window_bits < 0;
+}
+
+void line_buffer::gz_indexed::add_checkpoint(const unsigned char *out_end)
+{
+    checkpoint cp;
+
+    cp.c_out = this->gi_stream.total_out;
+    cp.c_in = this->gi_stream.total_in;
+    cp.c_bits = this->gi_stream.data_type & 7;
+    cp.c_bit_value = 0;
+    if (cp.c_bits) {
+        unsigned char last_byte;
+
+        // The current block starts in the middle of the previous byte, so
+        // we need to hang on to the bits that haven't been used yet.
+        if (this->gi_stream.next_in > this->gi_inbuf.get()) {
+            last_byte = this->gi_stream.next_in[-1];
+        }
+        else if (pread(this->gi_fd, &last_byte, 1, cp.c_in - 1) != 1) {
+            return;
+        }
+        cp.c_bit_value = last_byte >> (8 - cp.c_bits);
+    }
+    cp.c_window.reset(new unsigned char[WINDOW_SIZE]);
+    memcpy(cp.c_window.get(), out_end - WINDOW_SIZE, WINDOW_SIZE);
+
+    this->gi_checkpoints.emplace_back(std::move(cp));
+}
+
+void line_buffer::gz_indexed::restore_checkpoint(const checkpoint &cp)
+{
+    this->init_stream(GZ_RAW_WINDOW_BITS);
+    if (cp.c_bits) {
+        inflatePrime(&this->gi_stream, cp.c_bits, cp.c_bit_value);
+    }
+    inflateSetDictionary(&this->gi_stream, cp.c_window.get(), WINDOW_SIZE);
+    this->gi_stream.total_in = cp.c_in;
+    this->gi_stream.total_out = cp.c_out;
+}
+
+void line_buffer::gz_indexed::seek(off_t offset)
+{
+    off_t curr_offset = this->gi_stream.total_out;
+
+    if (offset == curr_offset) {
+        return;
+    }
+
+    auto iter = upper_bound(this->gi_checkpoints.begin(),
+                            this->gi_checkpoints.end(),
+                            offset,
+                            [](off_t off, const checkpoint &cp) {
+                                return off < cp.c_out;
+                            });
+    const checkpoint *cp = nullptr;
+
+    if (iter != this->gi_checkpoints.begin()) {
+        cp = &(*(iter - 1));
+    }
+
+    // Only go back to a checkpoint if it gets us closer than where we are.
+    if (offset < curr_offset || (cp != nullptr && cp->c_out > curr_offset)) {
+        if (cp != nullptr) {
+            this->restore_checkpoint(*cp);
+        }
+        else {
+            this->init_stream(GZ_HEADER_WINDOW_BITS);
+        }
+    }
+
+    // Decompress up to the requested offset, the scratch buffer needs to be
+    // big enough to record checkpoints as we go.
+    std::unique_ptr<char[]> scratch(new char[WINDOW_SIZE * 4]);
+
+    while ((off_t) this->gi_stream.total_out < offset) {
+        size_t amount = std::min((off_t) WINDOW_SIZE * 4,
+                                 offset - (off_t) this->gi_stream.total_out);
+
+        if (this->read(scratch.get(), amount) <= 0) {
+            break;
+        }
+    }
+}
+
+ssize_t line_buffer::gz_indexed::read(char *buf, size_t size)
+{
+    z_stream &strm = this->gi_stream;
+    off_t last_checkpoint = this->gi_checkpoints.empty() ?
+                            0 : this->gi_checkpoints.back().c_out;
+
+    strm.next_out = (unsigned char *) buf;
+    strm.avail_out = size;
+    while (strm.avail_out > 0) {
+        if (strm.avail_in == 0) {
+            ssize_t rc = pread(this->gi_fd,
+                               this->gi_inbuf.get(),
+                               GZ_INPUT_SIZE,
+                               strm.total_in);
+
+            if (rc == -1) {
+                return -1;
+            }
+            if (rc == 0) {
+                break;
+            }
+            strm.next_in = this->gi_inbuf.get();
+            strm.avail_in = rc;
+        }
+
+        // Stop at block boundaries when it's time for another checkpoint.
+        bool want_checkpoint =
+            (off_t) strm.total_out >= last_checkpoint + CHECKPOINT_INTERVAL;
+        int rc = inflate(&strm, want_checkpoint ? Z_BLOCK : Z_NO_FLUSH);
+
+        if (rc == Z_STREAM_END) {
+            // A gzip file can contain several members, so start over with a
+            // fresh stream at the next one.
+            uLong total_in = strm.total_in;
+            uLong total_out = strm.total_out;
+            unsigned char *next_out = strm.next_out;
+            uInt avail_out = strm.avail_out;
+
+            if (this->gi_raw) {
+                // A raw inflate does not consume the gzip trailer.
+                total_in += GZ_TRAILER_SIZE;
+            }
+            this->init_stream(GZ_HEADER_WINDOW_BITS);
+            strm.total_in = total_in;
+            strm.total_out = total_out;
+            strm.next_out = next_out;
+            strm.avail_out = avail_out;
+            continue;
+        }
+        if (rc != Z_OK) {
+            if (rc != Z_BUF_ERROR) {
+                log_error("inflate failed at offset %lu -- %d %s",
+                          strm.total_in,
+                          rc,
+                          strm.msg != nullptr ? strm.msg : "");
+            }
+            break;
+        }
+
+        if (want_checkpoint &&
+            (strm.data_type & 128) &&
+            !(strm.data_type & 64) &&
+            strm.next_out - (unsigned char *) buf >= (ssize_t) WINDOW_SIZE) {
+            this->add_checkpoint(strm.next_out);
+            last_checkpoint = strm.total_out;
+        }
+    }
+
+    return size - strm.avail_out;
+}
+
+line_buffer::block_indexed::block_indexed(int fd)
+    : bi_fd(fd)
+{
+}
+
+line_buffer::block_indexed::decode_result_t
+line_buffer::block_indexed::decode_block(size_t index,
+                                         std::vector<char> &out) const
+{
+    const block &blk = this->bi_blocks[index];
+
+    if (blk.b_out_size > MAX_DECODED_BLOCK_SIZE) {
+        return DR_TOO_BIG;
+    }
+
+    auto decoder = this->open_block(index);
+
+    if (decoder == nullptr) {
+        return DR_ERROR;
+    }
+
+    size_t produced = 0;
+
+    // Leave room for one more byte so the end of the block can be seen
+    // without having to grow the buffer.
+    out.resize(blk.b_out_size >= 0 ? blk.b_out_size + 1 : BLOCK_INPUT_SIZE * 4);
+    while (true) {
+        if (produced == out.size()) {
+            if ((off_t) out.size() >= MAX_DECODED_BLOCK_SIZE) {
+                return DR_TOO_BIG;
+            }
+            out.resize(std::min((off_t) out.size() * 2,
+                                MAX_DECODED_BLOCK_SIZE));
+        }
+
+        ssize_t rc = decoder->read(&out[produced], out.size() - produced);
+
+        if (rc < 0) {
+            return DR_ERROR;
+        }
+        if (rc == 0) {
+            break;
+        }
+        produced += rc;
+    }
+    out.resize(produced);
+
+    return DR_OK;
+}
+
+size_t line_buffer::block_indexed::get_worker_count() const
+{
+    if (this->bi_max_workers == 0) {
+        return parallel_worker_count();
+    }
+
+    return this->bi_max_workers;
+}
+
+bool line_buffer::block_indexed::decode_blocks(size_t first, size_t max_count)
+{
+    std::vector<size_t> indexes;
+
+    for (size_t index = first;
+         index < this->bi_blocks.size() && indexes.size() < max_count;
+         index++) {
+        if (this->bi_blocks[index].b_streamed ||
+            this->bi_cache.find(index) != this->bi_cache.end()) {
+            break;
+        }
+        indexes.push_back(index);
+    }
+
+    if (indexes.empty()) {
+        return true;
+    }
+
+    std::vector<std::vector<char>> results(indexes.size());
+    std::vector<decode_result_t> status(indexes.size());
+
+    parallel_for(indexes.size(), [&](size_t lpc) {
+        status[lpc] = this->decode_block(indexes[lpc], results[lpc]);
+    }, this->bi_max_workers);
+
+    bool retval = true;
+
+    for (size_t lpc = 0; lpc < indexes.size(); lpc++) {
+        block &blk = this->bi_blocks[indexes[lpc]];
+
+        switch (status[lpc]) {
+            case DR_OK:
+                if (blk.b_out_size == -1) {
+                    blk.b_out_size = results[lpc].size();
+                }
+                this->add_to_cache(indexes[lpc], std::move(results[lpc]));
+                break;
+            case DR_TOO_BIG:
+                blk.b_streamed = true;
+                break;
+            case DR_ERROR:
+                if (lpc == 0) {
+                    retval = false;
+                }
+                break;
+        }
+    }
+
+    return retval;
+}
+
+void line_buffer::block_indexed::add_located(size_t index)
+{
+    const block &blk = this->bi_blocks[index];
+
+    this->bi_located_size += blk.b_out_size;
+    this->bi_located_count += 1;
+    this->bi_located_in_offset = this->get_file_offset(blk.b_in_end);
+}
+
+bool line_buffer::block_indexed::locate(off_t offset, size_t &index_out)
+{
+    while (offset >= this->bi_located_size) {
+        if (this->bi_located_count == this->bi_blocks.size()) {
+            this->scan_blocks();
+            if (this->bi_located_count == this->bi_blocks.size()) {
+                return false;
+            }
+        }
+
+        size_t index = this->bi_located_count;
+
+        this->bi_blocks[index].b_out_offset = this->bi_located_size;
+        if (this->bi_blocks[index].b_out_size == -1 &&
+            !this->bi_blocks[index].b_streamed &&
+            !this->decode_blocks(index, this->get_worker_count())) {
+            if (this->recover_block(index)) {
+                // The blocks after this one might have been renumbered.
+                for (auto iter = this->bi_cache.lower_bound(index);
+                     iter != this->bi_cache.end();
+                     iter = this->bi_cache.erase(iter)) {
+                    this->bi_cache_size -= iter->second.size();
+                }
+                continue;
+            }
+            log_error("unable to decode compressed block at %lld",
+                      (long long) this->get_file_offset(
+                          this->bi_blocks[index].b_in_start));
+            return false;
+        }
+        if (this->bi_blocks[index].b_out_size == -1) {
+            // The size of a streamed block is only known once the end of
+            // it has been reached.
+            index_out = index;
+            return true;
+        }
+        this->add_located(index);
+    }
+
+    auto located_end = this->bi_blocks.begin() + this->bi_located_count;
+    auto iter = upper_bound(this->bi_blocks.begin(),
+                            located_end,
+                            offset,
+                            [](off_t off, const block &blk) {
+                                return off < blk.b_out_offset;
+                            });
+
+    index_out = (iter - this->bi_blocks.begin()) - 1;
+
+    return true;
+}
+
+void line_buffer::block_indexed::add_to_cache(size_t index,
+                                              std::vector<char> &&data)
+{
+    this->bi_cache_size += data.size();
+    this->bi_cache[index] = std::move(data);
+
+    // Evict the blocks that are furthest from this one.
+    while (this->bi_cache_size > MAX_BLOCK_CACHE_SIZE &&
+           this->bi_cache.size() > 1) {
+        auto first = this->bi_cache.begin();
+        auto last = std::prev(this->bi_cache.end());
+        size_t first_distance = index > first->first ?
+                                index - first->first : first->first - index;
+        size_t last_distance = index > last->first ?
+                               index - last->first : last->first - index;
+        auto victim = first_distance > last_distance ? first : last;
+
+        this->bi_cache_size -= victim->second.size();
+        this->bi_cache.erase(victim);
+    }
+}
+
+const std::vector<char> *line_buffer::block_indexed::get_block_data(
+    size_t index)
+{
+    auto iter = this->bi_cache.find(index);
+
+    if (iter == this->bi_cache.end()) {
+        // When reading through the file, decode the blocks that come next
+        // while we're at it.
+        size_t count = index == this->bi_last_index + 1 ?
+                       this->get_worker_count() : 1;
+
+        this->decode_blocks(index, count);
+        iter = this->bi_cache.find(index);
+    }
+    this->bi_last_index = index;
+
+    if (iter == this->bi_cache.end()) {
+        return nullptr;
+    }
+
+    return &iter->second;
+}
+
+ssize_t line_buffer::block_indexed::read_streamed(size_t index,
+                                                  off_t block_offset,
+                                                  char *buf,
+                                                  size_t size)
+{
+    if (this->bi_stream == nullptr ||
+        this->bi_stream_index != index ||
+        this->bi_stream_offset > block_offset) {
+        this->bi_stream = this->open_block(index);
+        this->bi_stream_index = index;
+        this->bi_stream_offset = 0;
+        if (this->bi_stream == nullptr) {
+            return -1;
+        }
+    }
+
+    std::unique_ptr<char[]> scratch;
+    ssize_t rc = 0;
+
+    while (this->bi_stream_offset < block_offset) {
+        if (scratch == nullptr) {
+            scratch.reset(new char[BLOCK_INPUT_SIZE]);
+        }
+        rc = this->bi_stream->read(
+            scratch.get(),
+            std::min((off_t) BLOCK_INPUT_SIZE,
+                     block_offset - this->bi_stream_offset));
+        if (rc <= 0) {
+            break;
+        }
+        this->bi_stream_offset += rc;
+    }
+    if (this->bi_stream_offset == block_offset) {
+        rc = this->bi_stream->read(buf, size);
+        if (rc > 0) {
+            this->bi_stream_offset += rc;
+        }
+    }
+    if (rc < 0) {
+        this->bi_stream.reset();
+    }
+
+    return rc;
+}
+
+ssize_t line_buffer::block_indexed::read(off_t offset, char *buf, size_t size)
+{
+    size_t retval = 0;
+
+    while (retval < size) {
+        off_t curr_offset = offset + retval;
+        size_t index;
+
+        if (!this->locate(curr_offset, index)) {
+            break;
+        }
+
+        off_t block_offset = curr_offset - this->bi_blocks[index].b_out_offset;
+        ssize_t rc;
+
+        if (this->bi_blocks[index].b_streamed) {
+            rc = this->read_streamed(index, block_offset,
+                                     &buf[retval], size - retval);
+            if (rc == 0 && this->bi_blocks[index].b_out_size == -1) {
+                this->bi_blocks[index].b_out_size = this->bi_stream_offset;
+                this->add_located(index);
+                continue;
+            }
+        }
+        else {
+            auto data = this->get_block_data(index);
+
+            if (data == nullptr) {
+                if (this->bi_blocks[index].b_streamed) {
+                    // Turned out to be too big to decode in one go.
+                    continue;
+                }
+                rc = -1;
+            }
+            else if (block_offset >= (off_t) data->size()) {
+                rc = 0;
+            }
+            else {
+                rc = std::min(size - retval,
+                              (size_t) (data->size() - block_offset));
+                memcpy(&buf[retval], &(*data)[block_offset], rc);
+            }
+        }
+
+        if (rc < 0) {
+            if (retval == 0) {
+                errno = EIO;
+                return -1;
+            }
+            break;
+        }
+        if (rc == 0) {
+            break;
+        }
+        retval += rc;
+    }
+
+    return retval;
+}
+
+namespace {
+
+using block_decoder = line_buffer::block_indexed::block_decoder;
+
+#ifdef HAVE_BZLIB_H
+/**
+ * Builds a bzip2 stream out of a single block pulled from another stream so
+ * that it can be decoded on its own.
+ */
+class bz_block_stream {
+public:
+    bz_block_stream(const unsigned char *block, int shift, off_t bit_count)
+    {
+        size_t byte_count = (bit_count + 7) / 8;
+
+        // A level 9 header allows for the largest possible block.
+        this->bbs_data = {'B', 'Z', 'h', '9'};
+        this->bbs_data.resize(4 + byte_count);
+        for (size_t lpc = 0; lpc < byte_count; lpc++) {
+            unsigned char value = block[lpc] << shift;
+
+            if (shift) {
+                value |= block[lpc + 1] >> (8 - shift);
+            }
+            this->bbs_data[4 + lpc] = value;
+        }
+        if (bit_count % 8) {
+            this->bbs_data.back() &= 0xff << (8 - bit_count % 8);
+        }
+        this->bbs_bits = 32 + bit_count;
+    };
+
+    /**
+     * @return The CRC of the block's data, which is stored right after the
+     *   block magic.
+     */
+    uint32_t get_block_crc() const
+    {
+        const unsigned char *crc = &this->bbs_data[4 + BZ_MAGIC_BITS / 8];
+
+        return ((uint32_t) crc[0] << 24 | (uint32_t) crc[1] << 16 |
+                (uint32_t) crc[2] << 8 | (uint32_t) crc[3]);
+    };
+
+    void put_bits(uint64_t value, int count)
+    {
+        for (int lpc = count - 1; lpc >= 0; lpc--) {
+            if (this->bbs_bits % 8 == 0) {
+                this->bbs_data.push_back(0);
+            }
+            if ((value >> lpc) & 1) {
+                this->bbs_data.back() |= 0x80 >> (this->bbs_bits % 8);
+            }
+            this->bbs_bits += 1;
+        }
+    };
+
+    std::vector<unsigned char> bbs_data;
+    off_t bbs_bits;
+};
+
+class bz_block_decoder : public block_decoder {
+public:
+    explicit bz_block_decoder(bz_block_stream &&stream)
+        : bbd_stream(std::move(stream))
+    {
+        memset(&this->bbd_bz, 0, sizeof(this->bbd_bz));
+        this->bbd_valid = BZ2_bzDecompressInit(&this->bbd_bz, 0, 0) == BZ_OK;
+        this->bbd_bz.next_in = (char *) this->bbd_stream.bbs_data.data();
+        this->bbd_bz.avail_in = this->bbd_stream.bbs_data.size();
+    };
+
+    ~bz_block_decoder() override
+    {
+        if (this->bbd_valid) {
+            BZ2_bzDecompressEnd(&this->bbd_bz);
+        }
+    };
+
+    ssize_t read(char *buf, size_t size) override
+    {
+        if (!this->bbd_valid) {
+            return -1;
+        }
+        if (this->bbd_done) {
+            return 0;
+        }
+
+        this->bbd_bz.next_out = buf;
+        this->bbd_bz.avail_out = size;
+        while (this->bbd_bz.avail_out > 0) {
+            int rc = BZ2_bzDecompress(&this->bbd_bz);
+
+            if (rc == BZ_STREAM_END) {
+                this->bbd_done = true;
+                break;
+            }
+            if (rc != BZ_OK ||
+                (this->bbd_bz.avail_in == 0 && this->bbd_bz.avail_out > 0)) {
+                return -1;
+            }
+        }
+
+        return size - this->bbd_bz.avail_out;
+    };
+
+private:
+    bz_block_stream bbd_stream;
+    bz_stream bbd_bz;
+    bool bbd_valid{false};
+    bool bbd_done{false};
+};
+
+/**
+ * Reader for bzip2 files.  There is no index in a bzip2 file, so the blocks
+ * are found by looking for the bit patterns at the start of each block.
+ */
+class bz_indexed : public line_buffer::block_indexed {
+public:
+    explicit bz_indexed(int fd) : block_indexed(fd) {};
+
+protected:
+    void scan_blocks() override
+    {
+        struct stat st;
+
+        if (fstat(this->bi_fd, &st) == -1 ||
+            st.st_size <= this->bz_scan_offset) {
+            return;
+        }
+
+        std::unique_ptr<unsigned char[]> buffer(
+            new unsigned char[BZ_SCAN_SIZE]);
+
+        while (this->bz_scan_offset < st.st_size) {
+            ssize_t rc = pread(this->bi_fd,
+                               buffer.get(),
+                               std::min((off_t) BZ_SCAN_SIZE,
+                                        st.st_size - this->bz_scan_offset),
+                               this->bz_scan_offset);
+
+            if (rc <= 0) {
+                break;
+            }
+            for (ssize_t lpc = 0; lpc < rc; lpc++) {
+                unsigned char byte = buffer[lpc];
+
+                for (int bit = 7; bit >= 0; bit--) {
+                    this->bz_scan_window = (this->bz_scan_window << 1) |
+                                           ((byte >> bit) & 1);
+
+                    uint64_t magic = this->bz_scan_window & BZ_MAGIC_MASK;
+
+                    if (magic != BZ_BLOCK_MAGIC && magic != BZ_EOS_MAGIC) {
+                        continue;
+                    }
+
+                    off_t magic_start = (this->bz_scan_offset + lpc) * 8 +
+                                        (8 - bit) - BZ_MAGIC_BITS;
+
+                    if (this->bz_open_block != -1) {
+                        this->bi_blocks.push_back({
+                            this->bz_open_block, magic_start, -1
+                        });
+                    }
+                    this->bz_open_block =
+                        magic == BZ_BLOCK_MAGIC ? magic_start : -1;
+                }
+            }
+            this->bz_scan_offset += rc;
+        }
+    };
+
+    std::unique_ptr<block_decoder> open_block(size_t index) const override
+    {
+        const block &blk = this->bi_blocks[index];
+        off_t byte_start = blk.b_in_start / 8;
+        size_t byte_count = (blk.b_in_end + 7) / 8 - byte_start;
+        std::vector<unsigned char> raw(byte_count + 1);
+
+        if (pread(this->bi_fd, raw.data(), byte_count, byte_start) !=
+            (ssize_t) byte_count) {
+            return nullptr;
+        }
+
+        bz_block_stream stream(raw.data(),
+                               blk.b_in_start % 8,
+                               blk.b_in_end - blk.b_in_start);
+
+        // The stream only has the one block, so its combined CRC is the same
+        // as the block's.
+        stream.put_bits(BZ_EOS_MAGIC, BZ_MAGIC_BITS);
+        stream.put_bits(stream.get_block_crc(), 32);
+
+        return std::make_unique<bz_block_decoder>(std::move(stream));
+    };
+
+    /** The block positions are bit offsets. */
+    off_t get_file_offset(off_t pos) const override
+    {
+        return pos / 8;
+    };
+
+    bool recover_block(size_t index) override
+    {
+        if (index + 1 >= this->bi_blocks.size()) {
+            return false;
+        }
+
+        // The block magic can turn up in the compressed data by chance, so
+        // try gluing the pieces back together.
+        log_debug("merging bzip2 blocks at bit offset %lld",
+                  (long long) this->bi_blocks[index].b_in_start);
+        this->bi_blocks[index].b_in_end = this->bi_blocks[index + 1].b_in_end;
+        this->bi_blocks.erase(this->bi_blocks.begin() + index + 1);
+
+        return true;
+    };
+
+private:
+    /** The number of bytes of the file that have been scanned. */
+    off_t bz_scan_offset{0};
+    uint64_t bz_scan_window{0};
+    /** The bit offset of the block that is currently being scanned. */
+    off_t bz_open_block{-1};
+};
+#endif
+
+#ifdef HAVE_ZSTD_H
+class zstd_block_decoder : public block_decoder {
+public:
+    zstd_block_decoder(int fd, off_t start, off_t end)
+        : zbd_fd(fd),
+          zbd_offset(start),
+          zbd_end(end),
+          zbd_dctx(ZSTD_createDCtx()),
+          zbd_inbuf(new char[BLOCK_INPUT_SIZE])
+    {
+        this->zbd_in = {this->zbd_inbuf.get(), 0, 0};
+    };
+
+    ~zstd_block_decoder() override
+    {
+        ZSTD_freeDCtx(this->zbd_dctx);
+    };
+
+    ssize_t read(char *buf, size_t size) override
+    {
+        if (this->zbd_dctx == nullptr) {
+            return -1;
+        }
+        if (this->zbd_done) {
+            return 0;
+        }
+
+        ZSTD_outBuffer out = {buf, size, 0};
+
+        while (out.pos < out.size) {
+            if (this->zbd_in.pos == this->zbd_in.size &&
+                this->zbd_offset < this->zbd_end) {
+                ssize_t rc = pread(this->zbd_fd,
+                                   this->zbd_inbuf.get(),
+                                   std::min((off_t) BLOCK_INPUT_SIZE,
+                                            this->zbd_end - this->zbd_offset),
+                                   this->zbd_offset);
+
+                if (rc <= 0) {
+                    return -1;
+                }
+                this->zbd_offset += rc;
+                this->zbd_in = {this->zbd_inbuf.get(), (size_t) rc, 0};
+            }
+
+            size_t out_before = out.pos;
+            size_t in_before = this->zbd_in.pos;
+            size_t rc = ZSTD_decompressStream(this->zbd_dctx,
+                                              &out,
+                                              &this->zbd_in);
+
+            if (ZSTD_isError(rc)) {
+                log_error("zstd decompression failed -- %s",
+                          ZSTD_getErrorName(rc));
+                return -1;
+            }
+            if (rc == 0) {
+                // The end of the frame.
+                this->zbd_done = true;
+                break;
+            }
+            if (out.pos == out_before && this->zbd_in.pos == in_before &&
+                this->zbd_offset >= this->zbd_end) {
+                // The frame is truncated.
+                return -1;
+            }
+        }
+
+        return out.pos;
+    };
+
+private:
+    int zbd_fd;
+    off_t zbd_offset;
+    off_t zbd_end;
+    ZSTD_DCtx *zbd_dctx;
+    std::unique_ptr<char[]> zbd_inbuf;
+    ZSTD_inBuffer zbd_in;
+    bool zbd_done{false};
+};
+
+/**
+ * Reader for zstd files.  Each frame is a block.  If the file is in the
+ * seekable format, the frames are taken from the seek table at the end of
+ * the file, otherwise the frames are found by walking the frame and block
+ * headers.
+ */
+class zstd_indexed : public line_buffer::block_indexed {
+public:
+    explicit zstd_indexed(int fd) : block_indexed(fd) {};
+
+protected:
+    void scan_blocks() override
+    {
+        struct stat st;
+
+        if (this->zi_scan_failed ||
+            fstat(this->bi_fd, &st) == -1 ||
+            st.st_size <= this->zi_scan_offset) {
+            return;
+        }
+        if (this->zi_scan_offset == 0 && this->read_seek_table(st.st_size)) {
+            return;
+        }
+
+        while (this->zi_scan_offset < st.st_size) {
+            off_t frame_end = this->find_frame_end(this->zi_scan_offset,
+                                                   st.st_size);
+
+            if (frame_end == -1) {
+                break;
+            }
+            this->zi_scan_offset = frame_end;
+        }
+    };
+
+    std::unique_ptr<block_decoder> open_block(size_t index) const override
+    {
+        const block &blk = this->bi_blocks[index];
+
+        return std::make_unique<zstd_block_decoder>(
+            this->bi_fd, blk.b_in_start, blk.b_in_end);
+    };
+
+private:
+    /**
+     * Find the end of the frame that starts at the given offset and add it
+     * to the list of blocks.
+     *
+     * @return The offset of the end of the frame or -1 if the frame is not
+     *   complete.
+     */
+    off_t find_frame_end(off_t offset, off_t file_size)
+    {
+        unsigned char header[18];
+        ssize_t rc = pread(this->bi_fd, header, sizeof(header), offset);
+
+        if (rc < 8) {
+            return -1;
+        }
 
-#ifdef HAVE_X86INTRIN_H
-#include "simdutf8check.h"
-#endif
+        uint32_t magic = read_le32(header);
 
-#include "base/is_utf8.hh"
-#include "lnav_util.hh"
-#include "line_buffer.hh"
-#include "fmtlib/fmt/format.h"
+        if ((magic & ZSTD_MAGIC_SKIPPABLE_MASK) == ZSTD_MAGIC_SKIPPABLE_START) {
+            off_t retval = offset + ZSTD_SKIPPABLE_HEADER_SIZE +
+                           (uint32_t) read_le32(&header[4]);
 
-using namespace std;
+            return retval <= file_size ? retval : -1;
+        }
+        if (magic != ZSTD_MAGICNUMBER) {
+            log_error("unrecognized data in zstd file at offset %lld",
+                      (long long) offset);
+            this->zi_scan_failed = true;
+            return -1;
+        }
 
-static const ssize_t DEFAULT_INCREMENT          = 128 * 1024;
-static const ssize_t MAX_COMPRESSED_BUFFER_SIZE = 32 * 1024 * 1024;
+        // Decode the frame header descriptor to find the size of the header
+        // and, if it's there, the size of the decompressed content.
+        unsigned char desc = header[4];
+        int fcs_flag = desc >> 6;
+        bool single_segment = (desc >> 5) & 1;
+        bool has_checksum = (desc >> 2) & 1;
+        static const int DICT_ID_SIZES[] = {0, 1, 2, 4};
+        static const int FCS_SIZES[] = {0, 2, 4, 8};
+        int fcs_size = FCS_SIZES[fcs_flag];
+        off_t header_size = 5 + (single_segment ? 0 : 1) +
+                            DICT_ID_SIZES[desc & 3];
+        off_t content_size = -1;
+
+        if (fcs_flag == 0 && single_segment) {
+            fcs_size = 1;
+        }
+        if (header_size + fcs_size > rc) {
+            return -1;
+        }
+        if (fcs_size > 0) {
+            uint64_t value = 0;
 
-/*
- * XXX REMOVE ME
- *
- * The stock gzipped file code does not use pread, so we need to use a lock to
- * get exclusive access to the file.  In the future, we should just rewrite
- * the gzipped file code to use pread.
- */
-class lock_hack {
-public:
-    class guard {
-public:
+            for (int lpc = fcs_size - 1; lpc >= 0; lpc--) {
+                value = (value << 8) | header[header_size + lpc];
+            }
+            if (fcs_size == 2) {
+                value += 256;
+            }
+            content_size = value;
+        }
 
-        guard() : g_lock(lock_hack::singleton())
-        {
-            this->g_lock.lock();
-        };
+        off_t pos = offset + header_size + fcs_size;
+        bool last_block = false;
 
-        ~guard()
-        {
-            this->g_lock.unlock();
-        };
+        while (!last_block) {
+            unsigned char block_header[ZSTD_BLOCK_HEADER_SIZE];
 
-private:
-        lock_hack &g_lock;
+            if (pread(this->bi_fd, block_header, sizeof(block_header), pos) !=
+                sizeof(block_header)) {
+                return -1;
+            }
+
+            uint32_t value = block_header[0] |
+                             (block_header[1] << 8) |
+                             (block_header[2] << 16);
+            int block_type = (value >> 1) & 3;
+
+            last_block = value & 1;
+            if (block_type == 3) {
+                log_error("invalid zstd block at offset %lld",
+                          (long long) pos);
+                this->zi_scan_failed = true;
+                return -1;
+            }
+            // RLE blocks only store the byte that is repeated.
+            pos += ZSTD_BLOCK_HEADER_SIZE + (block_type == 1 ? 1 : value >> 3);
+        }
+        if (has_checksum) {
+            pos += ZSTD_CHECKSUM_SIZE;
+        }
+        if (pos > file_size) {
+            return -1;
+        }
+
+        this->bi_blocks.push_back({offset, pos, content_size});
+
+        return pos;
+    };
+
+    /**
+     * Load the frames from the seek table at the end of a file that is in
+     * the zstd seekable format.
+     *
+     * @return True if the file has a valid seek table.
+     */
+    bool read_seek_table(off_t file_size)
+    {
+        unsigned char footer[ZSTD_SEEK_TABLE_FOOTER_SIZE];
+
+        if (file_size < ZSTD_SKIPPABLE_HEADER_SIZE +
+                        ZSTD_SEEK_TABLE_FOOTER_SIZE ||
+            pread(this->bi_fd, footer, sizeof(footer),
+                  file_size - sizeof(footer)) != sizeof(footer) ||
+            (uint32_t) read_le32(&footer[5]) != ZSTD_SEEKABLE_MAGIC) {
+            return false;
+        }
+
+        uint32_t frame_count = read_le32(footer);
+        off_t entry_size = (footer[4] & 0x80) ? 12 : 8;
+        off_t table_size = ZSTD_SKIPPABLE_HEADER_SIZE +
+                           frame_count * entry_size +
+                           ZSTD_SEEK_TABLE_FOOTER_SIZE;
+
+        if (table_size > file_size) {
+            return false;
+        }
+
+        std::vector<unsigned char> table(table_size);
+
+        if (pread(this->bi_fd, table.data(), table_size,
+                  file_size - table_size) != table_size ||
+            ((uint32_t) read_le32(table.data()) & ZSTD_MAGIC_SKIPPABLE_MASK) !=
+            ZSTD_MAGIC_SKIPPABLE_START) {
+            return false;
+        }
+
+        std::vector<block> blocks;
+        off_t offset = 0;
+
+        for (uint32_t lpc = 0; lpc < frame_count; lpc++) {
+            const unsigned char *entry =
+                &table[ZSTD_SKIPPABLE_HEADER_SIZE + lpc * entry_size];
+            off_t compressed_size = (uint32_t) read_le32(entry);
+            off_t decompressed_size = (uint32_t) read_le32(&entry[4]);
+
+            blocks.push_back({offset, offset + compressed_size,
+                              decompressed_size});
+            offset += compressed_size;
+        }
+        if (offset != file_size - table_size) {
+            log_warning("zstd seek table does not match the file, ignoring");
+            return false;
+        }
+
+        log_debug("loaded zstd seek table with %u frames", frame_count);
+        this->bi_blocks = std::move(blocks);
+        this->zi_scan_offset = file_size;
+
+        return true;
     };
 
-    static lock_hack &singleton()
+    off_t zi_scan_offset{0};
+    bool zi_scan_failed{false};
+};
+#endif
+
+#ifdef HAVE_LZMA_H
+class xz_block_decoder : public block_decoder {
+public:
+    xz_block_decoder(int fd, off_t start, off_t end, lzma_check check)
+        : xbd_fd(fd),
+          xbd_offset(start),
+          xbd_end(end),
+          xbd_inbuf(new uint8_t[BLOCK_INPUT_SIZE])
     {
-        static lock_hack retval;
+        uint8_t header[LZMA_BLOCK_HEADER_SIZE_MAX];
+        lzma_filter filters[LZMA_FILTERS_MAX + 1];
+        lzma_block blk;
+
+        if (pread(fd, header, 1, start) != 1) {
+            return;
+        }
 
-        return retval;
+        memset(&blk, 0, sizeof(blk));
+        blk.version = 1;
+        blk.check = check;
+        blk.filters = filters;
+        blk.header_size = lzma_block_header_size_decode(header[0]);
+        if (pread(fd, header, blk.header_size, start) !=
+            (ssize_t) blk.header_size ||
+            lzma_block_header_decode(&blk, nullptr, header) != LZMA_OK) {
+            return;
+        }
+        this->xbd_valid =
+            lzma_block_decoder(&this->xbd_stream, &blk) == LZMA_OK;
+        for (int lpc = 0; filters[lpc].id != LZMA_VLI_UNKNOWN; lpc++) {
+            free(filters[lpc].options);
+        }
+        this->xbd_offset += blk.header_size;
     };
 
-    void lock()
+    ~xz_block_decoder() override
     {
-        lockf(this->lh_fd, F_LOCK, 0);
+        lzma_end(&this->xbd_stream);
     };
 
-    void unlock()
+    ssize_t read(char *buf, size_t size) override
     {
-        lockf(this->lh_fd, F_ULOCK, 0);
+        if (!this->xbd_valid) {
+            return -1;
+        }
+        if (this->xbd_done) {
+            return 0;
+        }
+
+        lzma_stream &strm = this->xbd_stream;
+
+        strm.next_out = (uint8_t *) buf;
+        strm.avail_out = size;
+        while (strm.avail_out > 0) {
+            if (strm.avail_in == 0 && this->xbd_offset < this->xbd_end) {
+                ssize_t rc = pread(this->xbd_fd,
+                                   this->xbd_inbuf.get(),
+                                   std::min((off_t) BLOCK_INPUT_SIZE,
+                                            this->xbd_end - this->xbd_offset),
+                                   this->xbd_offset);
+
+                if (rc <= 0) {
+                    return -1;
+                }
+                this->xbd_offset += rc;
+                strm.next_in = this->xbd_inbuf.get();
+                strm.avail_in = rc;
+            }
+
+            lzma_ret rc = lzma_code(&strm, LZMA_RUN);
+
+            if (rc == LZMA_STREAM_END) {
+                this->xbd_done = true;
+                break;
+            }
+            if (rc != LZMA_OK) {
+                log_error("xz decompression failed -- %d", rc);
+                return -1;
+            }
+        }
+
+        return size - strm.avail_out;
     };
 
 private:
+    int xbd_fd;
+    off_t xbd_offset;
+    off_t xbd_end;
+    lzma_stream xbd_stream = LZMA_STREAM_INIT;
+    std::unique_ptr<uint8_t[]> xbd_inbuf;
+    bool xbd_valid{false};
+    bool xbd_done{false};
+};
+
+/**
+ * Reader for xz files.  The blocks are taken from the index at the end of
+ * each stream in the file.
+ */
+class xz_indexed : public line_buffer::block_indexed {
+public:
+    explicit xz_indexed(int fd) : block_indexed(fd) {};
+
+protected:
+    void scan_blocks() override
+    {
+        struct stat st;
+
+        if (fstat(this->bi_fd, &st) == -1 ||
+            st.st_size == this->xi_scan_size) {
+            return;
+        }
+        this->xi_scan_size = st.st_size;
+
+        std::vector<block> blocks;
+        std::vector<lzma_check> checks;
+        off_t pos = st.st_size;
+
+        // Walk the streams from the back of the file, the index for each
+        // stream is right before its footer.
+        while (pos > 0) {
+            uint8_t footer[LZMA_STREAM_HEADER_SIZE];
+            lzma_stream_flags flags;
+
+            if (pos < LZMA_STREAM_HEADER_SIZE * 2 ||
+                pread(this->bi_fd, footer, sizeof(footer),
+                      pos - sizeof(footer)) != sizeof(footer)) {
+                return;
+            }
+            if (memcmp(&footer[sizeof(footer) - 4], "\0\0\0\0", 4) == 0) {
+                // Stream padding.
+                pos -= 4;
+                continue;
+            }
+            if (lzma_stream_footer_decode(&flags, footer) != LZMA_OK) {
+                log_debug("xz file is not complete yet");
+                return;
+            }
+
+            off_t index_pos = pos - LZMA_STREAM_HEADER_SIZE -
+                              flags.backward_size;
 
-    lock_hack()
+            if (index_pos < LZMA_STREAM_HEADER_SIZE) {
+                return;
+            }
+
+            std::vector<uint8_t> index_data(flags.backward_size);
+            lzma_index *index = nullptr;
+            uint64_t memlimit = UINT64_MAX;
+            size_t in_pos = 0;
+
+            if (pread(this->bi_fd, index_data.data(), index_data.size(),
+                      index_pos) != (ssize_t) index_data.size() ||
+                lzma_index_buffer_decode(&index, &memlimit, nullptr,
+                                         index_data.data(), &in_pos,
+                                         index_data.size()) != LZMA_OK) {
+                log_error("unable to decode xz index at offset %lld",
+                          (long long) index_pos);
+                return;
+            }
+
+            off_t stream_start = pos - lzma_index_stream_size(index);
+            std::vector<block> stream_blocks;
+            lzma_index_iter iter;
+
+            lzma_index_iter_init(&iter, index);
+            while (!lzma_index_iter_next(&iter, LZMA_INDEX_ITER_BLOCK)) {
+                off_t start = stream_start +
+                              iter.block.compressed_stream_offset;
+
+                stream_blocks.push_back({
+                    start,
+                    start + (off_t) iter.block.total_size,
+                    (off_t) iter.block.uncompressed_size
+                });
+            }
+            lzma_index_end(index, nullptr);
+
+            blocks.insert(blocks.begin(),
+                          stream_blocks.begin(), stream_blocks.end());
+            checks.insert(checks.begin(), stream_blocks.size(), flags.check);
+            pos = stream_start;
+        }
+
+        // Only add the blocks from any streams that were appended since the
+        // last scan.
+        off_t known_end = this->bi_blocks.empty() ?
+                          0 : this->bi_blocks.back().b_in_end;
+
+        for (size_t lpc = 0; lpc < blocks.size(); lpc++) {
+            if (blocks[lpc].b_in_start >= known_end) {
+                this->bi_blocks.push_back(blocks[lpc]);
+                this->xi_checks.push_back(checks[lpc]);
+            }
+        }
+    };
+
+    std::unique_ptr<block_decoder> open_block(size_t index) const override
     {
-        char lockname[64];
+        const block &blk = this->bi_blocks[index];
 
-        snprintf(lockname, sizeof(lockname), "/tmp/lnav.%d.lck", getpid());
-        this->lh_fd = open(lockname, O_CREAT | O_RDWR, 0600);
-        log_perror(fcntl(this->lh_fd, F_SETFD, FD_CLOEXEC));
-        unlink(lockname);
+        return std::make_unique<xz_block_decoder>(
+            this->bi_fd, blk.b_in_start, blk.b_in_end, this->xi_checks[index]);
     };
 
-    auto_fd lh_fd;
+private:
+    off_t xi_scan_size{0};
+    /** The type of check used by the stream that each block is in. */
+    std::vector<lzma_check> xi_checks;
+};
+#endif
+
+/**
+ * Duplicate a descriptor for one of the compressed file readers, which read
+ * the file using pread().
+ */
+int dup_for_reader(int fd)
+{
+    int retval = dup(fd);
+
+    if (retval == -1) {
+        throw line_buffer::error(errno);
+    }
+    log_perror(fcntl(retval, F_SETFD, FD_CLOEXEC));
+
+    return retval;
+}
+
+}
+
+namespace {
+
+/**
+ * The mappings that are live, which are checked by the SIGBUS handler.
+ * The handler cannot take locks, so this is a fixed-size table of atomics.
+ */
+struct mapping_slot {
+    std::atomic<char *> ms_addr{nullptr};
+    std::atomic<size_t> ms_size{0};
 };
-/* XXX END */
+
+mapping_slot MAPPING_SLOTS[MAX_MAPPINGS];
+size_t MAPPING_PAGE_SIZE;
+struct sigaction PREV_SIGBUS_ACTION;
+
+/**
+ * Accessing a mapped page that is past the end of a file that has been
+ * truncated raises SIGBUS.  If that happens for one of our mappings, the
+ * page is replaced with zeroes so that the reader can carry on.  The
+ * truncation will be noticed the next time the file is polled.
+ */
+void mapping_sigbus_handler(int sig, siginfo_t *info, void *ctx)
+{
+    auto fault_addr = (char *) info->si_addr;
+
+    for (auto &slot : MAPPING_SLOTS) {
+        char *addr = slot.ms_addr.load();
+
+        if (addr == nullptr || fault_addr < addr ||
+            fault_addr >= addr + slot.ms_size.load()) {
+            continue;
+        }
+
+        auto page = (char *) ((uintptr_t) fault_addr &
+                              ~(uintptr_t) (MAPPING_PAGE_SIZE - 1));
+
+        if (mmap(page, MAPPING_PAGE_SIZE, PROT_READ,
+                 MAP_PRIVATE | MAP_ANON | MAP_FIXED, -1, 0) != MAP_FAILED) {
+            return;
+        }
+        break;
+    }
+
+    if (PREV_SIGBUS_ACTION.sa_flags & SA_SIGINFO) {
+        PREV_SIGBUS_ACTION.sa_sigaction(sig, info, ctx);
+    }
+    else if (PREV_SIGBUS_ACTION.sa_handler == SIG_DFL ||
+             PREV_SIGBUS_ACTION.sa_handler == SIG_IGN) {
+        // Returning will retry the access and take the default action.
+        signal(SIGBUS, SIG_DFL);
+    }
+    else {
+        PREV_SIGBUS_ACTION.sa_handler(sig);
+    }
+}
+
+bool register_mapping(char *addr, size_t size)
+{
+    static std::once_flag install_once;
+
+    std::call_once(install_once, []() {
+        struct sigaction sa;
+
+        MAPPING_PAGE_SIZE = sysconf(_SC_PAGESIZE);
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = mapping_sigbus_handler;
+        sa.sa_flags = SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGBUS, &sa, &PREV_SIGBUS_ACTION);
+    });
+
+    for (auto &slot : MAPPING_SLOTS) {
+        char *expected = nullptr;
+
+        if (slot.ms_addr.compare_exchange_strong(expected, addr)) {
+            slot.ms_size.store(size);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void unregister_mapping(char *addr)
+{
+    for (auto &slot : MAPPING_SLOTS) {
+        if (slot.ms_addr.load() == addr) {
+            slot.ms_size.store(0);
+            slot.ms_addr.store(nullptr);
+            return;
+        }
+    }
+}
+
+int to_madvise(line_buffer::access_pattern_t ap)
+{
+    switch (ap) {
+        case line_buffer::AP_SEQUENTIAL:
+            return POSIX_MADV_SEQUENTIAL;
+        case line_buffer::AP_RANDOM:
+            return POSIX_MADV_RANDOM;
+        default:
+            return POSIX_MADV_NORMAL;
+    }
+}
+
+}
+
+line_buffer::mapped_region::mapped_region(char *addr, size_t size)
+    : mr_addr(addr), mr_size(size)
+{
+}
+
+line_buffer::mapped_region::mapped_region(mapped_region &&other) noexcept
+    : mr_addr(other.mr_addr), mr_size(other.mr_size)
+{
+    other.mr_addr = nullptr;
+    other.mr_size = 0;
+}
+
+line_buffer::mapped_region &
+line_buffer::mapped_region::operator=(mapped_region &&other) noexcept
+{
+    std::swap(this->mr_addr, other.mr_addr);
+    std::swap(this->mr_size, other.mr_size);
+
+    return *this;
+}
+
+line_buffer::mapped_region::~mapped_region()
+{
+    if (this->mr_addr != nullptr) {
+        unregister_mapping(this->mr_addr);
+        munmap(this->mr_addr, this->mr_size);
+    }
+}
 
 line_buffer::line_buffer()
-    : lb_gz_file(NULL),
-      lb_bz_file(false),
+    : lb_gz_file(nullptr),
+      lb_block_file(nullptr),
       lb_compressed_offset(0),
       lb_file_size(-1),
       lb_file_offset(0),
@@ -148,14 +1527,9 @@ void line_buffer::set_fd(auto_fd &fd)
 {
     off_t newoff = 0;
 
-    if (this->lb_gz_file) {
-        gzclose(this->lb_gz_file);
-        this->lb_gz_file = NULL;
-    }
-
-    if (this->lb_bz_file) {
-        this->lb_bz_file = false;
-    }
+    this->unmap_file();
+    this->lb_gz_file.reset();
+    this->lb_block_file.reset();
 
     if (fd != -1) {
         /* Sync the fd's offset with the object. */
@@ -174,45 +1548,45 @@ void line_buffer::set_fd(auto_fd &fd)
 
             if (pread(fd, gz_id, sizeof(gz_id), 0) == sizeof(gz_id)) {
                 if (gz_id[0] == '\037' && gz_id[1] == '\213') {
-                    int gzfd = dup(fd);
-
-                    log_perror(fcntl(gzfd, F_SETFD, FD_CLOEXEC));
-                    if (lseek(fd, 0, SEEK_SET) < 0) {
-                        close(gzfd);
-                        throw error(errno);
-                    }
-                    if ((this->lb_gz_file = gzdopen(gzfd, "r")) == NULL) {
-                        close(gzfd);
-                        if (errno == 0) {
-                            throw bad_alloc();
-                        }
-                        else{
-                            throw error(errno);
-                        }
-                    }
+                    this->lb_gz_file = make_unique<gz_indexed>(
+                        dup_for_reader(fd));
                     this->lb_file_time = read_le32(
                         (const unsigned char *)&gz_id[4]);
                     if (this->lb_file_time < 0) {
                         this->lb_file_time = 0;
                     }
-                    this->lb_compressed_offset = lseek(this->lb_fd, 0, SEEK_CUR);
+                    this->lb_compressed_offset = 0;
                 }
 #ifdef HAVE_BZLIB_H
                 else if (gz_id[0] == 'B' && gz_id[1] == 'Z') {
-                    if (lseek(fd, 0, SEEK_SET) < 0) {
-                        throw error(errno);
-                    }
-                    this->lb_bz_file = true;
+                    this->lb_block_file = make_unique<bz_indexed>(
+                        dup_for_reader(fd));
+                }
+#endif
+#ifdef HAVE_ZSTD_H
+                else if ((uint32_t) read_le32((const unsigned char *) gz_id) ==
+                         ZSTD_MAGICNUMBER) {
+                    this->lb_block_file = make_unique<zstd_indexed>(
+                        dup_for_reader(fd));
+                }
+#endif
+#ifdef HAVE_LZMA_H
+                else if (memcmp(gz_id, "\xFD" "7zXZ\0", 6) == 0) {
+                    this->lb_block_file = make_unique<xz_indexed>(
+                        dup_for_reader(fd));
+                }
+#endif
 
+                if (this->lb_block_file) {
+                    this->lb_block_file->set_max_workers(this->lb_max_workers);
                     /*
-                     * Loading data from a bzip2 file is pretty slow, so we try
-                     * to keep as much in memory as possible.
+                     * Loading data from these files can be pretty slow, so
+                     * we try to keep as much in memory as possible.
                      */
                     this->resize_buffer(MAX_COMPRESSED_BUFFER_SIZE);
 
                     this->lb_compressed_offset = 0;
                 }
-#endif
             }
             this->lb_seekable = true;
         }
@@ -221,12 +1595,121 @@ void line_buffer::set_fd(auto_fd &fd)
     this->lb_buffer_size = 0;
     this->lb_fd          = fd;
 
+    if (this->lb_fd != -1 && this->lb_seekable && !this->is_compressed() &&
+        this->lb_mmap_enabled) {
+        this->map_file();
+    }
+
     ensure(this->invariant());
 }
 
+bool line_buffer::map_file()
+{
+    struct stat st;
+
+    if (fstat(this->lb_fd, &st) == -1) {
+        throw error(errno);
+    }
+
+    if (!this->is_mapped()) {
+        // Only map regular files and only when there is plenty of address
+        // space to reserve room for the file to grow.
+        if (!S_ISREG(st.st_mode) || sizeof(void *) < 8) {
+            return false;
+        }
+    }
+    else if (st.st_size <= this->lb_mapped_size) {
+        return false;
+    }
+
+    if (!this->is_mapped() ||
+        (size_t) st.st_size > this->lb_mappings.back().mr_size) {
+        size_t map_size = roundup_size(
+            std::max((size_t) st.st_size * 2, MIN_MAP_SIZE), MIN_MAP_SIZE);
+        auto addr = (char *) mmap(nullptr, map_size, PROT_READ, MAP_SHARED,
+                                  this->lb_fd, 0);
+
+        if (addr == MAP_FAILED) {
+            if (!this->is_mapped()) {
+                log_debug("unable to map file, using reads -- %s",
+                          strerror(errno));
+                return false;
+            }
+            throw error(errno);
+        }
+        if (!register_mapping(addr, map_size)) {
+            munmap(addr, map_size);
+            if (!this->is_mapped()) {
+                log_debug("too many mapped files, using reads");
+                return false;
+            }
+            throw error(ENOMEM);
+        }
+        posix_madvise(addr, map_size, to_madvise(this->lb_access_pattern));
+        this->lb_mappings.emplace_back(addr, map_size);
+
+        // Drop any older mappings that are no longer referenced.
+        for (auto iter = this->lb_mappings.begin();
+             iter != std::prev(this->lb_mappings.end());) {
+            shared_buffer_ref *ref;
+            bool in_use = false;
+
+            LIST_FOREACH(ref, &this->lb_share_manager.sb_refs, sb_link) {
+                if (iter->contains(ref->get_data())) {
+                    in_use = true;
+                    break;
+                }
+            }
+            if (in_use) {
+                ++iter;
+            }
+            else {
+                iter = this->lb_mappings.erase(iter);
+            }
+        }
+    }
+    this->lb_mapped_size = st.st_size;
+
+    return true;
+}
+
+void line_buffer::unmap_file()
+{
+    if (!this->is_mapped()) {
+        return;
+    }
+
+    // The references need their own copy of the data before it goes away.
+    this->lb_share_manager.invalidate_refs();
+    this->lb_mappings.clear();
+    this->lb_mapped_size = 0;
+}
+
+void line_buffer::set_access_pattern(access_pattern_t ap)
+{
+    if (ap == this->lb_access_pattern) {
+        return;
+    }
+
+    this->lb_access_pattern = ap;
+    if (this->is_mapped()) {
+        const auto &mr = this->lb_mappings.back();
+
+        posix_madvise(mr.mr_addr, mr.mr_size, to_madvise(ap));
+    }
+}
+
+void line_buffer::set_max_workers(size_t max_workers)
+{
+    this->lb_max_workers = max_workers;
+    if (this->lb_block_file) {
+        this->lb_block_file->set_max_workers(max_workers);
+    }
+}
+
 void line_buffer::resize_buffer(size_t new_max)
 {
-    require(this->lb_bz_file || this->lb_gz_file ||
+    require(this->lb_block_file || this->lb_gz_file ||
         new_max <= MAX_LINE_BUFFER_SIZE);
 
     if (new_max > (size_t)this->lb_buffer_max) {
@@ -253,6 +1736,11 @@ void line_buffer::ensure_available(off_t start, ssize_t max_length)
 
     require(max_length <= MAX_LINE_BUFFER_SIZE);
 
+    if (this->is_mapped()) {
+        // The whole file is already available.
+        return;
+    }
+
     if (this->lb_file_size != -1) {
         if (start + (off_t)max_length > this->lb_file_size) {
             max_length = (this->lb_file_size - start);
@@ -273,10 +1761,13 @@ void line_buffer::ensure_available(off_t start, ssize_t max_length)
         prefill = 0;
         this->lb_buffer_size = 0;
         if ((this->lb_file_size != (ssize_t)-1) &&
+            !this->is_compressed() &&
             (start + this->lb_buffer_max > this->lb_file_size)) {
             /*
              * If the start is near the end of the file, move the offset back a
-             * bit so we can get more of the file in the cache.
+             * bit so we can get more of the file in the cache.  This is not
+             * done for compressed files since the compressed buffer is large
+             * and decompressing all of that data is expensive.
              */
             this->lb_file_offset = this->lb_file_size -
                                    std::min(this->lb_file_size,
@@ -319,13 +1810,38 @@ void line_buffer::ensure_available(off_t start, ssize_t max_length)
     }
 }
 
+ssize_t line_buffer::get_compressed_fill_size(off_t start,
+                                              ssize_t max_length) const
+{
+    off_t fill_start = this->lb_file_offset + this->lb_buffer_size;
+
+    // Only decompress a bit more than what was asked for so that jumping
+    // around the file stays cheap.
+    return std::min(this->lb_buffer_max - this->lb_buffer_size,
+                    std::max((ssize_t) (start + max_length - fill_start),
+                             COMPRESSED_FILL_SIZE));
+}
+
 bool line_buffer::fill_range(off_t start, ssize_t max_length)
 {
     bool retval = false;
 
     require(start >= 0);
 
-    if (this->in_range(start) && this->in_range(start + max_length - 1)) {
+    if (this->is_mapped()) {
+        ssize_t old_size = this->lb_mapped_size;
+
+        if (start + max_length <= this->lb_mapped_size) {
+            retval = true;
+        }
+        else {
+            // Check if the file has grown.
+            retval = this->map_file() ||
+                     start + max_length <= this->lb_mapped_size;
+        }
+        ensure(this->lb_mapped_size >= old_size);
+    }
+    else if (this->in_range(start) && this->in_range(start + max_length - 1)) {
         /* Cache already has the data, nothing to do. */
         retval = true;
     }
@@ -343,25 +1859,22 @@ bool line_buffer::fill_range(off_t start, ssize_t max_length)
                 rc = 0;
             }
             else {
-                lock_hack::guard guard;
-
-                lseek(this->lb_fd, this->lb_compressed_offset, SEEK_SET);
-                gzseek(this->lb_gz_file,
-                       this->lb_file_offset + this->lb_buffer_size,
-                       SEEK_SET);
-                rc = gzread(this->lb_gz_file,
-                            &this->lb_buffer[this->lb_buffer_size],
-                            this->lb_buffer_max - this->lb_buffer_size);
-                this->lb_compressed_offset = lseek(this->lb_fd, 0, SEEK_CUR);
-                if (rc != -1 && (
-                        rc < (this->lb_buffer_max - this->lb_buffer_size))) {
+                off_t fill_start = this->lb_file_offset + this->lb_buffer_size;
+                ssize_t amount = this->get_compressed_fill_size(start,
+                                                                max_length);
+
+                this->lb_gz_file->seek(fill_start);
+                rc = this->lb_gz_file->read(
+                    &this->lb_buffer[this->lb_buffer_size], amount);
+                this->lb_compressed_offset =
+                    this->lb_gz_file->get_compressed_offset();
+                if (rc != -1 && rc < amount) {
                     this->lb_file_size = (
                             this->lb_file_offset + this->lb_buffer_size + rc);
                 }
             }
         }
-#ifdef HAVE_BZLIB_H
-        else if (this->lb_bz_file) {
+        else if (this->lb_block_file) {
             if (this->lb_file_size != (ssize_t)-1 &&
                 (((ssize_t)start >= this->lb_file_size) ||
                  (this->in_range(start) &&
@@ -369,55 +1882,21 @@ bool line_buffer::fill_range(off_t start, ssize_t max_length)
                 rc = 0;
             }
             else {
-                lock_hack::guard guard;
-                char             scratch[32 * 1024];
-                BZFILE *         bz_file;
-                off_t            seek_to;
-                int              bzfd;
-
-                /*
-                 * Unfortunately, there is no bzseek, so we need to reopen the
-                 * file every time we want to do a read.
-                 */
-                bzfd = dup(this->lb_fd);
-                if (lseek(this->lb_fd, 0, SEEK_SET) < 0) {
-                    close(bzfd);
-                    throw error(errno);
-                }
-                if ((bz_file = BZ2_bzdopen(bzfd, "r")) == NULL) {
-                    close(bzfd);
-                    if (errno == 0) {
-                        throw bad_alloc();
-                    }
-                    else{
-                        throw error(errno);
-                    }
-                }
-
-                seek_to = this->lb_file_offset + this->lb_buffer_size;
-                while (seek_to > 0) {
-                    int count;
-
-                    count = BZ2_bzread(bz_file,
-                                       scratch,
-                                       std::min((size_t)seek_to,
-                                                sizeof(scratch)));
-                    seek_to -= count;
-                }
-                rc = BZ2_bzread(bz_file,
-                                &this->lb_buffer[this->lb_buffer_size],
-                                this->lb_buffer_max - this->lb_buffer_size);
-                this->lb_compressed_offset = lseek(bzfd, 0, SEEK_SET);
-                BZ2_bzclose(bz_file);
-
-                if (rc != -1 && (
-                    rc < (this->lb_buffer_max - this->lb_buffer_size))) {
+                ssize_t amount = this->get_compressed_fill_size(start,
+                                                                max_length);
+
+                rc = this->lb_block_file->read(
+                    this->lb_file_offset + this->lb_buffer_size,
+                    &this->lb_buffer[this->lb_buffer_size],
+                    amount);
+                this->lb_compressed_offset =
+                    this->lb_block_file->get_compressed_offset();
+                if (rc != -1 && rc < amount) {
                     this->lb_file_size = (
                         this->lb_file_offset + this->lb_buffer_size + rc);
                 }
             }
         }
-#endif
         else if (this->lb_seekable) {
             rc = pread(this->lb_fd,
                        &this->lb_buffer[this->lb_buffer_size],
@@ -448,7 +1927,7 @@ bool line_buffer::fill_range(off_t start, ssize_t max_length)
                 retval = true;
             }
 
-            if (this->lb_gz_file || this->lb_bz_file) {
+            if (this->lb_gz_file || this->lb_block_file) {
                 /*
                  * For compressed files, increase the buffer size so we don't
                  * have to spend as much time uncompressing the data.
@@ -503,28 +1982,12 @@ Result<line_info, string> line_buffer::load_next_line(file_range prev_line)
         /* Find the data in the cache and */
         line_start = this->get_range(offset, retval.li_file_range.fr_size);
         /* ... look for the end-of-line or end-of-file. */
-        ssize_t utf8_end = -1;
+        auto scan_res = scan_utf8_line(line_start,
+                                       retval.li_file_range.fr_size);
 
-#undef HAVE_X86INTRIN_H
-#ifdef HAVE_X86INTRIN_H
-        if (!validate_utf8_fast(line_start, retval.li_file_range.fr_size, &utf8_end)) {
-            retval.li_valid_utf = false;
-        }
-#else
-        {
-            const char *msg;
-            int faulty_bytes;
-
-            utf8_end = is_utf8((unsigned char *) line_start, retval.li_file_range.fr_size, &msg, &faulty_bytes);
-            if (msg != nullptr) {
-                lf = (char *) memchr(line_start, '\n', retval.li_file_range.fr_size);
-                utf8_end = lf - line_start;
-                retval.li_valid_utf = false;
-            }
-        }
-#endif
-        if (utf8_end >= 0) {
-            lf = line_start + utf8_end;
+        retval.li_valid_utf = scan_res.usr_valid;
+        if (scan_res.usr_end >= 0) {
+            lf = line_start + scan_res.usr_end;
         } else {
             lf = nullptr;
         }
@@ -597,7 +2060,8 @@ Result<line_info, string> line_buffer::load_next_line(file_range prev_line)
         }
     }
 
-    ensure(retval.li_file_range.fr_size <= (size_t)this->lb_buffer_size);
+    ensure(retval.li_file_range.fr_size <= (size_t)(
+        this->is_mapped() ? this->lb_mapped_size : this->lb_buffer_size));
     ensure(this->invariant());
 
     return Ok(retval);
@@ -632,5 +2096,9 @@ Result<shared_buffer_ref, std::string> line_buffer::read_range(const file_range
 
 file_range line_buffer::get_available()
 {
+    if (this->is_mapped()) {
+        return {0, std::min(this->lb_mapped_size, this->lb_buffer_max)};
+    }
+
     return {this->lb_file_offset, this->lb_buffer_size};
 }
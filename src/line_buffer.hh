@@ -37,7 +37,11 @@
 #include <unistd.h>
 #include <zlib.h>
 
+#include <algorithm>
 #include <exception>
+#include <map>
+#include <memory>
+#include <vector>
 
 #include "base/lnav_log.hh"
 #include "base/file_range.hh"
@@ -74,6 +78,246 @@ public:
         int e_err;
     };
 
+    /**
+     * Reader for gzip files that records checkpoints while the data is
+     * decompressed so that later seeks only need to inflate the data from
+     * the nearest checkpoint instead of from the start of the file.
+     */
+    class gz_indexed {
+    public:
+        /** The amount of uncompressed data between checkpoints. */
+        static const off_t CHECKPOINT_INTERVAL = 4 * 1024 * 1024;
+        /** The size of the deflate dictionary that is saved at a checkpoint. */
+        static const size_t WINDOW_SIZE = 32 * 1024;
+
+        /**
+         * @param fd The file to read the compressed data from, this object
+         *   takes ownership of the descriptor.
+         */
+        explicit gz_indexed(int fd);
+
+        gz_indexed(const gz_indexed &) = delete;
+
+        gz_indexed &operator=(const gz_indexed &) = delete;
+
+        ~gz_indexed();
+
+        /**
+         * Position the stream so that the next read returns the data at the
+         * given offset in the uncompressed output.
+         */
+        void seek(off_t offset);
+
+        /**
+         * Decompress data at the current position.
+         *
+         * @return The number of bytes read, which is less than the size of
+         *   the buffer at the end of the file, or -1 if there was an error.
+         */
+        ssize_t read(char *buf, size_t size);
+
+        /** @return The offset of the next byte to read in the compressed file. */
+        off_t get_compressed_offset() const {
+            return this->gi_stream.total_in;
+        };
+
+        size_t get_checkpoint_count() const {
+            return this->gi_checkpoints.size();
+        };
+
+    private:
+        struct checkpoint {
+            /** The offset in the uncompressed output. */
+            off_t c_out;
+            /** The offset of the first full byte in the compressed input. */
+            off_t c_in;
+            /** The number of bits from the byte before c_in still needed. */
+            int c_bits;
+            /** The value of the bits before c_in. */
+            int c_bit_value;
+            /** The last WINDOW_SIZE bytes of output before this point. */
+            std::unique_ptr<unsigned char[]> c_window;
+        };
+
+        void init_stream(int window_bits);
+
+        void add_checkpoint(const unsigned char *out_end);
+
+        void restore_checkpoint(const checkpoint &cp);
+
+        auto_fd gi_fd;
+        z_stream gi_stream;
+        /** True if the stream is positioned inside a raw deflate stream. */
+        bool gi_raw;
+        std::unique_ptr<unsigned char[]> gi_inbuf;
+        std::vector<checkpoint> gi_checkpoints;
+    };
+
+    /**
+     * Base class for readers of compressed formats that are made up of
+     * blocks that can be decoded on their own, like bzip2 blocks, zstd
+     * frames, and xz blocks.  A read only has to decode the blocks that
+     * contain the data that was asked for and the blocks are decoded in
+     * parallel as the file is read through.  Blocks that are too big to
+     * keep in memory are streamed instead.
+     */
+    class block_indexed {
+    public:
+        /** Decoder for the data in a single block. */
+        class block_decoder {
+        public:
+            virtual ~block_decoder() = default;
+
+            /**
+             * @return The number of bytes read, zero at the end of the block,
+             *   or -1 if the block could not be decoded.
+             */
+            virtual ssize_t read(char *buf, size_t size) = 0;
+        };
+
+        /**
+         * @param fd The file to read the compressed data from, this object
+         *   takes ownership of the descriptor.
+         */
+        explicit block_indexed(int fd);
+
+        block_indexed(const block_indexed &) = delete;
+
+        block_indexed &operator=(const block_indexed &) = delete;
+
+        virtual ~block_indexed() = default;
+
+        /**
+         * Decompress data at the given offset in the uncompressed output.
+         *
+         * @return The number of bytes read, which is less than the size of
+         *   the buffer at the end of the file, or -1 if there was an error.
+         */
+        ssize_t read(off_t offset, char *buf, size_t size);
+
+        /**
+         * @return The offset in the compressed file of the end of the data
+         *   that has been located so far.
+         */
+        off_t get_compressed_offset() const {
+            return this->bi_located_in_offset;
+        };
+
+        size_t get_block_count() const {
+            return this->bi_blocks.size();
+        };
+
+        /**
+         * Limit the number of threads used to decode blocks.  A value of
+         * zero means to use parallel_worker_count().
+         */
+        void set_max_workers(size_t max_workers) {
+            this->bi_max_workers = max_workers;
+        };
+
+    protected:
+        struct block {
+            /**
+             * The position of the start of the block in the compressed file,
+             * the units are up to the subclass.
+             */
+            off_t b_in_start;
+            /** The position of the end of the block. */
+            off_t b_in_end;
+            /** The size of the block when decompressed or -1 if unknown. */
+            off_t b_out_size;
+            /** The offset of the block in the uncompressed output. */
+            off_t b_out_offset{-1};
+            /** True if the block is too big to be decoded in one go. */
+            bool b_streamed{false};
+        };
+
+        /** Add any complete blocks in newly written data to bi_blocks. */
+        virtual void scan_blocks() = 0;
+
+        /**
+         * Create a decoder for the block with the given index.  This method
+         * can be called from multiple threads at the same time.
+         */
+        virtual std::unique_ptr<block_decoder> open_block(
+            size_t index) const = 0;
+
+        /** @return The offset in the file of a block position. */
+        virtual off_t get_file_offset(off_t pos) const {
+            return pos;
+        };
+
+        /**
+         * Called when a block could not be decoded to give the subclass a
+         * chance to fix up the index.
+         *
+         * @return True if the block should be tried again.
+         */
+        virtual bool recover_block(size_t index) {
+            return false;
+        };
+
+        auto_fd bi_fd;
+        std::vector<block> bi_blocks;
+
+    private:
+        enum decode_result_t {
+            DR_OK,
+            DR_ERROR,
+            DR_TOO_BIG,
+        };
+
+        decode_result_t decode_block(size_t index,
+                                     std::vector<char> &out) const;
+
+        /**
+         * Decode a batch of blocks in parallel, starting at the given index.
+         *
+         * @return False if the first block could not be decoded.
+         */
+        bool decode_blocks(size_t first, size_t max_count);
+
+        size_t get_worker_count() const;
+
+        /**
+         * Find the block that contains the given offset in the output.
+         *
+         * @return False if the offset is past the end of the data.
+         */
+        bool locate(off_t offset, size_t &index_out);
+
+        void add_located(size_t index);
+
+        const std::vector<char> *get_block_data(size_t index);
+
+        void add_to_cache(size_t index, std::vector<char> &&data);
+
+        ssize_t read_streamed(size_t index, off_t block_offset,
+                              char *buf, size_t size);
+
+        /** The number of blocks at the start with a known offset and size. */
+        size_t bi_located_count{0};
+        off_t bi_located_size{0};
+        off_t bi_located_in_offset{0};
+        /** The index of the last block that was read from. */
+        size_t bi_last_index{0};
+        /** Recently decoded blocks, keyed by their index. */
+        std::map<size_t, std::vector<char>> bi_cache;
+        size_t bi_cache_size{0};
+        /** The decoder for a block that is being streamed. */
+        std::unique_ptr<block_decoder> bi_stream;
+        size_t bi_stream_index{0};
+        off_t bi_stream_offset{0};
+        size_t bi_max_workers{0};
+    };
+
+    /** How the data in the file is going to be read. */
+    enum access_pattern_t {
+        AP_NORMAL,
+        AP_SEQUENTIAL,
+        AP_RANDOM,
+    };
+
     /** Construct an empty line_buffer. */
     line_buffer();
 
@@ -103,9 +347,40 @@ public:
     };
 
     bool is_compressed() const {
-        return this->lb_gz_file != NULL || this->lb_bz_file;
+        return this->lb_gz_file != nullptr || this->lb_block_file != nullptr;
     };
 
+    /**
+     * Control whether regular files are mapped into memory instead of being
+     * read into the buffer.  Takes effect on the next call to set_fd().
+     */
+    void set_mmap_enabled(bool enabled) {
+        this->lb_mmap_enabled = enabled;
+    };
+
+    /**
+     * @return True if the file is mapped into memory.  The references
+     *   returned by read_range() for a mapped file point directly at the
+     *   mapping and are not invalidated when other parts of the file are
+     *   read.
+     */
+    bool is_mapped() const {
+        return !this->lb_mappings.empty();
+    };
+
+    /**
+     * Hint how the file is going to be read so the kernel can adjust its
+     * read-ahead.  Only used for mapped files.
+     */
+    void set_access_pattern(access_pattern_t ap);
+
+    /**
+     * Limit the number of threads used to decompress the file, so that a
+     * caller that is already running in parallel does not oversubscribe the
+     * CPUs.  A value of zero means to use parallel_worker_count().
+     */
+    void set_max_workers(size_t max_workers);
+
     off_t get_read_offset(off_t off) const
     {
         if (this->is_compressed()) {
@@ -153,6 +428,7 @@ public:
     /** Release any resources held by this object. */
     void reset()
     {
+        this->unmap_file();
         this->lb_fd.reset();
 
         this->lb_file_offset      = 0;
@@ -171,6 +447,36 @@ public:
     };
 
 private:
+    /**
+     * A read-only mapping of the file.  The mapping can extend past the end
+     * of the file to leave room for the file to grow.
+     */
+    class mapped_region {
+    public:
+        mapped_region(char *addr, size_t size);
+
+        mapped_region(mapped_region &&other) noexcept;
+
+        mapped_region &operator=(mapped_region &&other) noexcept;
+
+        ~mapped_region();
+
+        bool contains(const char *ptr) const {
+            return this->mr_addr <= ptr && ptr < this->mr_addr + this->mr_size;
+        };
+
+        char *mr_addr;
+        size_t mr_size;
+    };
+
+    /**
+     * Map the file or update the mapping after the file has grown.
+     *
+     * @return True if there is more data available than before.
+     */
+    bool map_file();
+
+    void unmap_file();
 
     /**
      * @param off The file offset to check for in the buffer.
@@ -208,6 +514,12 @@ private:
      */
     bool fill_range(off_t start, ssize_t max_length);
 
+    /**
+     * @return The amount of data to decompress into the buffer for a call
+     *   to fill_range().
+     */
+    ssize_t get_compressed_fill_size(off_t start, ssize_t max_length) const;
+
     /**
      * After a successful fill, the cached data can be retrieved with this
      * method.
@@ -220,6 +532,15 @@ private:
      */
     char *get_range(off_t start, ssize_t &avail_out) const
     {
+        if (this->is_mapped()) {
+            // Act like a buffer that is the maximum line size.
+            off_t data_start = std::min(start, (off_t) this->lb_mapped_size);
+
+            avail_out = std::min(this->lb_mapped_size - data_start,
+                                 MAX_LINE_BUFFER_SIZE);
+            return &this->lb_mappings.back().mr_addr[data_start];
+        }
+
         off_t buffer_offset = start - this->lb_file_offset;
         char *retval;
 
@@ -235,8 +556,9 @@ private:
     shared_buffer lb_share_manager;
 
     auto_fd lb_fd;              /*< The file to read data from. */
-    gzFile  lb_gz_file;         /*< File handle for gzipped files. */
-    bool    lb_bz_file;         /*< Flag set for bzip2 compressed files. */
+    std::unique_ptr<gz_indexed> lb_gz_file; /*< Reader for gzipped files. */
+    /** Reader for bzip2, zstd, and xz files. */
+    std::unique_ptr<block_indexed> lb_block_file;
     off_t   lb_compressed_offset; /*< The offset into the compressed file. */
 
     auto_mem<char> lb_buffer;   /*< The internal buffer where data is cached */
@@ -255,5 +577,16 @@ private:
     ssize_t lb_buffer_max;      /*< The size of the buffer memory. */
     bool   lb_seekable;         /*< Flag set for seekable file descriptors. */
     off_t  lb_last_line_offset; /*< */
+
+    bool lb_mmap_enabled{true};
+    size_t lb_max_workers{0};
+    /**
+     * The mappings of the file, the last one is the current mapping and the
+     * older ones are kept while there are references into them.
+     */
+    std::vector<mapped_region> lb_mappings;
+    /** The amount of the file that is known to be mapped. */
+    ssize_t lb_mapped_size{0};
+    access_pattern_t lb_access_pattern{AP_NORMAL};
 };
 #endif
@@ -84,6 +84,7 @@
 #include "init-sql.h"
 #include "logfile.hh"
 #include "base/lnav_log.hh"
+#include "base/pthreadpp.hh"
 #include "log_accel.hh"
 #include "lnav_util.hh"
 #include "ansi_scrubber.hh"
@@ -371,9 +372,13 @@ class loading_observer
 public:
     loading_observer()
         : lo_last_offset(0) {
-
+        pthread_mutex_init(&this->lo_mutex, nullptr);
     };
 
+    ~loading_observer() {
+        pthread_mutex_destroy(&this->lo_mutex);
+    }
+
     void logfile_indexing(logfile &lf, off_t off, size_t total)
     {
         static sig_atomic_t index_counter = 0;
@@ -382,6 +387,10 @@ public:
             return;
         }
 
+        // Files can be indexed in parallel, so only let one thread update
+        // the display at a time.
+        mutex_guard mg(this->lo_mutex);
+
         /* XXX require(off <= total); */
         if (off > (off_t)total) {
             off = total;
@@ -409,6 +418,7 @@ private:
         refresh();
     };
 
+    pthread_mutex_t lo_mutex;
     off_t          lo_last_offset;
 };
 
@@ -519,6 +529,42 @@ public:
     int front_top;
 };
 
+bool check_background_filters(bool wait)
+{
+    static bool showing_progress = false;
+
+    logfile_sub_source &lss = lnav_data.ld_log_source;
+    textfile_sub_source &tss = lnav_data.ld_text_source;
+    bool log_running = lss.check_filters(wait);
+    bool text_running = tss.check_filters(wait);
+
+    if (log_running || text_running) {
+        background_filter &lbf = lss.get_background_filter();
+        background_filter &tbf = tss.get_background_filter();
+        size_t done = 0, total = 0;
+
+        if (log_running) {
+            done += lbf.get_lines_done();
+            total += lbf.get_lines_total();
+        }
+        if (text_running) {
+            done += tbf.get_lines_done();
+            total += tbf.get_lines_total();
+        }
+        lnav_data.ld_bottom_source.update_loading(done, total);
+        showing_progress = true;
+
+        return true;
+    }
+
+    if (showing_progress) {
+        lnav_data.ld_bottom_source.update_loading(0, 0);
+        showing_progress = false;
+    }
+
+    return false;
+}
+
 void rebuild_indexes()
 {
     logfile_sub_source &lss = lnav_data.ld_log_source;
@@ -526,6 +572,12 @@ void rebuild_indexes()
     textview_curses &text_view = lnav_data.ld_views[LNV_TEXT];
     vis_line_t old_bottoms[LNV__MAX];
 
+    if (check_background_filters(false)) {
+        // The files cannot be re-indexed while the filters are being
+        // applied to them in the background.
+        return;
+    }
+
     bool scroll_downs[LNV__MAX];
 
     for (int lpc = 0; lpc < LNV__MAX; lpc++) {
@@ -971,6 +1023,11 @@ static bool watch_logfile(string filename, logfile_open_options &loo, bool requi
 
             default:
                 /* It's a new file, load it in. */
+                // Keep the UI responsive while large files are loaded by
+                // scanning them in the background, headless runs need the
+                // whole file indexed before the commands are executed.
+                loo.with_background_index(
+                    !(lnav_data.ld_flags & LNF_HEADLESS));
                 shared_ptr<logfile> lf = make_shared<logfile>(filename, loo);
 
                 log_info("loading new file: filename=%s",
@@ -1526,6 +1583,8 @@ static void looper()
 
 
         timer.start_fade(index_counter, 1);
+        lnav_data.ld_log_source.get_background_filter().set_enabled(true);
+        lnav_data.ld_text_source.get_background_filter().set_enabled(true);
         while (lnav_data.ld_looping) {
             vector<struct pollfd> pollfds;
             struct timeval to = { 0, 333000 };
@@ -1575,6 +1634,19 @@ static void looper()
             if (lnav_data.ld_input_dispatcher.in_escape()) {
                 to.tv_usec = 15000;
             }
+            for (const auto &lf : lnav_data.ld_files) {
+                if (lf->is_indexing()) {
+                    // Come back soon to pick up the lines that are being
+                    // scanned in the background.
+                    to.tv_usec = std::min(to.tv_usec, (suseconds_t) 10000);
+                    break;
+                }
+            }
+            if (lnav_data.ld_log_source.get_background_filter().is_running() ||
+                lnav_data.ld_text_source.get_background_filter().is_running()) {
+                // Come back soon to swap in the filtered lines.
+                to.tv_usec = std::min(to.tv_usec, (suseconds_t) 10000);
+            }
             rc = poll(&pollfds[0], pollfds.size(), to.tv_usec / 1000);
 
             gettimeofday(&current_time, nullptr);
@@ -1753,6 +1825,10 @@ static void looper()
                 lnav_data.ld_looping = false;
             }
         }
+
+        lnav_data.ld_log_source.get_background_filter().set_enabled(false);
+        lnav_data.ld_text_source.get_background_filter().set_enabled(false);
+        check_background_filters(true);
     }
     catch (readline_curses::error & e) {
         log_error("error: %s", strerror(e.e_err));
@@ -331,6 +331,14 @@ extern const ssize_t ZOOM_COUNT;
 
 void rebuild_hist();
 void rebuild_indexes();
+/**
+ * Swap in the result of applying the filters in the background, if it is
+ * ready, and show the progress otherwise.
+ *
+ * @param wait Wait for the filters to finish being applied.
+ * @return True if the filters are still being applied.
+ */
+bool check_background_filters(bool wait);
 void execute_examples();
 attr_line_t eval_example(const help_text &ht, const help_example &ex);
 
@@ -596,11 +596,30 @@ static void write_line_to(FILE *outfile, attr_line_t &al)
     }
 }
 
+static bool is_open_file(const string &path)
+{
+    struct stat st;
+
+    if (stat(path.c_str(), &st) == -1) {
+        return false;
+    }
+
+    for (const auto &lf : lnav_data.ld_files) {
+        const struct stat &lf_st = lf->get_stat();
+
+        if (lf_st.st_dev == st.st_dev && lf_st.st_ino == st.st_ino) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
 static string com_save_to(exec_context &ec, string cmdline, vector<string> &args)
 {
     FILE *outfile = nullptr, *toclose = nullptr;
     const char *mode    = "";
-    string fn, retval;
+    string fn, retval, copy_to;
     bool to_term = false;
     int (*closer)(FILE *) = fclose;
 
@@ -696,6 +715,16 @@ static string com_save_to(exec_context &ec, string cmdline, vector<string> &args
                    "Make sure xclip or pbcopy is installed.";
         }
     }
+    else if (strcmp(mode, "w") == 0 && is_open_file(split_args[0])) {
+        // The lines in the file are read straight out of a memory mapping,
+        // so truncating the file would lose them before they are written.
+        // Write to a temporary file instead and copy that over at the end.
+        if ((outfile = tmpfile()) == nullptr) {
+            return "error: unable to open temporary file";
+        }
+        toclose = outfile;
+        copy_to = split_args[0];
+    }
     else if ((outfile = fopen(split_args[0].c_str(), mode)) == nullptr) {
         return "error: unable to open file -- " + split_args[0];
     }
@@ -885,6 +914,39 @@ static string com_save_to(exec_context &ec, string cmdline, vector<string> &args
                  .truncate_to(10);
         lnav_data.ld_preview_status_source.get_description()
                  .set_value("First lines of file: %s", fn.c_str());
+    } else if (!copy_to.empty()) {
+        FILE *dst = fopen(copy_to.c_str(), mode);
+
+        if (dst == nullptr) {
+            retval = "error: unable to open file -- " + copy_to;
+        }
+        else {
+            char buffer[32 * 1024];
+            size_t rc;
+            int write_errno = 0;
+
+            rewind(outfile);
+            while ((rc = fread(buffer, 1, sizeof(buffer), outfile)) > 0) {
+                if (fwrite(buffer, 1, rc, dst) != rc) {
+                    write_errno = errno;
+                    break;
+                }
+            }
+            if (write_errno == 0 && ferror(outfile)) {
+                write_errno = errno;
+            }
+            if (fclose(dst) != 0 && write_errno == 0) {
+                write_errno = errno;
+            }
+            if (write_errno != 0) {
+                retval = "error: unable to write to file -- " + copy_to +
+                         " -- " + strerror(write_errno);
+            }
+            else {
+                retval = "Wrote " + to_string(line_count) + " rows to " +
+                         copy_to;
+            }
+        }
     } else {
         retval = "Wrote " + to_string(line_count) + " rows to " + split_args[0];
     }
@@ -2661,10 +2723,19 @@ static string com_zoom_to(exec_context &ec, string cmdline, vector<string> &args
 
                 textview_curses &hist_view = lnav_data.ld_views[LNV_HISTOGRAM];
 
-                if (hist_view.get_inner_height() > 0) {
+                bool hist_has_rows = hist_view.get_inner_height() > 0;
+
+                if (hist_has_rows) {
                     old_time = lnav_data.ld_hist_source2.time_for_row(
                         lnav_data.ld_views[LNV_HISTOGRAM].get_top());
-                    rebuild_hist();
+                }
+                // The buckets for the new zoom level are merged from the
+                // counts that were already collected, so there is no need
+                // to go through the log lines again.
+                lnav_data.ld_hist_source2.set_time_slice(
+                    ZOOM_LEVELS[lnav_data.ld_zoom_level]);
+                hist_view.reload_data();
+                if (hist_has_rows) {
                     lnav_data.ld_views[LNV_HISTOGRAM].set_top(
                         vis_line_t(
                             lnav_data.ld_hist_source2.row_for_time(old_time)));
@@ -2811,6 +2882,7 @@ static string com_toggle_field(exec_context &ec, string cmdline, vector<string>
                                 HELP_MSG_1(x, "to quickly show hidden fields"));
                         }
                     }
+                    tc->invalidate_row_cache();
                     tc->set_needs_update();
                 } else {
                     missing_fields.push_back(args[lpc]);
@@ -62,6 +62,7 @@
 using namespace std;
 
 static const int MAX_CRASH_LOG_COUNT = 16;
+static const time_t MAX_INDEX_CACHE_AGE = 7 * 24 * 60 * 60;
 
 struct _lnav_config lnav_config;
 struct _lnav_config rollback_lnav_config;
@@ -144,6 +145,28 @@ void ensure_dotlnav(void)
     if (!path.empty()) {
         log_perror(mkdir(path.c_str(), 0755));
     }
+
+    path = dotlnav_path("index-cache");
+    if (!path.empty()) {
+        log_perror(mkdir(path.c_str(), 0755));
+    }
+
+    {
+        static_root_mem<glob_t, globfree> gl;
+        time_t now = time(nullptr);
+
+        path += "/*";
+        if (glob(path.c_str(), 0, NULL, gl.inout()) == 0) {
+            for (size_t lpc = 0; lpc < gl->gl_pathc; lpc++) {
+                struct stat st;
+
+                if (stat(gl->gl_pathv[lpc], &st) == 0 &&
+                    (now - st.st_mtime) > MAX_INDEX_CACHE_AGE) {
+                    log_perror(remove(gl->gl_pathv[lpc]));
+                }
+            }
+        }
+    }
 }
 
 void install_git_format(const char *repo)
@@ -42,6 +42,7 @@
 #include "ptimec.hh"
 #include "log_search_table.hh"
 #include "command_executor.hh"
+#include "base/pthreadpp.hh"
 
 using namespace std;
 
@@ -55,6 +56,13 @@ string_attr_type logline::L_META("meta");
 
 external_log_format::mod_map_t external_log_format::MODULE_FORMATS;
 std::vector<external_log_format *> external_log_format::GRAPH_ORDERED_FORMATS;
+uint64_t external_log_format::HIDDEN_GENERATION = 0;
+
+/**
+ * Files can be indexed on several threads at once, so access to the module
+ * format map from the scan path is serialized.
+ */
+static pthread_mutex_t MODULE_FORMATS_MUTEX = PTHREAD_MUTEX_INITIALIZER;
 
 struct line_range logline_value::origin_in_full_msg(const char *msg, size_t len) const
 {
@@ -493,6 +501,199 @@ bool external_log_format::scan_for_partial(shared_buffer_ref &sbr, size_t &len_o
     return (int)len_out > pat->p_timestamp_end;
 }
 
+/**
+ * Decode the escapes in a JSON string, except for '\u' escapes, which the
+ * caller should have ruled out.
+ */
+static void decode_json_string(const json_scan_field &jsf, std::string &out)
+{
+    out.clear();
+    for (size_t lpc = 0; lpc < jsf.jsf_value_len; lpc++) {
+        char ch = jsf.jsf_value[lpc];
+
+        if (ch == '\\') {
+            lpc += 1;
+            switch (jsf.jsf_value[lpc]) {
+                case 'b':
+                    ch = '\b';
+                    break;
+                case 'f':
+                    ch = '\f';
+                    break;
+                case 'n':
+                    ch = '\n';
+                    break;
+                case 'r':
+                    ch = '\r';
+                    break;
+                case 't':
+                    ch = '\t';
+                    break;
+                default:
+                    ch = jsf.jsf_value[lpc];
+                    break;
+            }
+        }
+        out.push_back(ch);
+    }
+}
+
+/**
+ * Index a JSON line using the scanner.  This must give the same results as
+ * the read_json_*() callbacks above, so the line is left alone and false
+ * is returned for anything the scanner does not handle.  Note that the
+ * callbacks are installed with set_static_handler(), so they are called for
+ * every top-level member, not just the ones matching the handler's path.
+ */
+bool external_log_format::scan_json_fields(logline &ll,
+                                           shared_buffer_ref &sbr,
+                                           int &sub_line_count)
+{
+    auto &fields = this->jlf_scan_fields;
+    auto &infos = this->jlf_scan_infos;
+
+    if (!json_scan_object(sbr.get_data(), sbr.length(), fields)) {
+        return false;
+    }
+
+    infos.resize(fields.size());
+    for (size_t lpc = 0; lpc < fields.size(); lpc++) {
+        const auto &jsf = fields[lpc];
+
+        // yajl would pass the decoded key to the callbacks.
+        if (jsf.jsf_key_escaped) {
+            return false;
+        }
+
+        auto iter = lower_bound(
+            this->jlf_field_infos.begin(), this->jlf_field_infos.end(),
+            jsf,
+            [](const pair<string, json_field_info> &lhs,
+               const json_scan_field &rhs) {
+                return lhs.first.compare(
+                    0, string::npos, rhs.jsf_key, rhs.jsf_key_len) < 0;
+            });
+
+        if (iter != this->jlf_field_infos.end() &&
+            iter->first.compare(
+                0, string::npos, jsf.jsf_key, jsf.jsf_key_len) == 0) {
+            infos[lpc] = &iter->second;
+            if (jsf.jsf_type == JST_STRING && jsf.jsf_unicode_escaped &&
+                (iter->second.jfi_timestamp ||
+                 iter->second.jfi_level ||
+                 iter->second.jfi_opid)) {
+                return false;
+            }
+        }
+        else {
+            infos[lpc] = nullptr;
+        }
+    }
+
+    static thread_local string decoded;
+
+    for (size_t lpc = 0; lpc < fields.size(); lpc++) {
+        const auto &jsf = fields[lpc];
+        const auto *info = infos[lpc];
+        long newlines = jsf.jsf_type == JST_STRING ? jsf.jsf_newlines : 0;
+
+        if (info == nullptr) {
+            sub_line_count += this->jlf_hide_extra ? 0 : newlines + 1;
+            continue;
+        }
+
+        sub_line_count += info->jfi_line_count +
+                          newlines * info->jfi_line_count_per_newline;
+
+        switch (jsf.jsf_type) {
+            case JST_INTEGER:
+                if (info->jfi_timestamp) {
+                    long long divisor = this->elf_timestamp_divisor;
+                    long long val = jsf.jsf_integer;
+                    struct timeval tv;
+
+                    tv.tv_sec = val / divisor;
+                    tv.tv_usec = (val % divisor) * (1000000.0 / divisor);
+                    ll.set_time(tv);
+                }
+                else if (info->jfi_level) {
+                    if (this->elf_level_pairs.empty()) {
+                        char level_buf[128];
+
+                        snprintf(level_buf, sizeof(level_buf), "%lld",
+                                 (long long) jsf.jsf_integer);
+
+                        pcre_input pi(level_buf);
+                        pcre_context::capture_t level_cap = {
+                            0, (int) strlen(level_buf)
+                        };
+
+                        ll.set_level(this->convert_level(pi, &level_cap));
+                    } else {
+                        for (const auto &pair : this->elf_level_pairs) {
+                            if (pair.first == jsf.jsf_integer) {
+                                ll.set_level(pair.second);
+                                break;
+                            }
+                        }
+                    }
+                }
+                break;
+            case JST_DOUBLE:
+                if (info->jfi_timestamp) {
+                    double divisor = this->elf_timestamp_divisor;
+                    struct timeval tv;
+
+                    tv.tv_sec = jsf.jsf_double / divisor;
+                    tv.tv_usec = fmod(jsf.jsf_double, divisor) *
+                                 (1000000.0 / divisor);
+                    ll.set_time(tv);
+                }
+                break;
+            case JST_STRING: {
+                const char *str = jsf.jsf_value;
+                size_t len = jsf.jsf_value_len;
+
+                if (!info->jfi_timestamp && !info->jfi_level &&
+                    !info->jfi_opid) {
+                    break;
+                }
+                if (jsf.jsf_escaped) {
+                    decode_json_string(jsf, decoded);
+                    str = decoded.c_str();
+                    len = decoded.size();
+                }
+
+                if (info->jfi_timestamp) {
+                    struct exttm tm_out;
+                    struct timeval tv_out;
+
+                    this->lf_date_time.scan(str, len,
+                                            this->get_timestamp_formats(),
+                                            &tm_out, tv_out);
+                    this->lf_timestamp_flags =
+                        tm_out.et_flags & ~ETF_MACHINE_ORIENTED;
+                    ll.set_time(tv_out);
+                }
+                else if (info->jfi_level) {
+                    pcre_input pi(str, 0, len);
+                    pcre_context::capture_t level_cap = {0, (int) len};
+
+                    ll.set_level(this->convert_level(pi, &level_cap));
+                }
+                else {
+                    ll.set_opid(hash_str(str, len));
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    return true;
+}
+
 log_format::scan_result_t external_log_format::scan(logfile &lf,
                                                     std::vector<logline> &dst,
                                                     off_t offset,
@@ -522,44 +723,48 @@ log_format::scan_result_t external_log_format::scan(logfile &lf,
             return log_format::SCAN_INCOMPLETE;
         }
 
-        yajl_reset(handle);
-        ypc.set_static_handler(json_log_handlers[0]);
-        ypc.ypc_userdata = &jlu;
-        ypc.ypc_ignore_unused = true;
-        ypc.ypc_alt_callbacks.yajl_start_array = json_array_start;
-        ypc.ypc_alt_callbacks.yajl_start_map = json_array_start;
-        ypc.ypc_alt_callbacks.yajl_end_array = NULL;
-        ypc.ypc_alt_callbacks.yajl_end_map = NULL;
-        jlu.jlu_format = this;
-        jlu.jlu_base_line = &ll;
-        jlu.jlu_line_value = sbr.get_data();
-        jlu.jlu_line_size = sbr.length();
-        jlu.jlu_handle = handle;
-        if (yajl_parse(handle, line_data, sbr.length()) == yajl_status_ok &&
-            yajl_complete_parse(handle) == yajl_status_ok) {
-            if (ll.get_time() == 0) {
-                return log_format::SCAN_NO_MATCH;
-            }
-
-            jlu.jlu_sub_line_count += this->jlf_line_format_init_count;
-            for (int lpc = 0; lpc < jlu.jlu_sub_line_count; lpc++) {
-                ll.set_sub_offset(lpc);
-                if (lpc > 0) {
-                    ll.set_level((log_level_t) (ll.get_level_and_flags() |
-                        LEVEL_CONTINUED));
+        // Most lines can be handled by the scanner, anything it is not sure
+        // about goes through yajl.
+        if (!this->jlf_use_json_scan ||
+            !this->scan_json_fields(ll, sbr, jlu.jlu_sub_line_count)) {
+            yajl_reset(handle);
+            ypc.set_static_handler(json_log_handlers[0]);
+            ypc.ypc_userdata = &jlu;
+            ypc.ypc_ignore_unused = true;
+            ypc.ypc_alt_callbacks.yajl_start_array = json_array_start;
+            ypc.ypc_alt_callbacks.yajl_start_map = json_array_start;
+            ypc.ypc_alt_callbacks.yajl_end_array = NULL;
+            ypc.ypc_alt_callbacks.yajl_end_map = NULL;
+            jlu.jlu_format = this;
+            jlu.jlu_base_line = &ll;
+            jlu.jlu_line_value = sbr.get_data();
+            jlu.jlu_line_size = sbr.length();
+            jlu.jlu_handle = handle;
+            if (yajl_parse(handle, line_data, sbr.length()) != yajl_status_ok ||
+                yajl_complete_parse(handle) != yajl_status_ok) {
+                unsigned char *msg;
+
+                msg = yajl_get_error(handle, 1, (const unsigned char *)sbr.get_data(), sbr.length());
+                if (msg != NULL) {
+                    log_debug("Unable to parse line at offset %d: %s", offset, msg);
+                    yajl_free_error(handle, msg);
                 }
-                dst.push_back(ll);
+                return log_format::SCAN_INCOMPLETE;
             }
         }
-        else {
-            unsigned char *msg;
 
-            msg = yajl_get_error(handle, 1, (const unsigned char *)sbr.get_data(), sbr.length());
-            if (msg != NULL) {
-                log_debug("Unable to parse line at offset %d: %s", offset, msg);
-                yajl_free_error(handle, msg);
+        if (ll.get_time() == 0) {
+            return log_format::SCAN_NO_MATCH;
+        }
+
+        jlu.jlu_sub_line_count += this->jlf_line_format_init_count;
+        for (int lpc = 0; lpc < jlu.jlu_sub_line_count; lpc++) {
+            ll.set_sub_offset(lpc);
+            if (lpc > 0) {
+                ll.set_level((log_level_t) (ll.get_level_and_flags() |
+                    LEVEL_CONTINUED));
             }
-            return log_format::SCAN_INCOMPLETE;
+            dst.push_back(ll);
         }
 
         return log_format::SCAN_MATCH;
@@ -596,7 +801,8 @@ log_format::scan_result_t external_log_format::scan(logfile &lf,
         const char *last;
         struct exttm log_time_tm;
         struct timeval log_tv;
-        uint8_t mod_index = 0, opid = 0;
+        uint8_t mod_index = 0;
+        uint32_t opid = 0;
 
         if ((last = this->lf_date_time.scan(ts_str,
                                             ts->length(),
@@ -630,6 +836,7 @@ log_format::scan_result_t external_log_format::scan(logfile &lf,
         if (mod_cap != nullptr) {
             intern_string_t mod_name = intern_string::lookup(
                     pi.get_substr_start(mod_cap), mod_cap->length());
+            mutex_guard mg(MODULE_FORMATS_MUTEX);
             auto mod_iter = MODULE_FORMATS.find(mod_name);
 
             if (mod_iter == MODULE_FORMATS.end()) {
@@ -896,7 +1103,9 @@ void external_log_format::rewrite(exec_context &ec,
                              ":" +
                              vd_iter->first.to_string(),
                              1);
-        string field_value = execute_any(ec, vd.vd_rewriter);
+        string field_value = execute_rewriter(ec,
+                                              vd.vd_rewriter_impl,
+                                              vd.vd_rewriter);
         struct line_range adj_origin = iter->origin_in_full_msg(
             value_out.c_str(), value_out.length());
 
@@ -932,7 +1141,7 @@ static int read_json_field(yajlpp_parse_context *ypc, const unsigned char *str,
         jlu->jlu_base_line->set_level(jlu->jlu_format->convert_level(pi, &level_cap));
     }
     else if (jlu->jlu_format->elf_opid_field == field_name) {
-        uint8_t opid = hash_str((const char *) str, len);
+        uint32_t opid = hash_str((const char *) str, len);
         jlu->jlu_base_line->set_opid(opid);
     }
 
@@ -999,19 +1208,134 @@ static int rewrite_json_field(yajlpp_parse_context *ypc, const unsigned char *st
     return 1;
 }
 
+/**
+ * Move the current rendered message into the cache so that it does not have
+ * to be rendered again if it is needed after the next one.
+ */
+void external_log_format::stash_rendered_line()
+{
+    if (this->jlf_cached_offset == -1) {
+        return;
+    }
+
+    int64_t key = render_cache_key(this->jlf_cached_offset,
+                                   this->jlf_cached_full);
+    auto index_iter = this->jlf_render_cache_index.find(key);
+
+    if (index_iter != this->jlf_render_cache_index.end()) {
+        this->jlf_render_cache_size -= index_iter->second->jre_memory_size;
+        this->jlf_render_cache.erase(index_iter->second);
+        this->jlf_render_cache_index.erase(index_iter);
+    }
+
+    this->jlf_render_cache.emplace_front();
+
+    auto &jre = this->jlf_render_cache.front();
+
+    jre.jre_offset = this->jlf_cached_offset;
+    jre.jre_full = this->jlf_cached_full;
+    jre.jre_length = this->jlf_cached_length;
+    jre.jre_time = this->jlf_cached_time;
+    jre.jre_time_skewed = this->jlf_cached_time_skewed;
+    jre.jre_hidden_generation = this->jlf_cached_hidden_generation;
+    jre.jre_line.swap(this->jlf_cached_line);
+    jre.jre_line_offsets.swap(this->jlf_line_offsets);
+    jre.jre_line_values.swap(this->jlf_line_values);
+    jre.jre_line_attrs.swap(this->jlf_line_attrs);
+    jre.jre_memory_size = sizeof(jre) +
+        jre.jre_line.capacity() +
+        jre.jre_line_offsets.capacity() * sizeof(off_t) +
+        jre.jre_line_values.capacity() * sizeof(logline_value) +
+        jre.jre_line_attrs.capacity() * sizeof(string_attr);
+    for (const auto &lv : jre.jre_line_values) {
+        jre.jre_memory_size += lv.lv_sbr.length();
+    }
+    this->jlf_render_cache_size += jre.jre_memory_size;
+    this->jlf_render_cache_index[key] = this->jlf_render_cache.begin();
+    this->jlf_cached_offset = -1;
+
+    while (this->jlf_render_cache_size > JSON_RENDER_CACHE_BUDGET &&
+           this->jlf_render_cache.size() > 1) {
+        auto &lru = this->jlf_render_cache.back();
+
+        this->jlf_render_cache_size -= lru.jre_memory_size;
+        this->jlf_render_cache_index.erase(
+            render_cache_key(lru.jre_offset, lru.jre_full));
+        this->jlf_render_cache.pop_back();
+    }
+}
+
+/**
+ * Make a cached rendering of the given line the current one.
+ *
+ * @return True if the line was in the cache.
+ */
+bool external_log_format::restore_rendered_line(const logline &ll,
+                                                const shared_buffer_ref &sbr,
+                                                bool full_message)
+{
+    int64_t key = render_cache_key(ll.get_offset(), full_message);
+    auto index_iter = this->jlf_render_cache_index.find(key);
+
+    if (index_iter == this->jlf_render_cache_index.end()) {
+        return false;
+    }
+
+    auto entry_iter = index_iter->second;
+    auto &jre = *entry_iter;
+    bool valid = jre.jre_length == sbr.length() &&
+                 jre.jre_time == ll.get_timeval() &&
+                 jre.jre_time_skewed == ll.is_time_skewed() &&
+                 jre.jre_hidden_generation == HIDDEN_GENERATION;
+
+    if (valid) {
+        this->jlf_cached_offset = jre.jre_offset;
+        this->jlf_cached_full = jre.jre_full;
+        this->jlf_cached_length = jre.jre_length;
+        this->jlf_cached_time = jre.jre_time;
+        this->jlf_cached_time_skewed = jre.jre_time_skewed;
+        this->jlf_cached_hidden_generation = jre.jre_hidden_generation;
+        this->jlf_cached_line.swap(jre.jre_line);
+        this->jlf_line_offsets.swap(jre.jre_line_offsets);
+        this->jlf_line_values.swap(jre.jre_line_values);
+        this->jlf_line_attrs.swap(jre.jre_line_attrs);
+    }
+
+    this->jlf_render_cache_size -= jre.jre_memory_size;
+    this->jlf_render_cache_index.erase(index_iter);
+    this->jlf_render_cache.erase(entry_iter);
+
+    return valid;
+}
+
 void external_log_format::get_subline(const logline &ll, shared_buffer_ref &sbr, bool full_message)
 {
     if (this->elf_type == ELF_TYPE_TEXT) {
         return;
     }
 
-    if (this->jlf_cached_offset != ll.get_offset() ||
-        this->jlf_cached_full != full_message) {
+    bool cached = this->jlf_cached_offset == ll.get_offset() &&
+                  this->jlf_cached_full == full_message &&
+                  this->jlf_cached_length == sbr.length() &&
+                  this->jlf_cached_time == ll.get_timeval() &&
+                  this->jlf_cached_time_skewed == ll.is_time_skewed() &&
+                  this->jlf_cached_hidden_generation == HIDDEN_GENERATION;
+
+    if (!cached) {
+        this->jlf_share_manager.invalidate_refs();
+        this->stash_rendered_line();
+        cached = this->restore_rendered_line(ll, sbr, full_message);
+    }
+
+    if (cached) {
+        this->jlf_render_cache_stats.scs_hits += 1;
+    }
+    else {
         yajlpp_parse_context &ypc = *(this->jlf_parse_context);
         yajl_handle handle = this->jlf_yajl_handle.in();
         json_log_userdata jlu(sbr);
 
-        this->jlf_share_manager.invalidate_refs();
+        this->jlf_render_cache_stats.scs_misses += 1;
         this->jlf_cached_line.clear();
         this->jlf_line_values.clear();
         this->jlf_line_offsets.clear();
@@ -1246,6 +1570,10 @@ void external_log_format::get_subline(const logline &ll, shared_buffer_ref &sbr,
 
         this->jlf_cached_offset = ll.get_offset();
         this->jlf_cached_full = full_message;
+        this->jlf_cached_length = sbr.length();
+        this->jlf_cached_time = ll.get_timeval();
+        this->jlf_cached_time_skewed = ll.is_time_skewed();
+        this->jlf_cached_hidden_generation = HIDDEN_GENERATION;
     }
 
     off_t this_off = 0, next_off = 0;
@@ -1428,6 +1756,22 @@ void external_log_format::build(std::vector<std::string> &errors) {
         this->elf_pattern_order.push_back(iter->second);
     }
 
+    if (this->elf_type == ELF_TYPE_TEXT) {
+        bool has_line_pattern = false;
+
+        this->lf_first_bytes.reset();
+        for (const auto &pat : this->elf_pattern_order) {
+            if (pat->p_module_format) {
+                continue;
+            }
+            this->lf_first_bytes |= pat->p_pcre->first_bytes();
+            has_line_pattern = true;
+        }
+        if (!has_line_pattern) {
+            this->lf_first_bytes.set();
+        }
+    }
+
     if (this->elf_type != ELF_TYPE_TEXT) {
         if (!this->elf_patterns.empty()) {
             errors.push_back("error:" +
@@ -1699,6 +2043,41 @@ void external_log_format::build(std::vector<std::string> &errors) {
         }
     }
 
+    if (this->elf_type == ELF_TYPE_JSON) {
+        map<string, json_field_info> field_infos;
+        auto add_field = [&](const intern_string_t name) -> json_field_info & {
+            auto &jfi = field_infos[name.to_string()];
+            long no_nl = this->value_line_count(name, true);
+            long one_nl = this->value_line_count(
+                name, true, (const unsigned char *) "\n", 1);
+
+            jfi.jfi_line_count = no_nl;
+            jfi.jfi_line_count_per_newline = one_nl - no_nl;
+            // The yajl callbacks are also called for nested values with
+            // the path to the value as the name, like "obj/field" or
+            // "array#".  The scanner only looks at the top level.
+            if (strpbrk(name.get(), "/#") != nullptr) {
+                this->jlf_use_json_scan = false;
+            }
+            return jfi;
+        };
+
+        this->jlf_use_json_scan = true;
+        for (const auto &vd_pair : this->elf_value_defs) {
+            add_field(vd_pair.first);
+        }
+        if (!this->lf_timestamp_field.empty()) {
+            add_field(this->lf_timestamp_field).jfi_timestamp = true;
+        }
+        if (!this->elf_level_field.empty()) {
+            add_field(this->elf_level_field).jfi_level = true;
+        }
+        if (!this->elf_opid_field.empty()) {
+            add_field(this->elf_opid_field).jfi_opid = true;
+        }
+        this->jlf_field_infos.assign(field_infos.begin(), field_infos.end());
+    }
+
     for (auto &hd_pair : this->elf_highlighter_patterns) {
         external_log_format::highlighter_def &hd = hd_pair.second;
         const std::string &pattern = hd.hd_pattern;
@@ -1858,6 +2237,44 @@ public:
         }
     };
 
+    int get_opid_column() const {
+        auto iter = this->elt_format.elf_value_defs.find(
+            this->elt_format.elf_opid_field);
+
+        if (iter == this->elt_format.elf_value_defs.end()) {
+            return -1;
+        }
+
+        const auto &vd = *iter->second;
+
+        // The logline only has a hash of the raw text, so quoted values or
+        // values with a collator might not compare the same.
+        if (vd.vd_kind != logline_value::VALUE_TEXT ||
+            !vd.vd_collate.empty()) {
+            return -1;
+        }
+
+        return vd.vd_column;
+    };
+
+    bool is_indexable_column(int sub_col) const {
+        for (const auto &elf_value_def : this->elt_format.elf_value_defs) {
+            const auto &vd = *elf_value_def.second;
+
+            if (vd.vd_column != sub_col) {
+                continue;
+            }
+
+            // The index is keyed by the exact text, so it can only be used
+            // for plain text values that are compared byte-for-byte.
+            return vd.vd_identifier &&
+                   vd.vd_kind == logline_value::VALUE_TEXT &&
+                   vd.vd_collate.empty();
+        }
+
+        return false;
+    };
+
     void get_foreign_keys(std::vector<std::string> &keys_inout) const
     {
         log_vtab_impl::get_foreign_keys(keys_inout);
@@ -1983,11 +2400,5 @@ int log_format::pattern_index_for_line(uint64_t line_number) const
     return iter->pfl_pat_index;
 }
 
-log_format::pattern_for_lines::pattern_for_lines(
-    uint32_t pfl_line, uint32_t pfl_pat_index) :
-    pfl_line(pfl_line), pfl_pat_index(pfl_pat_index)
-{
-}
-
 /* XXX */
 #include "log_format_impls.cc"
@@ -41,6 +41,8 @@
 
 #include <set>
 #include <list>
+#include <unordered_map>
+#include <bitset>
 #include <string>
 #include <vector>
 #include <limits>
@@ -51,6 +53,7 @@
 #include "pcrepp/pcrepp.hh"
 #include "yajlpp/yajlpp.hh"
 #include "base/lnav_log.hh"
+#include "base/json_scan.hh"
 #include "lnav_util.hh"
 #include "byte_array.hh"
 #include "view_curses.hh"
@@ -64,6 +67,7 @@ class logfile;
 class log_format;
 class log_vtab_manager;
 struct exec_context;
+class field_rewriter;
 
 /**
  * Metadata for a single line in a log file.
@@ -91,13 +95,12 @@ public:
             uint16_t millis,
             log_level_t l,
             uint8_t mod = 0,
-            uint8_t opid = 0)
-        : ll_offset(off),
-          ll_time(t),
-          ll_millis(millis),
-          ll_opid(opid),
+            uint32_t opid = 0)
+        : ll_time(t * USECS_PER_SEC + millis * USECS_PER_MILLI),
+          ll_offset(off),
           ll_sub_offset(0),
           ll_valid_utf(1),
+          ll_opid(opid),
           ll_level(l),
           ll_module_id(mod)
     {
@@ -108,11 +111,11 @@ public:
             const struct timeval &tv,
             log_level_t l,
             uint8_t mod = 0,
-            uint8_t opid = 0)
+            uint32_t opid = 0)
         : ll_offset(off),
-          ll_opid(opid),
           ll_sub_offset(0),
           ll_valid_utf(1),
+          ll_opid(opid),
           ll_level(l),
           ll_module_id(mod)
     {
@@ -128,33 +131,51 @@ public:
     void set_sub_offset(uint16_t suboff) { this->ll_sub_offset = suboff; };
 
     /** @return The timestamp for the line. */
-    time_t get_time() const { return this->ll_time; };
+    time_t get_time() const {
+        return this->ll_time / USECS_PER_SEC - (this->get_usecs() < 0);
+    };
 
     void to_exttm(struct exttm &tm_out) const {
-        tm_out.et_tm = *gmtime(&this->ll_time);
-        tm_out.et_nsec = this->ll_millis * 1000 * 1000;
+        time_t t = this->get_time();
+
+        tm_out.et_tm = *gmtime(&t);
+        tm_out.et_nsec = this->get_millis() * 1000 * 1000;
     };
 
-    void set_time(time_t t) { this->ll_time = t; };
+    void set_time(time_t t) {
+        this->ll_time = t * USECS_PER_SEC + this->get_usecs_in_sec();
+    };
 
     /** @return The millisecond timestamp for the line. */
-    uint16_t get_millis() const { return this->ll_millis; };
+    uint16_t get_millis() const {
+        return this->get_usecs_in_sec() / USECS_PER_MILLI;
+    };
 
-    void set_millis(uint16_t m) { this->ll_millis = m; };
+    void set_millis(uint16_t m) {
+        this->ll_time = this->get_time() * USECS_PER_SEC +
+                        m * USECS_PER_MILLI;
+    };
 
     uint64_t get_time_in_millis() const {
-        return (this->ll_time * 1000ULL + (uint64_t) this->ll_millis);
+        return (this->get_time() * 1000ULL + (uint64_t) this->get_millis());
+    };
+
+    /** @return The timestamp for the line in microseconds. */
+    int64_t get_time_in_micros() const {
+        return this->ll_time;
     };
 
     struct timeval get_timeval() const {
-        struct timeval retval = { this->ll_time, this->ll_millis * 1000 };
+        struct timeval retval = {
+            this->get_time(),
+            (suseconds_t) this->get_usecs_in_sec(),
+        };
 
         return retval;
     };
 
     void set_time(const struct timeval &tv) {
-        this->ll_time = tv.tv_sec;
-        this->ll_millis = tv.tv_usec / 1000;
+        this->ll_time = tv.tv_sec * USECS_PER_SEC + tv.tv_usec;
     };
 
     void set_mark(bool val) {
@@ -214,11 +235,11 @@ public:
         return this->ll_module_id;
     };
 
-    void set_opid(uint8_t opid) {
+    void set_opid(uint32_t opid) {
         this->ll_opid = opid;
     };
 
-    uint8_t get_opid() const {
+    uint32_t get_opid() const {
         return this->ll_opid;
     };
 
@@ -268,36 +289,74 @@ public:
     {
         return (this->ll_time < rhs.ll_time) ||
                (this->ll_time == rhs.ll_time &&
-                this->ll_millis < rhs.ll_millis) ||
-               (this->ll_time == rhs.ll_time &&
-                this->ll_millis == rhs.ll_millis &&
                 this->ll_offset < rhs.ll_offset) ||
                (this->ll_time == rhs.ll_time &&
-                this->ll_millis == rhs.ll_millis &&
                 this->ll_offset == rhs.ll_offset &&
                 this->ll_sub_offset < rhs.ll_sub_offset);
     };
 
-    bool operator<(const time_t &rhs) const { return this->ll_time < rhs; };
+    bool operator<(const time_t &rhs) const {
+        return this->ll_time < to_usecs(rhs);
+    };
 
     bool operator<(const struct timeval &rhs) const {
-        return ((this->ll_time < rhs.tv_sec) ||
-                ((this->ll_time == rhs.tv_sec) &&
-                 (this->ll_millis < (rhs.tv_usec / 1000))));
+        return this->ll_time < to_millis_in_usecs(rhs);
     };
 
     bool operator<=(const struct timeval &rhs) const {
-        return ((this->ll_time < rhs.tv_sec) ||
-                ((this->ll_time == rhs.tv_sec) &&
-                 (this->ll_millis <= (rhs.tv_usec / 1000))));
+        return this->ll_time < to_millis_in_usecs(rhs) + USECS_PER_MILLI;
     };
 private:
-    off_t    ll_offset;
-    time_t   ll_time;
-    unsigned int ll_millis : 10;
-    unsigned int ll_opid : 6;
-    unsigned int ll_sub_offset : 15;
-    unsigned int ll_valid_utf : 1;
+    static const int64_t USECS_PER_SEC = 1000 * 1000;
+    static const int64_t USECS_PER_MILLI = 1000;
+    static const int64_t MAX_SECS =
+        std::numeric_limits<int64_t>::max() / USECS_PER_SEC - 1;
+
+    /**
+     * @return The given time in microseconds, clamped so that sentinels like
+     *   the maximum time_t still compare as expected.
+     */
+    static int64_t to_usecs(time_t t) {
+        if (t > MAX_SECS) {
+            t = MAX_SECS;
+        } else if (t < -MAX_SECS) {
+            t = -MAX_SECS;
+        }
+
+        return t * USECS_PER_SEC;
+    };
+
+    /**
+     * @return The given time truncated to milliseconds, since that is the
+     *   precision that time-based lookups have always worked at.
+     */
+    static int64_t to_millis_in_usecs(const struct timeval &tv) {
+        return to_usecs(tv.tv_sec) +
+               (tv.tv_usec / USECS_PER_MILLI) * USECS_PER_MILLI;
+    };
+
+    /** @return The signed remainder of the microsecond timestamp. */
+    int64_t get_usecs() const {
+        return this->ll_time % USECS_PER_SEC;
+    };
+
+    /** @return The microseconds into the second for the timestamp. */
+    int64_t get_usecs_in_sec() const {
+        int64_t retval = this->get_usecs();
+
+        return retval < 0 ? retval + USECS_PER_SEC : retval;
+    };
+
+    /**
+     * The timestamp in microseconds since the epoch.  It comes first and is
+     * a single integer so that sorting and merging only need to do a single
+     * comparison for lines that are not at the same time.
+     */
+    int64_t  ll_time;
+    uint64_t ll_offset : 48;
+    uint64_t ll_sub_offset : 15;
+    uint64_t ll_valid_utf : 1;
+    uint32_t ll_opid;
     uint8_t  ll_level;
     uint8_t  ll_module_id;
     char     ll_schema[2];
@@ -638,6 +697,21 @@ public:
         };
     };
 
+    /**
+     * Write the detection counters for this format to the debug log.
+     */
+    void log_detect_stats() const {
+        const auto &ds = this->lf_detect_stats;
+
+        log_debug("format detection stats for %s: attempts=%" PRIu64
+                  " skipped=%" PRIu64 " matches=%" PRIu64 " time=%" PRIu64 "us",
+                  this->get_name().get(),
+                  ds.ds_attempts,
+                  ds.ds_skipped,
+                  ds.ds_matches,
+                  ds.ds_nsecs / 1000);
+    };
+
     static log_format *find_root_format(const char *name) {
         std::vector<log_format *> &fmts = get_root_formats();
         for (std::vector<log_format *>::iterator iter = fmts.begin();
@@ -669,6 +743,7 @@ public:
                    lf_timestamp_flags(0),
                    lf_is_self_describing(false),
                    lf_time_ordered(true) {
+        this->lf_first_bytes.set();
     };
 
     virtual ~log_format() { };
@@ -712,6 +787,17 @@ public:
         return false;
     };
 
+    /**
+     * Check if a line that starts with the given byte could be matched by
+     * this format.  Used to skip formats while detecting the format of a
+     * file without running all of their patterns.  This matters most for
+     * files that start with lines no format recognizes, since every root
+     * format is tried on each of those lines.
+     */
+    bool may_start_with(unsigned char ch) const {
+        return this->lf_first_bytes[ch];
+    };
+
     /**
      * Remove redundant data from the log line string.
      *
@@ -747,6 +833,24 @@ public:
     virtual void get_subline(const logline &ll, shared_buffer_ref &sbr, bool full_message = false) {
     };
 
+    /** Counters for the messages rendered by get_subline(). */
+    struct subline_cache_stats {
+        int64_t scs_hits{0};
+        int64_t scs_misses{0};
+    };
+
+    virtual subline_cache_stats get_subline_cache_stats() const {
+        return {};
+    };
+
+    /**
+     * @return True if get_subline() replaces the text of a line, in which
+     *   case the raw contents of the file cannot stand in for the line.
+     */
+    virtual bool has_sublines() const {
+        return false;
+    };
+
     virtual const std::vector<std::string> *get_actions(const logline_value &lv) const {
         return NULL;
     };
@@ -786,7 +890,9 @@ public:
     };
 
     struct pattern_for_lines {
-        pattern_for_lines(uint32_t pfl_line, uint32_t pfl_pat_index);
+        pattern_for_lines(uint32_t pfl_line, uint32_t pfl_pat_index)
+            : pfl_line(pfl_line), pfl_pat_index(pfl_pat_index) {
+        };
 
         uint32_t pfl_line;
         int pfl_pat_index;
@@ -813,7 +919,30 @@ public:
     std::vector<highlighter> lf_highlighters;
     bool lf_is_self_describing;
     bool lf_time_ordered;
+
+    /**
+     * Counters for the work this format has done while detecting the format
+     * of files.
+     */
+    struct detect_stats {
+        /** The number of lines passed to scan(). */
+        uint64_t ds_attempts{0};
+        /** The number of lines skipped because of their first byte. */
+        uint64_t ds_skipped{0};
+        /** The number of lines that matched. */
+        uint64_t ds_matches{0};
+        /** The time spent in scan(), in nanoseconds. */
+        uint64_t ds_nsecs{0};
+    };
+
+    detect_stats lf_detect_stats;
 protected:
+    /**
+     * The bytes that a line can start with and still be matched by this
+     * format.  All of the bits are set if the format cannot tell.
+     */
+    std::bitset<256> lf_first_bytes;
+
     static std::vector<log_format *> lf_root_formats;
 
     struct pcre_format {
@@ -879,6 +1008,7 @@ public:
         bool vd_internal;
         std::vector<std::string> vd_action_list;
         std::string vd_rewriter;
+        std::shared_ptr<field_rewriter> vd_rewriter_impl;
         std::string vd_description;
     };
 
@@ -990,7 +1120,10 @@ public:
             return false;
         }
 
-        vd_iter->second->vd_user_hidden = val;
+        if (vd_iter->second->vd_user_hidden != val) {
+            vd_iter->second->vd_user_hidden = val;
+            HIDDEN_GENERATION += 1;
+        }
         return true;
     };
 
@@ -998,6 +1131,10 @@ public:
         external_log_format *elf = new external_log_format(*this);
         std::unique_ptr<log_format> retval(elf);
 
+        // The index points into our list, so start the copy off empty.
+        elf->clear_render_cache();
+        elf->jlf_cached_offset = -1;
+
         this->lf_pattern_locks.clear();
         if (fmt_lock != -1) {
             elf->lf_pattern_locks.emplace_back(0, fmt_lock);
@@ -1036,6 +1173,14 @@ public:
 
     void get_subline(const logline &ll, shared_buffer_ref &sbr, bool full_message);
 
+    subline_cache_stats get_subline_cache_stats() const {
+        return this->jlf_render_cache_stats;
+    };
+
+    bool has_sublines() const {
+        return this->elf_type != ELF_TYPE_TEXT;
+    };
+
     log_vtab_impl *get_vtab_impl(void) const;
 
     const std::vector<std::string> *get_actions(const logline_value &lv) const {
@@ -1261,6 +1406,11 @@ public:
     };
 
     bool jlf_hide_extra;
+    /**
+     * Incremented when a field is hidden or shown, since the rendered
+     * messages of every format record whether their values are hidden.
+     */
+    static uint64_t HIDDEN_GENERATION;
     std::vector<json_format_element> jlf_line_format;
     int jlf_line_format_init_count{0};
     std::vector<logline_value> jlf_line_values;
@@ -1271,9 +1421,86 @@ public:
     shared_buffer jlf_share_manager;
     std::vector<char> jlf_cached_line;
     string_attrs_t jlf_line_attrs;
+
+    /**
+     * A message rendered by get_subline() that is not the current one.
+     * The view, searches, and SQL queries all read from the same file, so
+     * a single rendered message would be thrown away constantly.
+     */
+    struct json_render_entry {
+        off_t jre_offset;
+        bool jre_full;
+        /** The length of the raw line, in case it was rewritten. */
+        size_t jre_length;
+        /** The time that was rendered, which changes with time offsets. */
+        struct timeval jre_time;
+        bool jre_time_skewed;
+        uint64_t jre_hidden_generation;
+        std::vector<char> jre_line;
+        std::vector<off_t> jre_line_offsets;
+        std::vector<logline_value> jre_line_values;
+        string_attrs_t jre_line_attrs;
+        size_t jre_memory_size{0};
+    };
+
+    /** The memory used by rendered messages in each file. */
+    static const size_t JSON_RENDER_CACHE_BUDGET = 4 * 1024 * 1024;
+
+    /** The rendered messages, most recently used first. */
+    std::list<json_render_entry> jlf_render_cache;
+    std::unordered_map<int64_t, std::list<json_render_entry>::iterator>
+        jlf_render_cache_index;
+    size_t jlf_render_cache_size{0};
+    struct timeval jlf_cached_time{0, 0};
+    bool jlf_cached_time_skewed{false};
+    uint64_t jlf_cached_hidden_generation{0};
+    size_t jlf_cached_length{0};
+    subline_cache_stats jlf_render_cache_stats;
     std::shared_ptr<yajlpp_parse_context> jlf_parse_context;
     auto_mem<yajl_handle_t> jlf_yajl_handle;
+
+    /** What scan() needs to know about a top-level field in a JSON log. */
+    struct json_field_info {
+        /** The value_line_count() for a value without any newlines. */
+        long jfi_line_count{0};
+        /** How much the line count grows for each newline in the value. */
+        long jfi_line_count_per_newline{0};
+        bool jfi_timestamp{false};
+        bool jfi_level{false};
+        bool jfi_opid{false};
+    };
+
+    /**
+     * True if JSON lines can be indexed with json_scan_object() instead of
+     * yajl.  Formats that refer to nested fields need the full parser.
+     */
+    bool jlf_use_json_scan{false};
+    /** The fields with special handling, sorted by name. */
+    std::vector<std::pair<std::string, json_field_info>> jlf_field_infos;
+    std::vector<json_scan_field> jlf_scan_fields;
+    std::vector<const json_field_info *> jlf_scan_infos;
 private:
+    bool scan_json_fields(logline &ll,
+                          shared_buffer_ref &sbr,
+                          int &sub_line_count);
+
+    static int64_t render_cache_key(off_t offset, bool full_message) {
+        return (offset << 1) | (full_message ? 1 : 0);
+    };
+
+    void stash_rendered_line();
+
+    bool restore_rendered_line(const logline &ll,
+                               const shared_buffer_ref &sbr,
+                               bool full_message);
+
+    void clear_render_cache() {
+        this->jlf_render_cache.clear();
+        this->jlf_render_cache_index.clear();
+        this->jlf_render_cache_size = 0;
+        this->jlf_render_cache_stats = {};
+    };
+
     const intern_string_t elf_name;
 
     static uint8_t module_scan(const pcre_input &pi,
@@ -410,7 +410,7 @@ public:
         struct exttm tm;
         bool found_ts = false;
         log_level_t level = LEVEL_INFO;
-        uint8_t opid = 0;
+        uint32_t opid = 0;
 
         ss.with_separator(this->blf_separator.get());
 
@@ -173,8 +173,10 @@ static int read_format_bool(yajlpp_parse_context *ypc, int val)
             elf->elf_type = external_log_format::ELF_TYPE_JSON;
         }
     }
-    else if (field_name == "hide-extra")
+    else if (field_name == "hide-extra") {
         elf->jlf_hide_extra = val;
+        external_log_format::HIDDEN_GENERATION += 1;
+    }
     else if (field_name == "multiline")
         elf->elf_multiline = val;
 
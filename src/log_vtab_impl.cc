@@ -34,6 +34,7 @@
 #include "log_vtab_impl.hh"
 #include "yajlpp/yajlpp_def.hh"
 #include "vtab_module.hh"
+#include "strnatcmp.h"
 
 #include "logfile_sub_source.hh"
 
@@ -159,17 +160,618 @@ pair<int, unsigned int> log_vtab_impl::logline_value_to_sqlite_type(logline_valu
     return make_pair(type, subtype);
 }
 
+/**
+ * An index of the values in an identifier column for the lines in a file.
+ * The index is built the first time a query looks up a value in the column
+ * and is extended with any lines that were appended to the file since.
+ */
+struct file_value_index {
+    std::weak_ptr<logfile> fvi_file;
+    /**
+     * The number of lines in the file that have been indexed.  The last
+     * message in the file is never indexed since more data can still be
+     * appended to it, so it is always a candidate instead.
+     */
+    size_t fvi_line_count{0};
+    std::unordered_map<std::string, std::vector<uint32_t>> fvi_lines;
+    /**
+     * Lines from a module format in a file with a different format.  The
+     * values for these are not indexed, so they are always candidates.
+     */
+    std::vector<uint32_t> fvi_module_lines;
+};
+
+/**
+ * The values of the format-specific columns that were extracted from the
+ * lines in a file.  The values are kept in blocks of lines and strings are
+ * dictionary-encoded, so queries that revisit lines do not need to read
+ * and parse the messages again.  The last message in the file is never
+ * cached since it is re-read when more data is appended to the file.  The
+ * caches share a memory budget and the ones for files that were not
+ * scanned recently are dropped first when it runs out.
+ */
+struct file_column_cache {
+    enum value_state : uint8_t {
+        VS_UNKNOWN,
+        VS_NULL,
+        VS_INTEGER,
+        VS_FLOAT,
+        VS_TEXT,
+        VS_JSON,
+    };
+
+    /** The number of lines in a block of values. */
+    static const size_t BLOCK_LINES = 1024;
+
+    /**
+     * The values of a column for a range of lines.  Blocks, and the arrays
+     * for each type of value in them, are only allocated when a line in
+     * their range is stored, so querying a few lines in a large file does
+     * not cost much.
+     */
+    struct block {
+        uint8_t b_states[BLOCK_LINES];
+        std::unique_ptr<int64_t[]> b_integers;
+        std::unique_ptr<double[]> b_floats;
+        std::unique_ptr<uint32_t[]> b_strings;
+    };
+
+    struct column {
+        std::vector<std::unique_ptr<block>> c_blocks;
+    };
+
+    std::weak_ptr<logfile> fcc_file;
+    /** The number of lines in the file when values were last stored. */
+    size_t fcc_line_count{0};
+    /** The value of vtab::scan_count when this cache was last used. */
+    uint64_t fcc_last_scan{0};
+    /** The approximate number of bytes used by this cache. */
+    size_t fcc_memory_size{0};
+    std::vector<column> fcc_columns;
+    std::unordered_map<std::string, uint32_t> fcc_dict_ids;
+    std::vector<const std::string *> fcc_dict;
+
+    const block *find_block(size_t sub_col, uint64_t line_number) const {
+        if (sub_col >= this->fcc_columns.size()) {
+            return nullptr;
+        }
+
+        const auto &blocks = this->fcc_columns[sub_col].c_blocks;
+        size_t index = line_number / BLOCK_LINES;
+
+        if (index >= blocks.size()) {
+            return nullptr;
+        }
+
+        return blocks[index].get();
+    };
+
+    block &get_block(size_t sub_col, uint64_t line_number) {
+        auto &blocks = this->fcc_columns[sub_col].c_blocks;
+        size_t index = line_number / BLOCK_LINES;
+
+        if (index >= blocks.size()) {
+            this->fcc_memory_size += (index + 1 - blocks.size()) *
+                                     sizeof(std::unique_ptr<block>);
+            blocks.resize(index + 1);
+        }
+        if (!blocks[index]) {
+            blocks[index].reset(new block());
+            this->fcc_memory_size += sizeof(block);
+        }
+
+        return *blocks[index];
+    };
+
+    bool has_value(uint64_t line_number, size_t sub_col) const {
+        const block *blk = this->find_block(sub_col, line_number);
+
+        return blk != nullptr &&
+               blk->b_states[line_number % BLOCK_LINES] != VS_UNKNOWN;
+    };
+
+    uint32_t intern(const std::string &str) {
+        auto iter = this->fcc_dict_ids.find(str);
+
+        if (iter == this->fcc_dict_ids.end()) {
+            iter = this->fcc_dict_ids.emplace(str, this->fcc_dict.size()).first;
+            this->fcc_dict.push_back(&iter->first);
+            this->fcc_memory_size += sizeof(std::string) + str.size() +
+                                     sizeof(uint32_t) +
+                                     sizeof(const std::string *);
+        }
+
+        return iter->second;
+    };
+
+    template<typename T>
+    T *get_array(std::unique_ptr<T[]> &array) {
+        if (!array) {
+            array.reset(new T[BLOCK_LINES]);
+            this->fcc_memory_size += BLOCK_LINES * sizeof(T);
+        }
+
+        return array.get();
+    };
+
+    /**
+     * @return The number of bytes, not counting new dictionary strings,
+     *   that the cache would grow by if the given values were stored.
+     */
+    size_t store_cost(uint64_t line_number,
+                      size_t column_count,
+                      const std::vector<logline_value> &values) const;
+
+    void store(uint64_t line_number,
+               size_t column_count,
+               const std::vector<logline_value> &values);
+
+    void to_sqlite(sqlite3_context *ctx,
+                   uint64_t line_number,
+                   size_t sub_col) const;
+};
+
+size_t file_column_cache::store_cost(uint64_t line_number,
+                                     size_t column_count,
+                                     const std::vector<logline_value> &values) const
+{
+    size_t retval = 0;
+
+    for (size_t sub_col = 0; sub_col < column_count; sub_col++) {
+        if (this->find_block(sub_col, line_number) == nullptr) {
+            retval += sizeof(block);
+        }
+    }
+
+    for (const auto &lv : values) {
+        if (lv.lv_column < 0 || lv.lv_column >= (int) column_count) {
+            continue;
+        }
+
+        const block *blk = this->find_block(lv.lv_column, line_number);
+
+        switch (lv.lv_kind) {
+            case logline_value::VALUE_BOOLEAN:
+            case logline_value::VALUE_INTEGER:
+                if (blk == nullptr || !blk->b_integers) {
+                    retval += BLOCK_LINES * sizeof(int64_t);
+                }
+                break;
+            case logline_value::VALUE_FLOAT:
+                if (blk == nullptr || !blk->b_floats) {
+                    retval += BLOCK_LINES * sizeof(double);
+                }
+                break;
+            case logline_value::VALUE_JSON:
+            case logline_value::VALUE_STRUCT:
+            case logline_value::VALUE_TEXT:
+            case logline_value::VALUE_TIMESTAMP:
+            case logline_value::VALUE_QUOTED:
+                if (blk == nullptr || !blk->b_strings) {
+                    retval += BLOCK_LINES * sizeof(uint32_t);
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    return retval;
+}
+
+void file_column_cache::store(uint64_t line_number,
+                              size_t column_count,
+                              const std::vector<logline_value> &values)
+{
+    size_t offset = line_number % BLOCK_LINES;
+
+    if (this->fcc_columns.size() < column_count) {
+        this->fcc_columns.resize(column_count);
+    }
+    for (size_t sub_col = 0; sub_col < column_count; sub_col++) {
+        this->get_block(sub_col, line_number).b_states[offset] = VS_NULL;
+    }
+
+    for (const auto &lv : values) {
+        if (lv.lv_column < 0 || lv.lv_column >= (int) column_count) {
+            continue;
+        }
+
+        auto &blk = this->get_block(lv.lv_column, line_number);
+        uint8_t state;
+
+        switch (lv.lv_kind) {
+            case logline_value::VALUE_BOOLEAN:
+            case logline_value::VALUE_INTEGER:
+                this->get_array(blk.b_integers)[offset] = lv.lv_value.i;
+                state = VS_INTEGER;
+                break;
+            case logline_value::VALUE_FLOAT:
+                this->get_array(blk.b_floats)[offset] = lv.lv_value.d;
+                state = VS_FLOAT;
+                break;
+            case logline_value::VALUE_JSON:
+            case logline_value::VALUE_STRUCT:
+            case logline_value::VALUE_TEXT:
+            case logline_value::VALUE_TIMESTAMP:
+            case logline_value::VALUE_QUOTED:
+                this->get_array(blk.b_strings)[offset] =
+                    this->intern(lv.to_string());
+                state = lv.lv_kind == logline_value::VALUE_JSON ?
+                        VS_JSON : VS_TEXT;
+                break;
+            default:
+                state = VS_NULL;
+                break;
+        }
+        blk.b_states[offset] = state;
+    }
+}
+
+void file_column_cache::to_sqlite(sqlite3_context *ctx,
+                                  uint64_t line_number,
+                                  size_t sub_col) const
+{
+    const block &blk = *this->find_block(sub_col, line_number);
+    size_t offset = line_number % BLOCK_LINES;
+
+    switch (blk.b_states[offset]) {
+        case VS_INTEGER:
+            sqlite3_result_int64(ctx, blk.b_integers[offset]);
+            break;
+        case VS_FLOAT:
+            sqlite3_result_double(ctx, blk.b_floats[offset]);
+            break;
+        case VS_TEXT:
+        case VS_JSON: {
+            const std::string &str = *this->fcc_dict[blk.b_strings[offset]];
+
+            // The cache can be dropped before the statement is done with
+            // the value, so it needs to be copied.
+            sqlite3_result_text(ctx, str.c_str(), str.length(),
+                                SQLITE_TRANSIENT);
+            if (blk.b_states[offset] == VS_JSON) {
+                sqlite3_result_subtype(ctx, 74);
+            }
+            break;
+        }
+        default:
+            sqlite3_result_null(ctx);
+            break;
+    }
+}
+
 struct vtab {
     sqlite3_vtab        base;
     sqlite3 *           db;
     textview_curses *tc;
     logfile_sub_source *lss;
     log_vtab_impl *     vi;
+    /** The value indexes for each format-specific column and file. */
+    std::map<int, std::map<const logfile *, file_value_index>> value_indexes;
+    /** The cached column values for each file. */
+    std::map<const logfile *, file_column_cache> column_caches;
+    /** The number of scans started on this table, used to age the caches. */
+    uint64_t scan_count{0};
+    /** The approximate number of bytes used by all of the column caches. */
+    size_t column_cache_size{0};
+};
+
+/** The amount of memory that the column caches for a table can use. */
+static const size_t COLUMN_CACHE_BUDGET = 64 * 1024 * 1024;
+
+static file_column_cache &get_column_cache(vtab *vt,
+                                           const shared_ptr<logfile> &lf)
+{
+    auto cache_iter = vt->column_caches.find(lf.get());
+
+    if (cache_iter == vt->column_caches.end() ||
+        cache_iter->second.fcc_file.lock() != lf ||
+        lf->size() < cache_iter->second.fcc_line_count) {
+        for (auto iter = vt->column_caches.begin();
+             iter != vt->column_caches.end(); ) {
+            if (iter->second.fcc_file.expired()) {
+                vt->column_cache_size -= iter->second.fcc_memory_size;
+                iter = vt->column_caches.erase(iter);
+            }
+            else {
+                ++iter;
+            }
+        }
+
+        auto &fcc = vt->column_caches[lf.get()];
+
+        vt->column_cache_size -= fcc.fcc_memory_size;
+        fcc = file_column_cache();
+        fcc.fcc_file = lf;
+        cache_iter = vt->column_caches.find(lf.get());
+    }
+    cache_iter->second.fcc_line_count = lf->size();
+    cache_iter->second.fcc_last_scan = vt->scan_count;
+
+    return cache_iter->second;
+}
+
+/**
+ * Make room in the column cache budget by dropping the caches for files
+ * that were not used by the current scan, least recently used first.
+ *
+ * @param fcc The cache that needs the room.
+ * @param size The number of bytes needed.
+ * @return True if there is room for the given number of bytes.
+ */
+static bool reserve_column_cache(vtab *vt,
+                                 const file_column_cache &fcc,
+                                 size_t size)
+{
+    while (vt->column_cache_size + size > COLUMN_CACHE_BUDGET) {
+        auto lru_iter = vt->column_caches.end();
+
+        for (auto iter = vt->column_caches.begin();
+             iter != vt->column_caches.end();
+             ++iter) {
+            if (&iter->second == &fcc ||
+                iter->second.fcc_last_scan == vt->scan_count) {
+                continue;
+            }
+            if (lru_iter == vt->column_caches.end() ||
+                iter->second.fcc_last_scan < lru_iter->second.fcc_last_scan) {
+                lru_iter = iter;
+            }
+        }
+
+        if (lru_iter == vt->column_caches.end()) {
+            return false;
+        }
+
+        log_debug("(%p) dropping column cache of %zu bytes",
+                  vt, lru_iter->second.fcc_memory_size);
+        vt->column_cache_size -= lru_iter->second.fcc_memory_size;
+        vt->column_caches.erase(lru_iter);
+    }
+
+    return true;
+}
+
+/**
+ * Special operator in the constraints passed to vt_filter for an IN
+ * constraint whose values are all passed at once.
+ */
+static const unsigned char VT_CONSTRAINT_IN_LIST = 0xff;
+
+static file_value_index &update_value_index(vtab *vt,
+                                            int sub_col,
+                                            const shared_ptr<logfile> &lf)
+{
+    auto &col_indexes = vt->value_indexes[sub_col];
+
+    for (auto iter = col_indexes.begin(); iter != col_indexes.end(); ) {
+        if (iter->second.fvi_file.expired()) {
+            iter = col_indexes.erase(iter);
+        }
+        else {
+            ++iter;
+        }
+    }
+
+    auto &fvi = col_indexes[lf.get()];
+
+    if (fvi.fvi_file.lock() != lf || lf->size() < fvi.fvi_line_count) {
+        fvi = file_value_index();
+        fvi.fvi_file = lf;
+    }
+
+    log_format *format = lf->get_format();
+    bool same_format = format->get_name() == vt->vi->get_name();
+    shared_buffer_ref msg;
+    string_attrs_t sa;
+    vector<logline_value> values;
+
+    size_t last_message = lf->size();
+
+    while (last_message > fvi.fvi_line_count) {
+        last_message -= 1;
+        if (!(lf->begin() + last_message)->is_continued()) {
+            break;
+        }
+    }
+
+    for (; fvi.fvi_line_count < last_message; fvi.fvi_line_count++) {
+        auto ll = lf->begin() + fvi.fvi_line_count;
+
+        if (ll->is_continued()) {
+            continue;
+        }
+
+        if (!same_format) {
+            if (ll->get_module_id()) {
+                fvi.fvi_module_lines.push_back(fvi.fvi_line_count);
+            }
+            continue;
+        }
+
+        lf->read_full_message(ll, msg);
+        sa.clear();
+        values.clear();
+        format->annotate(fvi.fvi_line_count, msg, sa, values, false);
+
+        auto lv_iter = find_if(values.begin(), values.end(),
+                               logline_value_cmp(NULL, sub_col));
+
+        if (lv_iter == values.end() ||
+            lv_iter->lv_kind != logline_value::VALUE_TEXT) {
+            continue;
+        }
+
+        fvi.fvi_lines[string(lv_iter->text_value(), lv_iter->text_length())]
+            .push_back(fvi.fvi_line_count);
+    }
+
+    return fvi;
+}
+
+/**
+ * Look up the visible lines with the given values in a column.
+ *
+ * @return The sorted list of lines.
+ */
+static vector<vis_line_t> lookup_value_index(vtab *vt,
+                                             int sub_col,
+                                             const vector<string> &keys)
+{
+    vector<vis_line_t> retval;
+
+    for (auto iter = vt->lss->cbegin(); iter != vt->lss->cend(); ++iter) {
+        if (*iter == nullptr || (*iter)->get_file() == nullptr) {
+            continue;
+        }
+
+        auto lf = (*iter)->get_file();
+        auto &fvi = update_value_index(vt, sub_col, lf);
+        content_line_t base(distance(vt->lss->cbegin(), iter) *
+                            logfile_sub_source::MAX_LINES_PER_FILE);
+        auto add_line = [&](uint32_t line) {
+            auto vl_opt = vt->lss->find_from_content(
+                content_line_t(base + line));
+
+            if (vl_opt) {
+                retval.push_back(vl_opt.value());
+            }
+        };
+
+        for (const auto &key : keys) {
+            auto lines_iter = fvi.fvi_lines.find(key);
+
+            if (lines_iter != fvi.fvi_lines.end()) {
+                for_each(lines_iter->second.begin(),
+                         lines_iter->second.end(),
+                         add_line);
+            }
+        }
+        for_each(fvi.fvi_module_lines.begin(),
+                 fvi.fvi_module_lines.end(),
+                 add_line);
+        for (size_t line = fvi.fvi_line_count; line < lf->size(); line++) {
+            if (!(lf->begin() + line)->is_continued()) {
+                add_line(line);
+            }
+        }
+    }
+
+    sort(retval.begin(), retval.end());
+    retval.erase(unique(retval.begin(), retval.end()), retval.end());
+
+    return retval;
+}
+
+/**
+ * Constraints from the WHERE clause that can be checked using the index
+ * instead of reading and parsing the log message.  SQLite still checks
+ * the constraints on the rows that are returned, so these only need to
+ * skip the rows that can never match.
+ */
+struct log_line_filter {
+    std::vector<std::pair<unsigned char, log_level_t>> llf_levels;
+    nonstd::optional<bool> llf_mark;
+    nonstd::optional<uint32_t> llf_opid;
+    /** Indexed by the position of the file in the logfile_sub_source. */
+    std::vector<bool> llf_files;
+
+    void clear() {
+        this->llf_levels.clear();
+        this->llf_mark = nonstd::nullopt;
+        this->llf_opid = nonstd::nullopt;
+        this->llf_files.clear();
+    };
+
+    bool empty() const {
+        return this->llf_levels.empty() &&
+               !this->llf_mark &&
+               !this->llf_opid &&
+               this->llf_files.empty();
+    };
+
+    bool matches(logfile_sub_source &lss,
+                 const log_vtab_impl &vi,
+                 vis_line_t vl) const;
 };
 
+bool log_line_filter::matches(logfile_sub_source &lss,
+                              const log_vtab_impl &vi,
+                              vis_line_t vl) const
+{
+    if (this->empty()) {
+        return true;
+    }
+
+    content_line_t cl(lss.at(vl));
+    uint64_t line_number;
+    auto ld = lss.find_data(cl, line_number);
+    size_t file_index = cl / logfile_sub_source::MAX_LINES_PER_FILE;
+
+    if (!this->llf_files.empty() &&
+        (file_index >= this->llf_files.size() ||
+         !this->llf_files[file_index])) {
+        return false;
+    }
+
+    logfile *lf = ld->get_file_ptr();
+    auto ll = lf->begin() + line_number;
+
+    for (const auto &level_pair : this->llf_levels) {
+        int diff = ll->get_msg_level() - level_pair.second;
+
+        switch (level_pair.first) {
+            case SQLITE_INDEX_CONSTRAINT_EQ:
+                if (diff != 0) {
+                    return false;
+                }
+                break;
+            case SQLITE_INDEX_CONSTRAINT_GT:
+                if (diff <= 0) {
+                    return false;
+                }
+                break;
+            case SQLITE_INDEX_CONSTRAINT_GE:
+                if (diff < 0) {
+                    return false;
+                }
+                break;
+            case SQLITE_INDEX_CONSTRAINT_LT:
+                if (diff >= 0) {
+                    return false;
+                }
+                break;
+            case SQLITE_INDEX_CONSTRAINT_LE:
+                if (diff > 0) {
+                    return false;
+                }
+                break;
+        }
+    }
+
+    if (this->llf_mark && ll->is_marked() != this->llf_mark.value()) {
+        return false;
+    }
+
+    // The opid column only comes from the format of the table, lines from
+    // a module format have their own opid.
+    if (this->llf_opid &&
+        lf->get_format()->get_name() == vi.get_name() &&
+        ll->get_opid() != this->llf_opid.value()) {
+        return false;
+    }
+
+    return true;
+}
+
 struct vtab_cursor {
     sqlite3_vtab_cursor        base;
     struct log_cursor          log_cursor;
+    log_line_filter            line_filter;
+    /** If use_index_rows is true, the only lines that need to be visited. */
+    bool                       use_index_rows{false};
+    std::vector<vis_line_t>    index_rows;
     shared_buffer_ref          log_msg;
     std::vector<logline_value> line_values;
 };
@@ -187,11 +789,7 @@ static int vt_create(sqlite3 *db,
     vtab *p_vt;
 
     /* Allocate the sqlite3_vtab/vtab structure itself */
-    p_vt = (vtab *)sqlite3_malloc(sizeof(*p_vt));
-
-    if (p_vt == NULL) {
-        return SQLITE_NOMEM;
-    }
+    p_vt = new vtab();
 
     memset(&p_vt->base, 0, sizeof(sqlite3_vtab));
     p_vt->db = db;
@@ -199,6 +797,7 @@ static int vt_create(sqlite3 *db,
     /* Declare the vtable's structure */
     p_vt->vi = vm->lookup_impl(intern_string::lookup(argv[3]));
     if (p_vt->vi == NULL) {
+        delete p_vt;
         return SQLITE_ERROR;
     }
     p_vt->tc = vm->get_view();
@@ -217,8 +816,7 @@ static int vt_destructor(sqlite3_vtab *p_svt)
 {
     vtab *p_vt = (vtab *)p_svt;
 
-    /* Free the SQLite structure */
-    sqlite3_free(p_vt);
+    delete p_vt;
 
     return SQLITE_OK;
 }
@@ -292,7 +890,23 @@ static int vt_next(sqlite3_vtab_cursor *cur)
              log_vtab_data.lvd_progress(log_cursor_latest))) {
             break;
         }
+        if (vc->use_index_rows) {
+            auto row_iter = lower_bound(vc->index_rows.begin(),
+                                        vc->index_rows.end(),
+                                        vc->log_cursor.lc_curr_line + 1_vl);
+
+            if (row_iter == vc->index_rows.end()) {
+                vc->log_cursor.lc_curr_line = vc->log_cursor.lc_end_line;
+                break;
+            }
+            vc->log_cursor.lc_curr_line = *row_iter - 1_vl;
+        }
         done = vt->vi->next(vc->log_cursor, *vt->lss);
+        if (done && !vc->log_cursor.is_eof() &&
+            !vc->line_filter.matches(*vt->lss, *vt->vi,
+                                     vc->log_cursor.lc_curr_line)) {
+            done = false;
+        }
     } while (!done);
 
     return SQLITE_OK;
@@ -563,12 +1177,35 @@ static int vt_column(sqlite3_vtab_cursor *cur, sqlite3_context *ctx, int col)
             }
         }
         else {
+            size_t sub_col = col - VT_COL_MAX;
+            auto &fcc = get_column_cache(vt, lf);
+
+            if (fcc.has_value(line_number, sub_col)) {
+                fcc.to_sqlite(ctx, line_number, sub_col);
+                break;
+            }
+
             if (vc->line_values.empty()) {
                 lf->read_full_message(ll, vc->log_msg);
                 vt->vi->extract(lf, line_number, vc->log_msg, vc->line_values);
             }
 
-            size_t sub_col = col - VT_COL_MAX;
+            auto next_ll = ll + 1;
+
+            while (next_ll != lf->end() && next_ll->is_continued()) {
+                ++next_ll;
+            }
+            if (next_ll != lf->end() &&
+                reserve_column_cache(vt, fcc, fcc.store_cost(
+                    line_number, vt->vi->vi_column_count, vc->line_values))) {
+                size_t old_size = fcc.fcc_memory_size;
+
+                fcc.store(line_number, vt->vi->vi_column_count, vc->line_values);
+                vt->column_cache_size += fcc.fcc_memory_size - old_size;
+                fcc.to_sqlite(ctx, line_number, sub_col);
+                break;
+            }
+
             std::vector<logline_value>::iterator lv_iter;
 
             lv_iter = find_if(vc->line_values.begin(), vc->line_values.end(),
@@ -699,8 +1336,103 @@ static int vt_filter(sqlite3_vtab_cursor *p_vtc,
         sqlite3_index_info::sqlite3_index_constraint *)idxStr;
 
     log_info("(%p) filter called: %d", vt, idxNum);
+    vt->scan_count += 1;
+    p_cur->line_filter.clear();
+    p_cur->use_index_rows = false;
+    p_cur->index_rows.clear();
+    for (int lpc = 0; lpc < idxNum; lpc++) {
+        int col = index[lpc].iColumn;
+
+        if (col >= VT_COL_MAX &&
+            vt->vi->is_indexable_column(col - VT_COL_MAX)) {
+            vector<string> keys;
+
+            if (index[lpc].op == VT_CONSTRAINT_IN_LIST) {
+#if SQLITE_VERSION_NUMBER >= 3038000
+                sqlite3_value *in_value;
+                int rc;
+
+                for (rc = sqlite3_vtab_in_first(argv[lpc], &in_value);
+                     rc == SQLITE_OK && in_value != nullptr;
+                     rc = sqlite3_vtab_in_next(argv[lpc], &in_value)) {
+                    if (sqlite3_value_type(in_value) != SQLITE_NULL) {
+                        keys.emplace_back(
+                            (const char *) sqlite3_value_text(in_value));
+                    }
+                }
+#endif
+            }
+            else if (sqlite3_value_type(argv[lpc]) != SQLITE_NULL) {
+                keys.emplace_back((const char *) sqlite3_value_text(argv[lpc]));
+            }
+
+            auto rows = lookup_value_index(vt, col - VT_COL_MAX, keys);
+
+            if (p_cur->use_index_rows) {
+                vector<vis_line_t> both;
+
+                set_intersection(p_cur->index_rows.begin(),
+                                 p_cur->index_rows.end(),
+                                 rows.begin(), rows.end(),
+                                 back_inserter(both));
+                rows = std::move(both);
+            }
+            p_cur->index_rows = std::move(rows);
+            p_cur->use_index_rows = true;
+            continue;
+        }
+
+        if (sqlite3_value_type(argv[lpc]) == SQLITE_NULL) {
+            continue;
+        }
+
+        if (col == VT_COL_LEVEL) {
+            const char *level_str = (const char *) sqlite3_value_text(argv[lpc]);
+
+            p_cur->line_filter.llf_levels.emplace_back(
+                index[lpc].op, abbrev2level(level_str, strlen(level_str)));
+        }
+        else if (col == VT_COL_MARK) {
+            if (sqlite3_value_type(argv[lpc]) == SQLITE_INTEGER) {
+                p_cur->line_filter.llf_mark = sqlite3_value_int64(argv[lpc]) != 0;
+            }
+        }
+        else if (vt->vi->get_opid_column() != -1 &&
+                 col == VT_COL_MAX + vt->vi->get_opid_column()) {
+            const char *opid_str = (const char *) sqlite3_value_text(argv[lpc]);
+
+            p_cur->line_filter.llf_opid = hash_str(opid_str, strlen(opid_str));
+        }
+        else if (col == VT_COL_MAX + vt->vi->vi_column_count) {
+            const char *path = (const char *) sqlite3_value_text(argv[lpc]);
+            int path_len = strlen(path);
+            auto &files = p_cur->line_filter.llf_files;
+            bool first = files.empty();
+
+            files.resize(distance(vt->lss->cbegin(), vt->lss->cend()), first);
+            for (auto iter = vt->lss->cbegin(); iter != vt->lss->cend(); ++iter) {
+                auto file_index = distance(vt->lss->cbegin(), iter);
+                logfile *lf = *iter == nullptr ? nullptr : (*iter)->get_file_ptr();
+
+                if (lf == nullptr ||
+                    strnatcasecmp(path_len, path,
+                                  lf->get_filename().length(),
+                                  lf->get_filename().c_str()) != 0) {
+                    files[file_index] = false;
+                }
+            }
+        }
+    }
+
     p_cur->log_cursor.lc_curr_line = vis_line_t(-1);
     p_cur->log_cursor.lc_end_line = vis_line_t(vt->lss->text_line_count());
+    if (!p_cur->line_filter.llf_files.empty() &&
+        find(p_cur->line_filter.llf_files.begin(),
+             p_cur->line_filter.llf_files.end(),
+             true) == p_cur->line_filter.llf_files.end()) {
+        p_cur->log_cursor.set_eof();
+        return SQLITE_OK;
+    }
     vt_next(p_vtc);
 
     if (!idxNum) {
@@ -735,13 +1467,84 @@ static int vt_filter(sqlite3_vtab_cursor *p_vtc,
         }
     }
 
-    while (!p_cur->log_cursor.is_eof() && !vt->vi->is_valid(p_cur->log_cursor, *vt->lss)) {
+    if (p_cur->use_index_rows) {
+        // Move to the first row from the index at or after the position
+        // set by the other constraints.
+        p_cur->log_cursor.lc_curr_line -= 1_vl;
+        vt_next(p_vtc);
+        return SQLITE_OK;
+    }
+
+    while (!p_cur->log_cursor.is_eof() &&
+           (!vt->vi->is_valid(p_cur->log_cursor, *vt->lss) ||
+            !p_cur->line_filter.matches(*vt->lss, *vt->vi,
+                                        p_cur->log_cursor.lc_curr_line))) {
         p_cur->log_cursor.lc_curr_line += vis_line_t(1);
     }
 
     return SQLITE_OK;
 }
 
+/**
+ * Check if a constraint can be checked by the log_line_filter.
+ *
+ * @return The fraction of the rows that are expected to match the
+ * constraint or zero if the constraint cannot be used.
+ */
+static double filter_selectivity(vtab *vt, sqlite3_index_info *p_info, int index)
+{
+    const auto &cons = p_info->aConstraint[index];
+    int opid_col = vt->vi->get_opid_column();
+
+    switch (cons.op) {
+        case SQLITE_INDEX_CONSTRAINT_EQ:
+            break;
+        case SQLITE_INDEX_CONSTRAINT_GT:
+        case SQLITE_INDEX_CONSTRAINT_GE:
+        case SQLITE_INDEX_CONSTRAINT_LT:
+        case SQLITE_INDEX_CONSTRAINT_LE:
+            // Ranges of levels can only be checked when they are compared
+            // using the loglevel collator.
+            if (cons.iColumn != VT_COL_LEVEL) {
+                return 0.0;
+            }
+#if SQLITE_VERSION_NUMBER >= 3022000
+            if (strcmp(sqlite3_vtab_collation(p_info, index), "loglevel") != 0) {
+                return 0.0;
+            }
+            return 0.5;
+#else
+            return 0.0;
+#endif
+        default:
+            return 0.0;
+    }
+
+    if (cons.iColumn == VT_COL_LEVEL) {
+        return 0.1;
+    }
+    if (cons.iColumn == VT_COL_MARK) {
+        return 0.01;
+    }
+    if (opid_col != -1 && cons.iColumn == VT_COL_MAX + opid_col) {
+        // The opid is checked by its hash, which only works when the values
+        // are compared byte-for-byte.
+#if SQLITE_VERSION_NUMBER >= 3022000
+        if (strcmp(sqlite3_vtab_collation(p_info, index), "BINARY") != 0) {
+            return 0.0;
+        }
+        return 0.01;
+#else
+        return 0.0;
+#endif
+    }
+    if (cons.iColumn == VT_COL_MAX + vt->vi->vi_column_count) {
+        return 1.0 / std::max((size_t) 1, vt->lss->file_count());
+    }
+
+    return 0.0;
+}
+
 static int vt_best_index(sqlite3_vtab *tab, sqlite3_index_info *p_info)
 {
     std::vector<sqlite3_index_info::sqlite3_index_constraint> indexes;
@@ -784,6 +1587,57 @@ static int vt_best_index(sqlite3_vtab *tab, sqlite3_index_info *p_info)
         }
     }
 
+    bool has_position = argvInUse > 0;
+    bool has_value_index = false;
+    double estimated_rows = has_position ? 10.0 : vt->lss->text_line_count();
+
+    for (int lpc = 0; lpc < p_info->nConstraint; lpc++) {
+        const auto &cons = p_info->aConstraint[lpc];
+
+        if (!cons.usable ||
+            cons.op != SQLITE_INDEX_CONSTRAINT_EQ ||
+            cons.iColumn < VT_COL_MAX ||
+            !vt->vi->is_indexable_column(cons.iColumn - VT_COL_MAX)) {
+            continue;
+        }
+#if SQLITE_VERSION_NUMBER >= 3022000
+        if (strcmp(sqlite3_vtab_collation(p_info, lpc), "BINARY") != 0) {
+            continue;
+        }
+#endif
+
+        argvInUse += 1;
+        indexes.push_back(cons);
+        p_info->aConstraintUsage[lpc].argvIndex = argvInUse;
+#if SQLITE_VERSION_NUMBER >= 3038000
+        if (sqlite3_vtab_in(p_info, lpc, 1)) {
+            indexes.back().op = VT_CONSTRAINT_IN_LIST;
+        }
+#endif
+        if (!has_value_index) {
+            estimated_rows *= 0.01;
+        }
+        has_value_index = true;
+    }
+
+    for (int lpc = 0; lpc < p_info->nConstraint; lpc++) {
+        if (!p_info->aConstraint[lpc].usable ||
+            p_info->aConstraintUsage[lpc].argvIndex) {
+            continue;
+        }
+
+        double selectivity = filter_selectivity(vt, p_info, lpc);
+
+        if (selectivity == 0.0) {
+            continue;
+        }
+
+        argvInUse += 1;
+        indexes.push_back(p_info->aConstraint[lpc]);
+        p_info->aConstraintUsage[lpc].argvIndex = argvInUse;
+        estimated_rows *= selectivity;
+    }
+
     if (argvInUse) {
         sqlite3_index_info::sqlite3_index_constraint *index_copy;
         size_t len = indexes.size() * sizeof(*index_copy);
@@ -799,7 +1653,20 @@ static int vt_best_index(sqlite3_vtab *tab, sqlite3_index_info *p_info)
         p_info->idxNum = argvInUse;
         p_info->idxStr = (char *) index_copy;
         p_info->needToFreeIdxStr = 1;
-        p_info->estimatedCost = 10.0;
+        if (has_position) {
+            p_info->estimatedCost = 10.0;
+        }
+        else if (has_value_index) {
+            p_info->estimatedCost = std::max(estimated_rows, 1.0);
+        }
+        else {
+            // The filter still has to look at the index for every line, but
+            // that is much cheaper than reading and parsing the message.
+            p_info->estimatedCost = std::max(
+                {estimated_rows, vt->lss->text_line_count() / 100.0, 1.0});
+        }
+        p_info->estimatedRows = std::max((sqlite3_int64) estimated_rows,
+                                         (sqlite3_int64) 1);
     }
 
     return SQLITE_OK;
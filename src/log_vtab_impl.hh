@@ -126,6 +126,24 @@ public:
 
     virtual void get_columns(std::vector<vtab_column> &cols) const { };
 
+    /**
+     * @return The index of the format-specific column that holds the
+     * operation ID, if the value in that column can be checked against the
+     * hash stored in the logline.  Otherwise, -1.
+     */
+    virtual int get_opid_column() const {
+        return -1;
+    };
+
+    /**
+     * @param sub_col The index of a format-specific column.
+     * @return True if equality constraints on the column can be answered
+     * using an index of the column's values.
+     */
+    virtual bool is_indexable_column(int sub_col) const {
+        return false;
+    };
+
     virtual void get_foreign_keys(std::vector<std::string> &keys_inout) const
     {
         keys_inout.emplace_back("log_line");
@@ -42,17 +42,39 @@
 #include <sys/stat.h>
 #include <sys/param.h>
 #include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/time.h>
 
 #include <time.h>
 
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "base/parallel_for.hh"
 #include "base/string_util.hh"
 #include "logfile.hh"
 #include "lnav_util.hh"
+#include "lnav_config.hh"
 
 using namespace std;
 
 static const size_t MAX_UNRECOGNIZED_LINES = 1000;
 static const size_t INDEX_RESERVE_INCREMENT = 1024;
+/** Files with less than this much data left to index are scanned serially. */
+static const off_t PARALLEL_SCAN_MIN_SIZE = 32 * 1024 * 1024;
+static const off_t SCAN_CHUNK_MIN_SIZE = 4 * 1024 * 1024;
+/**
+ * The amount of data scanned by the background thread between merges.  Files
+ * with less than this much data left to index are scanned inline.
+ */
+static const off_t BACKGROUND_CHUNK_SIZE = 1024 * 1024;
+/** The time spent merging background chunks in a call to rebuild_index(). */
+static const auto BACKGROUND_MERGE_BUDGET = std::chrono::milliseconds(10);
+/** The index for files smaller than this is not worth caching. */
+static const off_t INDEX_CACHE_MIN_SIZE = 1024 * 1024;
 
 logfile::logfile(const string &filename, logfile_open_options &loo)
     : lf_filename(filename)
@@ -106,6 +128,7 @@ logfile::logfile(const string &filename, logfile_open_options &loo)
 
 logfile::~logfile()
 {
+    this->stop_background_scan();
 }
 
 bool logfile::exists() const
@@ -135,12 +158,95 @@ void logfile::set_format_base_time(log_format *lf)
     lf->lf_date_time.set_base_time(file_time);
 }
 
+/**
+ * Update the index after a line has been scanned by a format.  Lines that
+ * were not recognized are treated as a continuation of the previous line and
+ * lines that are out of time order are either fixed up or flagged as needing
+ * a sort.
+ *
+ * @return True if the index needs to be sorted.
+ */
+static bool update_index(log_format::scan_result_t found,
+                         const log_format *format,
+                         vector<logline> &index,
+                         size_t prescan_size,
+                         time_t prescan_time,
+                         time_t index_time,
+                         const line_info &li,
+                         uint32_t &out_of_time_order_count)
+{
+    bool retval = false;
+
+    switch (found) {
+        case log_format::SCAN_MATCH:
+            if (!index.empty()) {
+                index.back().set_valid_utf(li.li_valid_utf);
+            }
+            if (!index.empty() && prescan_time != index[0].get_time()) {
+                retval = true;
+            }
+            if (prescan_size > 0 && prescan_size < index.size()) {
+                logline &second_to_last = index[prescan_size - 1];
+                logline &latest = index[prescan_size];
+
+                if (latest < second_to_last) {
+                    if (format->lf_time_ordered) {
+                        out_of_time_order_count += 1;
+                        for (size_t lpc = prescan_size;
+                             lpc < index.size(); lpc++) {
+                            logline &line_to_update = index[lpc];
+
+                            line_to_update.set_time_skew(true);
+                            line_to_update.set_time(
+                                second_to_last.get_timeval());
+                        }
+                    } else {
+                        retval = true;
+                    }
+                }
+            }
+            break;
+        case log_format::SCAN_NO_MATCH: {
+            log_level_t last_level = LEVEL_UNKNOWN;
+            struct timeval last_time = { index_time, 0 };
+            uint8_t last_mod = 0;
+            uint32_t last_opid = 0;
+
+            if (!index.empty()) {
+                logline &ll = index.back();
+
+                /*
+                 * Assume this line is part of the previous one(s) and copy the
+                 * metadata over.
+                 */
+                last_time = ll.get_timeval();
+                if (format != nullptr) {
+                    last_level = (log_level_t)(ll.get_level_and_flags() |
+                        LEVEL_CONTINUED);
+                }
+                last_mod = ll.get_module_id();
+                last_opid = ll.get_opid();
+            }
+            index.emplace_back(li.li_file_range.fr_offset,
+                               last_time,
+                               last_level,
+                               last_mod,
+                               last_opid);
+            index.back().set_valid_utf(li.li_valid_utf);
+            break;
+        }
+        case log_format::SCAN_INCOMPLETE:
+            break;
+    }
+
+    return retval;
+}
+
 bool logfile::process_prefix(shared_buffer_ref &sbr, const line_info &li)
 {
     log_format::scan_result_t found = log_format::SCAN_NO_MATCH;
     size_t prescan_size = this->lf_index.size();
     time_t prescan_time = 0;
-    bool retval = false;
 
     if (this->lf_format.get() != nullptr) {
         if (!this->lf_index.empty()) {
@@ -154,6 +260,8 @@ bool logfile::process_prefix(shared_buffer_ref &sbr, const line_info &li)
         vector<log_format *> &root_formats =
             log_format::get_root_formats();
         vector<log_format *>::iterator iter;
+        auto first_byte = sbr.empty() ?
+            0 : (unsigned char) sbr.get_data()[0];
 
         /*
          * Try each scanner until we get a match.  Fortunately, all the formats
@@ -166,10 +274,25 @@ bool logfile::process_prefix(shared_buffer_ref &sbr, const line_info &li)
                 continue;
             }
 
+            auto &stats = (*iter)->lf_detect_stats;
+
+            if (!sbr.empty() && !(*iter)->may_start_with(first_byte)) {
+                /* None of the format's patterns can match this line. */
+                stats.ds_skipped += 1;
+                found = log_format::SCAN_NO_MATCH;
+                continue;
+            }
+
+            auto scan_start = chrono::steady_clock::now();
+
             (*iter)->clear();
             this->set_format_base_time(*iter);
             found = (*iter)->scan(*this, this->lf_index, li.li_file_range.fr_offset, sbr);
+            stats.ds_attempts += 1;
+            stats.ds_nsecs += chrono::duration_cast<chrono::nanoseconds>(
+                chrono::steady_clock::now() - scan_start).count();
             if (found == log_format::SCAN_MATCH) {
+                stats.ds_matches += 1;
 #if 0
                 require(this->lf_index.size() == 1 ||
                        (this->lf_index[this->lf_index.size() - 2] <
@@ -179,6 +302,7 @@ bool logfile::process_prefix(shared_buffer_ref &sbr, const line_info &li)
                     this->lf_filename.c_str(),
                     this->lf_index.size(),
                     (*iter)->get_name().get());
+                (*iter)->log_detect_stats();
 
                 this->lf_format = (*iter)->specialized();
                 this->set_format_base_time(this->lf_format.get());
@@ -192,80 +316,972 @@ bool logfile::process_prefix(shared_buffer_ref &sbr, const line_info &li)
                 logline &last_line = this->lf_index[this->lf_index.size() - 1];
 
                 for (size_t lpc = 0; lpc < this->lf_index.size() - 1; lpc++) {
-                    this->lf_index[lpc].set_time(last_line.get_time());
-                    this->lf_index[lpc].set_millis(last_line.get_millis());
+                    this->lf_index[lpc].set_time(last_line.get_timeval());
                 }
                 break;
             }
         }
     }
 
-    switch (found) {
-        case log_format::SCAN_MATCH:
-            if (!this->lf_index.empty()) {
-                this->lf_index.back().set_valid_utf(li.li_valid_utf);
+    return update_index(found,
+                        this->lf_format.get(),
+                        this->lf_index,
+                        prescan_size,
+                        prescan_time,
+                        this->lf_index_time,
+                        li,
+                        this->lf_out_of_time_order_count);
+}
+
+/**
+ * Find the start of the first line that begins after the given offset.
+ *
+ * @return The offset of the line or -1 if there is no newline between 'off'
+ *   and 'end'.
+ */
+static off_t next_line_start(int fd, off_t off, off_t end)
+{
+    char buffer[16 * 1024];
+
+    while (off < end) {
+        ssize_t rc = pread(fd, buffer,
+                           std::min((off_t) sizeof(buffer), end - off),
+                           off);
+
+        if (rc <= 0) {
+            break;
+        }
+
+        auto nl = (const char *) memchr(buffer, '\n', rc);
+
+        if (nl != nullptr) {
+            return off + (nl - buffer) + 1;
+        }
+        off += rc;
+    }
+
+    return -1;
+}
+
+/**
+ * Find the end of the last complete line before the given offset.
+ *
+ * @return The offset just past the newline or -1 if there is no newline
+ *   between 'begin' and 'end'.
+ */
+static off_t last_line_end(int fd, off_t begin, off_t end)
+{
+    char buffer[16 * 1024];
+
+    while (begin < end) {
+        off_t read_off = std::max(begin, end - (off_t) sizeof(buffer));
+        ssize_t rc = pread(fd, buffer, end - read_off, read_off);
+
+        if (rc <= 0) {
+            break;
+        }
+
+        for (ssize_t lpc = rc - 1; lpc >= 0; lpc--) {
+            if (buffer[lpc] == '\n') {
+                return read_off + lpc + 1;
             }
-            if (!this->lf_index.empty() && prescan_time != this->lf_index[0].get_time()) {
-                retval = true;
+        }
+        end = read_off;
+    }
+
+    return -1;
+}
+
+/**
+ * Make a copy of a file's format that can be used to scan a chunk of the
+ * file on another thread.  The copy starts out with the current pattern lock
+ * and empty value statistics so that its results can be merged back into the
+ * original once the chunk has been scanned.
+ */
+static unique_ptr<log_format> chunk_format(log_format &format)
+{
+    auto pattern_locks = format.lf_pattern_locks;
+    auto value_stats = format.lf_value_stats;
+    int last_pattern = format.last_pattern_index();
+    auto retval = format.specialized(last_pattern);
+
+    // specialized() resets the state of the format being copied, so restore
+    // the parts that the lines that have already been indexed depend on.
+    format.lf_pattern_locks = std::move(pattern_locks);
+    format.lf_value_stats = std::move(value_stats);
+
+    retval->lf_pattern_locks.clear();
+    if (last_pattern != -1) {
+        retval->lf_pattern_locks.emplace_back(0, last_pattern);
+    }
+    retval->lf_value_stats.clear();
+    retval->lf_value_stats.resize(format.lf_value_stats.size());
+
+    return retval;
+}
+
+/**
+ * The state for a range of a file that is being scanned in parallel with
+ * other ranges.
+ */
+struct logfile::scan_chunk {
+    file_range sc_range;
+    vector<logline> sc_index;
+    /** The index of the first line that was recognized by the format. */
+    size_t sc_first_match{0};
+    size_t sc_longest_line{0};
+    uint32_t sc_out_of_time_order_count{0};
+    bool sc_sort_needed{false};
+    /**
+     * Set if the lines could not be indexed independently of the previous
+     * chunks, either because of an error or a time rollover, and the chunk
+     * needs to be rescanned serially.
+     */
+    bool sc_rescan{false};
+    /** The state of the chunk's format once the chunk was scanned. */
+    vector<log_format::pattern_for_lines> sc_pattern_locks;
+    vector<logline_value_stats> sc_value_stats;
+    int sc_timestamp_flags{0};
+};
+
+/**
+ * The state shared between a logfile and the thread that is scanning the
+ * file in the background.  The thread publishes chunks of scanned lines to
+ * the ready queue and the logfile merges them into its index the next time
+ * rebuild_index() is called.
+ */
+struct logfile::background_scan {
+    ~background_scan() {
+        this->bs_stop = true;
+        if (this->bs_thread.joinable()) {
+            this->bs_thread.join();
+        }
+    };
+
+    std::thread bs_thread;
+    std::atomic<bool> bs_stop{false};
+    std::mutex bs_mutex;
+    /** The chunks that have been scanned but not merged, guarded by the mutex. */
+    std::deque<scan_chunk> bs_ready;
+    /** Set by the thread once it has finished, guarded by the mutex. */
+    bool bs_done{false};
+};
+
+void logfile::scan_chunk_lines(line_buffer &lb,
+                               log_format &format,
+                               scan_chunk &sc)
+{
+    auto chunk_prev = file_range{sc.sc_range.fr_offset};
+    bool matched = false;
+
+    while (chunk_prev.next_offset() < sc.sc_range.next_offset()) {
+        auto load_result = lb.load_next_line(chunk_prev);
+
+        if (load_result.isErr()) {
+            sc.sc_rescan = true;
+            return;
+        }
+
+        auto li = load_result.unwrap();
+
+        if (li.li_file_range.empty()) {
+            break;
+        }
+        chunk_prev = li.li_file_range;
+
+        auto read_result = lb.read_range(li.li_file_range);
+        if (read_result.isErr()) {
+            sc.sc_rescan = true;
+            return;
+        }
+
+        auto sbr = read_result.unwrap().rtrim(is_line_ending);
+        size_t prescan_size = sc.sc_index.size();
+        time_t prescan_time = 0;
+
+        sc.sc_longest_line = std::max(sc.sc_longest_line, sbr.length());
+        if (!sc.sc_index.empty()) {
+            prescan_time = sc.sc_index[0].get_time();
+        }
+
+        auto found = format.scan(*this, sc.sc_index,
+                                 li.li_file_range.fr_offset, sbr);
+
+        sc.sc_sort_needed = update_index(found,
+                                         &format,
+                                         sc.sc_index,
+                                         prescan_size,
+                                         prescan_time,
+                                         0,
+                                         li,
+                                         sc.sc_out_of_time_order_count) ||
+                            sc.sc_sort_needed;
+        if (prescan_size > 0 &&
+            prescan_time != sc.sc_index[0].get_time()) {
+            // A time rollover adjusts all of the lines that came before
+            // it, including the ones in the previous chunks.
+            sc.sc_rescan = true;
+            return;
+        }
+        if (!matched) {
+            if (found == log_format::SCAN_MATCH) {
+                matched = true;
+            } else {
+                sc.sc_first_match = sc.sc_index.size();
             }
-            if (prescan_size > 0 && prescan_size < this->lf_index.size()) {
-                logline &second_to_last = this->lf_index[prescan_size - 1];
-                logline &latest = this->lf_index[prescan_size];
+        }
+    }
 
-                if (latest < second_to_last) {
-                    if (this->lf_format->lf_time_ordered) {
+    sc.sc_pattern_locks = format.lf_pattern_locks;
+    sc.sc_value_stats = format.lf_value_stats;
+    sc.sc_timestamp_flags = format.lf_timestamp_flags;
+}
+
+Result<file_range, std::string> logfile::scan_chunks(file_range prev_range,
+                                                     const struct stat &st,
+                                                     bool &sort_needed)
+{
+    off_t begin = prev_range.next_offset();
+    off_t remaining = st.st_size - begin;
+    off_t chunk_size = this->lf_options.loo_scan_chunk_size;
+    size_t workers = this->lf_max_workers == 0 ?
+                     parallel_worker_count() : this->lf_max_workers;
+    int fd = this->lf_line_buffer.get_fd();
+
+    if (chunk_size == 0) {
+        if (workers <= 1 || remaining < PARALLEL_SCAN_MIN_SIZE) {
+            return Ok(prev_range);
+        }
+        chunk_size = std::max(SCAN_CHUNK_MIN_SIZE,
+                              remaining / (off_t) (workers * 4));
+    }
+    if (this->lf_line_buffer.is_compressed() ||
+        this->lf_line_buffer.is_pipe() ||
+        remaining <= chunk_size) {
+        return Ok(prev_range);
+    }
+
+    // The last line might still be getting written, so only scan up to the
+    // last complete line and leave the rest for the serial scan.
+    off_t end = last_line_end(fd, begin, st.st_size);
+    vector<off_t> boundaries{begin};
+
+    while (end != -1 && boundaries.back() + chunk_size < end) {
+        off_t next = next_line_start(fd, boundaries.back() + chunk_size, end);
+
+        if (next == -1) {
+            break;
+        }
+        boundaries.push_back(next);
+    }
+    if (end != -1 && boundaries.back() < end) {
+        boundaries.push_back(end);
+    }
+    if (boundaries.size() < 3) {
+        return Ok(prev_range);
+    }
+
+    vector<scan_chunk> chunks(boundaries.size() - 1);
+    vector<unique_ptr<log_format>> formats(chunks.size());
+
+    for (size_t lpc = 0; lpc < chunks.size(); lpc++) {
+        chunks[lpc].sc_range = {
+            boundaries[lpc], boundaries[lpc + 1] - boundaries[lpc]
+        };
+        formats[lpc] = chunk_format(*this->lf_format);
+    }
+
+    parallel_for(chunks.size(), [this, fd, &chunks, &formats](size_t index) {
+        scan_chunk &sc = chunks[index];
+        auto_fd chunk_fd(dup(fd));
+        line_buffer lb;
+
+        if (chunk_fd == -1) {
+            sc.sc_rescan = true;
+            return;
+        }
+        lb.set_access_pattern(line_buffer::AP_SEQUENTIAL);
+        lb.set_fd(chunk_fd);
+        this->scan_chunk_lines(lb, *formats[index], sc);
+    }, workers);
+
+    size_t begin_size = this->lf_index.size();
+
+    for (auto &sc : chunks) {
+        if (!this->merge_chunk(sc, sort_needed)) {
+            break;
+        }
+        prev_range = sc.sc_range;
+    }
+
+    if (this->lf_index.size() == begin_size) {
+        return Ok(prev_range);
+    }
+
+    log_debug("%s: scanned %d lines in parallel",
+              this->lf_filename.c_str(),
+              this->lf_index.size() - begin_size);
+
+    this->lf_index_size = prev_range.next_offset();
+    this->lf_partial_line = false;
+    // The line buffer will not return data past the last line it has loaded,
+    // so let it know about the lines that were indexed by the chunks.
+    auto load_result = this->lf_line_buffer.load_next_line(
+        file_range{this->lf_index.back().get_offset()});
+
+    if (load_result.isErr()) {
+        return Err(load_result.unwrapErr());
+    }
+    for (auto iter = this->begin() + begin_size;
+         iter != this->end(); ++iter) {
+        if (this->lf_logline_observer == nullptr) {
+            break;
+        }
+
+        auto read_result = this->lf_line_buffer.read_range(
+            this->get_file_range(iter, false));
+
+        if (read_result.isErr()) {
+            continue;
+        }
+
+        auto sbr = read_result.unwrap().rtrim(is_line_ending);
+
+        this->lf_logline_observer->logline_new_line(*this, iter, sbr);
+    }
+    if (this->lf_logfile_observer != nullptr) {
+        this->lf_logfile_observer->logfile_indexing(
+            *this, prev_range.next_offset(), st.st_size);
+    }
+
+    return Ok(prev_range);
+}
+
+bool logfile::merge_chunk(scan_chunk &sc, bool &sort_needed)
+{
+    if (sc.sc_rescan) {
+        return false;
+    }
+
+    size_t base = this->lf_index.size();
+    log_format &format = *this->lf_format;
+    bool full_date = (format.lf_timestamp_flags & ETF_DAY_SET) &&
+                     (format.lf_timestamp_flags & ETF_MONTH_SET) &&
+                     (format.lf_timestamp_flags & ETF_YEAR_SET);
+
+    if (!this->lf_index.empty()) {
+        const logline &prev = this->lf_index.back();
+
+        // Lines at the start of the chunk that were not recognized are
+        // continuations of the last message in the previous chunk.
+        for (size_t lpc = 0; lpc < sc.sc_first_match; lpc++) {
+            logline &ll = sc.sc_index[lpc];
+            bool valid_utf = ll.is_valid_utf();
+
+            ll = logline(ll.get_offset(),
+                         prev.get_timeval(),
+                         (log_level_t) (prev.get_level_and_flags() |
+                                        LEVEL_CONTINUED),
+                         prev.get_module_id(),
+                         prev.get_opid());
+            ll.set_valid_utf(valid_utf);
+        }
+
+        if (sc.sc_first_match < sc.sc_index.size() &&
+            sc.sc_index[sc.sc_first_match] < prev) {
+            if (!full_date) {
+                // Going back in time might be a rollover that affects
+                // the earlier lines, let the serial scan figure it out.
+                sc.sc_rescan = true;
+                return false;
+            }
+            if (!format.lf_time_ordered) {
+                sort_needed = true;
+            } else {
+                // The skew corrections carry over from the previous
+                // chunk until a line is back in order.
+                for (size_t lpc = sc.sc_first_match;
+                     lpc < sc.sc_index.size() && sc.sc_index[lpc] < prev;
+                     lpc++) {
+                    logline &ll = sc.sc_index[lpc];
+
+                    if (!ll.is_continued()) {
                         this->lf_out_of_time_order_count += 1;
-                        for (size_t lpc = prescan_size;
-                             lpc < this->lf_index.size(); lpc++) {
-                            logline &line_to_update = this->lf_index[lpc];
+                    }
+                    ll.set_time_skew(true);
+                    ll.set_time(prev.get_timeval());
+                }
+            }
+        }
+    } else {
+        for (size_t lpc = 0; lpc < sc.sc_first_match; lpc++) {
+            sc.sc_index[lpc].set_time(this->lf_index_time);
+        }
+    }
 
-                            line_to_update.set_time_skew(true);
-                            line_to_update.set_time(second_to_last.get_time());
-                            line_to_update.set_millis(
-                                second_to_last.get_millis());
-                        }
-                    } else {
-                        retval = true;
+    for (const auto &pfl : sc.sc_pattern_locks) {
+        uint32_t lock_line = base + pfl.pfl_line;
+
+        if (!format.lf_pattern_locks.empty() &&
+            format.lf_pattern_locks.back().pfl_line == lock_line) {
+            format.lf_pattern_locks.back().pfl_pat_index =
+                pfl.pfl_pat_index;
+        } else if (format.last_pattern_index() != pfl.pfl_pat_index) {
+            format.lf_pattern_locks.emplace_back(lock_line,
+                                                 pfl.pfl_pat_index);
+        }
+    }
+    for (size_t lpc = 0; lpc < format.lf_value_stats.size() &&
+                         lpc < sc.sc_value_stats.size(); lpc++) {
+        format.lf_value_stats[lpc].merge(sc.sc_value_stats[lpc]);
+    }
+    if (sc.sc_first_match < sc.sc_index.size()) {
+        format.lf_timestamp_flags = sc.sc_timestamp_flags;
+    }
+
+    this->lf_index.insert(this->lf_index.end(),
+                          sc.sc_index.begin(),
+                          sc.sc_index.end());
+    this->lf_longest_line = std::max(this->lf_longest_line,
+                                     sc.sc_longest_line);
+    this->lf_out_of_time_order_count += sc.sc_out_of_time_order_count;
+    sort_needed = sort_needed || sc.sc_sort_needed;
+
+    return true;
+}
+
+bool logfile::start_background_scan(const struct stat &st)
+{
+    off_t begin = this->lf_index_size;
+    off_t chunk_size = this->lf_options.loo_scan_chunk_size;
+    int fd = this->lf_line_buffer.get_fd();
+
+    if (chunk_size == 0) {
+        chunk_size = BACKGROUND_CHUNK_SIZE;
+    }
+    if (!this->lf_options.loo_background_index ||
+        this->lf_format == nullptr ||
+        this->lf_format->has_sublines() ||
+        this->lf_index.empty() ||
+        this->lf_partial_line ||
+        this->lf_serial_scan_needed ||
+        this->lf_line_buffer.is_compressed() ||
+        this->lf_line_buffer.is_pipe() ||
+        st.st_size - begin < chunk_size) {
+        return false;
+    }
+
+    // Leave the last line, which might still be getting written, for the
+    // serial scan.
+    off_t end = last_line_end(fd, begin, st.st_size);
+
+    if (end == -1) {
+        return false;
+    }
+
+    auto_fd scan_fd(dup(fd));
+
+    if (scan_fd == -1) {
+        return false;
+    }
+
+    auto bs = std::make_unique<background_scan>();
+    shared_ptr<log_format> format = chunk_format(*this->lf_format);
+
+    log_debug("%s: scanning %lld bytes in the background",
+              this->lf_filename.c_str(),
+              (long long) (end - begin));
+    bs->bs_thread = std::thread([this, bs_ref = bs.get(), format, begin, end,
+                                 chunk_size, scan_fd = std::move(scan_fd)]() mutable {
+        off_t chunk_start = begin;
+
+        try {
+            line_buffer lb;
+
+            lb.set_access_pattern(line_buffer::AP_SEQUENTIAL);
+            lb.set_fd(scan_fd);
+            while (chunk_start < end && !bs_ref->bs_stop) {
+                off_t chunk_end = end;
+
+                if (chunk_start + chunk_size < end) {
+                    chunk_end = next_line_start(
+                        lb.get_fd(), chunk_start + chunk_size, end);
+                    if (chunk_end == -1) {
+                        chunk_end = end;
                     }
                 }
+
+                scan_chunk sc;
+
+                sc.sc_range = {chunk_start, chunk_end - chunk_start};
+                this->scan_chunk_lines(lb, *format, sc);
+
+                // Reset the format so the next chunk can be merged on its
+                // own, carrying over the pattern that was last used.
+                int last_pattern = format->last_pattern_index();
+
+                format->lf_pattern_locks.clear();
+                if (last_pattern != -1) {
+                    format->lf_pattern_locks.emplace_back(0, last_pattern);
+                }
+                for (auto &stats : format->lf_value_stats) {
+                    stats.clear();
+                }
+
+                bool rescan = sc.sc_rescan;
+
+                {
+                    std::lock_guard<std::mutex> lg(bs_ref->bs_mutex);
+
+                    bs_ref->bs_ready.emplace_back(std::move(sc));
+                }
+                if (rescan) {
+                    break;
+                }
+                chunk_start = chunk_end;
             }
+        }
+        catch (const line_buffer::error &e) {
+            scan_chunk sc;
+
+            sc.sc_range = {chunk_start, 0};
+            sc.sc_rescan = true;
+
+            std::lock_guard<std::mutex> lg(bs_ref->bs_mutex);
+
+            bs_ref->bs_ready.emplace_back(std::move(sc));
+        }
+
+        std::lock_guard<std::mutex> lg(bs_ref->bs_mutex);
+
+        bs_ref->bs_done = true;
+    });
+    this->lf_background_scan = std::move(bs);
+
+    return true;
+}
+
+logfile::rebuild_result_t logfile::merge_background_scan(const struct stat &st)
+{
+    auto &bs = *this->lf_background_scan;
+    auto merge_start = std::chrono::steady_clock::now();
+    size_t begin_size = this->lf_index.size();
+    bool sort_needed = false;
+    bool stop = false;
+
+    while (!stop) {
+        scan_chunk sc;
+
+        {
+            std::lock_guard<std::mutex> lg(bs.bs_mutex);
+
+            if (bs.bs_ready.empty()) {
+                stop = bs.bs_done;
+                break;
+            }
+            sc = std::move(bs.bs_ready.front());
+            bs.bs_ready.pop_front();
+        }
+
+        if (!this->merge_chunk(sc, sort_needed)) {
+            // The rest of the file needs to be scanned the slow way.
+            this->lf_serial_scan_needed = true;
+            stop = true;
             break;
-        case log_format::SCAN_NO_MATCH: {
-            log_level_t last_level = LEVEL_UNKNOWN;
-            time_t last_time = this->lf_index_time;
-            short last_millis = 0;
-            uint8_t last_mod = 0, last_opid = 0;
+        }
+        this->lf_index_size = sc.sc_range.next_offset();
 
-            if (!this->lf_index.empty()) {
-                logline &ll = this->lf_index.back();
+        if (std::chrono::steady_clock::now() - merge_start >
+            BACKGROUND_MERGE_BUDGET) {
+            break;
+        }
+    }
 
-                /*
-                 * Assume this line is part of the previous one(s) and copy the
-                 * metadata over.
-                 */
-                last_time = ll.get_time();
-                last_millis = ll.get_millis();
-                if (this->lf_format.get() != NULL) {
-                    last_level = (log_level_t)(ll.get_level_and_flags() |
-                        LEVEL_CONTINUED);
-                }
-                last_mod = ll.get_module_id();
-                last_opid = ll.get_opid();
+    if (stop) {
+        this->lf_background_scan.reset();
+    }
+
+    if (this->lf_index.size() == begin_size) {
+        if (stop) {
+            this->save_index_cache(st);
+        }
+        return RR_NO_NEW_LINES;
+    }
+
+    this->lf_partial_line = false;
+
+    auto load_result = this->lf_line_buffer.load_next_line(
+        file_range{this->lf_index.back().get_offset()});
+
+    if (load_result.isErr()) {
+        log_error("%s: unable to load the last scanned line -- %s",
+                  this->lf_filename.c_str(),
+                  load_result.unwrapErr().c_str());
+        this->close();
+        return RR_INVALID;
+    }
+    if (this->lf_logline_observer != nullptr) {
+        // Reopen the last message, since the new lines might continue it.
+        this->lf_logline_observer->logline_restart(*this, 0);
+        this->reobserve_from(this->begin() + begin_size);
+    }
+    if (this->lf_logfile_observer != nullptr) {
+        this->lf_logfile_observer->logfile_indexing(
+            *this, this->lf_index_size, st.st_size);
+    }
+    if (stop) {
+        this->save_index_cache(st);
+    }
+
+    return sort_needed ? RR_NEW_ORDER : RR_NEW_LINES;
+}
+
+void logfile::stop_background_scan()
+{
+    this->lf_background_scan.reset();
+}
+
+namespace {
+
+/**
+ * The header for an index cache file.  The header is followed by the pattern
+ * locks, the value statistics, and then the loglines.  The cache is only
+ * meant to be read by the same build on the same machine, so the data is
+ * written out as-is.
+ */
+struct index_cache_header {
+    char ich_magic[8];
+    uint32_t ich_version;
+    uint32_t ich_logline_size;
+    uint64_t ich_dev;
+    uint64_t ich_ino;
+    int64_t ich_file_size;
+    int64_t ich_mtime;
+    int64_t ich_index_size;
+    uint64_t ich_line_count;
+    uint64_t ich_longest_line;
+    uint32_t ich_pattern_lock_count;
+    uint32_t ich_value_stats_count;
+    int32_t ich_timestamp_flags;
+    int32_t ich_text_format;
+    char ich_format_name[128];
+    char ich_content_id[64];
+    char ich_head_hash[64];
+    char ich_tail_hash[64];
+};
+
+}
+
+static const char INDEX_CACHE_MAGIC[8] = {
+    'l', 'n', 'a', 'v', 'i', 'd', 'x', '\0'
+};
+static const uint32_t INDEX_CACHE_VERSION = 3;
+/** The amount of data at the start and end of the index that is hashed. */
+static const size_t INDEX_CACHE_HASH_SIZE = 4096;
+
+/**
+ * Hash the data in the given range of a file to check that the content has
+ * not changed since the cache was written.
+ */
+static bool hash_file_range(int fd, off_t off, off_t end, char *hash_out, size_t hash_len)
+{
+    char buffer[INDEX_CACHE_HASH_SIZE];
+    ssize_t len = std::min((off_t) sizeof(buffer), end - off);
+
+    if (len < 0 || pread(fd, buffer, len, off) != len) {
+        return false;
+    }
+
+    auto hash = hash_bytes(buffer, len, nullptr);
+
+    strncpy(hash_out, hash.c_str(), hash_len - 1);
+    hash_out[hash_len - 1] = '\0';
+
+    return true;
+}
+
+static bool write_fully(int fd, const void *buf, size_t len)
+{
+    const char *data = (const char *) buf;
+
+    while (len > 0) {
+        ssize_t rc = write(fd, data, len);
+
+        if (rc <= 0) {
+            return false;
+        }
+        data += rc;
+        len -= rc;
+    }
+
+    return true;
+}
+
+string logfile::index_cache_path() const
+{
+    char name[128];
+    auto hash = hash_bytes((const char *) &this->lf_stat.st_dev,
+                           sizeof(this->lf_stat.st_dev),
+                           (const char *) &this->lf_stat.st_ino,
+                           sizeof(this->lf_stat.st_ino),
+                           nullptr);
+
+    snprintf(name, sizeof(name), "index-cache/%s.idx", hash.c_str());
+
+    return dotlnav_path(name);
+}
+
+bool logfile::load_index_cache(const struct stat &st)
+{
+    if (!this->lf_valid_filename || this->is_compressed()) {
+        return false;
+    }
+
+    string path = this->index_cache_path();
+    auto_fd cache_fd(open(path.c_str(), O_RDONLY));
+    struct stat cache_st;
+
+    if (cache_fd == -1 || fstat(cache_fd, &cache_st) == -1 ||
+        cache_st.st_size < (off_t) sizeof(index_cache_header)) {
+        return false;
+    }
+
+    void *base = mmap(nullptr, cache_st.st_size, PROT_READ, MAP_PRIVATE,
+                      cache_fd, 0);
+
+    if (base == MAP_FAILED) {
+        log_perror(-1);
+        return false;
+    }
+
+    const auto *header = (const index_cache_header *) base;
+    const char *data = (const char *) base + sizeof(index_cache_header);
+    int fd = this->lf_line_buffer.get_fd();
+    char hash[sizeof(header->ich_head_hash)];
+    bool valid = false;
+
+    do {
+        if (memcmp(header->ich_magic, INDEX_CACHE_MAGIC,
+                   sizeof(INDEX_CACHE_MAGIC)) != 0 ||
+            header->ich_version != INDEX_CACHE_VERSION ||
+            header->ich_logline_size != sizeof(logline)) {
+            break;
+        }
+        if (header->ich_dev != (uint64_t) st.st_dev ||
+            header->ich_ino != (uint64_t) st.st_ino ||
+            header->ich_file_size > st.st_size ||
+            (header->ich_file_size == st.st_size &&
+             header->ich_mtime != st.st_mtime) ||
+            header->ich_index_size > header->ich_file_size) {
+            log_info("index cache is stale -- %s", this->lf_filename.c_str());
+            break;
+        }
+        if (cache_st.st_size != (off_t) (
+                sizeof(index_cache_header) +
+                header->ich_pattern_lock_count *
+                sizeof(log_format::pattern_for_lines) +
+                header->ich_value_stats_count * sizeof(logline_value_stats) +
+                header->ich_line_count * sizeof(logline))) {
+            break;
+        }
+        if (strncmp(header->ich_format_name,
+                    this->lf_format->get_name().get(),
+                    sizeof(header->ich_format_name)) != 0 ||
+            this->lf_content_id != header->ich_content_id ||
+            header->ich_value_stats_count !=
+                this->lf_format->lf_value_stats.size() ||
+            header->ich_line_count == 0 ||
+            header->ich_line_count < this->lf_index.size()) {
+            break;
+        }
+        if (!hash_file_range(fd, 0,
+                             std::min((int64_t) INDEX_CACHE_HASH_SIZE,
+                                      header->ich_index_size),
+                             hash, sizeof(hash)) ||
+            strcmp(hash, header->ich_head_hash) != 0 ||
+            !hash_file_range(fd,
+                             std::max((int64_t) 0,
+                                      header->ich_index_size -
+                                      (int64_t) INDEX_CACHE_HASH_SIZE),
+                             header->ich_index_size,
+                             hash, sizeof(hash)) ||
+            strcmp(hash, header->ich_tail_hash) != 0) {
+            log_info("index cache content does not match -- %s",
+                     this->lf_filename.c_str());
+            break;
+        }
+
+        const auto *locks = (const log_format::pattern_for_lines *) data;
+        data += header->ich_pattern_lock_count *
+                sizeof(log_format::pattern_for_lines);
+        const auto *stats = (const logline_value_stats *) data;
+        data += header->ich_value_stats_count * sizeof(logline_value_stats);
+        const auto *lines = (const logline *) data;
+
+        bool same_prefix = true;
+
+        for (size_t lpc = 0; lpc < this->lf_index.size(); lpc++) {
+            if (this->lf_index[lpc].get_offset() != lines[lpc].get_offset()) {
+                same_prefix = false;
+                break;
             }
-            this->lf_index.emplace_back(li.li_file_range.fr_offset,
-                                        last_time,
-                                        last_millis,
-                                        last_level,
-                                        last_mod,
-                                        last_opid);
-            this->lf_index.back().set_valid_utf(li.li_valid_utf);
+        }
+        if (!same_prefix) {
             break;
         }
-        case log_format::SCAN_INCOMPLETE:
+
+        auto load_result = this->lf_line_buffer.load_next_line(
+            file_range{lines[header->ich_line_count - 1].get_offset()});
+
+        if (load_result.isErr()) {
+            log_error("unable to load the last cached line -- %s (%s)",
+                      this->lf_filename.c_str(),
+                      load_result.unwrapErr().c_str());
             break;
+        }
+
+        size_t detected_size = this->lf_index.size();
+
+        this->lf_format->lf_pattern_locks.assign(
+            locks, locks + header->ich_pattern_lock_count);
+        this->lf_format->lf_value_stats.assign(
+            stats, stats + header->ich_value_stats_count);
+        this->lf_format->lf_timestamp_flags = header->ich_timestamp_flags;
+        this->lf_index.assign(lines, lines + header->ich_line_count);
+        this->lf_index_size = header->ich_index_size;
+        this->lf_longest_line = header->ich_longest_line;
+        this->lf_text_format = (text_format_t) header->ich_text_format;
+        this->lf_partial_line = false;
+        this->lf_index_cache_size = header->ich_index_size;
+
+        this->lf_activity.la_index_cache_hits += 1;
+        log_info("loaded %d lines from index cache -- %s",
+                 this->lf_index.size(),
+                 this->lf_filename.c_str());
+
+        if (this->lf_logline_observer != nullptr) {
+            this->lf_logline_observer->logline_restart(*this, detected_size);
+            this->reobserve_from(this->begin());
+        }
+        valid = true;
+    } while (false);
+
+    munmap(base, cache_st.st_size);
+
+    if (valid) {
+        // Keep the cache from being cleaned up while it is still in use.
+        log_perror(utimes(path.c_str(), nullptr));
     }
 
-    return retval;
+    return valid;
+}
+
+void logfile::save_index_cache(const struct stat &st)
+{
+    if (!this->lf_valid_filename || this->is_compressed() ||
+        this->lf_format == nullptr ||
+        this->lf_index_size < INDEX_CACHE_MIN_SIZE ||
+        this->lf_index_size < this->lf_index_cache_size * 2) {
+        return;
+    }
+
+    // Only try once for this amount of data, even if the write fails.
+    this->lf_index_cache_size = this->lf_index_size;
+
+    index_cache_header header;
+    int fd = this->lf_line_buffer.get_fd();
+    log_format &format = *this->lf_format;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.ich_magic, INDEX_CACHE_MAGIC, sizeof(header.ich_magic));
+    header.ich_version = INDEX_CACHE_VERSION;
+    header.ich_logline_size = sizeof(logline);
+    header.ich_dev = st.st_dev;
+    header.ich_ino = st.st_ino;
+    header.ich_file_size = std::max((off_t) st.st_size, this->lf_index_size);
+    if (st.st_size == this->lf_index_size) {
+        header.ich_mtime = st.st_mtime;
+    }
+    header.ich_index_size = this->lf_index_size;
+    header.ich_line_count = this->lf_index.size();
+    header.ich_longest_line = this->lf_longest_line;
+    header.ich_pattern_lock_count = format.lf_pattern_locks.size();
+    header.ich_value_stats_count = format.lf_value_stats.size();
+    header.ich_timestamp_flags = format.lf_timestamp_flags;
+    header.ich_text_format = (int32_t) this->lf_text_format;
+    strncpy(header.ich_format_name, format.get_name().get(),
+            sizeof(header.ich_format_name) - 1);
+    strncpy(header.ich_content_id, this->lf_content_id.c_str(),
+            sizeof(header.ich_content_id) - 1);
+    if (!hash_file_range(fd, 0,
+                         std::min((off_t) INDEX_CACHE_HASH_SIZE,
+                                  this->lf_index_size),
+                         header.ich_head_hash,
+                         sizeof(header.ich_head_hash)) ||
+        !hash_file_range(fd,
+                         std::max((off_t) 0,
+                                  this->lf_index_size -
+                                  (off_t) INDEX_CACHE_HASH_SIZE),
+                         this->lf_index_size,
+                         header.ich_tail_hash,
+                         sizeof(header.ich_tail_hash))) {
+        return;
+    }
+
+    string path = this->index_cache_path();
+    string tmp_path = path + "." + to_string(getpid()) + ".tmp";
+    auto_fd cache_fd(open(tmp_path.c_str(),
+                          O_WRONLY | O_CREAT | O_TRUNC,
+                          0644));
+
+    if (cache_fd == -1) {
+        log_debug("unable to open index cache: %s -- %s",
+                  tmp_path.c_str(), strerror(errno));
+        return;
+    }
+
+    bool ok = write_fully(cache_fd, &header, sizeof(header)) &&
+              write_fully(cache_fd,
+                          format.lf_pattern_locks.data(),
+                          format.lf_pattern_locks.size() *
+                          sizeof(log_format::pattern_for_lines)) &&
+              write_fully(cache_fd,
+                          format.lf_value_stats.data(),
+                          format.lf_value_stats.size() *
+                          sizeof(logline_value_stats));
+
+    // The bookmarks belong to the session, so they are cleared from the
+    // copy of the lines that is written out.
+    static const size_t LINE_BATCH_SIZE = 4096;
+    vector<logline> batch;
+
+    batch.reserve(LINE_BATCH_SIZE);
+    for (size_t start = 0; ok && start < this->lf_index.size();
+         start += LINE_BATCH_SIZE) {
+        size_t end = std::min(start + LINE_BATCH_SIZE, this->lf_index.size());
+
+        batch.assign(this->lf_index.begin() + start,
+                     this->lf_index.begin() + end);
+        for (auto &ll : batch) {
+            ll.set_mark(false);
+        }
+        ok = write_fully(cache_fd, batch.data(),
+                         batch.size() * sizeof(logline));
+    }
+
+    if (!ok) {
+        log_error("unable to write index cache: %s -- %s",
+                  tmp_path.c_str(), strerror(errno));
+        cache_fd.reset();
+        log_perror(remove(tmp_path.c_str()));
+        return;
+    }
+    cache_fd.reset();
+    log_perror(rename(tmp_path.c_str(), path.c_str()));
+
+    log_info("saved %d lines to index cache -- %s",
+             this->lf_index.size(),
+             this->lf_filename.c_str());
 }
 
 logfile::rebuild_result_t logfile::rebuild_index()
@@ -288,6 +1304,14 @@ logfile::rebuild_result_t logfile::rebuild_index()
         this->close();
         return RR_NO_NEW_LINES;
     }
+    else if (this->lf_background_scan != nullptr) {
+        retval = this->merge_background_scan(st);
+        this->lf_stat = st;
+    }
+    else if (this->start_background_scan(st)) {
+        this->lf_activity.la_reads += 1;
+        this->lf_stat = st;
+    }
     else if (this->lf_line_buffer.is_data_available(this->lf_index_size, st.st_size)) {
         this->lf_activity.la_reads += 1;
 
@@ -346,7 +1370,22 @@ logfile::rebuild_result_t logfile::rebuild_index()
         bool sort_needed = this->lf_sort_needed;
         this->lf_sort_needed = false;
 
+        // Indexing reads straight through the file, the view jumps around.
+        this->lf_line_buffer.set_access_pattern(line_buffer::AP_SEQUENTIAL);
+
         auto prev_range = file_range{off};
+        if (has_format) {
+            auto scan_result = this->scan_chunks(prev_range, st, sort_needed);
+
+            if (scan_result.isErr()) {
+                log_error("%s: unable to scan in parallel -- %s",
+                          this->lf_filename.c_str(),
+                          scan_result.unwrapErr().c_str());
+                this->close();
+                return RR_INVALID;
+            }
+            prev_range = scan_result.unwrap();
+        }
         while (true) {
             auto load_result = this->lf_line_buffer.load_next_line(prev_range);
 
@@ -412,7 +1451,16 @@ logfile::rebuild_result_t logfile::rebuild_index()
             }
         }
 
-        if (this->lf_logline_observer != nullptr) {
+        this->lf_line_buffer.set_access_pattern(line_buffer::AP_RANDOM);
+
+        if (!has_format && this->lf_format != nullptr &&
+            this->load_index_cache(st)) {
+            // The cached lines were already passed to the observer, along
+            // with the EOF.
+            prev_range = file_range{this->lf_index_size};
+            sort_needed = true;
+        }
+        else if (this->lf_logline_observer != nullptr) {
             this->lf_logline_observer->logline_eof(*this);
         }
 
@@ -436,11 +1484,16 @@ logfile::rebuild_result_t logfile::rebuild_index()
         this->lf_index_size = prev_range.next_offset();
         this->lf_stat = st;
 
+        if (has_format) {
+            this->save_index_cache(st);
+        }
+
         if (sort_needed) {
             retval = RR_NEW_ORDER;
         } else {
             retval = RR_NEW_LINES;
         }
+        this->lf_serial_scan_needed = false;
     }
 
     this->lf_index_time = this->lf_line_buffer.get_file_time();
@@ -458,10 +1511,11 @@ logfile::rebuild_result_t logfile::rebuild_index()
     return retval;
 }
 
-Result<shared_buffer_ref, std::string> logfile::read_line(logfile::iterator ll)
+Result<shared_buffer_ref, std::string> logfile::read_line(line_buffer &lb,
+                                                         logfile::iterator ll)
 {
     try {
-        return this->lf_line_buffer.read_range(this->get_file_range(ll, false))
+        return lb.read_range(this->get_file_range(ll, false))
             .map([&ll, this](auto sbr) {
                 sbr.rtrim(is_line_ending);
                 if (!ll->is_valid_utf()) {
@@ -517,29 +1571,109 @@ void logfile::set_logline_observer(logline_observer *llo)
 
 void logfile::reobserve_from(iterator iter)
 {
-    if (this->lf_logline_observer != NULL) {
-        for (; iter != this->end(); ++iter) {
-            off_t offset = std::distance(this->begin(), iter);
+    if (this->lf_logline_observer == nullptr) {
+        return;
+    }
 
-            if (this->lf_logfile_observer != NULL) {
+    this->observe_lines(
+        this->lf_line_buffer, *this->lf_logline_observer, iter,
+        [this](iterator curr) {
+            if (this->lf_logfile_observer != nullptr) {
                 this->lf_logfile_observer->logfile_indexing(
-                        *this, offset, this->size());
+                    *this, std::distance(this->begin(), curr), this->size());
             }
+            return true;
+        });
+    if (this->lf_logfile_observer != nullptr) {
+        this->lf_logfile_observer->logfile_indexing(
+                *this, this->size(), this->size());
+    }
+
+    this->lf_logline_observer->logline_eof(*this);
+}
 
-            this->read_line(iter).then([this, iter](auto sbr) {
-                this->lf_logline_observer->logline_new_line(*this, iter, sbr);
+bool logfile::observe_lines(line_buffer &lb,
+                            logline_observer &llo,
+                            iterator iter,
+                            const std::function<bool(iterator)> &progress)
+{
+    /*
+     * Lines are handed to the observer in windows read straight out of the
+     * line buffer, so each line does not need to be read and copied on its
+     * own.  Lines whose text has to be rewritten first, because they are
+     * not valid UTF-8 or the format replaces them, are read one at a time.
+     */
+    bool can_batch = this->lf_format == nullptr ||
+                     !this->lf_format->has_sublines();
+    std::vector<file_range> line_ranges;
+
+    while (iter != this->end()) {
+        if (!progress(iter)) {
+            return false;
+        }
+
+        if (!can_batch || !iter->is_valid_utf()) {
+            this->read_line(lb, iter).then([this, &llo, iter](auto sbr) {
+                llo.logline_new_line(*this, iter, sbr);
             });
+            ++iter;
+            continue;
         }
-        if (this->lf_logfile_observer != NULL) {
-            this->lf_logfile_observer->logfile_indexing(
-                    *this, this->size(), this->size());
+
+        auto window_start = iter;
+        off_t window_offset = iter->get_offset();
+        ssize_t window_size = 0;
+
+        line_ranges.clear();
+        for (; iter != this->end() && iter->is_valid_utf() &&
+               line_ranges.size() < MAX_OBSERVE_BATCH_LINES;
+             ++iter) {
+            auto fr = this->get_file_range(iter, false);
+
+            if (!line_ranges.empty() &&
+                fr.next_offset() - window_offset > MAX_OBSERVE_BATCH_SIZE) {
+                break;
+            }
+            fr.fr_offset -= window_offset;
+            window_size = fr.next_offset();
+            line_ranges.emplace_back(fr);
         }
 
-        this->lf_logline_observer->logline_eof(*this);
+        bool batched = false;
+
+        try {
+            auto read_result = lb.read_range({window_offset, window_size});
+
+            if (read_result.isOk()) {
+                auto window = read_result.unwrap();
+
+                for (auto &fr : line_ranges) {
+                    while (fr.fr_size > 0 &&
+                           is_line_ending(
+                               window.get_data()[fr.next_offset() - 1])) {
+                        fr.fr_size -= 1;
+                    }
+                }
+                llo.logline_new_lines(*this, window_start, window, line_ranges);
+                batched = true;
+            }
+        }
+        catch (line_buffer::error & e) {
+        }
+
+        if (!batched) {
+            for (auto ll = window_start; ll != iter; ++ll) {
+                this->read_line(lb, ll).then([this, &llo, ll](auto sbr) {
+                    llo.logline_new_line(*this, ll, sbr);
+                });
+            }
+        }
     }
+
+    return true;
 }
 
-filesystem::path logfile::get_path() const
+::filesystem::path logfile::get_path() const
 {
     return this->lf_filename;
 }
@@ -43,6 +43,7 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <functional>
 
 #include "base/lnav_log.hh"
 #include "base/result.h"
@@ -75,7 +76,10 @@ public:
 };
 
 struct logfile_open_options {
-    logfile_open_options() : loo_detect_format(true) {
+    logfile_open_options()
+        : loo_detect_format(true),
+          loo_scan_chunk_size(0),
+          loo_background_index(false) {
     };
 
     logfile_open_options &with_fd(auto_fd fd) {
@@ -90,8 +94,32 @@ struct logfile_open_options {
         return *this;
     };
 
+    logfile_open_options &with_scan_chunk_size(off_t val) {
+        this->loo_scan_chunk_size = val;
+
+        return *this;
+    };
+
+    logfile_open_options &with_background_index(bool val) {
+        this->loo_background_index = val;
+
+        return *this;
+    };
+
     auto_fd loo_fd;
     bool loo_detect_format;
+    /**
+     * The size of the chunks to split a file into when scanning it in
+     * parallel or in the background.  A value of zero means to pick a size
+     * based on the file size and the number of processors.
+     */
+    off_t loo_scan_chunk_size;
+    /**
+     * If true, large amounts of new data are scanned on a background thread
+     * and rebuild_index() only merges the lines that have been scanned so
+     * far instead of waiting for the whole file to be indexed.
+     */
+    bool loo_background_index;
 };
 
 struct logfile_activity {
@@ -101,6 +129,8 @@ struct logfile_activity {
 
     int64_t la_polls;
     int64_t la_reads;
+    /** The number of times the index was loaded from the index cache. */
+    int64_t la_index_cache_hits;
     struct rusage la_initial_index_rusage;
 };
 
@@ -123,6 +153,12 @@ public:
     typedef std::vector<logline>::iterator       iterator;
     typedef std::vector<logline>::const_iterator const_iterator;
 
+    /** The maximum number of lines passed to logline_new_lines() at once. */
+    static const size_t MAX_OBSERVE_BATCH_LINES = 4 * 1024;
+    /** The maximum size of the window passed to logline_new_lines(). */
+    static const ssize_t MAX_OBSERVE_BATCH_SIZE =
+        line_buffer::DEFAULT_LINE_BUFFER_SIZE / 2;
+
     /**
      * Construct a logfile with the given arguments.
      *
@@ -172,6 +208,16 @@ public:
         return this->lf_valid_filename;
     };
 
+    /**
+     * @return True if observe_lines() can be called from another thread with
+     *   a line buffer that reads from a dup() of this file's descriptor.
+     */
+    bool can_observe_in_background() const {
+        return !this->lf_line_buffer.is_compressed() &&
+               !this->lf_line_buffer.is_pipe() &&
+               (this->lf_format == nullptr || !this->lf_format->has_sublines());
+    };
+
     /**
      * @return The detected format, rebuild_index() must be called before this
      * will return a value other than NULL.
@@ -252,12 +298,21 @@ public:
 
     void close() {
         this->lf_is_closed = true;
+        this->stop_background_scan();
     };
 
     bool is_closed() const {
         return this->lf_is_closed;
     };
 
+    /**
+     * @return True if new data is being scanned on a background thread and
+     *   rebuild_index() should be called again soon to pick up the lines.
+     */
+    bool is_indexing() const {
+        return this->lf_background_scan != nullptr;
+    };
+
     struct timeval original_line_time(iterator ll) {
         if (this->is_time_adjusted()) {
             struct timeval line_time = ll->get_timeval();
@@ -270,7 +325,12 @@ public:
         return ll->get_timeval();
     };
 
-    Result<shared_buffer_ref, std::string> read_line(iterator ll);
+    Result<shared_buffer_ref, std::string> read_line(iterator ll) {
+        return this->read_line(this->lf_line_buffer, ll);
+    };
+
+    Result<shared_buffer_ref, std::string> read_line(line_buffer &lb,
+                                                     iterator ll);
 
     iterator line_base(iterator ll) {
         iterator retval = ll;
@@ -345,6 +405,24 @@ public:
 
     void reobserve_from(iterator iter);
 
+    /**
+     * Pass the lines from the given iterator to the end of the file to an
+     * observer, reading them through the given line buffer.  This can be
+     * called from another thread, if can_observe_in_background() is true,
+     * as long as the file is not re-indexed while it runs.
+     *
+     * @param lb The line buffer to read the lines with.
+     * @param llo The observer to pass the lines to.
+     * @param iter The first line to observe.
+     * @param progress Called with the next line to be observed, returns
+     *   false to stop early.
+     * @return True if all of the lines were observed.
+     */
+    bool observe_lines(line_buffer &lb,
+                       logline_observer &llo,
+                       iterator iter,
+                       const std::function<bool(iterator)> &progress);
+
     void set_logfile_observer(logfile_observer *lo) {
         this->lf_logfile_observer = lo;
     };
@@ -355,6 +433,16 @@ public:
         return this->lf_logline_observer;
     };
 
+    /**
+     * Limit the number of threads used to index this file, for when several
+     * files are being indexed at the same time.  A value of zero means to
+     * use parallel_worker_count().
+     */
+    void set_max_workers(size_t max_workers) {
+        this->lf_max_workers = max_workers;
+        this->lf_line_buffer.set_max_workers(max_workers);
+    };
+
     bool operator<(const logfile &rhs) const
     {
         bool retval;
@@ -395,6 +483,85 @@ protected:
 
     void set_format_base_time(log_format *lf);
 
+    /**
+     * Scan the lines in a large file in parallel by splitting the file into
+     * chunks that are each scanned with their own copy of the format.  The
+     * results are stitched back together in file order.
+     *
+     * @param prev_range The range of the last line that was indexed.
+     * @param st The current stat of the file.
+     * @param sort_needed Set to true if the new lines need to be sorted.
+     * @return The range of the last line that was indexed, the remainder of
+     *   the file should be scanned serially starting after this range.  An
+     *   error is returned if the file could not be read.
+     */
+    Result<file_range, std::string> scan_chunks(file_range prev_range,
+                                                const struct stat &st,
+                                                bool &sort_needed);
+
+    struct scan_chunk;
+    struct background_scan;
+
+    /**
+     * Scan the lines in a chunk of the file with the chunk's own copy of
+     * the format.  This can be called from any thread.
+     *
+     * @param lb The line buffer to read the chunk with.
+     * @param format The format to scan the lines with.
+     * @param sc The chunk to fill in.
+     */
+    void scan_chunk_lines(line_buffer &lb, log_format &format, scan_chunk &sc);
+
+    /**
+     * Append the lines from a scanned chunk to the index.
+     *
+     * @return False if the chunk could not be merged and the rest of the
+     *   file needs to be scanned serially.
+     */
+    bool merge_chunk(scan_chunk &sc, bool &sort_needed);
+
+    /**
+     * Start scanning the new data in the file on a background thread, if
+     * background indexing is enabled and there is enough data to make it
+     * worthwhile.
+     *
+     * @param st The current stat of the file.
+     * @return True if a scan was started.
+     */
+    bool start_background_scan(const struct stat &st);
+
+    /**
+     * Merge the chunks that have been scanned by the background thread into
+     * the index.  Merging stops after a short time so the caller is not
+     * held up, any remaining chunks are picked up by the next call.
+     *
+     * @param st The current stat of the file.
+     */
+    rebuild_result_t merge_background_scan(const struct stat &st);
+
+    void stop_background_scan();
+
+    /** @return The path to the file used to cache the index for this file. */
+    std::string index_cache_path() const;
+
+    /**
+     * Replace the index with the one saved in the cache by a previous
+     * session, if the cache is still valid for the file.  This should be
+     * called right after the format has been detected.
+     *
+     * @param st The current stat of the file.
+     * @return True if the index was loaded from the cache.
+     */
+    bool load_index_cache(const struct stat &st);
+
+    /**
+     * Save the index to the cache if the file is large enough and enough
+     * data has been indexed since the last time the cache was written.
+     *
+     * @param st The stat of the file at the start of indexing.
+     */
+    void save_index_cache(const struct stat &st);
+
     logfile_open_options lf_options;
     logfile_activity lf_activity;
     bool        lf_valid_filename;
@@ -417,6 +584,11 @@ protected:
     size_t lf_longest_line{0};
     text_format_t lf_text_format{text_format_t::TF_UNKNOWN};
     uint32_t lf_out_of_time_order_count{0};
+    off_t lf_index_cache_size{0};
+    size_t lf_max_workers{0};
+    /** Set when a background scan failed and the file has to be scanned inline. */
+    bool lf_serial_scan_needed{false};
+    std::unique_ptr<background_scan> lf_background_scan;
 };
 
 class logline_observer {
@@ -427,6 +599,30 @@ public:
 
     virtual void logline_new_line(const logfile &lf, logfile::const_iterator ll, shared_buffer_ref &sbr) = 0;
 
+    /**
+     * Called with a run of lines whose text is stored contiguously in a
+     * single buffer.  The default implementation passes each line to
+     * logline_new_line().
+     *
+     * @param lf The file that contains the lines.
+     * @param ll The first line in the run.
+     * @param window The buffer that holds the text of all the lines.
+     * @param line_ranges The range of each line's text, relative to the
+     *   start of the window and without the line ending.
+     */
+    virtual void logline_new_lines(const logfile &lf,
+                                   logfile::const_iterator ll,
+                                   shared_buffer_ref &window,
+                                   const std::vector<file_range> &line_ranges) {
+        for (const auto &fr : line_ranges) {
+            shared_buffer_ref sbr;
+
+            sbr.subset(window, fr.fr_offset, fr.fr_size);
+            this->logline_new_line(lf, ll, sbr);
+            ++ll;
+        }
+    };
+
     virtual void logline_eof(const logfile &lf) = 0;
 };
 
@@ -33,6 +33,7 @@
 #include <algorithm>
 #include <sqlite3.h>
 
+#include "base/parallel_for.hh"
 #include "k_merge_tree.h"
 #include "lnav_util.hh"
 #include "log_accel.hh"
@@ -48,6 +49,67 @@ bookmark_type_t logfile_sub_source::BM_ERRORS("error");
 bookmark_type_t logfile_sub_source::BM_WARNINGS("warning");
 bookmark_type_t logfile_sub_source::BM_FILES("");
 
+/**
+ * The maximum number of lines at the end of the index that will be merged
+ * again to make room for new lines that are older than the last indexed line.
+ * If the new lines are any later than this, the whole index is rebuilt.
+ */
+static const size_t MAX_REORDER_WINDOW = 64 * 1024;
+
+void pcre_filter::matches_batch(const logfile &lf,
+                                logfile::const_iterator ll,
+                                shared_buffer_ref &window,
+                                const std::vector<file_range> &line_ranges,
+                                size_t start,
+                                size_t end,
+                                std::vector<uint8_t> &matched)
+{
+    if (start >= end) {
+        return;
+    }
+
+    /*
+     * Search the whole window for the pattern's required literal and only
+     * run the regex on the lines that contain it.  A hit that straddles two
+     * lines just means an extra, unsuccessful, match attempt.
+     */
+    const char *data = window.get_data();
+    auto range_iter = line_ranges.begin() + start;
+    auto range_end = line_ranges.begin() + end;
+    off_t curr = range_iter->fr_offset;
+    off_t last = (range_end - 1)->next_offset();
+
+    while (curr < last) {
+        const char *hit = this->pf_pcre.find_required_literal_in(
+            &data[curr], last - curr);
+
+        if (hit == nullptr) {
+            break;
+        }
+
+        off_t hit_offset = hit - data;
+
+        range_iter = std::upper_bound(
+            range_iter, range_end, hit_offset,
+            [](off_t off, const file_range &fr) {
+                return off < fr.fr_offset;
+            }) - 1;
+
+        size_t index = std::distance(line_ranges.begin(), range_iter);
+        const file_range &fr = *range_iter;
+        pcre_context_static<30> pc;
+        pcre_input pi(&data[fr.fr_offset], 0, fr.fr_size);
+
+        matched[index] = this->pf_pcre.match(pc, pi);
+
+        ++range_iter;
+        if (range_iter == range_end) {
+            break;
+        }
+        curr = range_iter->fr_offset;
+    }
+}
+
 static int pretty_sql_callback(exec_context &ec, sqlite3_stmt *stmt)
 {
     if (!sqlite3_stmt_busy(stmt)) {
@@ -546,6 +608,71 @@ void logfile_sub_source::text_attrs_for_line(textview_curses &lv,
     }
 }
 
+/**
+ * Combine the results of two calls to logfile::rebuild_index(), keeping the
+ * one that requires the most work from the caller.
+ */
+static logfile::rebuild_result_t merge_rebuild_results(
+    logfile::rebuild_result_t lhs, logfile::rebuild_result_t rhs)
+{
+    if (lhs == logfile::RR_INVALID || rhs == logfile::RR_INVALID) {
+        return logfile::RR_INVALID;
+    }
+
+    return std::max(lhs, rhs);
+}
+
+vector<logfile::rebuild_result_t> logfile_sub_source::index_files()
+{
+    vector<logfile::rebuild_result_t> retval(this->lss_files.size(),
+                                             logfile::RR_NO_NEW_LINES);
+    vector<size_t> parallel_indexes;
+
+    /*
+     * Format detection tries the root formats, which are shared between all
+     * of the files, so any files that have not locked onto a format yet are
+     * indexed here on the calling thread.  Once the format is found, the
+     * rest of the file is picked up by the parallel pass below.
+     */
+    for (size_t lpc = 0; lpc < this->lss_files.size(); lpc++) {
+        auto lf = this->lss_files[lpc]->get_file();
+
+        if (lf == nullptr) {
+            continue;
+        }
+
+        if (lf->get_format() == nullptr) {
+            retval[lpc] = lf->rebuild_index();
+        }
+        if (lf->get_format() != nullptr && !lf->is_closed()) {
+            parallel_indexes.push_back(lpc);
+        }
+    }
+
+    /*
+     * Files with a locked format have their own specialized format, line
+     * buffer, index, and filter state, so they can be indexed concurrently.
+     * The threads are split between the files so that the parallel scan and
+     * decompression within each file do not oversubscribe the CPUs.
+     */
+    size_t worker_count = parallel_worker_count();
+    size_t file_workers = std::max(
+        worker_count / std::max(parallel_indexes.size(), (size_t) 1),
+        (size_t) 1);
+
+    parallel_for(parallel_indexes.size(), [&](size_t index) {
+        size_t file_index = parallel_indexes[index];
+        auto lf = this->lss_files[file_index]->get_file();
+
+        lf->set_max_workers(file_workers);
+        retval[file_index] = merge_rebuild_results(retval[file_index],
+                                                   lf->rebuild_index());
+        lf->set_max_workers(0);
+    }, worker_count);
+
+    return retval;
+}
+
 logfile_sub_source::rebuild_result logfile_sub_source::rebuild_index()
 {
     iterator iter;
@@ -553,6 +680,9 @@ logfile_sub_source::rebuild_result logfile_sub_source::rebuild_index()
     bool full_sort = false;
     int file_count = 0;
     bool force = this->lss_force_rebuild;
+    bool reorder_needed = false;
+    struct timeval reorder_time;
+    vis_line_t reorder_start(-1);
     rebuild_result retval = rebuild_result::rr_no_change;
 
     this->lss_force_rebuild = false;
@@ -560,6 +690,8 @@ logfile_sub_source::rebuild_result logfile_sub_source::rebuild_index()
         retval = rebuild_result::rr_full_rebuild;
     }
 
+    vector<logfile::rebuild_result_t> file_results = this->index_files();
+
     for (iter = this->lss_files.begin();
          iter != this->lss_files.end();
          iter++) {
@@ -574,7 +706,7 @@ logfile_sub_source::rebuild_result logfile_sub_source::rebuild_index()
         else {
             logfile &lf = *ld.get_file();
 
-            switch (lf.rebuild_index()) {
+            switch (file_results[std::distance(this->lss_files.begin(), iter)]) {
                 case logfile::RR_NO_NEW_LINES:
                     // No changes
                     break;
@@ -588,11 +720,19 @@ logfile_sub_source::rebuild_result logfile_sub_source::rebuild_index()
                         logline *last_indexed_line = this->find_line(cl);
 
                         // If there are new lines that are older than what we
-                        // have in the index, we need to resort.
-                        if (last_indexed_line == nullptr ||
-                            new_file_line < last_indexed_line->get_timeval()) {
+                        // have in the index, they need to be merged into the
+                        // tail of the index or, failing that, we need to
+                        // resort.
+                        if (last_indexed_line == nullptr) {
                             force = true;
                             retval = rebuild_result::rr_full_rebuild;
+                        } else if (new_file_line <
+                                   last_indexed_line->get_timeval()) {
+                            if (!reorder_needed ||
+                                new_file_line < reorder_time) {
+                                reorder_time = new_file_line.get_timeval();
+                            }
+                            reorder_needed = true;
                         }
                     }
                     break;
@@ -611,6 +751,17 @@ logfile_sub_source::rebuild_result logfile_sub_source::rebuild_index()
         force = true;
     }
 
+    vector<size_t> lines_indexed_before(this->lss_files.size(), 0);
+
+    if (!force && reorder_needed) {
+        if (this->trim_index_tail(reorder_time, lines_indexed_before)) {
+            reorder_start = vis_line_t(this->lss_filtered_index.size());
+        } else {
+            force = true;
+            retval = rebuild_result::rr_full_rebuild;
+        }
+    }
+
     if (force) {
         full_sort = true;
         for (iter = this->lss_files.begin();
@@ -732,7 +883,10 @@ logfile_sub_source::rebuild_result logfile_sub_source::rebuild_index()
             if (!ld->ld_filter_state.excluded(filter_in_mask, filter_out_mask,
                     line_number) && this->check_extra_filters(*line_iter)) {
                 this->lss_filtered_index.push_back(index_index);
-                if (this->lss_index_delegate != NULL) {
+                // Lines that were merged again after trimming the tail have
+                // already been passed to the delegate.
+                if (this->lss_index_delegate != NULL &&
+                    line_number >= lines_indexed_before[ld->ld_file_index]) {
                     shared_ptr<logfile> lf = ld->get_file();
                     this->lss_index_delegate->index_line(
                             *this, lf.get(), lf->begin() + line_number);
@@ -752,6 +906,9 @@ logfile_sub_source::rebuild_result logfile_sub_source::rebuild_index()
             this->tss_view->redo_search();
             break;
         case rebuild_result::rr_appended_lines:
+            if (reorder_start != -1) {
+                this->tss_view->search_range(reorder_start);
+            }
             this->tss_view->search_new_data();
             break;
     }
@@ -759,6 +916,79 @@ logfile_sub_source::rebuild_result logfile_sub_source::rebuild_index()
     return retval;
 }
 
+bool logfile_sub_source::trim_index_tail(const struct timeval &earliest,
+                                         vector<size_t> &lines_indexed_out)
+{
+    logline_cmp line_cmper(*this);
+    auto tail_iter = lower_bound(this->lss_index.begin(),
+                                 this->lss_index.end(),
+                                 earliest,
+                                 line_cmper);
+    size_t tail_start = std::distance(this->lss_index.begin(), tail_iter);
+
+    if (tail_start == 0 ||
+        this->lss_index.size() - tail_start > MAX_REORDER_WINDOW) {
+        return false;
+    }
+
+    vector<size_t> merge_starts(this->lss_files.size(), 0);
+    size_t merge_count = 0;
+
+    for (auto ld : this->lss_files) {
+        logfile *lf = ld->get_file_ptr();
+
+        if (lf == nullptr) {
+            continue;
+        }
+
+        auto indexed_end = lf->begin() + ld->ld_lines_indexed;
+        auto merge_iter = lower_bound(lf->begin(), indexed_end, earliest);
+
+        merge_starts[ld->ld_file_index] = std::distance(lf->begin(),
+                                                        merge_iter);
+        merge_count += std::distance(merge_iter, indexed_end);
+    }
+
+    // The files are in time order, so the lines to merge again from each
+    // file should make up the tail of the index.  Double-check that before
+    // throwing the tail away.
+    if (merge_count != this->lss_index.size() - tail_start) {
+        return false;
+    }
+    for (size_t index_index = tail_start;
+         index_index < this->lss_index.size();
+         index_index++) {
+        content_line_t cl = (content_line_t) this->lss_index[index_index];
+        uint64_t line_number;
+        logfile_data *ld = this->find_data(cl, line_number);
+
+        if (line_number < merge_starts[ld->ld_file_index]) {
+            return false;
+        }
+    }
+
+    for (auto ld : this->lss_files) {
+        if (ld->get_file_ptr() == nullptr) {
+            continue;
+        }
+
+        lines_indexed_out[ld->ld_file_index] = ld->ld_lines_indexed;
+        ld->ld_lines_indexed = merge_starts[ld->ld_file_index];
+    }
+
+    this->lss_index.truncate(tail_start);
+    while (!this->lss_filtered_index.empty() &&
+           this->lss_filtered_index.back() >= tail_start) {
+        this->lss_filtered_index.pop_back();
+    }
+    this->clear_line_size_cache();
+
+    log_debug("merging %d lines again at the tail of the index",
+              merge_count);
+
+    return true;
+}
+
 void logfile_sub_source::text_update_marks(vis_bookmarks &bm)
 {
     shared_ptr<logfile> last_file = nullptr;
@@ -788,7 +1018,12 @@ void logfile_sub_source::text_update_marks(vis_bookmarks &bm)
                 if (lss_user_mark.first == &textview_curses::BM_USER) {
                     auto ll = lf->begin() + cl;
 
-                    ll->set_mark(true);
+                    // Only touch the line if the mark was lost, since the
+                    // background filter has to be stopped to do it.
+                    if (!ll->is_marked()) {
+                        this->lss_background_filter.wait();
+                        ll->set_mark(true);
+                    }
                 }
             }
         }
@@ -844,15 +1079,64 @@ log_accel::direction_t logfile_sub_source::get_line_accel_direction(
 
 void logfile_sub_source::text_filters_changed()
 {
+    vector<logfile_data *> changed_files;
+    vector<line_filter_observer *> observers;
+
+    this->lss_background_filter.cancel();
     for (auto ld : *this) {
         shared_ptr<logfile> lf = ld->get_file();
 
         if (lf != nullptr) {
             ld->ld_filter_state.clear_deleted_filter_state();
-            lf->reobserve_from(lf->begin() + ld->ld_filter_state.get_min_count(lf->size()));
+            changed_files.push_back(ld);
+            observers.push_back(&ld->ld_filter_state);
         }
     }
 
+    if (this->lss_background_filter.start(this->get_filters(), observers)) {
+        // The current filtered index stays in place until check_filters()
+        // swaps in the result.
+        return;
+    }
+
+    /*
+     * Each file has its own filter state, so the files are re-observed in
+     * parallel.  Any threads that are left over are used to split up the
+     * matching within each file.
+     */
+    size_t worker_count = parallel_worker_count();
+    size_t file_workers = std::max(
+        worker_count / std::max(changed_files.size(), (size_t) 1), (size_t) 1);
+
+    parallel_for(changed_files.size(), [&](size_t index) {
+        logfile_data *ld = changed_files[index];
+        shared_ptr<logfile> lf = ld->get_file();
+
+        ld->ld_filter_state.lfo_max_workers = file_workers;
+        lf->reobserve_from(lf->begin() + ld->ld_filter_state.get_min_count(lf->size()));
+        ld->ld_filter_state.lfo_max_workers = 1;
+    }, worker_count);
+
+    this->rebuild_filtered_index();
+}
+
+bool logfile_sub_source::check_filters(bool wait)
+{
+    if (!this->lss_background_filter.is_running()) {
+        return false;
+    }
+    if (!wait && !this->lss_background_filter.is_done()) {
+        return true;
+    }
+
+    this->lss_background_filter.finish();
+    this->rebuild_filtered_index();
+
+    return false;
+}
+
+void logfile_sub_source::rebuild_filtered_index()
+{
     uint32_t filtered_in_mask, filtered_out_mask;
 
     this->get_filters().get_enabled_mask(filtered_in_mask, filtered_out_mask);
@@ -861,7 +1145,13 @@ void logfile_sub_source::text_filters_changed()
         this->lss_index_delegate->index_start(*this);
     }
 
-    this->lss_filtered_index.clear();
+    /*
+     * The new index is built on the side and swapped in at the end so that
+     * the view never sees a partially built index.
+     */
+    vector<uint32_t> filtered_index;
+
+    filtered_index.reserve(this->lss_index.size());
     for (size_t index_index = 0; index_index < this->lss_index.size(); index_index++) {
         content_line_t cl = (content_line_t) this->lss_index[index_index];
         uint64_t line_number;
@@ -870,7 +1160,7 @@ void logfile_sub_source::text_filters_changed()
 
         if (!ld->ld_filter_state.excluded(filtered_in_mask, filtered_out_mask,
                 line_number) && this->check_extra_filters(*line_iter)) {
-            this->lss_filtered_index.push_back(index_index);
+            filtered_index.push_back(index_index);
             if (this->lss_index_delegate != nullptr) {
                 shared_ptr<logfile> lf = ld->get_file();
                 this->lss_index_delegate->index_line(
@@ -878,6 +1168,7 @@ void logfile_sub_source::text_filters_changed()
             }
         }
     }
+    this->lss_filtered_index.swap(filtered_index);
 
     if (this->lss_index_delegate != nullptr) {
         this->lss_index_delegate->index_complete(*this);
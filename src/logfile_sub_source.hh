@@ -76,7 +76,7 @@ class pcre_filter
 public:
     pcre_filter(type_t type, const std::string id, size_t index, pcre *code)
         : text_filter(type, id, index),
-          pf_pcre(code) { };
+          pf_pcre(code, id) { };
 
     ~pcre_filter() override { };
 
@@ -87,6 +87,18 @@ public:
         return this->pf_pcre.match(pc, pi);
     };
 
+    void matches_batch(const logfile &lf,
+                       logfile::const_iterator ll,
+                       shared_buffer_ref &window,
+                       const std::vector<file_range> &line_ranges,
+                       size_t start,
+                       size_t end,
+                       std::vector<uint8_t> &matched) override;
+
+    bool is_batch_reentrant() const override {
+        return true;
+    };
+
     std::string to_command() override {
         return (this->lf_type == text_filter::INCLUDE ?
                 "filter-in " : "filter-out ") +
@@ -137,6 +149,19 @@ public:
 
     virtual void text_filters_changed();
 
+    /**
+     * Swap in the filter state that was computed in the background after
+     * the filters changed, once it is ready.
+     *
+     * @param wait Wait for the filters to finish being applied.
+     * @return True if the filters are still being applied.
+     */
+    bool check_filters(bool wait);
+
+    background_filter &get_background_filter() {
+        return this->lss_background_filter;
+    };
+
     logfile_sub_source();
     virtual ~logfile_sub_source();
 
@@ -308,6 +333,10 @@ public:
                              int row,
                              string_attrs_t &value_out);
 
+    int64_t text_row_cache_key(vis_line_t row) {
+        return this->at(row);
+    };
+
     size_t text_size_for_line(textview_curses &tc, int row, line_flags_t flags) {
         size_t index = row % LINE_SIZE_CACHE_SIZE;
 
@@ -333,6 +362,8 @@ public:
         if (bm == &textview_curses::BM_USER) {
             logline *ll = this->find_line(cl);
 
+            // The background filter reads the line flags.
+            this->lss_background_filter.wait();
             ll->set_mark(added);
         }
         lb = std::lower_bound(this->lss_user_marks[bm].begin(),
@@ -360,6 +391,7 @@ public:
         std::vector<content_line_t>::iterator iter;
 
         if (bm == &textview_curses::BM_USER) {
+            this->lss_background_filter.wait();
             for (iter = this->lss_user_marks[bm].begin();
                  iter != this->lss_user_marks[bm].end();) {
                 auto bm_iter = this->lss_user_mark_metadata.find(*iter);
@@ -489,10 +521,10 @@ public:
     logline *find_line(content_line_t line)
     {
         logline *retval = nullptr;
-        std::shared_ptr<logfile> lf = this->find(line);
+        logfile *lf = this->lss_files[line / MAX_LINES_PER_FILE]->get_file_ptr();
 
         if (lf != nullptr) {
-            auto ll_iter = lf->begin() + line;
+            auto ll_iter = lf->begin() + line % MAX_LINES_PER_FILE;
 
             retval = &(*ll_iter);
         }
@@ -599,6 +631,14 @@ public:
             return this->ld_filter_state.lfo_filter_state.tfs_logfile;
         };
 
+        /**
+         * @return The file without taking a reference, for use in hot paths
+         *   like sorting where the file is known to be kept alive elsewhere.
+         */
+        logfile *get_file_ptr() const {
+            return this->ld_filter_state.lfo_filter_state.tfs_logfile.get();
+        };
+
         size_t ld_file_index;
         line_filter_observer ld_filter_state;
         size_t ld_lines_indexed;
@@ -874,9 +914,41 @@ private:
         std::shared_ptr<logfile> lde_file;
     };
 
+    /**
+     * Index any new data in the files, using multiple threads when more than
+     * one file has locked onto a format.
+     *
+     * @return The result of logfile::rebuild_index() for each entry in
+     *   lss_files.
+     */
+    std::vector<logfile::rebuild_result_t> index_files();
+
+    /**
+     * Trim the lines at the end of the index that are at or after the given
+     * time so they can be merged again along with new lines that are older
+     * than the last indexed line.
+     *
+     * @param earliest The time of the oldest new line.
+     * @param lines_indexed_out Set to the number of lines that had been
+     *   indexed for each file that was trimmed.
+     * @return True if the tail was trimmed, false if the lines are too far
+     *   back and the index needs to be fully rebuilt.
+     */
+    bool trim_index_tail(const struct timeval &earliest,
+                         std::vector<size_t> &lines_indexed_out);
+
+    /**
+     * Rebuild the filtered index from the current filter state of each file
+     * and reload the view.
+     */
+    void rebuild_filtered_index();
+
     void clear_line_size_cache() {
         memset(this->lss_line_size_cache, 0, sizeof(this->lss_line_size_cache));
         this->lss_line_size_cache[0].first = -1;
+        if (this->tss_view != nullptr) {
+            this->tss_view->invalidate_row_cache();
+        }
     };
 
     bool check_extra_filters(const logline &ll) {
@@ -920,6 +992,7 @@ private:
     size_t            lss_longest_line;
     meta_grepper lss_meta_grepper;
     log_location_history lss_location_history;
+    background_filter lss_background_filter;
 };
 
 #endif
@@ -31,6 +31,10 @@
 
 #include "config.h"
 
+#include <ctype.h>
+#include <string.h>
+#include <strings.h>
+
 #include <pcrecpp.h>
 
 #include "pcrepp.hh"
@@ -126,6 +130,284 @@ void pcrepp::find_captures(const char *pattern)
     }
 }
 
+/**
+ * The shortest literal that is worth checking for before running PCRE.  PCRE
+ * already looks for a single required character on its own.
+ */
+static const size_t MIN_REQUIRED_LITERAL = 3;
+
+void pcrepp::find_required_literal(const char *pattern)
+{
+    unsigned long options = 0;
+    std::string longest, current;
+    bool caseless;
+    int depth = 0;
+
+    this->p_required_literal.clear();
+    pcre_fullinfo(this->p_code,
+                  this->p_code_extra,
+                  PCRE_INFO_OPTIONS,
+                  &options);
+    if (options & PCRE_EXTENDED) {
+        return;
+    }
+    caseless = (options & PCRE_CASELESS) != 0;
+
+    auto end_run = [&]() {
+        if (current.length() > longest.length()) {
+            longest = current;
+        }
+        current.clear();
+    };
+    auto add_char = [&](char ch) {
+        if (depth > 0) {
+            return;
+        }
+        if (caseless && (ch & 0x80)) {
+            /* Non-ASCII characters can fold to other byte sequences. */
+            end_run();
+            return;
+        }
+        current.push_back(ch);
+    };
+    auto skip_to = [&](size_t &lpc, char term) {
+        while (pattern[lpc + 1] && pattern[lpc + 1] != term) {
+            lpc += 1;
+        }
+        if (pattern[lpc + 1]) {
+            lpc += 1;
+        }
+    };
+
+    /*
+     * Collect the runs of literal characters that are outside of any group.
+     * Anything we do not understand ends the current run or, if it could
+     * change the meaning of the rest of the pattern, abandons the search.
+     */
+    for (size_t lpc = 0; pattern[lpc]; lpc++) {
+        char ch = pattern[lpc];
+
+        switch (ch) {
+            case '\\': {
+                char next = pattern[lpc + 1];
+
+                if (next == '\0') {
+                    return;
+                }
+                lpc += 1;
+                if (!isalnum((unsigned char) next)) {
+                    add_char(next);
+                    break;
+                }
+
+                static const char ESCAPE_CHARS[] = "ntrfea";
+                static const char ESCAPE_VALUES[] = "\n\t\r\f\x1b\a";
+                const char *esc = strchr(ESCAPE_CHARS, next);
+
+                if (esc != nullptr) {
+                    add_char(ESCAPE_VALUES[esc - ESCAPE_CHARS]);
+                    break;
+                }
+                end_run();
+                switch (next) {
+                    case 'd': case 'D': case 'w': case 'W': case 's':
+                    case 'S': case 'b': case 'B': case 'h': case 'H':
+                    case 'v': case 'V': case 'A': case 'z': case 'Z':
+                    case 'G': case 'K': case 'R': case 'X': case 'E':
+                        break;
+                    case 'x':
+                        if (pattern[lpc + 1] == '{') {
+                            skip_to(lpc, '}');
+                        } else {
+                            for (int hex = 0;
+                                 hex < 2 && isxdigit((unsigned char) pattern[lpc + 1]);
+                                 hex++) {
+                                lpc += 1;
+                            }
+                        }
+                        break;
+                    case 'c':
+                        if (pattern[lpc + 1]) {
+                            lpc += 1;
+                        }
+                        break;
+                    case 'p': case 'P': case 'N': case 'o':
+                        if (pattern[lpc + 1] == '{') {
+                            skip_to(lpc, '}');
+                        } else if (next != 'N' && pattern[lpc + 1]) {
+                            lpc += 1;
+                        }
+                        break;
+                    default:
+                        if (isdigit((unsigned char) next)) {
+                            while (isdigit((unsigned char) pattern[lpc + 1])) {
+                                lpc += 1;
+                            }
+                            break;
+                        }
+                        /* \Q, \g, \k and friends, just give up. */
+                        return;
+                }
+                break;
+            }
+            case '[': {
+                end_run();
+                if (pattern[lpc + 1] == '^') {
+                    lpc += 1;
+                }
+                if (pattern[lpc + 1] == ']') {
+                    lpc += 1;
+                }
+                for (lpc += 1; pattern[lpc] && pattern[lpc] != ']'; lpc++) {
+                    if (pattern[lpc] == '\\' && pattern[lpc + 1]) {
+                        lpc += 1;
+                    } else if (pattern[lpc] == '[' && pattern[lpc + 1] == ':') {
+                        const char *posix_end = strstr(&pattern[lpc], ":]");
+
+                        if (posix_end != nullptr) {
+                            lpc = posix_end - pattern + 1;
+                        }
+                    }
+                }
+                if (!pattern[lpc]) {
+                    return;
+                }
+                break;
+            }
+            case '(':
+                end_run();
+                if (pattern[lpc + 1] == '?') {
+                    for (size_t flag = lpc + 2;
+                         isalpha((unsigned char) pattern[flag]) ||
+                         pattern[flag] == '-';
+                         flag++) {
+                        if (pattern[flag] == 'i') {
+                            caseless = true;
+                            longest.clear();
+                        } else if (pattern[flag] == 'x') {
+                            return;
+                        }
+                    }
+                }
+                depth += 1;
+                break;
+            case ')':
+                end_run();
+                depth -= 1;
+                break;
+            case '|':
+                if (depth == 0) {
+                    return;
+                }
+                break;
+            case '?':
+            case '*':
+            case '{':
+                /*
+                 * The previous character might not be there, drop all of
+                 * it in case it is a multibyte UTF-8 sequence.
+                 */
+                while (!current.empty() &&
+                       ((unsigned char) current.back() & 0xc0) == 0x80) {
+                    current.pop_back();
+                }
+                if (!current.empty()) {
+                    current.pop_back();
+                }
+                end_run();
+                if (ch == '{') {
+                    skip_to(lpc, '}');
+                }
+                if (pattern[lpc + 1] == '?' || pattern[lpc + 1] == '+') {
+                    lpc += 1;
+                }
+                break;
+            case '+':
+                end_run();
+                if (pattern[lpc + 1] == '?' || pattern[lpc + 1] == '+') {
+                    lpc += 1;
+                }
+                break;
+            case '.':
+            case '^':
+            case '$':
+                end_run();
+                break;
+            default:
+                add_char(ch);
+                break;
+        }
+    }
+    end_run();
+
+    if (depth == 0 && longest.length() >= MIN_REQUIRED_LITERAL) {
+        this->p_required_literal = longest;
+        this->p_literal_caseless = caseless;
+    }
+}
+
+const char *pcrepp::find_required_literal_in(const char *str,
+                                             size_t len) const
+{
+    const std::string &lit = this->p_required_literal;
+
+    if (lit.empty()) {
+        return str;
+    }
+    if (len < lit.length()) {
+        return nullptr;
+    }
+
+    if (!this->p_literal_caseless) {
+        return (const char *) memmem(str, len, lit.data(), lit.length());
+    }
+
+    /*
+     * Anchor the search on a character that has no case, if there is one,
+     * so that memchr() can do the scanning.
+     */
+    size_t anchor = 0;
+
+    while (anchor < lit.length() && isalpha((unsigned char) lit[anchor])) {
+        anchor += 1;
+    }
+    if (anchor < lit.length()) {
+        const char *curr = str + anchor;
+        const char *last = str + len - (lit.length() - anchor);
+
+        while (curr <= last &&
+               (curr = (const char *) memchr(curr, lit[anchor],
+                                             last - curr + 1)) != nullptr) {
+            if (strncasecmp(curr - anchor, lit.c_str(), lit.length()) == 0) {
+                return curr - anchor;
+            }
+            curr += 1;
+        }
+        return nullptr;
+    }
+
+    char first = tolower(lit[0]);
+
+    for (size_t lpc = 0; lpc + lit.length() <= len; lpc++) {
+        if ((str[lpc] | 0x20) == first &&
+            strncasecmp(&str[lpc], lit.c_str(), lit.length()) == 0) {
+            return &str[lpc];
+        }
+    }
+
+    return nullptr;
+}
+
+bool pcrepp::has_required_literal(const pcre_input &pi) const
+{
+    if (pi.pi_offset > pi.pi_length) {
+        return false;
+    }
+
+    return this->find_required_literal_in(
+        pi.get_string() + pi.pi_offset, pi.pi_length - pi.pi_offset) != nullptr;
+}
+
 bool pcrepp::match(pcre_context &pc, pcre_input &pi, int options) const
 {
     int         length, startoffset, filtered_options = options;
@@ -136,6 +418,12 @@ bool pcrepp::match(pcre_context &pc, pcre_input &pi, int options) const
     pc.set_pcrepp(this);
     pi.pi_offset = pi.pi_next_offset;
 
+    if (!this->p_required_literal.empty() && !(options & PCRE_PARTIAL) &&
+        !this->has_required_literal(pi)) {
+        pc.set_count(PCRE_ERROR_NOMATCH);
+        return false;
+    }
+
     str = pi.get_string();
     if (filtered_options & PCRE_ANCHORED) {
         filtered_options &= ~PCRE_ANCHORED;
@@ -236,6 +524,43 @@ void pcrepp::study(void)
                   &this->p_named_entries);
 }
 
+std::bitset<256> pcrepp::first_bytes() const
+{
+    std::bitset<256> retval;
+    unsigned long options = 0;
+
+    retval.set();
+    if (pcre_fullinfo(this->p_code,
+                      this->p_code_extra,
+                      PCRE_INFO_OPTIONS,
+                      &options) != 0 ||
+        !(options & PCRE_ANCHORED)) {
+        return retval;
+    }
+
+    /*
+     * PCRE only computes a start-of-match table for unanchored patterns, so
+     * we probe the pattern with each possible byte instead.  An anchored
+     * pattern that cannot even partially match a single byte can never
+     * match a subject that starts with that byte.
+     */
+    for (int lpc = 0; lpc < 256; lpc++) {
+        char subject[1] = { (char) lpc };
+        int rc = pcre_exec(this->p_code,
+                           this->p_code_extra.in(),
+                           subject,
+                           1,
+                           0,
+                           PCRE_PARTIAL,
+                           nullptr,
+                           0);
+
+        retval[lpc] = (rc != PCRE_ERROR_NOMATCH);
+    }
+
+    return retval;
+}
+
 #ifdef PCRE_STUDY_JIT_COMPILE
 pcre_jit_stack *pcrepp::jit_stack(void)
 {
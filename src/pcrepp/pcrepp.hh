@@ -49,6 +49,7 @@
 
 #include <string.h>
 
+#include <bitset>
 #include <string>
 #include <memory>
 #include <utility>
@@ -371,6 +372,19 @@ public:
         this->study();
     };
 
+    /**
+     * @param code The compiled pattern.
+     * @param pattern The source of the pattern, used to find any literal
+     *   text that is required for a match.
+     */
+    pcrepp(pcre *code, const std::string &pattern)
+        : p_code(code), p_code_extra(pcre_free_study)
+    {
+        pcre_refcount(this->p_code, 1);
+        this->study();
+        this->find_required_literal(pattern.c_str());
+    };
+
     pcrepp(const char *pattern, int options = 0)
             : p_code_extra(pcre_free_study)
     {
@@ -388,6 +402,7 @@ public:
         pcre_refcount(this->p_code, 1);
         this->study();
         this->find_captures(pattern);
+        this->find_required_literal(pattern);
     };
 
     pcrepp(const std::string &pattern, int options = 0)
@@ -407,9 +422,12 @@ public:
         pcre_refcount(this->p_code, 1);
         this->study();
         this->find_captures(pattern.c_str());
+        this->find_required_literal(pattern.c_str());
     };
 
     pcrepp(const pcrepp &other)
+        : p_required_literal(other.p_required_literal),
+          p_literal_caseless(other.p_literal_caseless)
     {
         this->p_code = other.p_code;
         pcre_refcount(this->p_code, 1);
@@ -477,6 +495,35 @@ public:
         return this->p_capture_count;
     };
 
+    /**
+     * Compute the set of bytes that a subject can start with and still be
+     * matched by this pattern.  This is not cheap, so callers should hold
+     * onto the result.
+     *
+     * @return The set of possible first bytes.  Every bit is set if the
+     *   pattern is not anchored.
+     */
+    std::bitset<256> first_bytes() const;
+
+    /**
+     * @return The longest literal text that must appear in any match of
+     *   this pattern or an empty string if there is no such text.  Subjects
+     *   that do not contain the text are rejected without running PCRE.
+     */
+    const std::string &get_required_literal() const {
+        return this->p_required_literal;
+    };
+
+    /**
+     * Search a buffer for the first occurrence of the required literal.
+     *
+     * @param str The buffer to search.
+     * @param len The length of the buffer.
+     * @return A pointer to the start of the literal in the buffer, nullptr
+     *   if it was not found, or 'str' if this pattern has no literal.
+     */
+    const char *find_required_literal_in(const char *str, size_t len) const;
+
     bool match(pcre_context &pc, pcre_input &pi, int options = 0) const;
 
     size_t match_partial(pcre_input &pi) const {
@@ -515,6 +562,10 @@ public:
 
     void find_captures(const char *pattern);
 
+    void find_required_literal(const char *pattern);
+
+    bool has_required_literal(const pcre_input &pi) const;
+
     pcre *p_code;
     auto_mem<pcre_extra> p_code_extra;
     int p_capture_count;
@@ -522,6 +573,8 @@ public:
     int p_name_len;
     pcre_named_capture *p_named_entries;
     std::vector<pcre_context::capture> p_captures;
+    std::string p_required_literal;
+    bool p_literal_caseless{false};
 };
 
 #endif
@@ -1446,7 +1446,7 @@ void reset_session()
         }
 
         for (const auto &vd : elf->elf_value_defs) {
-            vd.second->vd_user_hidden = false;
+            elf->hide_field(vd.first, false);
         }
     }
 }
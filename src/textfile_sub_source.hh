@@ -32,6 +32,7 @@
 
 #include <list>
 
+#include "base/parallel_for.hh"
 #include "logfile.hh"
 #include "textview_curses.hh"
 #include "filter_observer.hh"
@@ -239,26 +240,54 @@ public:
     virtual void text_filters_changed() {
         std::shared_ptr<logfile> lf = this->current_file();
 
+        this->tss_background_filter.cancel();
         if (lf == nullptr) {
             return;
         }
 
         line_filter_observer *lfo = (line_filter_observer *) lf->get_logline_observer();
-        uint32_t filter_in_mask, filter_out_mask;
 
         lfo->clear_deleted_filter_state();
+        if (this->tss_background_filter.start(this->get_filters(), {lfo})) {
+            // The current filtered index stays in place until
+            // check_filters() swaps in the result.
+            this->tss_background_file = lf;
+            return;
+        }
+
+        lfo->lfo_max_workers = parallel_worker_count();
         lf->reobserve_from(lf->begin() + lfo->get_min_count(lf->size()));
+        lfo->lfo_max_workers = 1;
 
-        this->get_filters().get_enabled_mask(filter_in_mask, filter_out_mask);
-        lfo->lfo_filter_state.tfs_index.clear();
-        for (uint32_t lpc = 0; lpc < lf->size(); lpc++) {
-            if (lfo->excluded(filter_in_mask, filter_out_mask, lpc)) {
-                continue;
-            }
-            lfo->lfo_filter_state.tfs_index.push_back(lpc);
+        this->rebuild_filtered_index(lf);
+    };
+
+    /**
+     * Swap in the filter state that was computed in the background after
+     * the filters changed, once it is ready.
+     *
+     * @param wait Wait for the filters to finish being applied.
+     * @return True if the filters are still being applied.
+     */
+    bool check_filters(bool wait) {
+        if (!this->tss_background_filter.is_running()) {
+            return false;
+        }
+        if (!wait && !this->tss_background_filter.is_done()) {
+            return true;
         }
 
-        this->tss_view->redo_search();
+        std::shared_ptr<logfile> lf = std::move(this->tss_background_file);
+
+        this->tss_background_filter.finish();
+        this->rebuild_filtered_index(lf);
+        this->tss_view->reload_data();
+
+        return false;
+    };
+
+    background_filter &get_background_filter() {
+        return this->tss_background_filter;
     };
 
     int get_filtered_count() const {
@@ -298,12 +327,40 @@ public:
 
 private:
     void detach_observer(std::shared_ptr<logfile> lf) {
+        if (lf == this->tss_background_file) {
+            this->tss_background_filter.cancel();
+            this->tss_background_file = nullptr;
+        }
+
         line_filter_observer *lfo = (line_filter_observer *) lf->get_logline_observer();
         lf->set_logline_observer(NULL);
         delete lfo;
     };
 
+    void rebuild_filtered_index(const std::shared_ptr<logfile> &lf) {
+        line_filter_observer *lfo = (line_filter_observer *) lf->get_logline_observer();
+        uint32_t filter_in_mask, filter_out_mask;
+
+        this->get_filters().get_enabled_mask(filter_in_mask, filter_out_mask);
+
+        std::vector<uint32_t> filtered_index;
+
+        filtered_index.reserve(lf->size());
+        for (uint32_t lpc = 0; lpc < lf->size(); lpc++) {
+            if (lfo->excluded(filter_in_mask, filter_out_mask, lpc)) {
+                continue;
+            }
+            filtered_index.push_back(lpc);
+        }
+        lfo->lfo_filter_state.tfs_index.swap(filtered_index);
+
+        this->tss_view->redo_search();
+    };
+
     std::list<std::shared_ptr<logfile>> tss_files;
+    /** The file whose filters are being applied in the background. */
+    std::shared_ptr<logfile> tss_background_file;
+    background_filter tss_background_filter;
 };
 
 #endif
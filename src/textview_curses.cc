@@ -83,6 +83,44 @@ void text_filter::add_line(
     lfs.tfs_lines_for_message[this->lf_index] += 1;
 }
 
+void text_filter::add_lines(logfile_filter_state &lfs,
+                            logfile::const_iterator ll,
+                            const std::vector<uint8_t> &matched,
+                            size_t start)
+{
+    bool &message_matched = lfs.tfs_message_matched[this->lf_index];
+    size_t &lines_for_message = lfs.tfs_lines_for_message[this->lf_index];
+
+    ll += start;
+    for (size_t lpc = start; lpc < matched.size(); lpc++, ++ll) {
+        if (!ll->is_continued()) {
+            this->end_of_message(lfs);
+        }
+
+        message_matched = message_matched || matched[lpc];
+        lines_for_message += 1;
+    }
+}
+
+void text_filter::matches_batch(const logfile &lf,
+                                logfile::const_iterator ll,
+                                shared_buffer_ref &window,
+                                const std::vector<file_range> &line_ranges,
+                                size_t start,
+                                size_t end,
+                                std::vector<uint8_t> &matched)
+{
+    ll += start;
+    for (size_t lpc = start; lpc < end; lpc++, ++ll) {
+        shared_buffer_ref sbr;
+
+        sbr.subset(window,
+                   line_ranges[lpc].fr_offset,
+                   line_ranges[lpc].fr_size);
+        matched[lpc] = this->matches(lf, *ll, sbr);
+    }
+}
+
 void text_filter::end_of_message(logfile_filter_state &lfs)
 {
     uint32_t mask = 0;
@@ -132,6 +170,7 @@ textview_curses::~textview_curses()
 
 void textview_curses::reload_data(void)
 {
+    this->invalidate_row_cache();
     if (this->tc_sub_source != nullptr) {
         this->tc_sub_source->text_update_marks(this->tc_bookmarks);
     }
@@ -150,6 +189,7 @@ void textview_curses::grep_begin(grep_proc<vis_line_t> &gp, vis_line_t start, vi
 {
     require(this->tc_searching >= 0);
 
+    this->invalidate_row_cache();
     this->tc_searching += 1;
     this->tc_search_action.invoke(this);
 
@@ -158,11 +198,14 @@ void textview_curses::grep_begin(grep_proc<vis_line_t> &gp, vis_line_t start, vi
     if (start != -1) {
         auto pair = search_bv.equal_range(vis_line_t(start), vis_line_t(stop));
 
-        for (auto mark_iter = pair.first;
-             mark_iter != pair.second;
-             ++mark_iter) {
-            this->set_user_mark(&BM_SEARCH, *mark_iter, false);
+        if (this->tc_sub_source != nullptr) {
+            for (auto mark_iter = pair.first;
+                 mark_iter != pair.second;
+                 ++mark_iter) {
+                this->tc_sub_source->text_mark(&BM_SEARCH, *mark_iter, false);
+            }
         }
+        search_bv.erase(pair.first, pair.second);
     }
 
     listview_curses::reload_data();
@@ -187,6 +230,7 @@ void textview_curses::grep_match(grep_proc<vis_line_t> &gp,
     }
 
     if (this->get_top() <= line && line <= this->get_bottom()) {
+        this->invalidate_row_cache();
         listview_curses::reload_data();
     }
 }
@@ -283,8 +327,73 @@ bool textview_curses::handle_mouse(mouse_event &me)
     return true;
 }
 
+size_t textview_curses::row_marks_fingerprint(vis_line_t row) const
+{
+    size_t retval = 0;
+
+    // The marks on a row and the row after it change how the row is
+    // decorated, like the corner graphics at the edges of a file.
+    for (const auto &pair : this->tc_bookmarks) {
+        const auto &bv = pair.second;
+
+        retval = retval * 31 + bv.size();
+        retval = retval * 4 +
+                 (binary_search(bv.begin(), bv.end(), row) ? 1 : 0) +
+                 (binary_search(bv.begin(), bv.end(), row + 1_vl) ? 2 : 0);
+    }
+
+    return retval;
+}
+
 void textview_curses::textview_value_for_row(vis_line_t row,
                                              attr_line_t &value_out)
+{
+    int64_t key = this->tc_sub_source->text_row_cache_key(row);
+
+    if (key == -1) {
+        this->render_row(row, value_out);
+        return;
+    }
+
+    size_t generation = this->tc_row_cache_generation +
+                        view_colors::singleton().vc_roles_generation;
+    size_t marks = this->row_marks_fingerprint(row);
+    auto index_iter = this->tc_row_cache_index.find(key);
+
+    if (index_iter != this->tc_row_cache_index.end()) {
+        auto entry_iter = index_iter->second;
+
+        this->tc_row_cache.splice(this->tc_row_cache.begin(),
+                                  this->tc_row_cache,
+                                  entry_iter);
+        if (entry_iter->rce_row == row &&
+            entry_iter->rce_generation == generation &&
+            entry_iter->rce_marks == marks) {
+            value_out = entry_iter->rce_value;
+            return;
+        }
+    }
+    else {
+        if (this->tc_row_cache.size() >= ROW_CACHE_SIZE) {
+            this->tc_row_cache_index.erase(this->tc_row_cache.back().rce_key);
+            this->tc_row_cache.pop_back();
+        }
+        this->tc_row_cache.emplace_front();
+        this->tc_row_cache_index[key] = this->tc_row_cache.begin();
+    }
+
+    auto &entry = this->tc_row_cache.front();
+
+    value_out.clear();
+    this->render_row(row, value_out);
+    entry.rce_key = key;
+    entry.rce_row = row;
+    entry.rce_generation = generation;
+    entry.rce_marks = marks;
+    entry.rce_value = value_out;
+}
+
+void textview_curses::render_row(vis_line_t row, attr_line_t &value_out)
 {
     view_colors &vc = view_colors::singleton();
     bookmark_vector<vis_line_t> &user_marks = this->tc_bookmarks[&BM_USER];
@@ -466,7 +575,8 @@ void textview_curses::execute_search(const std::string &regex_orig)
             textview_curses::highlight_map_t &hm = this->get_highlights();
             hm[{highlight_source_t::PREVIEW, "search"}] = hl;
 
-            unique_ptr<grep_proc<vis_line_t>> gp = make_unique<grep_proc<vis_line_t>>(code, *this);
+            pcrepp search_pcre(code, regex);
+            unique_ptr<grep_proc<vis_line_t>> gp = make_unique<grep_proc<vis_line_t>>(search_pcre, *this);
 
             gp->set_sink(this);
             gp->queue_request(this->get_top());
@@ -479,8 +589,8 @@ void textview_curses::execute_search(const std::string &regex_orig)
                 gp, highlight_source_t::PREVIEW, "search", hm);
 
             if (this->tc_sub_source != nullptr) {
-                this->tc_sub_source->get_grepper() | [this, code] (auto pair) {
-                    shared_ptr<grep_proc<vis_line_t>> sgp = make_shared<grep_proc<vis_line_t>>(code, *pair.first);
+                this->tc_sub_source->get_grepper() | [this, &search_pcre] (auto pair) {
+                    shared_ptr<grep_proc<vis_line_t>> sgp = make_shared<grep_proc<vis_line_t>>(search_pcre, *pair.first);
 
                     sgp->set_sink(pair.second);
                     sgp->queue_request(0_vl);
@@ -32,8 +32,11 @@
 #ifndef __textview_curses_hh
 #define __textview_curses_hh
 
+#include <atomic>
+#include <list>
 #include <utility>
 #include <vector>
+#include <unordered_map>
 
 #include "ring_span.hh"
 #include "grep_proc.hh"
@@ -150,15 +153,61 @@ public:
 
     void end_of_message(logfile_filter_state &lfs);
 
+    /**
+     * Update the filter state with the result of matching a run of lines.
+     *
+     * @param lfs The filter state to update.
+     * @param ll The first line in the run.
+     * @param matched The result of matching each line in the run.
+     * @param start The index of the first result to apply, earlier results
+     *   are for lines that have already been counted.
+     */
+    void add_lines(logfile_filter_state &lfs,
+                   logfile::const_iterator ll,
+                   const std::vector<uint8_t> &matched,
+                   size_t start);
+
     virtual bool matches(const logfile &lf, const logline &ll, shared_buffer_ref &line) = 0;
 
+    /**
+     * Match this filter against a run of lines whose text is stored
+     * contiguously in a buffer.  The default implementation calls matches()
+     * for each line, subclasses can override it to scan the whole window
+     * at once.
+     *
+     * @param lf The file that contains the lines.
+     * @param ll The first line in the run.
+     * @param window The buffer that holds the text of the lines.
+     * @param line_ranges The range of each line in the window.
+     * @param start The index of the first line that needs to be matched.
+     * @param end The index after the last line that needs to be matched.
+     * @param matched The result for each line in the run, only the entries
+     *   in the range [start, end) are written.
+     */
+    virtual void matches_batch(const logfile &lf,
+                               logfile::const_iterator ll,
+                               shared_buffer_ref &window,
+                               const std::vector<file_range> &line_ranges,
+                               size_t start,
+                               size_t end,
+                               std::vector<uint8_t> &matched);
+
+    /**
+     * @return True if matches_batch() can be called from several threads at
+     *   once with different parts of the same window.
+     */
+    virtual bool is_batch_reentrant() const {
+        return false;
+    };
+
     virtual std::string to_command() = 0;
 
     bool operator==(const std::string &rhs) {
         return this->lf_id == rhs;
     };
 
-    bool lf_deleted{false};
+    /** Atomic since the filter can be read while it is applied in the background. */
+    std::atomic<bool> lf_deleted{false};
 
 protected:
     bool        lf_enabled{true};
@@ -446,6 +495,20 @@ public:
                                      int line,
                                      string_attrs_t &value_out) {};
 
+    /**
+     * Get a key for the content that is shown on a line so that the view
+     * can cache the rendered line.  Sources that opt into caching need to
+     * call textview_curses::invalidate_row_cache() whenever a change would
+     * render the same content differently.
+     *
+     * @param line The line number.
+     * @return The key for the content of the line or -1 if the line should
+     *   not be cached.
+     */
+    virtual int64_t text_row_cache_key(vis_line_t line) {
+        return -1;
+    };
+
     /**
      * Update the bookmarks used by the text view based on the bookmarks
      * maintained by the text source.
@@ -629,6 +692,7 @@ public:
                 this->tc_sub_source->text_mark(bm, curr_line, added);
             }
         }
+        this->invalidate_row_cache();
         this->search_range(start_line, end_line + 1_vl);
         this->search_new_data();
     };
@@ -650,6 +714,7 @@ public:
             this->tc_sub_source->text_mark(bm, vl, marked);
         }
 
+        this->invalidate_row_cache();
         this->search_range(vl, vl + 1_vl);
         this->search_new_data();
         this->set_needs_update();
@@ -835,6 +900,7 @@ public:
 
     void match_reset()
     {
+        this->invalidate_row_cache();
         this->tc_bookmarks[&BM_SEARCH].clear();
         if (this->tc_sub_source != NULL) {
             this->tc_sub_source->text_clear_marks(&BM_SEARCH);
@@ -844,7 +910,11 @@ public:
     using highlight_map_t =
         std::map<std::pair<highlight_source_t, std::string>, highlighter>;
 
-    highlight_map_t &get_highlights() { return this->tc_highlights; };
+    highlight_map_t &get_highlights() {
+        // The caller is probably going to change the highlights.
+        this->invalidate_row_cache();
+        return this->tc_highlights;
+    };
 
     const highlight_map_t &get_highlights() const { return this->tc_highlights; };
 
@@ -863,10 +933,19 @@ public:
         bool retval = this->tc_hide_fields;
 
         this->tc_hide_fields = !this->tc_hide_fields;
+        this->invalidate_row_cache();
 
         return retval;
     };
 
+    /**
+     * Drop the rendered rows that have been cached so that they are
+     * rendered again on the next update.
+     */
+    void invalidate_row_cache() {
+        this->tc_row_cache_generation += 1;
+    };
+
     void execute_search(const std::string &regex_orig);
 
     void redo_search() {
@@ -943,6 +1022,21 @@ public:
 
 protected:
 
+    /** The maximum number of rendered rows to keep in the cache. */
+    static const size_t ROW_CACHE_SIZE = 512;
+
+    struct row_cache_entry {
+        int64_t rce_key;
+        vis_line_t rce_row;
+        size_t rce_generation;
+        size_t rce_marks;
+        attr_line_t rce_value;
+    };
+
+    void render_row(vis_line_t row, attr_line_t &value_out);
+
+    size_t row_marks_fingerprint(vis_line_t row) const;
+
     class grep_highlighter {
     public:
         grep_highlighter(std::unique_ptr<grep_proc<vis_line_t>> &gp,
@@ -985,6 +1079,11 @@ protected:
     bool tc_selection_cleared;
     bool tc_hide_fields;
 
+    size_t tc_row_cache_generation{0};
+    std::list<row_cache_entry> tc_row_cache;
+    std::unordered_map<int64_t, std::list<row_cache_entry>::iterator>
+        tc_row_cache_index;
+
     std::string tc_last_search;
     std::unique_ptr<grep_highlighter> tc_search_child;
     std::shared_ptr<grep_proc<vis_line_t>> tc_source_search_child;
@@ -673,6 +673,8 @@ void view_colors::init_roles(const lnav_theme &lt,
     rgb_color fg, bg;
     string err;
 
+    this->vc_roles_generation += 1;
+
     if (COLORS == 256) {
         const style_config &ident_sc = lt.lt_style_identifier;
         int ident_bg = (lnav_config.lc_ui_default_colors ? -1 : COLOR_BLACK);
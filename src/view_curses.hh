@@ -426,6 +426,9 @@ public:
 
     std::pair<attr_t, attr_t> vc_level_attrs[LEVEL__MAX];
 
+    /** Incremented when the roles are changed, like when switching themes. */
+    size_t vc_roles_generation{0};
+
     static bool initialized;
 
 private:
@@ -56,6 +56,13 @@ string execute_any(exec_context &ec, const string &cmdline_with_mode)
     return "";
 }
 
+string execute_rewriter(exec_context &ec,
+                        shared_ptr<field_rewriter> &fr,
+                        const string &cmdline)
+{
+    return "";
+}
+
 void add_global_vars(exec_context &ec)
 {
 }
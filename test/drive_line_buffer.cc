@@ -57,12 +57,14 @@ int main(int argc, char *argv[])
 	int c, rnd_iters = 5, retval = EXIT_SUCCESS;
 	vector<tuple<int, off_t, ssize_t> > index;
 	auto_fd fd = STDIN_FILENO;
+	auto_fd ref_fd;
 	int offseti = 0;
 	off_t offset = 0;
 	int count = 1000;
+	bool use_mmap = true;
 	struct stat st;
 
-	while ((c = getopt(argc, argv, "o:i:n:c:")) != -1) {
+	while ((c = getopt(argc, argv, "o:i:n:c:p")) != -1) {
 		switch (c) {
 			case 'o':
 				if (sscanf(optarg, "%d", &offseti) != 1) {
@@ -90,6 +92,10 @@ int main(int argc, char *argv[])
 					retval = EXIT_FAILURE;
 				}
 				break;
+			case 'p':
+				// Read the file into the buffer instead of mapping it.
+				use_mmap = false;
+				break;
 			case 'i': {
 				FILE *file;
 
@@ -132,7 +138,13 @@ int main(int argc, char *argv[])
 	} else if ((argc > 0) && (fd = open(argv[0], O_RDONLY)) == -1) {
 		perror("open");
 		retval = EXIT_FAILURE;
-	} else if ((argc > 0) && (fstat(fd, &st) == -1)) {
+	} else if ((argc > 1) && (ref_fd = open(argv[1], O_RDONLY)) == -1) {
+		// The random reads of a compressed file are checked against the
+		// uncompressed version.
+		perror("open");
+		retval = EXIT_FAILURE;
+	} else if ((argc > 0) &&
+	           (fstat(argc > 1 ? ref_fd : fd, &st) == -1)) {
 		perror("fstat");
 		retval = EXIT_FAILURE;
 	} else {
@@ -141,6 +153,7 @@ int main(int argc, char *argv[])
 			line_buffer lb;
 			char *maddr;
 
+			lb.set_mmap_enabled(use_mmap);
 			lb.set_fd(fd);
 			if (index.size() == 0) {
 				while (count) {
@@ -179,7 +192,8 @@ int main(int argc, char *argv[])
 											  st.st_size,
 											  PROT_READ,
 											  MAP_FILE | MAP_PRIVATE,
-											  lb.get_fd(),
+											  argc > 1 ?
+											  (int) ref_fd : lb.get_fd(),
 											  0)) == MAP_FAILED) {
 				perror("mmap");
 				retval = EXIT_FAILURE;
@@ -38,6 +38,7 @@
 #include <string.h>
 
 #include <algorithm>
+#include <fstream>
 
 #include "logfile.hh"
 #include "log_format.hh"
@@ -63,15 +64,32 @@ string execute_any(exec_context &ec, const string &cmdline_with_mode)
     return "";
 }
 
+string execute_rewriter(exec_context &ec,
+                        shared_ptr<field_rewriter> &fr,
+                        const string &cmdline)
+{
+    return "";
+}
+
 void add_global_vars(exec_context &ec)
 {
 }
 
+static void mark_all(logfile &lf)
+{
+    for (auto iter = lf.begin(); iter != lf.end(); ++iter) {
+        iter->set_mark(true);
+    }
+}
+
 int main(int argc, char *argv[])
 {
     int c, retval = EXIT_SUCCESS;
     dl_mode_t mode = MODE_NONE;
     string expected_format;
+    off_t chunk_size = 0;
+    string append_path;
+    bool mark_lines = false, expect_cached = false;
 
     {
         std::vector<std::string> paths, errors;
@@ -82,8 +100,17 @@ int main(int argc, char *argv[])
         load_formats(paths, errors);
     }
 
-    while ((c = getopt(argc, argv, "ef:ltv")) != -1) {
+    while ((c = getopt(argc, argv, "a:c:Cef:lmtv")) != -1) {
         switch (c) {
+            case 'a':
+                append_path = optarg;
+                break;
+            case 'c':
+                chunk_size = atoi(optarg);
+                break;
+            case 'C':
+                expect_cached = true;
+                break;
             case 'f':
                 expected_format = optarg;
                 break;
@@ -93,6 +120,9 @@ int main(int argc, char *argv[])
             case 'l':
                 mode = MODE_LINE_COUNT;
                 break;
+            case 'm':
+                mark_lines = true;
+                break;
             case 't':
                 mode = MODE_TIMES;
                 break;
@@ -110,22 +140,55 @@ int main(int argc, char *argv[])
         fprintf(stderr, "error: expecting log file name\n");
     } else {
         try {
-            logfile_open_options default_loo;
-            logfile lf(argv[0], default_loo);
+            logfile_open_options loo;
+            loo.with_scan_chunk_size(chunk_size);
+            if (!append_path.empty()) {
+                loo.with_background_index(true);
+            }
+            logfile lf(argv[0], loo);
             struct stat st;
 
-            stat(argv[0], &st);
             assert(strcmp(argv[0], lf.get_filename().c_str()) == 0);
 
-            lf.rebuild_index();
-            assert(!lf.is_closed());
-            lf.rebuild_index();
-            assert(!lf.is_closed());
-            lf.rebuild_index();
-            assert(!lf.is_closed());
-            assert(lf.get_activity().la_polls == 3);
-            if (lf.size() > 1) {
-                assert(lf.get_activity().la_reads == 2);
+            if (append_path.empty()) {
+                stat(argv[0], &st);
+                lf.rebuild_index();
+                assert(!lf.is_closed());
+                if (mark_lines) {
+                    mark_all(lf);
+                }
+                lf.rebuild_index();
+                assert(!lf.is_closed());
+                lf.rebuild_index();
+                assert(!lf.is_closed());
+                assert(lf.get_activity().la_polls == 3);
+                if (lf.size() > 1) {
+                    // A file that is fully covered by the index cache only
+                    // needs to be read for detecting the format.
+                    assert(lf.get_activity().la_reads == 2 ||
+                           (lf.get_activity().la_index_cache_hits == 1 &&
+                            lf.get_activity().la_reads == 1));
+                }
+            } else {
+                // Index the start of the file and then append the rest so
+                // that it gets picked up by the background scan.
+                lf.rebuild_index();
+                assert(!lf.is_closed());
+                if (mark_lines) {
+                    mark_all(lf);
+                }
+                {
+                    ifstream in(append_path);
+                    ofstream out(argv[0], ios::app);
+
+                    out << in.rdbuf();
+                }
+                stat(argv[0], &st);
+                while (lf.rebuild_index() != logfile::RR_NO_NEW_LINES ||
+                       lf.is_indexing()) {
+                    assert(!lf.is_closed());
+                }
+                assert(!lf.is_closed());
             }
             if (expected_format == "") {
                 assert(lf.get_format() == NULL);
@@ -138,6 +201,10 @@ int main(int argc, char *argv[])
             if (!lf.is_compressed()) {
                 assert(lf.get_modified_time() == st.st_mtime);
             }
+            if (expect_cached && lf.get_activity().la_index_cache_hits == 0) {
+                fprintf(stderr, "error: index was not loaded from the cache\n");
+                retval = EXIT_FAILURE;
+            }
 
             switch (mode) {
                 case MODE_NONE:
@@ -0,0 +1,133 @@
+/**
+ * Copyright (c) 2020, Timothy Stack
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Timothy Stack nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * @file drive_rewriter.cc
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <sqlite3.h>
+
+#include "lnav.hh"
+#include "command_executor.hh"
+#include "sqlite-extension-func.hh"
+
+using namespace std;
+
+struct _lnav_data lnav_data;
+
+void rebuild_hist()
+{
+}
+
+bool setup_logline_table(exec_context &ec)
+{
+    return false;
+}
+
+bool rescan_files(bool required)
+{
+    return false;
+}
+
+void wait_for_children()
+{
+}
+
+void rebuild_indexes()
+{
+}
+
+bool check_background_filters(bool wait)
+{
+    return false;
+}
+
+readline_context::command_map_t lnav_commands;
+
+extern "C" {
+const char *help_txt = "";
+}
+
+static int rewriter_sql_callback(exec_context &ec, sqlite3_stmt *stmt)
+{
+    if (!sqlite3_stmt_busy(stmt)) {
+        return 0;
+    }
+
+    const char *res = (const char *) sqlite3_column_text(stmt, 0);
+
+    if (res != nullptr) {
+        ec.ec_accumulator.append(res);
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int retval = EXIT_SUCCESS;
+
+    log_argv(argc, argv);
+
+    if (argc < 2) {
+        fprintf(stderr, "error: expecting a rewriter and values to rewrite\n");
+        retval = EXIT_FAILURE;
+    }
+    else if (sqlite3_open(":memory:", lnav_data.ld_db.out()) != SQLITE_OK) {
+        fprintf(stderr, "error: unable to make sqlite memory database\n");
+        retval = EXIT_FAILURE;
+    }
+    else {
+        register_sqlite_funcs(lnav_data.ld_db.in(), sqlite_registration_funcs);
+
+        exec_context ec(nullptr, rewriter_sql_callback);
+        field_rewriter fr(argv[1]);
+
+        printf("prepared: %d\n", fr.is_prepared());
+        printf("memoized: %d\n", fr.is_memoized());
+
+        // Rewrite each value twice, a remembered result will be the same.
+        for (int lpc = 2; fr.is_prepared() && lpc < argc; lpc++) {
+            ec.ec_local_vars.top()["value"] = argv[lpc];
+
+            string first = fr.execute(ec);
+            string second = fr.execute(ec);
+
+            printf("%s -> %s (%s)\n",
+                   argv[lpc],
+                   first.c_str(),
+                   first == second ? "same" : "different");
+        }
+    }
+
+    return retval;
+}
@@ -58,6 +58,11 @@ void rebuild_indexes()
 {
 }
 
+bool check_background_filters(bool wait)
+{
+    return false;
+}
+
 readline_context::command_map_t lnav_commands;
 
 extern "C" {
@@ -39,6 +39,9 @@
 #include "relative_time.hh"
 #include "unique_path.hh"
 #include "logfile.hh"
+#include "filter_observer.hh"
+#include "textview_curses.hh"
+#include "base/parallel_for.hh"
 
 using namespace std;
 
@@ -153,15 +156,15 @@ TEST_CASE("ptime_roundtrip") {
 
 class my_path_source : public unique_path_source {
 public:
-    my_path_source(const filesystem::path &p) : mps_path(p) {
+    my_path_source(const ::filesystem::path &p) : mps_path(p) {
 
     }
 
-    filesystem::path get_path() const override {
+    ::filesystem::path get_path() const override {
         return this->mps_path;
     }
 
-    filesystem::path mps_path;
+    ::filesystem::path mps_path;
 };
 
 TEST_CASE("unique_path") {
@@ -192,3 +195,257 @@ TEST_CASE("unique_path") {
     CHECK(log1->get_unique_path() == "[machine1]/syslog.log");
     CHECK(log2->get_unique_path() == "[machine2]/syslog.log");
 }
+
+TEST_CASE("parallel_for") {
+    vector<int> results(1000);
+
+    parallel_for(results.size(), [&results](size_t index) {
+        results[index] = index * 2;
+    }, 4);
+
+    for (size_t lpc = 0; lpc < results.size(); lpc++) {
+        CHECK(results[lpc] == lpc * 2);
+    }
+
+    CHECK_THROWS_AS(parallel_for(10, [](size_t index) {
+        if (index == 5) {
+            throw logfile::error("test", EINVAL);
+        }
+    }, 4), logfile::error);
+}
+
+class substr_filter : public text_filter {
+public:
+    substr_filter(type_t type, const string &str, size_t index)
+        : text_filter(type, str, index), sf_str(str) {
+    };
+
+    bool matches(const logfile &lf, const logline &ll,
+                 shared_buffer_ref &line) override {
+        return string(line.get_data(), line.length()).find(this->sf_str) !=
+               string::npos;
+    };
+
+    string to_command() override {
+        return "";
+    };
+
+    string sf_str;
+};
+
+TEST_CASE("background_filter") {
+    string fname = "background_filter.0";
+
+    {
+        ofstream out(fname);
+
+        for (int lpc = 0; lpc < 20000; lpc++) {
+            out << "line " << lpc << "\n";
+        }
+    }
+
+    logfile_open_options loo;
+    auto lf = make_shared<logfile>(fname, loo);
+
+    lf->rebuild_index();
+    REQUIRE(lf->size() == 20000);
+
+    filter_stack fs;
+    line_filter_observer lfo(fs, lf);
+    background_filter bf;
+
+    lf->set_logline_observer(&lfo);
+    fs.add_filter(make_shared<substr_filter>(text_filter::EXCLUDE, "5", 0));
+
+    CHECK_FALSE(bf.start(fs, {&lfo}));
+
+    bf.set_enabled(true);
+    REQUIRE(bf.start(fs, {&lfo}));
+    CHECK(bf.is_running());
+    CHECK(bf.get_lines_total() == lf->size());
+    // The observer keeps the old state until the result is swapped in.
+    CHECK(lfo.lfo_filter_state.tfs_filter_count[0] == 0);
+    CHECK(bf.finish());
+    CHECK_FALSE(bf.is_running());
+    CHECK(bf.get_lines_done() == lf->size());
+    CHECK(lfo.lfo_filter_state.tfs_filter_count[0] == lf->size());
+    for (size_t lpc = 0; lpc < lf->size(); lpc++) {
+        bool expected = to_string(lpc).find('5') != string::npos;
+
+        CHECK(lfo.excluded(0, 1, lpc) == expected);
+    }
+
+    // Nothing to do once the state is up-to-date.
+    CHECK_FALSE(bf.start(fs, {&lfo}));
+
+    fs.add_filter(make_shared<substr_filter>(text_filter::EXCLUDE, "7", 1));
+    REQUIRE(bf.start(fs, {&lfo}));
+    bf.cancel();
+    CHECK_FALSE(bf.is_running());
+    CHECK_FALSE(bf.finish());
+    CHECK(lfo.lfo_filter_state.tfs_filter_count[1] == 0);
+
+    // Waiting stops the thread, but the result is kept for finish().
+    REQUIRE(bf.start(fs, {&lfo}));
+    bf.wait();
+    CHECK(bf.is_running());
+    CHECK(bf.is_done());
+    CHECK(lfo.lfo_filter_state.tfs_filter_count[1] == 0);
+    CHECK(bf.finish());
+    CHECK_FALSE(bf.is_running());
+    CHECK(lfo.lfo_filter_state.tfs_filter_count[1] == lf->size());
+
+    lf->set_logline_observer(nullptr);
+}
+
+class row_cache_source : public text_sub_source {
+public:
+    size_t text_line_count() override {
+        return this->rcs_lines.size();
+    };
+
+    void text_value_for_line(textview_curses &tc,
+                             int line,
+                             string &value_out,
+                             line_flags_t flags) override {
+        this->rcs_renders += 1;
+        value_out = this->rcs_lines[line];
+    };
+
+    size_t text_size_for_line(textview_curses &tc,
+                              int line,
+                              line_flags_t flags) override {
+        return this->rcs_lines[line].size();
+    };
+
+    int64_t text_row_cache_key(vis_line_t line) override {
+        return line;
+    };
+
+    vector<string> rcs_lines;
+    int rcs_renders{0};
+};
+
+static bool has_style(attr_line_t &al, int attrs)
+{
+    for (const auto &sa : al.get_attrs()) {
+        if (sa.sa_type == &view_curses::VC_STYLE &&
+            (sa.sa_value.sav_int & attrs) == attrs) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+TEST_CASE("textview row cache") {
+    row_cache_source src;
+    textview_curses tc;
+    vector<attr_line_t> rows(2);
+
+    src.rcs_lines = {"hello, world", "goodbye, world"};
+    tc.set_sub_source(&src);
+
+    tc.listview_value_for_rows(tc, 0_vl, rows);
+    CHECK(src.rcs_renders == 2);
+    tc.listview_value_for_rows(tc, 0_vl, rows);
+    CHECK(src.rcs_renders == 2);
+
+    tc.toggle_user_mark(&textview_curses::BM_USER, 0_vl);
+    tc.listview_value_for_rows(tc, 0_vl, rows);
+    CHECK(src.rcs_renders == 4);
+    CHECK(has_style(rows[0], A_REVERSE));
+    CHECK_FALSE(has_style(rows[1], A_REVERSE));
+
+    const char *errptr;
+    int eoff;
+    pcre *code = pcre_compile("goodbye", 0, &errptr, &eoff, nullptr);
+
+    REQUIRE(code != nullptr);
+
+    highlighter hl(code);
+
+    hl.with_attrs(A_UNDERLINE);
+    tc.get_highlights()[{highlight_source_t::INTERACTIVE, "goodbye"}] = hl;
+    tc.listview_value_for_rows(tc, 0_vl, rows);
+    CHECK(src.rcs_renders == 6);
+    CHECK(has_style(rows[1], A_UNDERLINE));
+
+    src.rcs_lines[1] = "goodbye, cruel world";
+    tc.reload_data();
+    tc.listview_value_for_rows(tc, 0_vl, rows);
+    CHECK(src.rcs_renders == 8);
+    CHECK(rows[1].get_string() == "goodbye, cruel world");
+
+    tc.set_sub_source(nullptr);
+}
+
+TEST_CASE("logline time") {
+    struct timeval tv = { 1500000000, 123456 };
+    logline ll(100, tv, LEVEL_INFO, 0, 0xdeadbeef);
+
+    CHECK(ll.get_time() == 1500000000);
+    CHECK(ll.get_millis() == 123);
+    CHECK(ll.get_time_in_micros() == 1500000000123456LL);
+    CHECK(ll.get_timeval().tv_usec == 123456);
+    CHECK(ll.get_opid() == 0xdeadbeef);
+
+    ll.set_millis(456);
+    CHECK(ll.get_time() == 1500000000);
+    CHECK(ll.get_millis() == 456);
+
+    ll.set_time((time_t) 1500000001);
+    CHECK(ll.get_time() == 1500000001);
+    CHECK(ll.get_millis() == 456);
+
+    struct timeval same_milli = { 1500000001, 456999 };
+    struct timeval next_milli = { 1500000001, 457000 };
+
+    CHECK(!(ll < same_milli));
+    CHECK(ll <= same_milli);
+    CHECK(ll < next_milli);
+
+    logline before_epoch(0, -2, 250, LEVEL_INFO);
+
+    CHECK(before_epoch.get_time() == -2);
+    CHECK(before_epoch.get_millis() == 250);
+    CHECK(before_epoch < ll);
+
+    logline later_offset(200, ll.get_timeval(), LEVEL_INFO);
+
+    CHECK(ll < later_offset);
+    CHECK(!(later_offset < ll));
+}
+
+TEST_CASE("intern_string table") {
+    auto stats_before = intern_string::get_table_stats();
+    vector<string> names(20000);
+
+    for (size_t lpc = 0; lpc < names.size(); lpc++) {
+        names[lpc] = "intern-test-" + to_string(lpc);
+    }
+
+    vector<const intern_string *> interned(names.size());
+
+    parallel_for(names.size(), [&names, &interned](size_t index) {
+        interned[index] = intern_string::lookup(names[index]);
+    }, 4);
+
+    for (size_t lpc = 0; lpc < names.size(); lpc++) {
+        CHECK(interned[lpc]->to_string() == names[lpc]);
+        CHECK(interned[lpc]->get()[names[lpc].size()] == '\0');
+        CHECK(intern_string::lookup(names[lpc]) == interned[lpc]);
+    }
+
+    auto stats_after = intern_string::get_table_stats();
+
+    CHECK(stats_after.ts_count == stats_before.ts_count + names.size());
+    CHECK(stats_after.ts_capacity > stats_after.ts_count);
+    CHECK(stats_after.ts_arena_used <= stats_after.ts_arena_bytes);
+
+    string big(64 * 1024, 'x');
+    auto big_is = intern_string::lookup(big);
+
+    CHECK(big_is->size() == big.size());
+    CHECK(intern_string::lookup(big.c_str(), -1) == big_is);
+}
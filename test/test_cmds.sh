@@ -174,6 +174,35 @@ check_output "adjust-log-time is not working" <<EOF
 EOF
 
 
+run_test ${lnav_test} -n \
+    -c ":write-screen-to /dev/null" \
+    -c ":adjust-log-time 2010-01-01T00:00:00" \
+    -c ":write-screen-to -" \
+    ${test_dir}/logfile_access_log.0
+
+check_output "cached rows are not redrawn after adjust-log-time" <<EOF
+192.168.202.254 - - [01/Jan/2010:00:00:00 +0000] "GET /vmw/cgi/tramp HTTP/1.0" 200 134 "-" "gPXE/0.9.7"
+192.168.202.254 - - [01/Jan/2010:00:00:03 +0000] "GET /vmw/vSphere/default/vmkboot.gz HTTP/1.0" 404 46210 "-" "gPXE/0.9.7"
+192.168.202.254 - - [01/Jan/2010:00:00:03 +0000] "GET /vmw/vSphere/default/vmkernel.gz HTTP/1.0" 200 78929 "-" "gPXE/0.9.7"
+EOF
+
+# Leave the last line without a newline so that the append extends it.
+printf '%s' "$(cat ${test_dir}/logfile_access_log.0)" > row_cache_partial.0
+
+run_test ${lnav_test} -n \
+    -c ":write-screen-to /dev/null" \
+    -c ":mark" \
+    -c ":append-to row_cache_partial.0" \
+    -c ":write-screen-to -" \
+    row_cache_partial.0
+
+check_output "cached rows are not redrawn after new data" <<EOF
+192.168.202.254 - - [20/Jul/2009:22:59:26 +0000] "GET /vmw/cgi/tramp HTTP/1.0" 200 134 "-" "gPXE/0.9.7"
+192.168.202.254 - - [20/Jul/2009:22:59:29 +0000] "GET /vmw/vSphere/default/vmkboot.gz HTTP/1.0" 404 46210 "-" "gPXE/0.9.7"
+192.168.202.254 - - [20/Jul/2009:22:59:29 +0000] "GET /vmw/vSphere/default/vmkernel.gz HTTP/1.0" 200 78929 "-" "gPXE/0.9.7"192.168.202.254 - - [20/Jul/2009:22:59:26 +0000] "GET /vmw/cgi/tramp HTTP/1.0" 200 134 "-" "gPXE/0.9.7"
+EOF
+
+
 run_test ${lnav_test} -n \
     -c ":goto 1" \
     ${test_dir}/logfile_access_log.0
@@ -376,6 +405,66 @@ check_output "filter-out append is not working" <<EOF
   How are you today?
 EOF
 
+cat > logfile_reorder.0 <<EOF
+2009-07-20 22:59:27,000:INFO:first file 1
+2009-07-20 22:59:29,000:INFO:first file 2
+EOF
+cat > logfile_reorder.1 <<EOF
+2009-07-20 22:59:28,000:INFO:second file 1
+2009-07-20 22:59:31,000:INFO:second file 2
+EOF
+
+run_test ${lnav_test} -n \
+    -c ":shexec echo '2009-07-20 22:59:30,000:INFO:first file 3' >> logfile_reorder.0" \
+    -c ":rebuild" \
+    logfile_reorder.0 logfile_reorder.1
+
+check_output "late lines are not merged into the index?" <<EOF
+2009-07-20 22:59:27,000:INFO:first file 1
+2009-07-20 22:59:28,000:INFO:second file 1
+2009-07-20 22:59:29,000:INFO:first file 2
+2009-07-20 22:59:30,000:INFO:first file 3
+2009-07-20 22:59:31,000:INFO:second file 2
+EOF
+
+cat > logfile_reorder.0 <<EOF
+2009-07-20 22:59:27,000:INFO:first file 1
+2009-07-20 22:59:29,000:INFO:first file 2
+EOF
+
+run_test ${lnav_test} -n \
+    -c ":filter-out file 3" \
+    -c ":shexec echo '2009-07-20 22:59:28,500:INFO:first file 3' >> logfile_reorder.0" \
+    -c ":rebuild" \
+    -c ";select log_line, log_body from generic_log" \
+    logfile_reorder.0 logfile_reorder.1
+
+check_output "late lines are not merged into the filtered index?" <<EOF
+log_line        log_body
+       0 :first file 1
+       1 :second file 1
+       2 :first file 2
+       3 :second file 2
+EOF
+
+seq 1 10000 | sed -e 's/^/2009-07-20 22:59:27,000:INFO:line /' \
+    > logfile_filter_batch.0
+
+run_test ${lnav_test} -n \
+    -c ":filter-in line 7[0-9]77$" \
+    -c ":disable-filter line 7[0-9]77$" \
+    -c ":enable-filter line 7[0-9]77$" \
+    -c ":filter-out 7[5-9]77" \
+    logfile_filter_batch.0
+
+check_output "filters are not applied across a large file?" <<EOF
+2009-07-20 22:59:27,000:INFO:line 7077
+2009-07-20 22:59:27,000:INFO:line 7177
+2009-07-20 22:59:27,000:INFO:line 7277
+2009-07-20 22:59:27,000:INFO:line 7377
+2009-07-20 22:59:27,000:INFO:line 7477
+EOF
+
 
 run_test ${lnav_test} -n \
     -c ":filter-in avahi" \
@@ -858,6 +947,17 @@ check_output "histogram is not working?" <<EOF
  Sat Nov 03 00:00:00          2 normal         2 errors         0 warnings         0 marks
 EOF
 
+run_test ${lnav_test} -n \
+    -c ":switch-to-view histogram" \
+    -c ":zoom-to 1-day" \
+    -c ":zoom-to 1-minute" \
+    ${test_dir}/logfile_syslog.0
+
+check_output "histogram zoom levels are not merged correctly?" <<EOF
+ Sat Nov 03 09:23:00          1 normal         2 errors         0 warnings         0 marks
+ Sat Nov 03 09:47:00          1 normal         0 errors         0 warnings         0 marks
+EOF
+
 run_test ${lnav_test} -n \
     -c ":filter-in sudo" \
     -c ":switch-to-view histogram" \
@@ -74,10 +74,55 @@ public:
 };
 
 class my_sleeper_source : public grep_proc_source<vis_line_t> {
+public:
     bool grep_value_for_line(vis_line_t line_number, string &value_out) {
+       this->mss_calls += 1;
        sleep(1000);
        return true;
     };
+
+    int mss_calls{0};
+};
+
+class my_counting_source : public grep_proc_source<vis_line_t> {
+public:
+    bool grep_value_for_line(vis_line_t line_number, string &value_out) {
+        if (line_number >= LINE_COUNT) {
+            return false;
+        }
+
+        value_out = "line " + to_string((int) line_number);
+        if ((line_number % 7) == 0) {
+            value_out += " foobar foobar";
+        }
+        return true;
+    };
+
+    static const int LINE_COUNT = 50000;
+};
+
+class my_ordered_sink : public grep_proc_sink<vis_line_t> {
+public:
+    void grep_match(grep_proc<vis_line_t> &gp,
+                    vis_line_t line,
+                    int start,
+                    int end) {
+        assert(line >= this->mos_last_line);
+        this->mos_last_line = line;
+        this->mos_match_count += 1;
+    };
+
+    void grep_match_end(grep_proc<vis_line_t> &gp, vis_line_t line) {
+        assert(line == this->mos_last_line);
+    };
+
+    void grep_end(grep_proc<vis_line_t> &gp) {
+        this->mos_end_count += 1;
+    };
+
+    vis_line_t mos_last_line{0};
+    int mos_match_count{0};
+    int mos_end_count{0};
 };
 
 class my_sink : public grep_proc_sink<vis_line_t> {
@@ -138,20 +183,41 @@ int main(int argc, char *argv[])
        looper(gp);
     }
 
+    {
+       my_counting_source mcs;
+       my_ordered_sink mos;
+       grep_proc<vis_line_t> gp(code, mcs);
+
+       gp.set_sink(&mos);
+       gp.queue_request();
+       gp.start();
+       while (mos.mos_end_count == 0) {
+           vector<struct pollfd> pollfds;
+
+           gp.update_poll_set(pollfds);
+           assert(!pollfds.empty());
+           poll(&pollfds[0], pollfds.size(), -1);
+
+           gp.check_poll_set(pollfds);
+       }
+
+       /* Each matching line has two matches. */
+       assert(mos.mos_match_count ==
+              2 * ((my_counting_source::LINE_COUNT + 6) / 7));
+       assert(mos.mos_end_count == 1);
+    }
+
     {
        my_sleeper_source mss;
        grep_proc<vis_line_t> *gp = new grep_proc<vis_line_t>(code, mss);
-       int status;
 
        gp->queue_request();
        gp->start();
 
-       assert(wait3(&status, WNOHANG, NULL) == 0);
+       /* The source is only read from the main loop. */
+       assert(mss.mss_calls == 0);
 
        delete gp;
-
-       assert(wait(&status) == -1);
-       assert(errno == ECHILD);
     }
 
     free(code);
@@ -393,6 +393,50 @@ check_output "timestamp-format not working" <<EOF
 2013-09-06T22:01:49.124 abc 49 def    10 c.e.foo looking bad
 EOF
 
+run_test ${lnav_test} -n \
+    -I ${test_dir} \
+    -c ':write-screen-to /dev/null' \
+    -c ':hide-fields cl' \
+    -c ':write-screen-to -' \
+    ${test_dir}/logfile_json2.json
+
+check_output "hide-fields does not replace a rendered message" <<EOF
+2013-09-06T20:00:49.124 abc 49 def 0     ⋮ Starting up service
+2013-09-06T22:00:49.124 abc 49 def 0     ⋮ Shutting down service
+  user: steve@example.com
+2013-09-06T22:01:49.124 abc 49 def 10    ⋮ looking bad
+EOF
+
+# Members with keys that are not plain words still get a line each.
+cat > keys_logfile_json2.json <<EOF
+{"ts": "2013-09-06T20:00:49.124817Z", "@version": "1", "lvl": 0, "msg": "Starting up service", "cl": "com.exmaple.foo"}
+{"ts": "2013-09-06T22:00:49.124817Z", "log.level": "warn", "lvl": 0, "msg": "Shutting down service", "user-agent": "curl", "user": "steve@example.com", "cl": "com.exmaple.foo"}
+{"ts": "2013-09-06T22:01:49.124817Z", "lvl": 10, "msg": "looking bad", "req-info": {"id": 1}, "cl": "com.exmaple.foo"}
+EOF
+
+run_test ${lnav_test} -n \
+    -I ${test_dir} \
+    -c ';SELECT log_line, log_level FROM json_log2' \
+    -c ':write-csv-to -' \
+    -c ':switch-to-view log' \
+    -c ':write-screen-to -' \
+    keys_logfile_json2.json
+
+check_output "scanned JSON lines do not match the rendered lines" <<EOF
+log_line,log_level
+0,info
+2,info
+6,error
+2013-09-06T20:00:49.124 abc 49 def 0     c.e.foo Starting up service
+  @version: 1
+2013-09-06T22:00:49.124 abc 49 def 0     c.e.foo Shutting down service
+  log.level: warn
+  user-agent: curl
+  user: steve@example.com
+2013-09-06T22:01:49.124 abc 49 def 10    c.e.foo looking bad
+  req-info: {"id": 1}
+EOF
+
 run_test ${lnav_test} -n -d /tmp/lnav.err \
     -I ${test_dir} \
     -c ';select * from json_log2' \
@@ -517,3 +561,15 @@ log_line,log_part,log_time,log_idle_msecs,log_level,log_mark,log_comment,log_tag
 1,<NULL>,2017-03-24 20:12:47.764,381524,critical,0,<NULL>,<NULL>,[],1.1.1.1,<NULL>,<NULL>,<NULL>,GET,166,/example/uri/5,500
 2,<NULL>,2017-03-24 20:15:31.694,163930,warning,0,<NULL>,<NULL>,[],1.1.1.1,"{""foo"": ""bar""}","{""foo"": ""bar""}","{""foo"": ""bar""}",GET,166,/example/uri/5,400
 EOF
+
+run_test ${lnav_test} -n \
+    -I ${test_dir} \
+    -c ';select log_line, user from test_log' \
+    -c ';select render_cache_hits > 0 as hits, render_cache_misses > 0 as misses from lnav_file where format = "test_log"' \
+    -c ':write-csv-to -' \
+    ${test_dir}/logfile_json.json
+
+check_output "render cache stats are not working" <<EOF
+hits,misses
+1,1
+EOF
@@ -0,0 +1,323 @@
+/**
+ * Copyright (c) 2020, Timothy Stack
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Timothy Stack nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "base/json_scan.hh"
+
+using namespace std;
+
+static bool same_fields(const vector<json_scan_field> &lhs,
+                        const vector<json_scan_field> &rhs)
+{
+    if (lhs.size() != rhs.size()) {
+        return false;
+    }
+
+    for (size_t lpc = 0; lpc < lhs.size(); lpc++) {
+        const auto &l = lhs[lpc], &r = rhs[lpc];
+
+        if (l.jsf_key != r.jsf_key ||
+            l.jsf_key_len != r.jsf_key_len ||
+            l.jsf_key_escaped != r.jsf_key_escaped ||
+            l.jsf_type != r.jsf_type ||
+            l.jsf_value != r.jsf_value ||
+            l.jsf_value_len != r.jsf_value_len ||
+            l.jsf_escaped != r.jsf_escaped ||
+            l.jsf_unicode_escaped != r.jsf_unicode_escaped ||
+            l.jsf_newlines != r.jsf_newlines ||
+            l.jsf_integer != r.jsf_integer) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/** Scan with every implementation and make sure they agree. */
+static bool check_all_impls(const string &data,
+                            vector<json_scan_field> &fields_out)
+{
+    bool expected = json_scan_object(JSI_SCALAR, data.data(), data.size(),
+                                     fields_out);
+
+    for (int impl = JSI_SCALAR + 1; impl < JSI__MAX; impl++) {
+        vector<json_scan_field> fields;
+
+        if (!json_scan_supported((json_scan_impl_t) impl)) {
+            continue;
+        }
+
+        bool actual = json_scan_object((json_scan_impl_t) impl,
+                                       data.data(), data.size(), fields);
+
+        if (actual != expected || (actual && !same_fields(fields, fields_out))) {
+            fprintf(stderr, "error: %s does not match scalar for:\n  %s\n",
+                    json_scan_impl_name((json_scan_impl_t) impl),
+                    data.c_str());
+            abort();
+        }
+    }
+
+    return expected;
+}
+
+static void check_valid(const char *data, bool valid)
+{
+    vector<json_scan_field> fields;
+
+    if (check_all_impls(data, fields) != valid) {
+        fprintf(stderr, "error: expected %s to be %s\n",
+                data, valid ? "valid" : "invalid");
+        abort();
+    }
+}
+
+static string field_key(const json_scan_field &jsf)
+{
+    return string(jsf.jsf_key, jsf.jsf_key_len);
+}
+
+static string field_value(const json_scan_field &jsf)
+{
+    return string(jsf.jsf_value, jsf.jsf_value_len);
+}
+
+static string generate_line(mt19937 &gen, int line_number)
+{
+    uniform_int_distribution<int> len_dist(40, 1800);
+    char prefix[256];
+    string retval;
+    int len = len_dist(gen);
+
+    snprintf(prefix, sizeof(prefix),
+             "{\"ts\": \"2020-03-01T12:34:56.%03d\", \"level\": \"INFO\", "
+             "\"opid\": \"op-%d\", \"pid\": %d, \"elapsed\": %d.%d, "
+             "\"tags\": [\"a\", {\"b\": null}], \"msg\": \"",
+             line_number % 1000, line_number % 16, line_number,
+             line_number % 100, line_number % 7);
+    retval.append(prefix);
+    for (int lpc = 0; lpc < len; lpc++) {
+        retval.push_back('a' + (lpc + line_number) % 26);
+        if ((lpc % 97) == 96) {
+            retval.append("\\n");
+        }
+    }
+    retval.append("\"}");
+
+    return retval;
+}
+
+static void benchmark(int iterations)
+{
+    mt19937 gen(1234);
+    vector<string> lines;
+    size_t total = 0;
+
+    for (int lpc = 0; total < 16 * 1024 * 1024; lpc++) {
+        lines.emplace_back(generate_line(gen, lpc));
+        total += lines.back().size();
+    }
+
+    printf("benchmark: %zu bytes x %d iterations\n", total, iterations);
+    for (int impl = JSI_SCALAR; impl < JSI__MAX; impl++) {
+        if (!json_scan_supported((json_scan_impl_t) impl)) {
+            printf("  %-8s not supported\n",
+                   json_scan_impl_name((json_scan_impl_t) impl));
+            continue;
+        }
+
+        vector<json_scan_field> fields;
+        size_t field_count = 0;
+        auto start = chrono::steady_clock::now();
+
+        for (int iter = 0; iter < iterations; iter++) {
+            for (const auto &line : lines) {
+                json_scan_object((json_scan_impl_t) impl,
+                                 line.data(), line.size(), fields);
+                field_count += fields.size();
+            }
+        }
+
+        auto elapsed = chrono::duration<double>(
+            chrono::steady_clock::now() - start).count();
+
+        printf("  %-8s %8.1f MB/s  (%zu fields)\n",
+               json_scan_impl_name((json_scan_impl_t) impl),
+               (total * iterations) / elapsed / (1024.0 * 1024.0),
+               field_count / iterations);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int retval = EXIT_SUCCESS;
+    int iterations = 10;
+    bool bench = false;
+    int c;
+
+    while ((c = getopt(argc, argv, "bi:")) != -1) {
+        switch (c) {
+            case 'b':
+                bench = true;
+                break;
+            case 'i':
+                iterations = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-b] [-i iterations]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (bench) {
+        benchmark(iterations);
+        return retval;
+    }
+
+    check_valid("{}", true);
+    check_valid(" {\n} \n", true);
+    check_valid("{\"a\":1}", true);
+    check_valid("{\"a\":[]}", true);
+    check_valid("{\"a\":[1, {\"b\": [true, false, null]}, \"c\"]}", true);
+    check_valid("{\"a\":\"\\u00e9\\\"\\\\\\/\\b\\f\\n\\r\\t\"}", true);
+    check_valid("{\"a\":-0.5e+10}", true);
+    check_valid("", false);
+    check_valid("[]", false);
+    check_valid("{", false);
+    check_valid("{\"a\"}", false);
+    check_valid("{\"a\":}", false);
+    check_valid("{\"a\":1,}", false);
+    check_valid("{\"a\":[1,]}", false);
+    check_valid("{\"a\":[1}", false);
+    check_valid("{\"a\":{\"b\"]}", false);
+    check_valid("{\"a\":01}", false);
+    check_valid("{\"a\":1.}", false);
+    check_valid("{\"a\":.5}", false);
+    check_valid("{\"a\":1e}", false);
+    check_valid("{\"a\":tru}", false);
+    check_valid("{\"a\":\"\\x\"}", false);
+    check_valid("{\"a\":\"\\u12\"}", false);
+    check_valid("{\"a\":\"tab\there\"}", false);
+    check_valid("{\"a\":\"unterminated}", false);
+    check_valid("{\"a\":1} x", false);
+    check_valid("{\"a\":1}{}", false);
+    check_valid("{\"a\":1e999}", false);
+    check_valid("{\"a\":1234567890123456789}", false);
+
+    {
+        string deep = "{\"a\":";
+
+        for (int lpc = 0; lpc < JSON_SCAN_MAX_DEPTH; lpc++) {
+            deep.append("[");
+        }
+        for (int lpc = 0; lpc < JSON_SCAN_MAX_DEPTH; lpc++) {
+            deep.append("]");
+        }
+        deep.append("}");
+        check_valid(deep.c_str(), false);
+    }
+
+    {
+        vector<json_scan_field> fields;
+        string data = "{\"ts\": 1583066096.5, \"pid\" : -42, "
+                      "\"msg\": \"line 1\\nline 2\\u000Aline 3\", "
+                      "\"k\\\"ey\": null, \"obj\": {\"x\": [1, \"}\"]}, "
+                      "\"arr\": [], \"t\": true, \"f\": false}";
+
+        assert(check_all_impls(data, fields));
+        assert(fields.size() == 8);
+
+        assert(field_key(fields[0]) == "ts");
+        assert(fields[0].jsf_type == JST_DOUBLE);
+        assert(fields[0].jsf_double == 1583066096.5);
+
+        assert(field_key(fields[1]) == "pid");
+        assert(fields[1].jsf_type == JST_INTEGER);
+        assert(fields[1].jsf_integer == -42);
+
+        assert(field_key(fields[2]) == "msg");
+        assert(fields[2].jsf_type == JST_STRING);
+        assert(field_value(fields[2]) ==
+               "line 1\\nline 2\\u000Aline 3");
+        assert(fields[2].jsf_escaped);
+        assert(fields[2].jsf_unicode_escaped);
+        assert(fields[2].jsf_newlines == 2);
+
+        assert(field_key(fields[3]) == "k\\\"ey");
+        assert(fields[3].jsf_key_escaped);
+        assert(fields[3].jsf_type == JST_NULL);
+
+        assert(field_key(fields[4]) == "obj");
+        assert(fields[4].jsf_type == JST_OBJECT);
+        assert(field_value(fields[4]) == "{\"x\": [1, \"}\"]}");
+
+        assert(field_key(fields[5]) == "arr");
+        assert(fields[5].jsf_type == JST_ARRAY);
+        assert(field_value(fields[5]) == "[]");
+
+        assert(fields[6].jsf_type == JST_TRUE);
+        assert(fields[7].jsf_type == JST_FALSE);
+    }
+
+    {
+        // Long strings exercise the vector loops and their tails.
+        mt19937 gen(1234);
+
+        for (int lpc = 0; lpc < 1000; lpc++) {
+            vector<json_scan_field> fields;
+            string line = generate_line(gen, lpc);
+
+            assert(check_all_impls(line, fields));
+            assert(fields.size() == 7);
+            assert(fields[3].jsf_integer == lpc);
+
+            // Corrupt a byte and make sure the implementations still agree.
+            uniform_int_distribution<size_t> pos_dist(0, line.size() - 1);
+            uniform_int_distribution<int> byte_dist(0, 127);
+
+            line[pos_dist(gen)] = byte_dist(gen);
+            check_all_impls(line, fields);
+        }
+    }
+
+    return retval;
+}
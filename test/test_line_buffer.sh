@@ -20,6 +20,11 @@ run_test ./drive_line_buffer "${top_srcdir}/src/line_buffer.hh"
 check_output "Line buffer output doesn't match input?" < \
     "${top_srcdir}/src/line_buffer.hh"
 
+run_test ./drive_line_buffer -p "${top_srcdir}/src/line_buffer.hh"
+
+check_output "Line buffer output doesn't match input without mmap?" < \
+    "${top_srcdir}/src/line_buffer.hh"
+
 run_test ./drive_line_buffer < ${top_srcdir}/src/line_buffer.hh
 
 check_output "Line buffer output doesn't match input from pipe?" < \
@@ -56,3 +61,108 @@ run_test ./drive_line_buffer -i lb.index -n 10 lb-2.dat
 check_output "Random reads don't match input?" <<EOF
 All done
 EOF
+
+run_test ./drive_line_buffer -p -i lb.index -n 10 lb-2.dat
+
+check_output "Random reads don't match input without mmap?" <<EOF
+All done
+EOF
+
+# Make the file bigger than the buffer used for compressed files so that the
+# random reads have to seek around the gzip stream.  The compressed file is
+# made up of several gzip members to check that seeks can cross them.
+rm -f lb-3.dat lb-3.dat.gz
+for i in `seq 1 12`; do
+    cat lb-2.dat >> lb-3.dat
+    gzip -c lb-2.dat >> lb-3.dat.gz
+done
+grep -b '$' lb-3.dat | awk 'NR % 10000 == 1' | cut -f 1 -d : > lb-3.index
+
+run_test ./drive_line_buffer -i lb-3.index -n 1 lb-3.dat.gz lb-3.dat
+
+check_output "Random reads of a gzip file don't match input?" <<EOF
+All done
+EOF
+
+if [ "$BZIP2_SUPPORT" -eq 1 ] && [ x"$BZIP2_CMD" != x"" ] ; then
+    rm -f lb-3.dat.bz2
+    for i in `seq 1 12`; do
+        $BZIP2_CMD -z -c lb-2.dat >> lb-3.dat.bz2
+    done
+    awk 'NR % 4 == 1' lb-3.index > lb-3.bz2.index
+
+    run_test ./drive_line_buffer -i lb-3.bz2.index -n 1 lb-3.dat.bz2 lb-3.dat
+
+    check_output "Random reads of a bzip2 file don't match input?" <<EOF
+All done
+EOF
+fi
+
+# Write a 32-bit little-endian value.
+le32() {
+    printf "\\$(printf '%03o' $(($1 & 255)))"
+    printf "\\$(printf '%03o' $((($1 >> 8) & 255)))"
+    printf "\\$(printf '%03o' $((($1 >> 16) & 255)))"
+    printf "\\$(printf '%03o' $((($1 >> 24) & 255)))"
+}
+
+if [ "$ZSTD_SUPPORT" -eq 1 ] && [ x"$ZSTD_CMD" != x"" ] ; then
+    $ZSTD_CMD -q -c lb-2.dat > lb-2.dat.zst
+    rm -f lb-3.dat.zst
+    for i in `seq 1 12`; do
+        cat lb-2.dat.zst >> lb-3.dat.zst
+    done
+
+    run_test ./drive_line_buffer -i lb-3.index -n 1 lb-3.dat.zst lb-3.dat
+
+    check_output "Random reads of a zstd file don't match input?" <<EOF
+All done
+EOF
+
+    # Add a seek table in the zstd seekable format to the end of the file.
+    cp lb-3.dat.zst lb-3.seekable.zst
+    FRAME_SIZE=`wc -c < lb-2.dat.zst`
+    DATA_SIZE=`wc -c < lb-2.dat`
+    (
+        le32 0x184D2A5E
+        le32 $((12 * 8 + 9))
+        for i in `seq 1 12`; do
+            le32 $FRAME_SIZE
+            le32 $DATA_SIZE
+        done
+        le32 12
+        printf '\000'
+        le32 0x8F92EAB1
+    ) >> lb-3.seekable.zst
+
+    run_test ./drive_line_buffer -i lb-3.index -n 1 lb-3.seekable.zst lb-3.dat
+
+    check_output "Random reads of a seekable zstd file don't match input?" <<EOF
+All done
+EOF
+
+    # A single frame that is too big to decode in one go and does not have
+    # the content size in the header.
+    $ZSTD_CMD -q -c < lb-3.dat > lb-3.single.zst
+    awk 'NR % 4 == 1' lb-3.index > lb-3.single.index
+
+    run_test ./drive_line_buffer -i lb-3.single.index -n 1 \
+        lb-3.single.zst lb-3.dat
+
+    check_output "Random reads of a single zstd frame don't match input?" <<EOF
+All done
+EOF
+fi
+
+if [ "$XZ_SUPPORT" -eq 1 ] && [ x"$XZ_CMD" != x"" ] ; then
+    rm -f lb-3.dat.xz
+    for i in `seq 1 12`; do
+        $XZ_CMD -1 -T1 --block-size=1MiB -c lb-2.dat >> lb-3.dat.xz
+    done
+
+    run_test ./drive_line_buffer -i lb-3.index -n 1 lb-3.dat.xz lb-3.dat
+
+    check_output "Random reads of an xz file don't match input?" <<EOF
+All done
+EOF
+fi
@@ -33,6 +33,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "auto_fd.hh"
 #include "line_buffer.hh"
@@ -150,7 +151,68 @@ int main(int argc, char *argv[])
         assert(!li.li_partial);
         assert(li.li_file_range.empty());
         assert(lb.is_pipe_closed());
+        assert(!lb.is_mapped());
+    }
+
+    {
+        char fn_template[] = "test_line_buffer.XXXXXX";
+
+        auto fd = auto_fd(mkstemp(fn_template));
+        remove(fn_template);
+        line_buffer lb;
+
+        log_perror(write(fd, TEST_DATA, strlen(TEST_DATA)));
+        lb.set_fd(fd);
+        assert(lb.is_mapped());
+
+        auto first_result = lb.read_range({0, 14});
+        auto first = first_result.unwrap();
+        assert(memcmp(first.get_data(), TEST_DATA, 14) == 0);
+
+        // Grow the file past the address space that was reserved for it so
+        // that a new mapping is needed.
+        string filler(1024 * 1024, 'a');
+        filler.back() = '\n';
+        off_t off = strlen(TEST_DATA);
+        for (int lpc = 0; lpc < 40; lpc++) {
+            log_perror(write(lb.get_fd(), filler.c_str(), filler.size()));
+        }
+
+        file_range last_range{off};
+        for (int lpc = 0; lpc < 40; lpc++) {
+            auto load_result = lb.load_next_line(last_range);
+            auto li = load_result.unwrap();
+            assert(!li.li_partial);
+            assert(li.li_file_range.fr_size == (ssize_t) filler.size());
+            last_range = li.li_file_range;
+        }
+        auto last_result = lb.read_range(last_range);
+        auto last = last_result.unwrap();
+        assert(memcmp(last.get_data(), filler.c_str(), filler.size()) == 0);
+
+        // The reference from before the file grew is still good.
+        assert(memcmp(first.get_data(), TEST_DATA, 14) == 0);
+
+        // Reading a reference into a truncated file should not crash.
+        assert(ftruncate(lb.get_fd(), 0) == 0);
+        assert(last.get_data()[0] == '\0');
+    }
 
+    {
+        char fn_template[] = "test_line_buffer.XXXXXX";
+
+        auto fd = auto_fd(mkstemp(fn_template));
+        remove(fn_template);
+        line_buffer lb;
+
+        log_perror(write(fd, TEST_DATA, strlen(TEST_DATA)));
+        lb.set_mmap_enabled(false);
+        lb.set_fd(fd);
+        assert(!lb.is_mapped());
+
+        auto load_result = lb.load_next_line({0});
+        auto li = load_result.unwrap();
+        assert(li.li_file_range.fr_size == 14);
     }
 
     return retval;
@@ -314,6 +314,142 @@ info 0x0
 error 0x0
 EOF
 
+touch -t 200711030923 ${srcdir}/logfile_syslog.1
+run_test ./drive_logfile -c 64 -t -f syslog_log ${srcdir}/logfile_syslog.1
+
+check_output "Syslog year end interpreted incorrectly when scanned in chunks?" <<EOF
+Dec 03 09:23:38 2006 -- 000
+Dec 03 09:23:38 2006 -- 000
+Dec 03 09:23:38 2006 -- 000
+Jan 03 09:47:02 2007 -- 000
+EOF
+
+touch -t 201509130923 ${srcdir}/logfile_syslog_with_mixed_times.0
+run_test ./drive_logfile -c 64 -t -f syslog_log ${srcdir}/logfile_syslog_with_mixed_times.0
+
+check_output "syslog_log with mixed times interpreted incorrectly when scanned in chunks?" <<EOF
+Sep 13 00:58:45 2015 -- 000
+Sep 13 00:59:30 2015 -- 000
+Sep 13 01:23:54 2015 -- 000
+Sep 13 03:12:04 2015 -- 000
+Sep 13 03:12:04 2015 -- 000
+Sep 13 03:12:04 2015 -- 000
+Sep 13 03:12:04 2015 -- 000
+Sep 13 03:12:58 2015 -- 000
+Sep 13 03:46:03 2015 -- 000
+Sep 13 03:46:03 2015 -- 000
+Sep 13 03:46:03 2015 -- 000
+Sep 13 03:46:03 2015 -- 000
+Sep 13 03:46:03 2015 -- 000
+EOF
+
+run_test ./drive_logfile -c 20 -t -f generic_log ${srcdir}/logfile_multiline.0
+
+check_output "continued line at the start of a chunk has the wrong time?" <<EOF
+Jul 20 22:59:27 2009 -- 672
+Jul 20 22:59:27 2009 -- 672
+Jul 20 22:59:30 2009 -- 221
+EOF
+
+run_test ./drive_logfile -c 20 -v -f generic_log ${srcdir}/logfile_multiline.0
+
+check_output "continued line at the start of a chunk has the wrong level?" <<EOF
+debug 0x0
+debug 0x80
+error 0x0
+EOF
+
+run_test ./drive_logfile -c 20 -e -f generic_log ${srcdir}/logfile_multiline.0
+
+check_output "lines cannot be read after being scanned in chunks?" <<EOF
+2009-07-20 22:59:27,672:DEBUG:Hello, World!
+  How are you today?
+2009-07-20 22:59:30,221:ERROR:Goodbye, World!
+EOF
+
+rm -rf ${HOME}/.lnav/index-cache
+mkdir -p ${HOME}/.lnav/index-cache
+
+gen_index_cache_log() {
+    seq $1 $2 | awk '{
+        printf("2009-07-20 %02d:%02d:%02d,000:INFO:Hello, World! %d\n",
+               int($1 / 3600), int($1 / 60) % 60, $1 % 60, $1);
+    }'
+}
+
+gen_index_cache_log 1 40000 > index_cache.0
+
+./drive_logfile -f generic_log index_cache.0
+
+on_error_fail_with "Didn't index a large file?"
+
+test -n "`ls ${HOME}/.lnav/index-cache/*.idx 2> /dev/null`"
+
+on_error_fail_with "index cache was not written?"
+
+gen_index_cache_log 40001 40010 >> index_cache.0
+
+./drive_logfile -C -t -f generic_log index_cache.0 > index_cache.cached.out
+
+on_error_fail_with "unable to use index cache?"
+
+rm ${HOME}/.lnav/index-cache/*.idx
+
+./drive_logfile -t -f generic_log index_cache.0 > index_cache.scanned.out
+
+on_error_fail_with "unable to scan a file without the index cache?"
+
+cmp index_cache.cached.out index_cache.scanned.out
+
+on_error_fail_with "index loaded from the cache does not match a fresh scan?"
+
+test `wc -l < index_cache.cached.out` -eq 40010
+
+on_error_fail_with "index cache did not pick up new lines?"
+
+gen_index_cache_log 1 10 > index_cache_mark.0
+gen_index_cache_log 11 40000 > index_cache_mark.1
+
+./drive_logfile -m -a index_cache_mark.1 -f generic_log index_cache_mark.0
+
+on_error_fail_with "unable to index a file with marked lines?"
+
+./drive_logfile -C -v -f generic_log index_cache_mark.0 > index_cache_mark.out
+
+on_error_fail_with "index cache was not used for the marked file?"
+
+! grep -q 0x40 index_cache_mark.out
+
+on_error_fail_with "marks were saved in the index cache?"
+
+head -1 ${srcdir}/logfile_multiline.0 > logfile_background.0
+tail -n +2 ${srcdir}/logfile_multiline.0 > logfile_background.1
+
+run_test ./drive_logfile -a logfile_background.1 -c 20 -v -f generic_log \
+    logfile_background.0
+
+check_output "continued line appended in the background has the wrong level?" <<EOF
+debug 0x0
+debug 0x80
+error 0x0
+EOF
+
+gen_index_cache_log 1 10 > logfile_background.0
+gen_index_cache_log 11 20000 > logfile_background.1
+gen_index_cache_log 1 20000 > logfile_background.2
+
+./drive_logfile -a logfile_background.1 -c 4096 -t -f generic_log \
+    logfile_background.0 > logfile_background.scanned.out
+
+on_error_fail_with "unable to index appended lines in the background?"
+
+./drive_logfile -t -f generic_log logfile_background.2 \
+    > logfile_background.expected.out
+
+cmp logfile_background.scanned.out logfile_background.expected.out
+
+on_error_fail_with "lines indexed in the background do not match a fresh scan?"
+
 cp ${srcdir}/logfile_syslog.0 truncfile.0
 chmod u+w truncfile.0
 
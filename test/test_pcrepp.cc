@@ -173,5 +173,105 @@ int main(int argc, char *argv[])
         assert(re.captures()[0].c_end == 11);
     }
 
+    {
+        pcrepp re("^(?<timestamp>\\d{4}-\\d{2}-\\d{2}) (?i)error");
+        std::bitset<256> first = re.first_bytes();
+
+        assert(first.count() == 10);
+        assert(first['0']);
+        assert(first['9']);
+        assert(!first['a']);
+        assert(!first[' ']);
+    }
+
+    {
+        pcrepp re("(?i)^warn");
+        std::bitset<256> first = re.first_bytes();
+
+        assert(first['w']);
+        assert(first['W']);
+        assert(!first['x']);
+    }
+
+    {
+        pcrepp re("\\d+ error");
+
+        assert(re.first_bytes().all());
+    }
+
+    {
+        static struct {
+            const char *pattern;
+            const char *literal;
+        } LITERAL_TESTS[] = {
+            { "ERROR.*timeout", "timeout" },
+            { "^(?<ts>\\d+) connection reset", " connection reset" },
+            { "abcd?", "abc" },
+            { "ab+cdef", "cdef" },
+            { "x{2}yzzy", "yzzy" },
+            { "foo\\.bar", "foo.bar" },
+            { "[abc]def", "def" },
+            { "[[:alpha:]]defg", "defg" },
+            { "\\x41BCD", "BCD" },
+            { "(abcdef)?xy", "" },
+            { "abcdef|ghi", "" },
+            { "\\Qabcdef\\E", "" },
+            { "(?x)abcdef", "" },
+            { "ab", "" },
+        };
+
+        for (const auto &lt : LITERAL_TESTS) {
+            pcrepp re(lt.pattern);
+
+            assert(re.get_required_literal() == lt.literal);
+        }
+    }
+
+    {
+        pcrepp re("xyzz\xc3\xa9?abc", PCRE_UTF8);
+        pcre_input pi("xyzzabc");
+        pcre_input pi_accent("xyzz\xc3\xa9" "abc");
+
+        assert(re.get_required_literal() == "xyzz");
+        assert(re.match(context, pi));
+        assert(re.match(context, pi_accent));
+    }
+
+    {
+        pcrepp re("error.*timeout", PCRE_CASELESS);
+        pcre_input pi("Error: read TIMEOUT");
+
+        assert(re.get_required_literal() == "timeout");
+        assert(re.match(context, pi));
+
+        pcre_input pi_miss("Error: read timeou");
+
+        assert(!re.match(context, pi_miss));
+    }
+
+    {
+        pcrepp re("id=\\d+ key:val");
+        pcre_input pi("id=1 KEY:VAL id=2 key:val");
+
+        assert(re.match(context, pi));
+        assert(context.all()->c_begin == 13);
+        assert(!re.match(context, pi));
+    }
+
+    {
+        const char *window = "abc\nxyz TIMEOUT\nfoo timeout";
+        pcrepp re("timeout");
+        pcrepp re_caseless("time(out)", PCRE_CASELESS);
+        pcrepp re_none("t.*t");
+
+        assert(re.find_required_literal_in(window, strlen(window)) ==
+               &window[20]);
+        assert(re.find_required_literal_in(window, 20) == nullptr);
+        assert(re_caseless.find_required_literal_in(window, strlen(window)) ==
+               &window[8]);
+        assert(re_none.find_required_literal_in(window, strlen(window)) ==
+               window);
+    }
+
     return retval;
 }
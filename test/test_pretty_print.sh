@@ -60,3 +60,27 @@ check_output "pretty print is not including leading white space?" <<EOF
             line 1:34 no viable alternative at character '\$'
 ""}]}
 EOF
+
+run_test ./drive_rewriter ";SELECT upper(\$value) || ' bork'" abc def
+
+check_output "pure rewriter result is not remembered" <<EOF
+prepared: 1
+memoized: 1
+abc -> ABC bork (same)
+def -> DEF bork (same)
+EOF
+
+run_test ./drive_rewriter ";SELECT \$value || ' ' || typeof(random())" abc
+
+check_output "rewriter with an impure function is remembered" <<EOF
+prepared: 1
+memoized: 0
+abc -> abc integer (same)
+EOF
+
+run_test ./drive_rewriter ";SELECT \$value || count(*) FROM sqlite_master" abc
+
+check_output "rewriter that reads a table is prepared" <<EOF
+prepared: 0
+memoized: 0
+EOF
@@ -117,6 +117,8 @@ duration,bro_uid,req
 71.658218,CnGze54kQWWpKqrrZ4,GET ajax.googleapis.com
 EOF
 
+# Several of these requests were made in the same millisecond, so the lines
+# are sorted by the microseconds in their bro_ts values.
 run_test env TZ=UTC ${lnav_test} -n \
     -c ";SELECT * FROM bro_http_log LIMIT 5" \
     -c ":write-csv-to -" \
@@ -125,10 +127,10 @@ run_test env TZ=UTC ${lnav_test} -n \
 check_output "bro logs are not recognized?" <<EOF
 log_line,log_part,log_time,log_idle_msecs,log_level,log_mark,log_comment,log_tags,log_filters,bro_ts,bro_uid,bro_id_orig_h,bro_id_orig_p,bro_id_resp_h,bro_id_resp_p,bro_trans_depth,bro_method,bro_host,bro_uri,bro_referrer,bro_version,bro_user_agent,bro_request_body_len,bro_response_body_len,bro_status_code,bro_status_msg,bro_info_code,bro_info_msg,bro_tags,bro_username,bro_password,bro_proxied,bro_orig_fuids,bro_orig_filenames,bro_orig_mime_types,bro_resp_fuids,bro_resp_filenames,bro_resp_mime_types
 0,<NULL>,2011-11-03 00:19:26.452,0,info,0,<NULL>,<NULL>,[],1320279566.452687,CwFs1P2UcUdlSxD2La,192.168.2.76,52026,132.235.215.119,80,1,GET,www.reddit.com,/,<NULL>,1.1,Mozilla/5.0 (Macintosh; Intel Mac OS X 10.6; rv:7.0.1) Gecko/20100101 Firefox/7.0.1,0,109978,200,OK,<NULL>,<NULL>,,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,Ftw3fJ2JJF3ntMTL2,<NULL>,text/html
-1,<NULL>,2011-11-03 00:19:26.831,379,info,0,<NULL>,<NULL>,[],1320279566.831619,CJxSUgkInyKSHiju1,192.168.2.76,52030,72.21.211.173,80,1,GET,e.thumbs.redditmedia.com,/E-pbDbmiBclPkDaX.jpg,http://www.reddit.com/,1.1,Mozilla/5.0 (Macintosh; Intel Mac OS X 10.6; rv:7.0.1) Gecko/20100101 Firefox/7.0.1,0,2300,200,OK,<NULL>,<NULL>,,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,FFTf9Zdgk3YkfCKo3,<NULL>,image/jpeg
-2,<NULL>,2011-11-03 00:19:26.831,0,info,0,<NULL>,<NULL>,[],1320279566.831563,CJwUi9bdB9c1lLW44,192.168.2.76,52029,72.21.211.173,80,1,GET,f.thumbs.redditmedia.com,/BP5bQfy4o-C7cF6A.jpg,http://www.reddit.com/,1.1,Mozilla/5.0 (Macintosh; Intel Mac OS X 10.6; rv:7.0.1) Gecko/20100101 Firefox/7.0.1,0,2272,200,OK,<NULL>,<NULL>,,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,FfXtOj3o7aub4vbs2j,<NULL>,image/jpeg
-3,<NULL>,2011-11-03 00:19:26.831,0,info,0,<NULL>,<NULL>,[],1320279566.831473,CoX7zA3OJKGUOSCBY2,192.168.2.76,52027,72.21.211.173,80,1,GET,e.thumbs.redditmedia.com,/SVUtep3Rhg5FTRn4.jpg,http://www.reddit.com/,1.1,Mozilla/5.0 (Macintosh; Intel Mac OS X 10.6; rv:7.0.1) Gecko/20100101 Firefox/7.0.1,0,2562,200,OK,<NULL>,<NULL>,,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,F21Ybs3PTqS6O4Q2Zh,<NULL>,image/jpeg
-4,<NULL>,2011-11-03 00:19:26.831,0,info,0,<NULL>,<NULL>,[],1320279566.831643,CT0JIh479jXIGt0Po1,192.168.2.76,52031,72.21.211.173,80,1,GET,f.thumbs.redditmedia.com,/uuy31444rLSyKdHS.jpg,http://www.reddit.com/,1.1,Mozilla/5.0 (Macintosh; Intel Mac OS X 10.6; rv:7.0.1) Gecko/20100101 Firefox/7.0.1,0,1595,200,OK,<NULL>,<NULL>,,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,Fdk0MZ1wQmKWAJ4WH4,<NULL>,image/jpeg
+1,<NULL>,2011-11-03 00:19:26.831,379,info,0,<NULL>,<NULL>,[],1320279566.831473,CoX7zA3OJKGUOSCBY2,192.168.2.76,52027,72.21.211.173,80,1,GET,e.thumbs.redditmedia.com,/SVUtep3Rhg5FTRn4.jpg,http://www.reddit.com/,1.1,Mozilla/5.0 (Macintosh; Intel Mac OS X 10.6; rv:7.0.1) Gecko/20100101 Firefox/7.0.1,0,2562,200,OK,<NULL>,<NULL>,,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,F21Ybs3PTqS6O4Q2Zh,<NULL>,image/jpeg
+2,<NULL>,2011-11-03 00:19:26.831,0,info,0,<NULL>,<NULL>,[],1320279566.831535,CdrfXZ1NOFPEawF218,192.168.2.76,52028,72.21.211.173,80,1,GET,c.thumbs.redditmedia.com,/IEeSI3Q47xHE0UEz.jpg,http://www.reddit.com/,1.1,Mozilla/5.0 (Macintosh; Intel Mac OS X 10.6; rv:7.0.1) Gecko/20100101 Firefox/7.0.1,0,1874,200,OK,<NULL>,<NULL>,,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,FHK4nO28ZC5rrBZPqa,<NULL>,image/jpeg
+3,<NULL>,2011-11-03 00:19:26.831,0,info,0,<NULL>,<NULL>,[],1320279566.831563,CJwUi9bdB9c1lLW44,192.168.2.76,52029,72.21.211.173,80,1,GET,f.thumbs.redditmedia.com,/BP5bQfy4o-C7cF6A.jpg,http://www.reddit.com/,1.1,Mozilla/5.0 (Macintosh; Intel Mac OS X 10.6; rv:7.0.1) Gecko/20100101 Firefox/7.0.1,0,2272,200,OK,<NULL>,<NULL>,,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,FfXtOj3o7aub4vbs2j,<NULL>,image/jpeg
+4,<NULL>,2011-11-03 00:19:26.831,0,info,0,<NULL>,<NULL>,[],1320279566.831619,CJxSUgkInyKSHiju1,192.168.2.76,52030,72.21.211.173,80,1,GET,e.thumbs.redditmedia.com,/E-pbDbmiBclPkDaX.jpg,http://www.reddit.com/,1.1,Mozilla/5.0 (Macintosh; Intel Mac OS X 10.6; rv:7.0.1) Gecko/20100101 Firefox/7.0.1,0,2300,200,OK,<NULL>,<NULL>,,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,<NULL>,FFTf9Zdgk3YkfCKo3,<NULL>,image/jpeg
 EOF
 
 run_test env TZ=UTC ${lnav_test} -n \
@@ -362,6 +364,78 @@ check_output "query bookmark not working?" <<EOF
 EOF
 
 
+run_test ${lnav_test} -n \
+    -c ";select log_line, cs_uri_stem from access_log where cs_uri_stem = '/vmw/vSphere/default/vmkboot.gz'" \
+    -c ':write-csv-to -' \
+    ${test_dir}/logfile_access_log.0
+
+check_output "identifier value index is not working" <<EOF
+log_line,cs_uri_stem
+1,/vmw/vSphere/default/vmkboot.gz
+EOF
+
+
+run_test ${lnav_test} -n \
+    -c ";select log_line, cs_uri_stem from access_log where cs_uri_stem in ('/vmw/cgi/tramp', '/vmw/vSphere/default/vmkernel.gz')" \
+    -c ':write-csv-to -' \
+    ${test_dir}/logfile_access_log.0
+
+check_output "identifier value index with IN is not working" <<EOF
+log_line,cs_uri_stem
+0,/vmw/cgi/tramp
+2,/vmw/vSphere/default/vmkernel.gz
+EOF
+
+
+run_test ${lnav_test} -n \
+    -c ";select a.log_line, b.log_line from access_log as a join access_log as b on a.cs_uri_stem = b.cs_uri_stem" \
+    -c ':write-csv-to -' \
+    ${test_dir}/logfile_access_log.0
+
+check_output "join using the identifier value index is not working" <<EOF
+log_line,log_line
+0,0
+1,1
+2,2
+EOF
+
+
+# The last line is partial, so the append below changes its user agent.
+head -2 ${test_dir}/logfile_access_log.0 > value_index_partial.0
+printf '%s' '192.168.202.254 - - [20/Jul/2009:22:59:29 +0000] "GET /vmw/vSphere/default/vmkernel.gz HTTP/1.0" 200 78929 "-" "' \
+    >> value_index_partial.0
+
+run_test ${lnav_test} -n \
+    -c ";select log_line, cs_user_agent from access_log where cs_user_agent = 'gPXE/0.9.7'" \
+    -c ':write-csv-to -' \
+    -c ':switch-to-view log' \
+    -c ':mark' \
+    -c ':append-to value_index_partial.0' \
+    -c ";select log_line, cs_user_agent from access_log where cs_user_agent = '192.168.202.254 - - [20/Jul/2009:22:59:26 +0000] '" \
+    -c ':write-csv-to -' \
+    value_index_partial.0
+
+check_output "identifier value index has a stale value for the last message" <<EOF
+log_line,cs_user_agent
+0,gPXE/0.9.7
+1,gPXE/0.9.7
+log_line,cs_user_agent
+2,192.168.202.254 - - [20/Jul/2009:22:59:26 +0000] 
+EOF
+
+
+run_test ${lnav_test} -n \
+    -c ";select log_line, sc_bytes, cs_method, cs_uri_query from access_log" \
+    -c ";select sum(sc_bytes), group_concat(cs_uri_stem), typeof(sc_bytes), count(cs_uri_query) from access_log" \
+    -c ':write-csv-to -' \
+    ${test_dir}/logfile_access_log.0
+
+check_output "cached column values are not working" <<EOF
+sum(sc_bytes),group_concat(cs_uri_stem),typeof(sc_bytes),count(cs_uri_query)
+125273,"/vmw/cgi/tramp,/vmw/vSphere/default/vmkboot.gz,/vmw/vSphere/default/vmkernel.gz",integer,0
+EOF
+
+
 # XXX The timestamp on the file is used to determine the year for syslog files.
 touch -t 201311030923 ${test_dir}/logfile_syslog.0
 run_test ${lnav_test} -n \
@@ -398,6 +472,77 @@ log_line,log_part,log_time,log_idle_msecs,log_level,log_mark,log_comment,log_tag
 EOF
 
 
+run_test ${lnav_test} -n \
+    -c ";select log_line, log_level from syslog_log where log_level = 'ERROR'" \
+    -c ':write-csv-to -' \
+    ${test_dir}/logfile_syslog.0
+
+check_output "log_level constraint is not working" <<EOF
+log_line,log_level
+0,error
+2,error
+EOF
+
+
+run_test ${lnav_test} -n \
+    -c ";select log_line, log_level from syslog_log where log_level < 'warning' and log_line > 0" \
+    -c ':write-csv-to -' \
+    ${test_dir}/logfile_syslog.0
+
+check_output "log_level range constraint is not working" <<EOF
+log_line,log_level
+1,info
+3,info
+EOF
+
+
+run_test ${lnav_test} -n \
+    -c ":goto 2" \
+    -c ":mark" \
+    -c ";select log_line from syslog_log where log_mark = 1" \
+    -c ':write-csv-to -' \
+    ${test_dir}/logfile_syslog.0
+
+check_output "log_mark constraint is not working" <<EOF
+log_line
+2
+EOF
+
+
+run_test ${lnav_test} -n \
+    -c ";select log_line, log_pid from syslog_log where log_pid = '7999'" \
+    -c ':write-csv-to -' \
+    ${test_dir}/logfile_syslog.0
+
+check_output "opid constraint is not working" <<EOF
+log_line,log_pid
+2,7999
+EOF
+
+
+run_test ${lnav_test} -n \
+    -c ";select log_line, log_pid from syslog_log where log_pid = ' 7999' collate naturalnocase" \
+    -c ':write-csv-to -' \
+    ${test_dir}/logfile_syslog.0
+
+check_output "opid constraint does not respect the collation" <<EOF
+log_line,log_pid
+2,7999
+EOF
+
+
+run_test ${lnav_test} -n \
+    -c ";select count(*), min(log_procname) from syslog_log where log_path = (select filepath from lnav_file where basename(filepath) = 'logfile_syslog.2')" \
+    -c ':write-csv-to -' \
+    ${test_dir}/logfile_syslog.0 \
+    ${test_dir}/logfile_syslog.2
+
+check_output "log_path constraint is not working" <<EOF
+count(*),min(log_procname)
+3,foo
+EOF
+
+
 run_test ${lnav_test} -n \
     -c ':filter-in sudo' \
     -c ";select * from logline" \
@@ -0,0 +1,332 @@
+/**
+ * Copyright (c) 2020, Timothy Stack
+ *
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ * list of conditions and the following disclaimer.
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ * this list of conditions and the following disclaimer in the documentation
+ * and/or other materials provided with the distribution.
+ * * Neither the name of Timothy Stack nor the names of its contributors
+ * may be used to endorse or promote products derived from this software
+ * without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE REGENTS AND CONTRIBUTORS ''AS IS'' AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE FOR ANY
+ * DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ * (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ * LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ * ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "config.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "base/utf8_scan.hh"
+
+using namespace std;
+
+static void check_all_impls(const string &data)
+{
+    auto expected = scan_utf8_line(USI_SCALAR, data.data(), data.size());
+
+    for (int impl = USI_SCALAR + 1; impl < USI__MAX; impl++) {
+        if (!utf8_scan_supported((utf8_scan_impl_t) impl)) {
+            continue;
+        }
+
+        auto actual = scan_utf8_line((utf8_scan_impl_t) impl,
+                                     data.data(), data.size());
+
+        if (actual.usr_end != expected.usr_end ||
+            actual.usr_valid != expected.usr_valid) {
+            fprintf(stderr, "error: %s does not match scalar for:\n  ",
+                    utf8_scan_impl_name((utf8_scan_impl_t) impl));
+            for (unsigned char ch : data) {
+                fprintf(stderr, "%02x ", ch);
+            }
+            fprintf(stderr, "\n  expected %zd/%d, got %zd/%d\n",
+                    expected.usr_end, expected.usr_valid,
+                    actual.usr_end, actual.usr_valid);
+            abort();
+        }
+    }
+}
+
+static void check_expected(const char *data, ssize_t end, bool valid)
+{
+    for (int impl = USI_SCALAR; impl < USI__MAX; impl++) {
+        if (!utf8_scan_supported((utf8_scan_impl_t) impl)) {
+            continue;
+        }
+
+        auto res = scan_utf8_line((utf8_scan_impl_t) impl, data, strlen(data));
+
+        assert(res.usr_end == end);
+        assert(res.usr_valid == valid);
+    }
+}
+
+static const char *SEQUENCES[] = {
+    "a",
+    "\n",
+    "\xc3\xa9",
+    "\xe2\x82\xac",
+    "\xf0\x9f\x98\x80",
+    "\xf4\x8f\xbf\xbf",
+    "\xc3",
+    "\xe2\x82",
+    "\xf0\x9f\x98",
+    "\x80",
+    "\xbf\xbf",
+    "\xc0\xaf",
+    "\xc1\xbf",
+    "\xe0\x80\xaf",
+    "\xed\xa0\x80",
+    "\xf0\x80\x80\xaf",
+    "\xf4\x90\x80\x80",
+    "\xf5\x80\x80\x80",
+    "\xff",
+};
+
+/**
+ * Generate a buffer with a mix of ASCII, valid and invalid UTF-8, and
+ * newlines.
+ */
+static string random_buffer(mt19937 &gen)
+{
+    uniform_int_distribution<int> len_dist(0, 200);
+    uniform_int_distribution<int> kind_dist(0, 99);
+    uniform_int_distribution<int> seq_dist(0, (sizeof(SEQUENCES) /
+                                               sizeof(SEQUENCES[0])) - 1);
+    uniform_int_distribution<int> byte_dist(0, 255);
+    int len = len_dist(gen);
+    string retval;
+
+    while ((int) retval.size() < len) {
+        int kind = kind_dist(gen);
+
+        if (kind < 80) {
+            retval.push_back('a' + kind % 26);
+        }
+        else if (kind < 97) {
+            retval.append(SEQUENCES[seq_dist(gen)]);
+        }
+        else {
+            retval.push_back(byte_dist(gen));
+        }
+    }
+
+    return retval;
+}
+
+static string generate_log(size_t size)
+{
+    mt19937 gen(1234);
+    uniform_int_distribution<int> len_dist(40, 240);
+    uniform_int_distribution<int> utf_dist(0, 99);
+    string retval;
+    int line_number = 0;
+
+    while (retval.size() < size) {
+        char prefix[128];
+        int len = len_dist(gen);
+
+        snprintf(prefix, sizeof(prefix),
+                 "2020-03-01T12:34:56.%03d INFO [worker-%d] request ",
+                 line_number % 1000, line_number % 16);
+        retval.append(prefix);
+        for (int lpc = 0; lpc < len; lpc++) {
+            retval.push_back('a' + (lpc + line_number) % 26);
+        }
+        if (utf_dist(gen) < 5) {
+            retval.append(" caf\xc3\xa9 \xe2\x82\xac");
+        }
+        retval.push_back('\n');
+        line_number += 1;
+    }
+
+    return retval;
+}
+
+/**
+ * Split the data into lines the same way that line_buffer does and report
+ * the throughput for each implementation.
+ */
+static void benchmark(const string &data, int iterations)
+{
+    printf("benchmark: %zu bytes x %d iterations\n",
+           data.size(), iterations);
+    for (int impl = USI_SCALAR; impl < USI__MAX; impl++) {
+        if (!utf8_scan_supported((utf8_scan_impl_t) impl)) {
+            printf("  %-8s not supported\n",
+                   utf8_scan_impl_name((utf8_scan_impl_t) impl));
+            continue;
+        }
+
+        size_t line_count = 0, invalid_count = 0;
+        auto start = chrono::steady_clock::now();
+
+        for (int iter = 0; iter < iterations; iter++) {
+            size_t offset = 0;
+
+            while (offset < data.size()) {
+                auto res = scan_utf8_line((utf8_scan_impl_t) impl,
+                                          &data[offset],
+                                          data.size() - offset);
+
+                if (!res.usr_valid) {
+                    invalid_count += 1;
+                }
+                line_count += 1;
+                if (res.usr_end == -1) {
+                    break;
+                }
+                offset += res.usr_end + 1;
+            }
+        }
+
+        auto elapsed = chrono::duration<double>(
+            chrono::steady_clock::now() - start).count();
+
+        printf("  %-8s %8.1f MB/s  (%zu lines, %zu invalid)\n",
+               utf8_scan_impl_name((utf8_scan_impl_t) impl),
+               (data.size() * iterations) / elapsed / (1024.0 * 1024.0),
+               line_count / iterations,
+               invalid_count / iterations);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int retval = EXIT_SUCCESS;
+    bool bench = false;
+    int iterations = 10;
+    int c;
+
+    while ((c = getopt(argc, argv, "bi:")) != -1) {
+        switch (c) {
+            case 'b':
+                bench = true;
+                break;
+            case 'i':
+                iterations = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr,
+                        "usage: %s [-b] [-i iterations] [file]\n",
+                        argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (bench) {
+        string data;
+
+        if (argc > 0) {
+            FILE *file = fopen(argv[0], "r");
+            char buffer[64 * 1024];
+            size_t rc;
+
+            if (file == nullptr) {
+                perror("fopen");
+                return EXIT_FAILURE;
+            }
+            while ((rc = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+                data.append(buffer, rc);
+            }
+            fclose(file);
+        }
+        else {
+            data = generate_log(64 * 1024 * 1024);
+        }
+        benchmark(data, iterations);
+
+        return retval;
+    }
+
+    check_expected("", -1, true);
+    check_expected("abc", -1, true);
+    check_expected("abc\ndef", 3, true);
+    check_expected("caf\xc3\xa9\n", 5, true);
+    check_expected("caf\xc3\n", 4, false);
+    check_expected("caf\xc3", -1, false);
+    check_expected("abc\n\xff", 3, true);
+    check_expected("\xff\nabc", 1, false);
+    check_expected("\xed\xa0\x80\n", 3, false);
+    check_expected("\xc0\xaf\n", 2, false);
+    check_expected("\xf4\x90\x80\x80\n", 4, false);
+    check_expected("\xf0\x9f\x98\x80\n", 4, true);
+
+    // Try each sequence at every position around the block boundaries,
+    // with the newline before, right after, and well after it.
+    for (auto seq : SEQUENCES) {
+        for (int pos = 0; pos < 70; pos++) {
+            for (int lf_delta : {-1, 0, 1, 3, 40}) {
+                string data(pos, 'x');
+
+                data.append(seq);
+                data.append(70, 'y');
+                if (lf_delta < 0) {
+                    if (pos > 0) {
+                        data[pos - 1] = '\n';
+                    }
+                }
+                else {
+                    data.insert(pos + strlen(seq) + lf_delta, "\n");
+                }
+                // Bad data after the newline should be ignored.
+                data.append("\xff\xc3");
+
+                for (size_t len = pos; len <= data.size(); len++) {
+                    check_all_impls(data.substr(0, len));
+                }
+            }
+        }
+    }
+
+    {
+        mt19937 gen(5678);
+
+        for (int lpc = 0; lpc < 50000; lpc++) {
+            check_all_impls(random_buffer(gen));
+        }
+    }
+
+    {
+        string log_data = generate_log(1024 * 1024);
+
+        for (size_t offset = 0; offset < log_data.size(); ) {
+            auto res = scan_utf8_line(&log_data[offset],
+                                      log_data.size() - offset);
+
+            assert(res.usr_valid);
+            assert(res.usr_end != -1);
+            assert(log_data[offset + res.usr_end] == '\n');
+            offset += res.usr_end + 1;
+        }
+    }
+
+    return retval;
+}